@@ -0,0 +1,95 @@
+//
+// File: cache.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for shared block cache of served files.
+//
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+
+// Files are cached in chunks of this size, one DATA block spans at most two chunks.
+#define CACHE_CHUNK_SIZE 65536
+
+/**
+* @brief Identification of one version of a file, changed size or mtime makes a new key.
+*/
+typedef struct CacheKey {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} CacheKey_t;
+
+/**
+* @brief Cached chunk of a file.
+*/
+typedef struct CacheSlot {
+    CacheKey_t key;
+    long chunk;
+    int size;
+    // Next slot in hash bucket, -1 terminates chain.
+    int next;
+    bool used;
+    // Set on every hit, cleared by passing clock hand.
+    bool referenced;
+} CacheSlot_t;
+
+/**
+* @brief Block cache shared by all transfers, lives in one shared mapping so forked processes use it too.
+*/
+typedef struct Cache {
+    pthread_mutex_t lock;
+    int slot_count;
+    int bucket_count;
+    // Clock hand for eviction.
+    int hand;
+    long hits;
+    long misses;
+    // Bucket heads, slots and chunk data follow in the same mapping.
+    int *buckets;
+    CacheSlot_t *slots;
+    char *data;
+} Cache_t;
+
+/**
+* @brief Create cache in shared anonymous memory.
+*
+* @param budget Memory budget in bytes for cached data.
+*
+* @return Pointer to cache, NULL if budget is too small or allocation failed.
+*/
+Cache_t *cache_create(long budget);
+
+/**
+* @brief Fill cache key of opened file.
+*
+* @param key Pointer to cache key.
+* @param fd File descriptor.
+*
+* @return True on success, false if file could not be stat'ed.
+*/
+bool cache_key_set(CacheKey_t *key, int fd);
+
+/**
+* @brief Read part of file through cache, missing chunks are read from fd and inserted.
+*
+* @param cache Pointer to cache.
+* @param key Key of file version.
+* @param fd File descriptor used on miss.
+* @param buffer Destination buffer.
+* @param offset File offset.
+* @param size Number of bytes requested.
+*
+* @return Number of bytes read, less than size at end of file, -1 on failure.
+*/
+long cache_read(Cache_t *cache, CacheKey_t *key, int fd, char *buffer, off_t offset, long size);
+
+#endif // CACHE_H
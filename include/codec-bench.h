@@ -0,0 +1,62 @@
+//
+// File: codec-bench.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for packet codec microbenchmark, parser is validated on malformed packets first.
+//
+
+#ifndef CODEC_BENCH_H
+#define CODEC_BENCH_H
+
+#include "utils.h"
+
+// Defaults of microbenchmark.
+#define CODEC_BENCH_PACKETS_DEFAULT 10000000
+#define CODEC_BENCH_FUZZ_DEFAULT 1000000
+#define CODEC_BENCH_SEED_DEFAULT 1
+
+// Largest generated packet, request buffer size plus room for oversized packets.
+#define CODEC_BENCH_PACKET_MAX (REQUEST_PACKET_SIZE + 88)
+
+/**
+* @brief Struct for storing microbenchmark's command line arguments.
+*/
+typedef struct CodecBenchArgs {
+    // Packets parsed per packet type.
+    long packets;
+    // Random malformed packets parsed during validation.
+    long fuzz;
+    unsigned long seed;
+} CodecBenchArgs_t;
+
+/**
+* @brief Sample packet whose parse rate is measured.
+*/
+typedef struct CodecSample {
+    char *name;
+    char packet[CODEC_BENCH_PACKET_MAX];
+    int size;
+} CodecSample_t;
+
+/**
+* @brief Initialize CodecBenchArgs_t struct.
+*
+* @param codec_args Pointer to CodecBenchArgs_t struct.
+*
+* @return void
+*/
+void init_args(CodecBenchArgs_t *codec_args);
+
+/**
+* @brief Handle microbenchmark's command line arguments.
+*
+* @param argc Number of command line arguments.
+* @param argv Command line arguments array.
+* @param codec_args Pointer to CodecBenchArgs_t struct.
+*
+* @return void
+*/
+void parse_args(int argc, char *argv[], CodecBenchArgs_t *codec_args);
+
+#endif // CODEC_BENCH_H
@@ -0,0 +1,189 @@
+//
+// File: codec.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for TFTP packet codec, packets are parsed into views of receive buffer and built into
+//              caller's buffer, nothing is allocated or copied.
+//
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+// Most options one request or OACK may carry, more makes packet malformed.
+#define CODEC_OPTIONS_MAX 16
+
+// Results of parsing.
+#define CODEC_OK 0
+// Packet ends before fixed field or before option value.
+#define CODEC_TRUNCATED 1
+// String is not terminated inside packet.
+#define CODEC_UNTERMINATED 2
+#define CODEC_BAD_OPCODE 3
+#define CODEC_TOO_MANY_OPTIONS 4
+
+/**
+* @brief Option of request or OACK, both strings point into parsed packet.
+*/
+typedef struct PacketOption {
+    char *name;
+    char *value;
+} PacketOption_t;
+
+/**
+* @brief Parsed packet, only fields of its opcode are set and strings point into parsed packet.
+*/
+typedef struct Packet {
+    int opcode;
+    // RRQ and WRQ.
+    char *file_name;
+    char *mode;
+    // RRQ, WRQ and OACK.
+    PacketOption_t options[CODEC_OPTIONS_MAX];
+    int num_options;
+    // DATA and ACK, low 16 bits as on the wire.
+    int block_number;
+    // DATA.
+    char *data;
+    int data_size;
+    // ERROR.
+    int error_code;
+    char *error_msg;
+} Packet_t;
+
+/**
+* @brief Read 16 bit field in network byte order, buffer may be unaligned.
+*
+* @param buffer Pointer to field.
+*
+* @return Value in host byte order.
+*/
+static inline int codec_get_u16(const char *buffer) {
+    uint16_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohs(value);
+}
+
+/**
+* @brief Write 16 bit field in network byte order, buffer may be unaligned.
+*
+* @param buffer Pointer to field.
+* @param value Value, only its low 16 bits are written.
+*
+* @return void
+*/
+static inline void codec_put_u16(char *buffer, long value) {
+    uint16_t field = htons((uint16_t)(value & 0xFFFF));
+    memcpy(buffer, &field, sizeof(field));
+}
+
+/**
+* @brief Parse packet, every field is checked against packet size.
+*
+* @param buffer Received packet.
+* @param size Size of received packet.
+* @param packet Pointer to store parsed packet.
+*
+* @return CODEC_OK or reason packet is malformed.
+*/
+int packet_parse(char *buffer, int size, Packet_t *packet);
+
+/**
+* @brief Get description of parse result, suitable for ERROR packet.
+*
+* @param result Parse result.
+*
+* @return Description.
+*/
+char *codec_error_msg(int result);
+
+/**
+* @brief Append 16 bit field to packet.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param pos Size of packet so far, -1 is passed through.
+* @param value Value.
+*
+* @return New size of packet, -1 if field does not fit.
+*/
+int packet_put_u16(char *buffer, int capacity, int pos, long value);
+
+/**
+* @brief Append NUL terminated string to packet.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param pos Size of packet so far, -1 is passed through.
+* @param string String.
+*
+* @return New size of packet, -1 if string does not fit.
+*/
+int packet_put_string(char *buffer, int capacity, int pos, const char *string);
+
+/**
+* @brief Append option name and value to request or OACK.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param pos Size of packet so far, -1 is passed through.
+* @param name Option name.
+* @param value Option value.
+*
+* @return New size of packet, -1 if option does not fit.
+*/
+int packet_put_option(char *buffer, int capacity, int pos, const char *name, const char *value);
+
+/**
+* @brief Build RRQ or WRQ without options.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param opcode RRQ or WRQ.
+* @param file_name File name.
+* @param mode Transfer mode name.
+*
+* @return Size of packet, -1 if it does not fit.
+*/
+int packet_build_request(char *buffer, int capacity, int opcode, const char *file_name, const char *mode);
+
+/**
+* @brief Build ACK.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param block_number Block number, only its low 16 bits go on the wire.
+*
+* @return Size of packet, -1 if it does not fit.
+*/
+int packet_build_ack(char *buffer, int capacity, long block_number);
+
+/**
+* @brief Build header of DATA, payload goes right after it.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param block_number Block number, only its low 16 bits go on the wire.
+*
+* @return Size of header, -1 if it does not fit.
+*/
+int packet_build_data(char *buffer, int capacity, long block_number);
+
+/**
+* @brief Build ERROR, message that does not fit is cut off.
+*
+* @param buffer Packet.
+* @param capacity Size of buffer.
+* @param error_code Error code.
+* @param error_msg Error message.
+*
+* @return Size of packet, -1 if not even empty message fits.
+*/
+int packet_build_error(char *buffer, int capacity, int error_code, const char *error_msg);
+
+#endif // CODEC_H
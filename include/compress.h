@@ -0,0 +1,115 @@
+//
+// File: compress.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for compressed transfers, built-in LZ codec in independent frames, files are compressed
+//              frame by frame as they are sent and decompressed block by block.
+//
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "encodecache.h"
+
+// Name of the only codec, value of compress option.
+#define COMPRESS_CODEC_NAME "lz"
+
+// Size of file chunk compressed into one frame, frames are decoded independently of each other.
+#define COMPRESS_CHUNK (64 * 1024)
+
+// Frame header is 32-bit little endian payload size, high bit marks chunk stored without compression.
+#define COMPRESS_HEADER 4
+#define COMPRESS_STORED 0x80000000u
+
+// Largest frame, chunk that does not compress is stored.
+#define COMPRESS_FRAME_MAX (COMPRESS_HEADER + COMPRESS_CHUNK)
+
+// Total size of compressed files kept by one process, larger files are compressed as every transfer reads them.
+#define COMPRESS_CACHE_MAX (256L * 1024 * 1024)
+
+/**
+* @brief State of decompressing stream, blocks are fed in order and every completed frame is written at offset.
+*/
+typedef struct CompressDecoder {
+    // Frame split by block boundary, allocated with first such frame.
+    char *frame;
+    size_t frame_size;
+    // Decompressed chunk of last frame.
+    char *output;
+    // File offset of the next decompressed byte.
+    off_t offset;
+} CompressDecoder_t;
+
+/**
+* @brief Compress data with LZ codec, sequences of literals and back references up to 64 KiB back.
+*
+* @param input Input bytes, at most COMPRESS_CHUNK.
+* @param size Number of input bytes.
+* @param output Buffer of at least size + size / 255 + 16 bytes.
+*
+* @return Number of compressed bytes.
+*/
+size_t lz_compress(const char *input, size_t size, char *output);
+
+/**
+* @brief Decompress LZ data, every length and offset is checked against input and output buffer.
+*
+* @param input Compressed bytes.
+* @param size Number of compressed bytes.
+* @param output Output buffer.
+* @param capacity Size of output buffer.
+*
+* @return Number of decompressed bytes, -1 if data is corrupted.
+*/
+long lz_decompress(const char *input, size_t size, char *output, size_t capacity);
+
+/**
+* @brief Compress chunk into frame, chunk is stored as is if it does not get smaller.
+*
+* @param input Input bytes, at most COMPRESS_CHUNK.
+* @param size Number of input bytes.
+* @param output Buffer of at least COMPRESS_HEADER + size + size / 255 + 16 bytes.
+*
+* @return Size of frame.
+*/
+size_t compress_frame(const char *input, size_t size, char *output);
+
+/**
+* @brief Feed received bytes to decoder until next frame is complete.
+*
+* @param decoder Pointer to decoder state.
+* @param input Pointer to input bytes, advanced past consumed bytes.
+* @param size Pointer to number of input bytes, decreased by consumed bytes.
+* @param output Pointer to store decompressed chunk of completed frame.
+* @param output_size Pointer to store size of decompressed chunk.
+*
+* @return 1 if frame was completed, 0 if input ran out first, -1 if stream is corrupted.
+*/
+int compress_decode(CompressDecoder_t *decoder, const char **input, size_t *size, const char **output, size_t *output_size);
+
+/**
+* @brief Deallocate buffers of decoder.
+*
+* @param decoder Pointer to decoder state.
+*
+* @return void
+*/
+void compress_decoder_free(CompressDecoder_t *decoder);
+
+/**
+* @brief Open stream of compressed frames of file, frames are compressed as reads reach them, compressed files are
+*        cached by process.
+*
+* @param fd Descriptor of opened file, it stays open and must outlive the stream.
+*
+* @return Pointer to stream, NULL on failure.
+*/
+EncodeStream_t *compress_open(int fd);
+
+#endif // COMPRESS_H
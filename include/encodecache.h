@@ -0,0 +1,147 @@
+//
+// File: encodecache.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for cache of encoded files, whole encodings (netascii, compressed) are kept in memory
+//              files of the process and keyed by device, inode, size and mtime of their source. Files are encoded
+//              chunk by chunk as they are read, the first stream of a file fills its cache entry on the way.
+//
+
+#ifndef ENCODECACHE_H
+#define ENCODECACHE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Number of encoded files kept by one cache.
+#define ENCODECACHE_ENTRIES 32
+
+/**
+* @brief Encoded file cached by process, keyed like block cache so a changed file is encoded again.
+*/
+typedef struct EncodeEntry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    // Memory file with encoded content, -1 if entry is free.
+    int fd;
+    off_t encoded_size;
+    long last_used;
+    // Encoding is still being appended by the stream that reads the file first, it is not served yet.
+    bool filling;
+} EncodeEntry_t;
+
+/**
+* @brief Encode one chunk of file, chunks are encoded independently of each other.
+*
+* @param input Input bytes, at most chunk size of the encoding.
+* @param size Number of input bytes.
+* @param output Buffer of at least output size of the encoding.
+*
+* @return Number of encoded bytes.
+*/
+typedef size_t (*ChunkEncoder_t)(const char *input, size_t size, char *output);
+
+/**
+* @brief Encoded files of one encoding, initialized with name, encoder and limits, the rest is zero.
+*/
+typedef struct EncodeCache {
+    EncodeEntry_t entries[ENCODECACHE_ENTRIES];
+    // Name of memory files.
+    const char *name;
+    ChunkEncoder_t encode;
+    // Size of source chunk and largest encoding of one chunk.
+    size_t chunk;
+    size_t output_max;
+    // Limit of total encoded size including entries being filled, larger encodings are never cached.
+    off_t max;
+    long clock;
+    bool ready;
+} EncodeCache_t;
+
+/**
+* @brief Encoded view of one source file, read at any encoded offset like the encoding itself.
+*
+* Cached encoding is read from its memory file. Otherwise chunks are encoded as reads reach them and the last
+* encoded chunk is kept, so blocks read in order and retransmitted windows encode every chunk about once.
+*/
+typedef struct EncodeStream {
+    EncodeCache_t *cache;
+    // Descriptor of source file, owned by caller.
+    int fd;
+    // Memory file of cached encoding, -1 if source is encoded as it is read.
+    int cached_fd;
+    off_t cached_size;
+    // Encoded offsets of chunks encoded so far, index[count] is end of the last one.
+    off_t *index;
+    long count;
+    long capacity;
+    // Source ended inside the last encoded chunk, index[count] is size of whole encoding.
+    bool complete;
+    // Source and encoding of last encoded chunk, chunk is its number, -1 before the first one.
+    char *input;
+    char *output;
+    size_t output_size;
+    long chunk;
+    // Cache entry new chunks are appended to, NULL if encoding is not cached by this stream.
+    EncodeEntry_t *fill;
+} EncodeStream_t;
+
+/**
+* @brief Write whole buffer to descriptor.
+*
+* @param fd File descriptor.
+* @param buffer Data.
+* @param size Size of data.
+*
+* @return True on success, false otherwise.
+*/
+bool encodecache_write(int fd, const char *buffer, size_t size);
+
+/**
+* @brief Open encoded view of file, cached encoding is used if there is one, otherwise the first chunk is encoded.
+*
+* @param cache Pointer to cache of the encoding.
+* @param fd Descriptor of opened source file, it stays open and must outlive the stream.
+*
+* @return Pointer to stream, NULL on failure.
+*/
+EncodeStream_t *encodestream_open(EncodeCache_t *cache, int fd);
+
+/**
+* @brief Read encoded bytes at offset, chunks up to offset are encoded first if they were not yet.
+*
+* @param stream Pointer to stream.
+* @param buffer Buffer of at least size bytes.
+* @param size Number of bytes to read.
+* @param offset Offset in encoding.
+*
+* @return Number of bytes read, fewer than size only at end of encoding, -1 on failure.
+*/
+long encodestream_read(EncodeStream_t *stream, char *buffer, long size, off_t offset);
+
+/**
+* @brief Get size of whole encoding.
+*
+* @param stream Pointer to stream.
+*
+* @return Encoded size, -1 if source was not encoded up to its end yet.
+*/
+off_t encodestream_size(EncodeStream_t *stream);
+
+/**
+* @brief Close stream, encoding it was caching is dropped unless it is complete.
+*
+* @param stream Pointer to stream, may be NULL.
+*
+* @return void
+*/
+void encodestream_close(EncodeStream_t *stream);
+
+#endif // ENCODECACHE_H
@@ -0,0 +1,113 @@
+//
+// File: filecache.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for cache of served files' metadata and descriptors kept coherent by inotify.
+//
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Number of hash buckets.
+#define FILECACHE_BUCKETS 16384
+
+// Upper limit of cached names, least recently used unreferenced entry is dropped above it.
+#define FILECACHE_MAX_ENTRIES 65536
+
+// Upper limit of cached open descriptors, metadata of older entries stays cached without descriptor.
+#define FILECACHE_MAX_FDS 256
+
+/**
+* @brief Cached state of one name in server root directory.
+*/
+typedef struct FileEntry {
+    char *name;
+    // False for cached "file not found".
+    bool exists;
+    // Open read-only descriptor, -1 if not cached.
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    // Number of transfers holding entry.
+    int refs;
+    // Entry was invalidated while referenced, it is freed by last release.
+    bool stale;
+    struct FileEntry *hash_next;
+    struct FileEntry *lru_prev;
+    struct FileEntry *lru_next;
+} FileEntry_t;
+
+/**
+* @brief Per process cache of files in server root directory.
+*/
+typedef struct FileCache {
+    char *dir_path;
+    int inotify_fd;
+    FileEntry_t *buckets[FILECACHE_BUCKETS];
+    // Most recently used entry is at head.
+    FileEntry_t *lru_head;
+    FileEntry_t *lru_tail;
+    int entries;
+    int open_fds;
+    long hits;
+    long misses;
+} FileCache_t;
+
+/**
+* @brief Create cache watching server root directory.
+*
+* @param dir_path Server root directory.
+*
+* @return Pointer to cache, NULL if inotify is not available.
+*/
+FileCache_t *filecache_create(char *dir_path);
+
+/**
+* @brief Look up name, on miss its metadata is read once and cached (also when it does not exist).
+*
+* @param files Pointer to cache.
+* @param name File name relative to root directory.
+*
+* @return Referenced entry, NULL if name is not cacheable (subdirectory, not a regular file, access error).
+*/
+FileEntry_t *filecache_get(FileCache_t *files, char *name);
+
+/**
+* @brief Open stream for reading entry's file, cached descriptor is duplicated when present.
+*
+* @param files Pointer to cache.
+* @param entry Pointer to entry.
+*
+* @return Pointer to stream, NULL on failure.
+*/
+FILE *filecache_open(FileCache_t *files, FileEntry_t *entry);
+
+/**
+* @brief Drop reference taken by filecache_get.
+*
+* @param files Pointer to cache.
+* @param entry Pointer to entry.
+*
+* @return void
+*/
+void filecache_release(FileCache_t *files, FileEntry_t *entry);
+
+/**
+* @brief Read pending inotify events and invalidate affected entries.
+*
+* @param files Pointer to cache.
+*
+* @return void
+*/
+void filecache_process_events(FileCache_t *files);
+
+#endif // FILECACHE_H
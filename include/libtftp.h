@@ -0,0 +1,244 @@
+//
+// File: libtftp.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Public header of libtftp, asynchronous TFTP client library. Any number of transfers run inside one
+//              client, which is driven by the caller's event loop through a single pollable descriptor. Nothing
+//              in the library exits the process, every failure is reported by the transfer it belongs to.
+//
+
+#ifndef LIBTFTP_H
+#define LIBTFTP_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <netinet/in.h>
+
+// Symbols of shared library that are part of API, everything else is hidden.
+#define TFTP_API __attribute__((visibility("default")))
+
+// Transfer directions, same values as RRQ and WRQ opcodes.
+#define TFTP_GET 1
+#define TFTP_PUT 2
+
+// Blksize derived from path MTU to server.
+#define TFTP_BLKSIZE_AUTO -1
+
+// Results of finished transfer.
+#define TFTP_OK 0
+// Transfer failed on our side, e.g. timeout, invalid response or failed callback.
+#define TFTP_FAILED 1
+// Server ended transfer with ERROR packet.
+#define TFTP_REJECTED 2
+
+// Log levels of tftp_log_init.
+#define TFTP_LOG_NONE 0
+#define TFTP_LOG_REQUEST 1
+#define TFTP_LOG_PACKET 2
+
+/**
+* @brief Client running transfers, not thread safe, one client belongs to one thread.
+*/
+typedef struct TftpClient TftpClient_t;
+
+/**
+* @brief One transfer of client.
+*/
+typedef struct TftpTransfer TftpTransfer_t;
+
+/**
+* @brief Description of transfer, initialized with tftp_request_init.
+*/
+typedef struct TftpRequest {
+    // TFTP_GET or TFTP_PUT.
+    int type;
+    struct sockaddr_in server;
+    // File name on server.
+    const char *file_name;
+    bool netascii;
+    // Requested options, 0 (false) leaves option out of request.
+    long blksize;
+    bool tsize;
+    long windowsize;
+    long timeout;
+    long utimeout;
+    bool multicast;
+    // Continue interrupted transfer in octet mode with file (offset extension). Download keeps bytes already in file
+    // if server confirms them by CRC32C and starts over otherwise, upload sends only what server does not have yet.
+    bool resume;
+    // Download only range_length bytes from range_start on (range extension), blocks are written at their offsets in
+    // file. Server without the extension sends whole file, see tftp_transfer_range.
+    bool range;
+    long range_start;
+    long range_length;
+    // Send data as stream of compressed frames in octet mode (compress extension), download is decompressed as blocks
+    // arrive. Upload needs file, server without the extension gets it uncompressed, see tftp_transfer_compress.
+    bool compress;
+    // Data comes from or goes to file, the transfer owns it from tftp_transfer_start on, also when start fails.
+    FILE *file;
+    // Without file data comes from read callback (TFTP_PUT) or goes to write callback (TFTP_GET). Blocks are
+    // addressed by offset, retransmission reads the same offset again and multicast writes blocks out of order.
+    long (*read)(void *user, char *buffer, long size, long offset);
+    bool (*write)(void *user, const char *buffer, long size, long offset);
+    // Size announced by tsize of TFTP_PUT with read callback.
+    long size;
+    // Called once when transfer finishes, transfer is freed right after it returns.
+    void (*done)(TftpTransfer_t *transfer, int result);
+    void *user;
+} TftpRequest_t;
+
+/**
+* @brief Initialize request with no options, port 69 and no data source.
+*
+* @param request Pointer to request.
+*
+* @return void
+*/
+TFTP_API void tftp_request_init(TftpRequest_t *request);
+
+/**
+* @brief Create client.
+*
+* @return Pointer to client, NULL on failure.
+*/
+TFTP_API TftpClient_t *tftp_client_create(void);
+
+/**
+* @brief Cancel all transfers of client without calling their callbacks and deallocate it.
+*
+* @param client Pointer to client.
+*
+* @return void
+*/
+TFTP_API void tftp_client_destroy(TftpClient_t *client);
+
+/**
+* @brief Get descriptor that becomes readable whenever tftp_client_process has work, packet or expired timer.
+*
+* @param client Pointer to client.
+*
+* @return File descriptor for poll, select or epoll of caller.
+*/
+TFTP_API int tftp_client_fd(TftpClient_t *client);
+
+/**
+* @brief Handle received packets and expired timers without blocking, done callbacks are called from here.
+*
+* @param client Pointer to client.
+*
+* @return Number of transfers still running, -1 if descriptor of client failed.
+*/
+TFTP_API int tftp_client_process(TftpClient_t *client);
+
+/**
+* @brief Block until all transfers of client finish.
+*
+* @param client Pointer to client.
+*
+* @return 0 on success, -1 if descriptor of client failed.
+*/
+TFTP_API int tftp_client_run(TftpClient_t *client);
+
+/**
+* @brief Get reason why last tftp_transfer_start failed.
+*
+* @param client Pointer to client.
+*
+* @return Error message.
+*/
+TFTP_API const char *tftp_client_error(TftpClient_t *client);
+
+/**
+* @brief Validate request, send it and start its transfer, may be called from done callback.
+*
+* @param client Pointer to client.
+* @param request Pointer to request, it is copied.
+*
+* @return Pointer to transfer, NULL if request is invalid (see tftp_client_error).
+*/
+TFTP_API TftpTransfer_t *tftp_transfer_start(TftpClient_t *client, TftpRequest_t *request);
+
+/**
+* @brief Abort running transfer, server is told with ERROR and done callback is not called.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+TFTP_API void tftp_transfer_cancel(TftpClient_t *client, TftpTransfer_t *transfer);
+
+/**
+* @brief Get user pointer of transfer's request.
+*
+* @param transfer Pointer to transfer.
+*
+* @return User pointer.
+*/
+TFTP_API void *tftp_transfer_user(TftpTransfer_t *transfer);
+
+/**
+* @brief Get transfer size negotiated by tsize option.
+*
+* @param transfer Pointer to transfer.
+*
+* @return Size in bytes, -1 if server did not acknowledge tsize (yet).
+*/
+TFTP_API long tftp_transfer_size(TftpTransfer_t *transfer);
+
+/**
+* @brief Get offset resumed transfer continued from.
+*
+* @param transfer Pointer to transfer.
+*
+* @return Number of bytes destination already held and that were not sent, 0 if transfer started at beginning.
+*/
+TFTP_API long tftp_transfer_offset(TftpTransfer_t *transfer);
+
+/**
+* @brief Check whether server acknowledged requested range.
+*
+* @param transfer Pointer to transfer.
+*
+* @return True if only the range was transferred, false if server answered without it and sent whole file.
+*/
+TFTP_API bool tftp_transfer_range(TftpTransfer_t *transfer);
+
+/**
+* @brief Check whether server acknowledged compression.
+*
+* @param transfer Pointer to transfer.
+*
+* @return True if data went over the wire compressed, false otherwise.
+*/
+TFTP_API bool tftp_transfer_compress(TftpTransfer_t *transfer);
+
+/**
+* @brief Get TFTP error code of failed transfer, sent to or received from server.
+*
+* @param transfer Pointer to transfer.
+*
+* @return Error code.
+*/
+TFTP_API int tftp_transfer_error_code(TftpTransfer_t *transfer);
+
+/**
+* @brief Get error message of failed transfer.
+*
+* @param transfer Pointer to transfer.
+*
+* @return Error message, NULL if transfer did not fail.
+*/
+TFTP_API const char *tftp_transfer_error(TftpTransfer_t *transfer);
+
+/**
+* @brief Log packets of all clients to stderr, nothing is logged by default.
+*
+* @param level TFTP_LOG_NONE, TFTP_LOG_REQUEST (requests, OACKs and ERRORs) or TFTP_LOG_PACKET (every packet).
+*
+* @return void
+*/
+TFTP_API void tftp_log_init(int level);
+
+#endif // LIBTFTP_H
@@ -0,0 +1,110 @@
+//
+// File: log.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for asynchronous packet log, records are queued in per thread rings and written by
+//              background thread.
+//
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+// Verbosity levels.
+#define LOG_NONE 0
+// Requests, OACKs and ERRORs.
+#define LOG_REQUEST 1
+// Every DATA and ACK as well.
+#define LOG_PACKET 2
+#define LOG_DEFAULT LOG_REQUEST
+
+// Size of ring of one thread in bytes, power of two.
+#define LOG_RING_SIZE (256 * 1024)
+
+// Maximum number of threads logging at once, ring of exited thread is taken over by the next one.
+#define LOG_MAX_THREADS 64
+
+// Bytes of packet after opcode kept in record, requests, OACKs and ERRORs fit.
+#define LOG_PAYLOAD_MAX 510
+
+// Text written by one write call of background thread.
+#define LOG_BATCH_SIZE 65536
+
+/**
+* @brief Logged packet, fields are copied from packet and formatted by background thread.
+*/
+typedef struct LogRecord {
+    // Size of record in ring including padding, 0 marks skipped end of ring.
+    uint32_t size;
+    uint16_t opcode;
+    uint16_t payload_size;
+    struct in_addr src_ip;
+    uint16_t src_port;
+    uint16_t dest_port;
+    // Packet after opcode.
+    char payload[];
+} LogRecord_t;
+
+/**
+* @brief Single producer single consumer ring of one thread.
+*/
+typedef struct LogRing {
+    char buffer[LOG_RING_SIZE];
+    // Monotonic byte positions, head is moved only by owning thread, tail only by writer.
+    uint64_t head;
+    uint64_t tail;
+    // Records that did not fit into full ring.
+    uint64_t dropped;
+    uint64_t dropped_reported;
+    // Set while some thread produces to ring, cleared when that thread exits.
+    bool owned;
+} LogRing_t;
+
+// Current verbosity, records above it are not even queued.
+extern int log_level;
+
+/**
+* @brief Check whether records of level are logged.
+*
+* @param level Verbosity level.
+*
+* @return True if level is enabled.
+*/
+static inline bool log_enabled(int level) {
+    return level <= log_level;
+}
+
+/**
+* @brief Set verbosity and start background writer if anything is logged.
+*
+* @param level Verbosity level.
+*
+* @return void
+*/
+void log_init(int level);
+
+/**
+* @brief Queue packet to log of calling thread, record is dropped if ring is full.
+*
+* @param opcode Opcode of packet.
+* @param packet Packet.
+* @param size Size of packet.
+* @param src_addr Address packet came from.
+* @param dest_port Local port of socket packet was received on.
+*
+* @return void
+*/
+void log_packet(int opcode, char *packet, int size, struct sockaddr_in *src_addr, int dest_port);
+
+/**
+* @brief Write all queued records, called on exit so nothing queued is lost.
+*
+* @return void
+*/
+void log_flush();
+
+#endif // LOG_H
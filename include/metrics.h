@@ -0,0 +1,105 @@
+//
+// File: metrics.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for server metrics, per CPU counters in shared memory exported in Prometheus text format.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <sched.h>
+#include "cache.h"
+
+// Counters, every one is kept per CPU slot and summed when exported.
+#define METRIC_TRANSFERS_RRQ 0
+#define METRIC_TRANSFERS_WRQ 1
+#define METRIC_TRANSFERS_COMPLETED 2
+#define METRIC_TRANSFERS_FINISHED 3
+#define METRIC_PACKETS_SENT 4
+#define METRIC_PACKETS_RECEIVED 5
+#define METRIC_BYTES_SENT 6
+#define METRIC_BYTES_RECEIVED 7
+#define METRIC_RETRANSMITS 8
+#define METRIC_TIMEOUTS 9
+#define METRIC_OACKS 10
+#define METRIC_FILECACHE_HITS 11
+#define METRIC_FILECACHE_MISSES 12
+#define METRIC_FORKS 13
+#define METRIC_BUSY_US 14
+#define METRIC_TRANSFERS_FAILED 15
+// Errors sent, one counter per TFTP error code 0 to 8.
+#define METRIC_ERRORS 16
+#define METRIC_ERROR_CODES 9
+#define METRIC_COUNT (METRIC_ERRORS + METRIC_ERROR_CODES)
+
+// Number of per CPU slots, CPUs above it share slots.
+#define METRICS_SLOTS 64
+
+// Pending connections of metrics endpoint.
+#define METRICS_BACKLOG 16
+
+/**
+* @brief Counters updated from one CPU, slots are cache line aligned so CPUs never write the same line.
+*/
+typedef struct MetricsSlot {
+    long counters[METRIC_COUNT];
+} __attribute__((aligned(64))) MetricsSlot_t;
+
+/**
+* @brief Metrics of whole server, lives in one shared mapping so forked processes and workers update it too.
+*/
+typedef struct Metrics {
+    MetricsSlot_t slots[METRICS_SLOTS];
+    // Server settings exported as gauges.
+    char mode[8];
+    int workers;
+    long max_transfers;
+    // Block cache whose hit and miss counters are exported, NULL if disabled.
+    Cache_t *cache;
+    // Wall clock time of server start in seconds.
+    long start_time;
+} Metrics_t;
+
+// Metrics of this server, NULL in client and when metrics are disabled.
+extern Metrics_t *metrics;
+
+/**
+* @brief Add value to counter in slot of current CPU, lock-free relaxed atomic add.
+*
+* @param counter Counter index.
+* @param value Value to add.
+*
+* @return void
+*/
+static inline void metrics_add(int counter, long value) {
+    if (metrics != NULL) {
+        int cpu = sched_getcpu();
+        __atomic_fetch_add(&metrics->slots[(cpu < 0 ? 0 : cpu) % METRICS_SLOTS].counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+* @brief Create metrics in shared anonymous memory and make them current for this process and its children.
+*
+* @param mode Name of server mode.
+* @param workers Number of worker processes, 0 for single process.
+* @param max_transfers Limit of concurrent transfers per event loop.
+* @param cache Block cache, NULL if disabled.
+*
+* @return Pointer to metrics, NULL if allocation failed.
+*/
+Metrics_t *metrics_create(char *mode, int workers, long max_transfers, Cache_t *cache);
+
+/**
+* @brief Start process serving metrics over HTTP, it ends together with its parent.
+*
+* @param endpoint Path of UNIX socket, or TCP port on loopback if endpoint is a number.
+*
+* @return True if endpoint is listening, false otherwise.
+*/
+bool metrics_serve(char *endpoint);
+
+#endif // METRICS_H
@@ -0,0 +1,135 @@
+//
+// File: multicast.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for multicast transfers (RFC 2090), server side groups and client side block tracking.
+//
+
+#ifndef MULTICAST_H
+#define MULTICAST_H
+
+#include "utils.h"
+
+// RFC 2090 has no block number rollover, larger files are served by unicast.
+#define MULTICAST_MAX_BLOCKS 65535
+
+/**
+* @brief Client taking part in multicast transfer.
+*/
+typedef struct MulticastMember {
+    struct sockaddr_in addr;
+    // Options requested by client, every OACK sent to it acknowledges exactly these.
+    Option_t options[NUM_OPTIONS];
+} MulticastMember_t;
+
+/**
+* @brief Server side group of clients reading the same file, every block is sent once to group address.
+*/
+typedef struct MulticastGroup {
+    char file_name[MAX_FILE_NAME_LEN + 1];
+    // Group address, port is the port of transfer socket, so groups of all processes differ.
+    struct sockaddr_in addr;
+    long file_size;
+    long last_block;
+    // Members in order of arrival, the first one is master client and the only one acknowledging DATA.
+    MulticastMember_t *members;
+    int count;
+    int capacity;
+} MulticastGroup_t;
+
+/**
+* @brief Client side record of received blocks, blocks arrive out of order when client joined running transfer.
+*/
+typedef struct MulticastReceiver {
+    unsigned char received[MULTICAST_MAX_BLOCKS / 8 + 1];
+    // Number of the short block ending the file, 0 until it arrives.
+    long last_block;
+} MulticastReceiver_t;
+
+/**
+* @brief Create group for transfer socket, socket is bound and its multicast egress set towards the first client.
+*
+* @param file_name Requested file name.
+* @param socket Transfer socket DATA is sent from.
+* @param group_addr Multicast address of group.
+* @param client_addr Address of the first client.
+* @param file_size Size of served file.
+* @param blksize Negotiated blksize.
+*
+* @return Pointer to group, NULL if socket could not be set up.
+*/
+MulticastGroup_t *multicast_group_create(char *file_name, int socket, struct in_addr group_addr, struct sockaddr_in *client_addr,
+                                         long file_size, long blksize);
+
+/**
+* @brief Deallocate group.
+*
+* @param group Pointer to group.
+*
+* @return void
+*/
+void multicast_group_free(MulticastGroup_t *group);
+
+/**
+* @brief Find member by address.
+*
+* @param group Pointer to group.
+* @param addr Client address.
+*
+* @return Index of member, -1 if address is not a member.
+*/
+int multicast_member_find(MulticastGroup_t *group, struct sockaddr_in *addr);
+
+/**
+* @brief Append member to group.
+*
+* @param group Pointer to group.
+* @param addr Client address.
+* @param options Options requested by client.
+*
+* @return True on success, false if allocation failed.
+*/
+bool multicast_member_add(MulticastGroup_t *group, struct sockaddr_in *addr, Option_t *options);
+
+/**
+* @brief Remove member, order of remaining members is kept.
+*
+* @param group Pointer to group.
+* @param index Index of member.
+*
+* @return void
+*/
+void multicast_member_remove(MulticastGroup_t *group, int index);
+
+/**
+* @brief Open socket receiving datagrams sent to group and join the group on interface facing server.
+*
+* @param group_addr Group address and port.
+* @param server_addr Server address.
+*
+* @return Socket file descriptor, -1 on failure.
+*/
+int multicast_socket_open(struct sockaddr_in *group_addr, struct sockaddr_in *server_addr);
+
+/**
+* @brief Record received block.
+*
+* @param receiver Pointer to receiver.
+* @param block_number Block number.
+*
+* @return True if block was not received before, false for duplicates.
+*/
+bool multicast_block_set(MulticastReceiver_t *receiver, long block_number);
+
+/**
+* @brief Extend number of the last block received with all blocks before it.
+*
+* @param receiver Pointer to receiver.
+* @param block_number Current number of such block.
+*
+* @return New number of the last block received with all blocks before it.
+*/
+long multicast_block_prefix(MulticastReceiver_t *receiver, long block_number);
+
+#endif // MULTICAST_H
@@ -0,0 +1,69 @@
+//
+// File: netascii.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for netascii transcoding, files are encoded chunk by chunk as they are sent and decoded
+//              block by block.
+//
+
+#ifndef NETASCII_H
+#define NETASCII_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "encodecache.h"
+
+// Size of file chunk read and encoded at once.
+#define NETASCII_CHUNK (64 * 1024)
+
+// Total size of encoded files kept by one process, larger files are encoded as every transfer reads them.
+#define NETASCII_CACHE_MAX (64L * 1024 * 1024)
+
+/**
+* @brief State of decoding netascii stream, blocks are decoded in order and written one after another.
+*/
+typedef struct NetasciiDecoder {
+    // Previous block ended with CR, its meaning depends on the first byte of next block.
+    bool pending_cr;
+    // File offset of the next decoded byte.
+    off_t offset;
+} NetasciiDecoder_t;
+
+/**
+* @brief Encode local text (LF line ends) to netascii, LF becomes CR LF and CR becomes CR NUL.
+*
+* @param input Input bytes.
+* @param size Number of input bytes.
+* @param output Buffer of at least 2 * size bytes.
+*
+* @return Number of encoded bytes.
+*/
+size_t netascii_encode(const char *input, size_t size, char *output);
+
+/**
+* @brief Decode netascii, CR LF becomes LF and CR NUL becomes CR, CR ending input is kept for the next call.
+*
+* @param decoder Pointer to decoder state.
+* @param input Input bytes.
+* @param size Number of input bytes.
+* @param output Buffer of at least size + 1 bytes.
+*
+* @return Number of decoded bytes.
+*/
+size_t netascii_decode(NetasciiDecoder_t *decoder, const char *input, size_t size, char *output);
+
+/**
+* @brief Open netascii encoding of file, encoded files are cached by process.
+*
+* @param fd Descriptor of opened file, it stays open and must outlive the stream.
+*
+* @return Pointer to stream, NULL on failure.
+*/
+EncodeStream_t *netascii_open(int fd);
+
+#endif // NETASCII_H
@@ -0,0 +1,126 @@
+//
+// File: tftp-bench.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for TFTP load generator.
+//
+
+#ifndef TFTP_BENCH_H
+#define TFTP_BENCH_H
+
+#include "utils.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+// Defaults of load generator.
+#define BENCH_TRANSFERS_DEFAULT 100
+#define BENCH_CONCURRENCY_DEFAULT 10
+#define BENCH_PREFIX_DEFAULT "bench"
+
+// Upper limit of concurrently running transfers.
+#define BENCH_CONCURRENCY_MAX 65536
+
+// Upper limit of comma separated files or sizes.
+#define BENCH_LIST_MAX 64
+
+// Initial retransmission timeout of load generator in microseconds, it is doubled on every retry and not estimated.
+#define BENCH_RTO_DEFAULT 1000000
+
+/**
+* @brief Struct for storing load generator's command line arguments.
+*/
+typedef struct BenchArgs {
+    struct sockaddr_in server_address;
+    // Total number of transfers and number of transfers running at once.
+    int transfers;
+    int concurrency;
+    // New transfers per second, 0 starts a new transfer whenever one finishes.
+    double rate;
+    // Files read by RRQ, cycled through.
+    char *files[BENCH_LIST_MAX];
+    int num_files;
+    // Sizes of files written by WRQ, cycled through.
+    long sizes[BENCH_LIST_MAX];
+    int num_sizes;
+    // Requested options, 0 leaves option out of request.
+    long blksize;
+    long windowsize;
+    long rto;
+    // Name prefix of written files, names are unique per process.
+    char *prefix;
+    // Server root directory, written files are removed from it when set.
+    char *dir_path;
+} BenchArgs_t;
+
+/**
+* @brief State of one transfer driven by load generator.
+*/
+typedef struct BenchTransfer {
+    bool active;
+    int socket;
+    int opcode;
+    // Index of transfer in run, selects file or size and names written file.
+    int index;
+    char file_name[MAX_FILE_NAME_LEN + 1];
+    // Server address, port is replaced by server's TID on first response.
+    struct sockaddr_in server_address;
+    bool tid_known;
+    // Negotiated options.
+    long blksize;
+    long windowsize;
+    // Last in-order received (RRQ) or acknowledged (WRQ) block and last block sent (WRQ).
+    long block_number;
+    long block_sent;
+    // Block ending written file.
+    long last_block;
+    long size;
+    int window_count;
+    bool gap_acked;
+    // Payload bytes moved so far.
+    long bytes;
+    // Times in microseconds, first_byte is 0 until server answers with data (RRQ) or acknowledgement (WRQ).
+    long started_at;
+    long first_byte_at;
+    long deadline;
+    int retries;
+} BenchTransfer_t;
+
+/**
+* @brief Results of load generator run.
+*/
+typedef struct BenchStats {
+    int reads;
+    int writes;
+    int completed;
+    int failed;
+    long bytes;
+    long packets_sent;
+    long packets_received;
+    long retransmissions;
+    // Per completed transfer, in microseconds.
+    long *ttfb;
+    long *completion;
+} BenchStats_t;
+
+/**
+* @brief Initialize BenchArgs_t struct.
+*
+* @param bench_args Pointer to BenchArgs_t struct.
+*
+* @return void
+*/
+void init_args(BenchArgs_t *bench_args);
+
+/**
+* @brief Handle load generator's command line arguments.
+*
+* @param argc Number of command line arguments.
+* @param argv Command line arguments array.
+* @param bench_args Pointer to BenchArgs_t struct.
+*
+* @return void
+*/
+void parse_args(int argc, char *argv[], BenchArgs_t *bench_args);
+
+#endif // TFTP_BENCH_H
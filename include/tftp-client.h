@@ -3,13 +3,23 @@
 //
 // Author: Lukáš Zavadil (xzavad20)
 //
-// Description: Header file for tfpt client.
+// Description: Header file for tfpt client, command line front end of libtftp.
 //
 
 #ifndef TFTP_CLIENT_H
 #define TFTP_CLIENT_H
 
+#include <fcntl.h>
+#include <pthread.h>
 #include "utils.h"
+#include "libtftp.h"
+
+// Transfers running at once in batch mode.
+#define BATCH_JOBS_DEFAULT 8
+#define BATCH_JOBS_MAX 1024
+
+// Maximum number of byte ranges of segmented download, every one logs from own thread.
+#define SEGMENTS_MAX 32
 
 /**
 * @brief Struct for storing client's command line arguments.
@@ -19,11 +29,82 @@ typedef struct ClientArgs {
     int port;
     char *file_path;
     char *dest_file_path;
+    // Requested blksize, 0 if not requested or TFTP_BLKSIZE_AUTO.
+    long blksize;
+    bool tsize;
+    long windowsize;
+    long timeout;
+    long utimeout;
+    bool multicast;
+    bool netascii;
+    // Continue interrupted transfer from data already at destination.
+    bool resume;
+    // Send data compressed with built-in codec.
+    bool compress;
+    // Number of concurrent range sessions of download, 0 for single session.
+    long segments;
+    // Log verbosity, LOG_NONE to LOG_PACKET.
+    int log_level;
+    // Manifest of batch mode, "-" for stdin, empty string for single transfer.
+    char *manifest_path;
+    long jobs;
 } ClientArgs_t;
 
-int opcode;
-int out_block_number;
-FILE *file;
+/**
+* @brief One transfer of batch, read from manifest.
+*/
+typedef struct BatchJob {
+    // TFTP_GET or TFTP_PUT.
+    int type;
+    char remote[MAX_FILE_NAME_LEN];
+    char local[MAX_FILE_NAME_LEN];
+    // Line of manifest job was read from.
+    long line;
+    // Local file was created by this job and is removed if it fails, unless batch resumes.
+    bool created;
+    int result;
+    // Bytes sent over network, resumed job leaves out bytes destination already held.
+    long bytes;
+    long offset;
+    // Start and duration of transfer in microseconds.
+    long start;
+    long duration;
+    struct ClientBatch *batch;
+} BatchJob_t;
+
+/**
+* @brief Jobs of batch mode and their progress.
+*/
+typedef struct ClientBatch {
+    TftpClient_t *client;
+    // Request with options shared by all jobs.
+    TftpRequest_t request;
+    BatchJob_t *jobs;
+    long count;
+    long capacity;
+    // Index of next job to start, number of running jobs and their limit.
+    long next;
+    long running;
+    long limit;
+    long failed;
+    long bytes;
+} ClientBatch_t;
+
+/**
+* @brief One byte range of segmented download, fetched by its own client in its own thread.
+*/
+typedef struct Segment {
+    TftpRequest_t request;
+    pthread_t thread;
+    // Destination shared by all segments, blocks are written with pwrite at their offsets.
+    int fd;
+    int result;
+    int error_code;
+    char error[MAX_STR_LEN];
+    // Server acknowledged range and file size it reported, -1 if unknown.
+    bool ranged;
+    long size;
+} Segment_t;
 
 /**
 * @brief Initialize ClientArgs_t struct.
@@ -62,4 +143,34 @@ void parse_args(int argc, char *argv[], ClientArgs_t *client_args, int *opcode);
 */
 FILE *client_data_stream(int opcode, ClientArgs_t *client_args);
 
+/**
+* @brief Download file over concurrent sessions, one per byte range, or over one session if server lacks range extension.
+*
+* @param client_args Pointer to struct for storing client's command line arguments.
+* @param request Pointer to request with server, file name and options shared by all sessions.
+*
+* @return Exit code.
+*/
+int segmented_download(ClientArgs_t *client_args, TftpRequest_t *request);
+
+/**
+* @brief Read jobs of batch from manifest, exits on malformed line.
+*
+* @param batch Pointer to batch.
+* @param manifest Manifest stream, one "get remote [local]", "put local [remote]" or bare remote name per line.
+*
+* @return void
+*/
+void batch_load(ClientBatch_t *batch, FILE *manifest);
+
+/**
+* @brief Run all jobs of batch, at most jobs transfers at once, and report each of them and totals.
+*
+* @param batch Pointer to batch.
+* @param jobs Number of transfers running at once.
+*
+* @return Exit code, failure if any job failed.
+*/
+int batch_run(ClientBatch_t *batch, long jobs);
+
 #endif // TFTP_CLIENT_H
\ No newline at end of file
@@ -0,0 +1,119 @@
+//
+// File: tftp-proxy.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for UDP impairment proxy placed between TFTP client and server.
+//
+
+#ifndef TFTP_PROXY_H
+#define TFTP_PROXY_H
+
+#include "utils.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+// Defaults of proxy.
+#define PROXY_PORT_DEFAULT 6970
+#define PROXY_QUEUE_DEFAULT 1000
+#define PROXY_REORDER_DELAY_DEFAULT 10
+#define PROXY_SEED_DEFAULT 1
+
+// Upper limit of clients relayed at once.
+#define PROXY_MAX_FLOWS 1024
+
+// Flow without traffic for this long is closed, in microseconds.
+#define PROXY_FLOW_IDLE 30000000
+
+// Directions of relayed datagrams.
+#define PROXY_TO_SERVER 0
+#define PROXY_TO_CLIENT 1
+
+/**
+* @brief Impairments applied to every relayed datagram, in both directions.
+*/
+typedef struct ProxyArgs {
+    int port;
+    struct sockaddr_in server_address;
+    // Probabilities in percent.
+    double loss;
+    double duplicate;
+    double reorder;
+    // Times in microseconds.
+    long delay;
+    long jitter;
+    long reorder_delay;
+    // Link rate per direction in kbit/s, 0 for unlimited.
+    long bandwidth;
+    // Datagrams waiting per direction, further ones are dropped.
+    int queue_limit;
+    uint64_t seed;
+} ProxyArgs_t;
+
+/**
+* @brief Relayed client, it gets own sockets so server's TID can be mirrored to it.
+*/
+typedef struct ProxyFlow {
+    bool active;
+    struct sockaddr_in client_address;
+    // Server's TID, port is server's listening port until the first answer.
+    struct sockaddr_in server_address;
+    // Socket facing server and socket standing for server's TID towards client.
+    int upstream;
+    int downstream;
+    // Datagrams of flow waiting for delivery, flow is not closed while any wait.
+    int queued;
+    long last_active;
+} ProxyFlow_t;
+
+/**
+* @brief Datagram waiting for delivery.
+*/
+typedef struct ProxyPacket {
+    long deliver_at;
+    // Order of arrival, packets due at the same time leave in it.
+    long sequence;
+    int flow;
+    int direction;
+    int size;
+    char data[];
+} ProxyPacket_t;
+
+/**
+* @brief One direction of emulated link.
+*/
+typedef struct ProxyLink {
+    // Time when the last queued datagram leaves the link, used for bandwidth cap.
+    long busy_until;
+    int queued;
+    // Statistics.
+    long received;
+    long sent;
+    long lost;
+    long overflowed;
+    long duplicated;
+    long reordered;
+} ProxyLink_t;
+
+/**
+* @brief Initialize ProxyArgs_t struct.
+*
+* @param proxy_args Pointer to ProxyArgs_t struct.
+*
+* @return void
+*/
+void init_args(ProxyArgs_t *proxy_args);
+
+/**
+* @brief Handle proxy's command line arguments.
+*
+* @param argc Number of command line arguments.
+* @param argv Command line arguments array.
+* @param proxy_args Pointer to ProxyArgs_t struct.
+*
+* @return void
+*/
+void parse_args(int argc, char *argv[], ProxyArgs_t *proxy_args);
+
+#endif // TFTP_PROXY_H
@@ -10,17 +10,53 @@
 #define TFTP_SERVER_H
 
 #include "utils.h"
+#include "transfer.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+// Server modes.
+#define MODE_EPOLL 0
+#define MODE_FORK 1
+#define MODE_URING 2
+#define MODE_EPOLL_NAME "epoll"
+#define MODE_FORK_NAME "fork"
+#define MODE_URING_NAME "uring"
+
+// Default limit of concurrently running transfers in event loop.
+#define MAX_TRANSFERS_DEFAULT 1024
+
+// Maximum number of events returned by one epoll_wait call.
+#define MAX_EVENTS 64
+
+// Upper limit of worker processes.
+#define MAX_WORKERS 1024
+
+// Upper limit of block cache size in megabytes.
+#define CACHE_SIZE_MAX 1048576
 
 /**
 * @brief Struct for storing server's command line arguments.
 */
 typedef struct ServerArgs {
     int port;
-    char *dir_path;
+    int mode;
+    int max_transfers;
+    int workers;
+    bool pin_workers;
+    // Block cache budget in megabytes, 0 disables cache.
+    long cache_size;
+    // Datagrams per recvmmsg/sendmmsg call in event loop.
+    int batch_size;
+    // UNIX socket path or loopback TCP port metrics are served on, NULL disables metrics.
+    char *metrics_endpoint;
+    // Log verbosity, LOG_NONE to LOG_PACKET.
+    int log_level;
+    TransferConfig_t transfer_config;
 } ServerArgs_t;
 
-FILE *file;
-
 /**
 * @brief Initialize ServerArgs_t struct.
 *
@@ -50,4 +86,73 @@ void free_args(ServerArgs_t *server_args);
 */
 void parse_args(int argc, char *argv[], ServerArgs_t *server_args);
 
+/**
+* @brief Create socket bound to port on all interfaces.
+*
+* @param port Port number.
+* @param reuse_port Allow other workers to bind the same port (SO_REUSEPORT).
+*
+* @return Socket file descriptor.
+*/
+int bind_listener(int port, bool reuse_port);
+
+/**
+* @brief Serve requests on listening socket in mode selected by -m.
+*
+* @param listen_fd Socket receiving request packets.
+* @param server_args Pointer to ServerArgs_t struct.
+*
+* @return void
+*/
+void run_server(int listen_fd, ServerArgs_t *server_args);
+
+/**
+* @brief Start -j worker processes, each with its own SO_REUSEPORT listener, and keep them running.
+*
+* @param server_args Pointer to ServerArgs_t struct.
+*
+* @return void
+*/
+void run_workers(ServerArgs_t *server_args);
+
+/**
+* @brief Serve requests by forking new process for every transfer.
+*
+* @param listen_fd Socket receiving request packets.
+* @param server_args Pointer to ServerArgs_t struct.
+*
+* @return void
+*/
+void run_fork_server(int listen_fd, ServerArgs_t *server_args);
+
+/**
+* @brief Serve all transfers inside one process using epoll and non-blocking sockets.
+*
+* @param listen_fd Socket receiving request packets.
+* @param server_args Pointer to ServerArgs_t struct.
+*
+* @return void
+*/
+void run_event_loop(int listen_fd, ServerArgs_t *server_args);
+
+/**
+* @brief Serve all transfers inside one process with io_uring, sends, receives and file I/O are queued and submitted
+*        together with one io_uring_enter call per pass.
+*
+* @param listen_fd Socket receiving request packets.
+* @param server_args Pointer to ServerArgs_t struct.
+*
+* @return False if io_uring is not available (nothing was served), does not return otherwise.
+*/
+bool run_uring_loop(int listen_fd, ServerArgs_t *server_args);
+
+/**
+* @brief Switch socket to non-blocking mode.
+*
+* @param sock_fd Socket file descriptor.
+*
+* @return void
+*/
+void socket_nonblocking(int sock_fd);
+
 #endif // TFTP_SERVER_H
\ No newline at end of file
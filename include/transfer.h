@@ -0,0 +1,169 @@
+//
+// File: transfer.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for server side transfer state machine.
+//
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "utils.h"
+#include "filecache.h"
+#include "multicast.h"
+
+// After the last ACK receiver lingers for this many timeouts (at least DALLY_MIN microseconds)
+// to answer retransmitted last DATA, sender's timer may have backed off far beyond ours.
+#define DALLY_TIMEOUTS 2
+#define DALLY_MIN 1000000
+
+/**
+* @brief Server settings shared by all transfers.
+*/
+typedef struct TransferConfig {
+    // Server root directory.
+    char *dir_path;
+    // Send RRQ DATA from mapped file (MSG_ZEROCOPY where supported).
+    bool zero_copy;
+    // Let WRQ with offset option continue existing file, any client could append to writable files otherwise.
+    bool resume_uploads;
+    // Shared block cache for RRQ, NULL if disabled.
+    Cache_t *cache;
+    // Per process metadata cache of root directory, NULL if disabled.
+    FileCache_t *files;
+    // Per process sendmmsg/recvmmsg buffers, NULL sends and receives packet by packet.
+    Batch_t *batch;
+    // Per process io_uring of uring engine, NULL in other modes.
+    Uring_t *uring;
+    // Group address of multicast transfers (RFC 2090), INADDR_ANY declines multicast option.
+    struct in_addr multicast_addr;
+} TransferConfig_t;
+
+/**
+* @brief States of a single RRQ/WRQ transfer.
+*/
+typedef enum TransferState {
+    WAIT_OACK_ACK,  // RRQ, OACK sent and ACK 0 is expected.
+    WAIT_ACK,       // RRQ, DATA sent and its ACK is expected.
+    WAIT_DATA,      // WRQ, ACK or OACK sent and next DATA is expected.
+    DALLY,          // WRQ, last ACK sent, waiting in case it was lost.
+    DONE            // Transfer finished or failed.
+} TransferState_t;
+
+/**
+* @brief Struct for storing state of one server side transfer.
+*/
+typedef struct Transfer {
+    int socket;
+    struct sockaddr_in client_addr;
+    TransferState_t state;
+    int opcode;
+    bool oack_sent;
+    // Whole file was moved, transfer is counted as completed or failed once it is freed.
+    bool completed;
+    Session_t session;
+    TransferConfig_t *config;
+    // Cached file of RRQ, held until file is opened by first DATA.
+    FileEntry_t *entry;
+    // Multicast group, client_addr is then address of its master client, NULL for unicast transfer.
+    MulticastGroup_t *group;
+    // Position in timer queue, -1 if timer is stopped.
+    int timer_index;
+    struct Transfer *prev;
+    struct Transfer *next;
+} Transfer_t;
+
+/**
+* @brief Binary min-heap of transfers ordered by retransmission deadline.
+*/
+typedef struct TimerQueue {
+    Transfer_t **items;
+    int size;
+    int capacity;
+} TimerQueue_t;
+
+/**
+* @brief Validate request packet, open requested file and send first response.
+*
+* @param packet Pointer to request packet.
+* @param size Size of request packet.
+* @param client_addr Client address.
+* @param config Pointer to server settings.
+*
+* @return Pointer to new transfer, NULL if request was rejected or transfer failed before it got going.
+*/
+Transfer_t *transfer_start(char *packet, int size, struct sockaddr_in client_addr, TransferConfig_t *config);
+
+/**
+* @brief Add client requesting the same file with the same mode, blksize and windowsize to multicast transfer.
+*
+* @param transfer Pointer to transfer.
+* @param packet Pointer to request packet.
+* @param size Size of request packet.
+* @param client_addr Client address.
+*
+* @return True if request was taken by transfer (client joined or is already a member), false otherwise.
+*/
+bool transfer_join(Transfer_t *transfer, char *packet, int size, struct sockaddr_in client_addr);
+
+/**
+* @brief Advance transfer state machine with packet received on its socket.
+*
+* @param transfer Pointer to transfer.
+* @param packet Pointer to received packet.
+* @param recvfrom_size Size of received packet.
+* @param source_addr Address packet was received from.
+*
+* @return True if transfer is finished, false otherwise.
+*/
+bool transfer_handle_packet(Transfer_t *transfer, char *packet, int recvfrom_size, struct sockaddr_in source_addr);
+
+/**
+* @brief Handle expired retransmission timer of transfer.
+*
+* @param transfer Pointer to transfer.
+*
+* @return True if transfer is finished (retries exhausted or dallying ended), false otherwise.
+*/
+bool transfer_timeout(Transfer_t *transfer);
+
+/**
+* @brief Allocate timer queue.
+*
+* @param queue Pointer to timer queue.
+* @param capacity Maximum number of transfers.
+*
+* @return void
+*/
+void timer_queue_init(TimerQueue_t *queue, int capacity);
+
+/**
+* @brief Insert, move or remove transfer in timer queue according to its current deadline.
+*
+* @param queue Pointer to timer queue.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+void timer_queue_update(TimerQueue_t *queue, Transfer_t *transfer);
+
+/**
+* @brief Get transfer with the earliest deadline.
+*
+* @param queue Pointer to timer queue.
+*
+* @return Pointer to transfer, NULL if queue is empty.
+*/
+Transfer_t *timer_queue_peek(TimerQueue_t *queue);
+
+/**
+* @brief Close transfer's socket and file and deallocate it.
+*
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+void transfer_free(Transfer_t *transfer);
+
+#endif // TRANSFER_H
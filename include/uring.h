@@ -0,0 +1,335 @@
+//
+// File: uring.h
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Header file for io_uring backend of server data path (raw syscalls, no liburing).
+//
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Number of submission queue entries, completion queue is twice as large.
+#define URING_ENTRIES 4096
+
+// Size of registered buffer arena, split into page sized units for per transfer slots.
+#define URING_ARENA_SIZE (16 * 1024 * 1024)
+#define URING_PAGE_SIZE 4096
+
+// Upper limit of registered block slots of one transfer, blocks beyond are sent from copied buffers.
+#define URING_SESSION_SLOTS 64
+
+// Kinds of queued operations.
+#define URING_OP_LISTEN 0
+#define URING_OP_POLL 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_READ 4
+#define URING_OP_WRITE 5
+#define URING_OP_CANCEL 6
+
+struct Session;
+struct UringSession;
+
+/**
+* @brief One queued operation, its address is the user_data of the SQE.
+*/
+typedef struct UringOp {
+    int type;
+    // Session the operation belongs to, NULL for operations nobody waits for.
+    struct UringSession *owner;
+    // Engine defined pointer for listener and poll operations.
+    void *context;
+    // Registered slot used by operation, -1 if buffer is part of operation.
+    int slot;
+    // Expected result of read or write.
+    int expected;
+    struct msghdr msg;
+    struct iovec iov[2];
+    struct sockaddr_in addr;
+    int buffer_size;
+    char buffer[];
+} UringOp_t;
+
+/**
+* @brief Ring shared by all transfers of one process.
+*/
+typedef struct Uring {
+    int fd;
+    // Submission queue.
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    // Last SQE of currently built link chain, NULL if no chain is open.
+    struct io_uring_sqe *link;
+    // Completion queue.
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    // Ring mappings.
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    // Registered buffer arena and its page allocation map.
+    char *arena;
+    unsigned char *arena_used;
+    int arena_pages;
+    // Free indexes of registered file table.
+    int *free_files;
+    int free_file_count;
+    // Statistics.
+    long enter_calls;
+    long submitted;
+    long completed;
+} Uring_t;
+
+/**
+* @brief io_uring state of one session.
+*/
+typedef struct UringSession {
+    Uring_t *ring;
+    struct Session *session;
+    // Engine defined pointer, the transfer owning the session.
+    void *context;
+    // Registered file indexes of socket and file, file is registered on first file operation.
+    int socket_index;
+    int file_index;
+    // Size of served file, async reads are issued for exact block lengths.
+    long file_size;
+    // Registered block slots, each blksize + 4 bytes.
+    char *slots;
+    int slot_size;
+    int slot_count;
+    int first_page;
+    int page_count;
+    int free_slots[URING_SESSION_SLOTS];
+    int free_slot_count;
+    // Receive operation, re-armed after every packet.
+    UringOp_t *recv_op;
+    bool recv_armed;
+    // Operations in flight that reference this session.
+    int inflight;
+    // Writes in flight, ACK is held back until all of them succeed.
+    int writes;
+    bool ack_pending;
+    long ack_block;
+    int ack_socket;
+    struct sockaddr_in ack_dest;
+    // Async read or write failed, error is reported by engine.
+    bool failed;
+    int error_code;
+    char *error_msg;
+    // Transfer finished, it is freed when last operation completes.
+    bool closing;
+} UringSession_t;
+
+/**
+* @brief Create ring, register buffer arena and file table.
+*
+* @param ring Pointer to ring.
+* @param files Size of registered file table.
+*
+* @return True on success, false if io_uring or a required operation is not available.
+*/
+bool uring_init(Uring_t *ring, int files);
+
+/**
+* @brief Get free SQE, queue is submitted first when full.
+*
+* @param ring Pointer to ring.
+*
+* @return Pointer to zeroed SQE.
+*/
+struct io_uring_sqe *uring_get_sqe(Uring_t *ring);
+
+/**
+* @brief Close link chain, next SQE starts independent operation.
+*
+* @param ring Pointer to ring.
+*
+* @return void
+*/
+void uring_link_end(Uring_t *ring);
+
+/**
+* @brief Submit queued SQEs and wait for at least one completion with one io_uring_enter call.
+*
+* @param ring Pointer to ring.
+* @param timeout Wait limit in microseconds, -1 waits without limit, 0 only submits.
+*
+* @return void
+*/
+void uring_submit_and_wait(Uring_t *ring, long timeout);
+
+/**
+* @brief Get next completion.
+*
+* @param ring Pointer to ring.
+* @param result Pointer to store result of completed operation.
+*
+* @return Completed operation, NULL if completion queue is empty.
+*/
+UringOp_t *uring_complete_next(Uring_t *ring, int *result);
+
+/**
+* @brief Register fd in file table.
+*
+* @param ring Pointer to ring.
+* @param fd File descriptor.
+*
+* @return Registered index, -1 if table is full.
+*/
+int uring_file_register(Uring_t *ring, int fd);
+
+/**
+* @brief Remove fd from file table, operations already submitted keep their reference.
+*
+* @param ring Pointer to ring.
+* @param index Registered index.
+*
+* @return void
+*/
+void uring_file_unregister(Uring_t *ring, int index);
+
+/**
+* @brief Allocate operation with buffer.
+*
+* @param type Kind of operation.
+* @param owner Session waiting for the operation, NULL if nobody waits.
+* @param size Buffer size.
+*
+* @return Pointer to operation.
+*/
+UringOp_t *uring_op_alloc(int type, UringSession_t *owner, int size);
+
+/**
+* @brief Queue receive of one datagram into operation's buffer.
+*
+* @param ring Pointer to ring.
+* @param op Receive operation.
+* @param index Registered index of socket.
+*
+* @return void
+*/
+void uring_recv(Uring_t *ring, UringOp_t *op, int index);
+
+/**
+* @brief Queue one shot poll for readability of fd.
+*
+* @param ring Pointer to ring.
+* @param op Poll operation.
+* @param fd File descriptor.
+*
+* @return void
+*/
+void uring_poll(Uring_t *ring, UringOp_t *op, int fd);
+
+/**
+* @brief Attach io_uring state to session, register its socket and reserve block slots.
+*
+* @param ring Pointer to ring.
+* @param session Pointer to session with negotiated options.
+* @param socket Session's socket.
+* @param context Engine defined owner pointer.
+*
+* @return True on success, false if file table is full.
+*/
+bool uring_session_attach(Uring_t *ring, struct Session *session, int socket, void *context);
+
+/**
+* @brief Detach io_uring state, no operation of session may be in flight.
+*
+* @param session Pointer to session.
+*
+* @return void
+*/
+void uring_session_detach(struct Session *session);
+
+/**
+* @brief Arm receive of next packet of session.
+*
+* @param us Pointer to session's io_uring state.
+*
+* @return void
+*/
+void uring_session_recv(UringSession_t *us);
+
+/**
+* @brief Mark session finished and cancel its receive, session may be freed once no operation is in flight.
+*
+* @param us Pointer to session's io_uring state.
+*
+* @return True if session can be freed right away.
+*/
+bool uring_session_close(UringSession_t *us);
+
+/**
+* @brief Account completion of session's operation, release its slot and send held back ACK when writes are done.
+*
+* @param op Completed operation.
+* @param result Result of operation.
+*
+* @return Session the operation belonged to, NULL for operations nobody waits for.
+*/
+UringSession_t *uring_session_complete(UringOp_t *op, int result);
+
+/**
+* @brief Queue datagram, data is copied into operation.
+*
+* @param us Pointer to session's io_uring state.
+* @param iov Data parts.
+* @param count Number of parts.
+* @param dest_addr Destination address.
+*
+* @return void
+*/
+void uring_send(UringSession_t *us, struct iovec *iov, int count, struct sockaddr_in *dest_addr);
+
+/**
+* @brief Queue DATA packet of block into current link chain, payload is read by linked READ_FIXED when slot is free.
+*
+* @param us Pointer to session's io_uring state.
+* @param dest_addr Destination address.
+* @param block_number Block number.
+*
+* @return Payload size, -1 if file could not be read.
+*/
+long uring_data_queue(UringSession_t *us, struct sockaddr_in *dest_addr, long block_number);
+
+/**
+* @brief Queue write of received block from registered slot.
+*
+* @param us Pointer to session's io_uring state.
+* @param block_number Block number.
+* @param buffer Payload.
+* @param size Payload size.
+*
+* @return True if write was queued, false if no slot is free and block has to be written synchronously.
+*/
+bool uring_block_write(UringSession_t *us, long block_number, char *buffer, long size);
+
+/**
+* @brief Hold back ACK while writes of session are in flight.
+*
+* @param us Pointer to session's io_uring state.
+* @param socket Socket file descriptor.
+* @param dest_addr Destination address.
+* @param block_number Acknowledged block.
+*
+* @return True if ACK was held back, false if it can be sent now.
+*/
+bool uring_ack_defer(UringSession_t *us, int socket, struct sockaddr_in *dest_addr, long block_number);
+
+#endif // URING_H
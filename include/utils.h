@@ -10,6 +10,8 @@
 #define UTILS_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -24,6 +26,17 @@
 #include <sys/vfs.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "cache.h"
+#include "uring.h"
+#include "netascii.h"
+#include "compress.h"
+#include "metrics.h"
+#include "log.h"
+#include "codec.h"
 
 #define MAX_STR_LEN 256
 #define DEFAULT_DATA_SIZE 512
@@ -57,13 +70,59 @@
 #define TIMEOUT 0
 #define TSIZE 1
 #define BLKSIZE 2
+#define WINDOWSIZE 3
+#define UTIMEOUT 4
+#define MULTICAST 5
+#define OFFSET 6
+#define RANGE 7
+#define COMPRESS 8
 #define BLKSIZE_MIN 8
 #define BLKSIZE_MAX 65464
 #define BLKSIZE_DEFAULT 512
+// Headers in front of TFTP DATA, blksize fitting path MTU leaves room for them.
+#define IP_HEADER_SIZE 20
+#define UDP_HEADER_SIZE 8
+#define WINDOWSIZE_MIN 1
+#define WINDOWSIZE_MAX 65535
+#define WINDOWSIZE_DEFAULT 1
+#define TIMEOUT_MIN 1
+#define TIMEOUT_MAX 255
+// Microsecond timeout extension, same name and range as in tftp-hpa.
+#define UTIMEOUT_MIN 10000
+#define UTIMEOUT_MAX 255000000
 #define TIMEOUT_NAME "timeout"
 #define TSIZE_NAME "tsize"
 #define BLKSIZE_NAME "blksize"
-#define NUM_OPTIONS 3
+#define WINDOWSIZE_NAME "windowsize"
+#define UTIMEOUT_NAME "utimeout"
+#define MULTICAST_NAME "multicast"
+// Resume extension, value is number of bytes receiver already holds and CRC32C of the last of them ("bytes,crc").
+#define OFFSET_NAME "offset"
+// Bytes before offset covered by its CRC, so checking a resumed request of any file costs the same.
+#define OFFSET_CRC_WINDOW (1024 * 1024)
+// Range extension of read request, value is first byte and length of served part of file ("start,length").
+#define RANGE_NAME "range"
+// Compression extension, value is name of codec, data of octet transfer is sent as stream of compressed frames.
+#define COMPRESS_NAME "compress"
+#define NUM_OPTIONS 9
+
+// Retransmission timeout estimation (RFC 6298) in microseconds, used when timeout is not negotiated.
+#define RTO_INITIAL 1000000
+#define RTO_MIN 20000
+#define RTO_MAX 16000000
+#define RTO_GRANULARITY 1000
+// Number of retransmissions after which transfer is abandoned.
+#define MAX_RETRIES 6
+
+// Default and maximum number of datagrams moved by one recvmmsg/sendmmsg call.
+#define BATCH_DEFAULT 32
+#define BATCH_MAX 1024
+
+// Every batch slot fits the largest DATA packet.
+#define BATCH_SLOT_SIZE (BLKSIZE_MAX + 4)
+
+// MSG_ZEROCOPY pays off only for large packets, smaller blocks are still sent from mapping but copied by kernel.
+#define ZEROCOPY_MIN_BLKSIZE 8192
 
 // Theoretical max file size.
 //long int maxFileSize = 65536 * (65464 - OPCODE_SIZE - BLOCK_NUMBER_SIZE);
@@ -77,9 +136,7 @@
 #define ERR_UNKNOWN_TRANSFER_ID 5
 #define ERR_FILE_ALREADY_EXISTS 6
 #define ERR_NO_SUCH_USER 7
-
-extern int packet_pos;
-extern bool last;
+#define ERR_OPTION_NEGOTIATION 8
 
 // Struct for storing options.
 typedef struct Option {
@@ -88,213 +145,458 @@ typedef struct Option {
     int order;
 } Option_t;
 
-// Array of options.
-extern Option_t options[NUM_OPTIONS];
+/**
+* @brief Struct for storing retransmission timer of one session, all times are in microseconds.
+*/
+typedef struct Timer {
+    // Smoothed round trip time and its variation, srtt is 0 until first sample.
+    long srtt;
+    long rttvar;
+    // Current retransmission timeout.
+    long rto;
+    // Time of first transmission of timed packet, 0 if nothing is timed.
+    long sent_at;
+    // Time when retransmission is due, 0 if timer is stopped.
+    long deadline;
+    // Retransmissions of the current packet or window.
+    int retries;
+    // Timed packet was retransmitted, its ACK is not used as RTT sample (Karn's algorithm).
+    bool retransmitted;
+} Timer_t;
+
+/**
+* @brief Buffers for receiving and sending several datagrams with one recvmmsg/sendmmsg call.
+*        One batch is owned by a process and shared by all its sessions.
+*/
+typedef struct Batch {
+    int capacity;
+    struct mmsghdr *recv_msgs;
+    struct iovec *recv_iovs;
+    struct sockaddr_in *recv_addrs;
+    char *recv_buffer;
+    struct mmsghdr *send_msgs;
+    // Two per message, header and payload.
+    struct iovec *send_iovs;
+    char *send_buffer;
+    // Syscall and datagram counters for statistics.
+    long recv_calls;
+    long recv_packets;
+    long send_calls;
+    long send_packets;
+} Batch_t;
+
+/**
+* @brief Read up to size bytes at offset of transferred data, fewer only at its end.
+*/
+typedef long (*BlockReader_t)(void *user, char *buffer, long size, long offset);
+
+/**
+* @brief Write size bytes at offset of transferred data.
+*/
+typedef bool (*BlockWriter_t)(void *user, const char *buffer, long size, long offset);
+
+/**
+* @brief Struct for storing state of one transfer, packet functions keep all their state here.
+*/
+typedef struct Session {
+    // Pointer to the current position in packet.
+    int packet_pos;
+    // Last packet flag.
+    bool last;
+    // Transfer mode (NETASCII or OCTET), netascii file is sent from its encoding and received through decoder.
+    int mode;
+    // Encoding DATA is read from instead of file (netascii, compressed frames), chunks of file are encoded as blocks
+    // reach them, NULL for plain file.
+    EncodeStream_t *encoded;
+    NetasciiDecoder_t netascii;
+    // Receiver of compressed transfer decompresses frames as blocks arrive.
+    CompressDecoder_t compress;
+    // Socket whose local port was last looked up for log and the port.
+    int log_socket;
+    int log_port;
+    // Requested or negotiated options.
+    Option_t options[NUM_OPTIONS];
+    // Number of last acknowledged (sender) or last in-order received (receiver) block, counted
+    // from the start of transfer, only its low 16 bits go on the wire.
+    long block_number;
+    // Number of last sent block, blocks after block_number are in flight.
+    long block_sent;
+    // Blocks received since last ACK was sent.
+    int window_count;
+    // Time last in-order block was acknowledged because of gap, 0 if not since last timeout.
+    long gap_acked_at;
+    // Block acknowledged by that ACK.
+    long gap_block;
+    // Time window was last restarted by ACK of block before the last sent one, 0 if not since last full window.
+    long restarted_at;
+    // Retransmission timer.
+    Timer_t timer;
+    // Transferred file.
+    FILE *file;
+    // Callbacks blocks are read from and written to instead of file, NULL if file is used.
+    BlockReader_t reader;
+    BlockWriter_t writer;
+    void *user;
+    // Read-only mapping of served file in zero-copy mode, NULL otherwise.
+    char *map;
+    long map_size;
+    // Socket has SO_ZEROCOPY enabled, large DATA packets are sent with MSG_ZEROCOPY.
+    bool zero_copy;
+    // Batch used for sending windows of DATA with sendmmsg, NULL sends packet by packet.
+    Batch_t *batch;
+    // io_uring state, sends and file writes are queued on the ring instead of issued, NULL otherwise.
+    UringSession_t *uring;
+    // Shared block cache DATA is read through, NULL if disabled.
+    Cache_t *cache;
+    CacheKey_t cache_key;
+    // Buffer for incoming packets, sized for negotiated blksize.
+    char *packet;
+    int packet_size;
+    // Error reported back when request handling fails.
+    int error_code;
+    char *error_msg;
+    // Group of multicast transfer (RFC 2090), multicast option value is 1 for master client.
+    struct sockaddr_in multicast_addr;
+    // CRC32C of data before offset option value, blocks are counted from that offset.
+    uint32_t offset_crc;
+    // Length of served byte range, range option value is its start.
+    long range_length;
+} Session_t;
+
+/**
+* @brief Initialize session with default options and no open file.
+*
+* @param session Pointer to session.
+*
+* @return void
+*/
+void session_init(Session_t *session);
 
 /**
-* @brief Prints error message and exits program.
+* @brief Resize session's packet buffer to fit negotiated blksize.
 *
-* @param message Error message.
+* @param session Pointer to session.
+*
+* @return True on success, false if allocation failed.
+*/
+bool session_packet_alloc(Session_t *session);
+
+/**
+* @brief Close session's file and deallocate its buffers.
+*
+* @param session Pointer to session.
 *
 * @return void
 */
-void error_exit(const char *message);
+void session_close(Session_t *session);
 
 /**
-* @brief Parse port number from string.
+* @brief Allocate batch buffers.
 *
-* @param port_str String containing port number.
+* @param capacity Maximum number of datagrams per syscall.
 *
-* @return Port number.
+* @return Pointer to batch, NULL if allocation failed.
 */
-int parse_port(char *port_str);
+Batch_t *batch_create(int capacity);
 
 /**
-* @brief Display client's usage.
+* @brief Deallocate batch.
+*
+* @param batch Pointer to batch.
 *
 * @return void
 */
-void display_client_help();
+void batch_free(Batch_t *batch);
 
 /**
-* @brief Display server's usage.
+* @brief Receive all queued datagrams up to batch capacity with one non-blocking recvmmsg call.
 *
-* @return void
+* @param batch Pointer to batch.
+* @param socket Socket file descriptor.
+* @param size Maximum size of one datagram.
+*
+* @return Number of received datagrams, -1 on failure (errno is set, EAGAIN if nothing is queued).
 */
-void display_server_help();
+int batch_recv(Batch_t *batch, int socket, int size);
 
 /**
-* @brief Create unbouded socket.
+* @brief Get datagram received by batch_recv.
 *
-* @param port Port number.
-* @param addr Pointer to socket address.
+* @param batch Pointer to batch.
+* @param index Datagram index.
 *
-* @return Socket file descriptor.
+* @return Pointer to datagram.
 */
-int init_socket(int port, struct sockaddr_in *addr);
+char *batch_packet(Batch_t *batch, int index);
 
 /**
-* @brief Handle SIGINT signal.
+* @brief Map session's file for zero-copy sending and enable SO_ZEROCOPY on socket when supported.
 *
-* @param sig Signal number.
+* @param session Pointer to session.
+* @param socket Socket DATA packets are sent from.
+*
+* @return True if file was mapped, false otherwise (DATA is then read with pread).
+*/
+bool session_map_file(Session_t *session, int socket);
+
+/**
+* @brief Consume MSG_ZEROCOPY completion notifications queued on socket's error queue.
+*
+* @param session Pointer to session.
+* @param socket Socket file descriptor.
 *
 * @return void
 */
-void sigint_handler(int sig);
+void zerocopy_drain(Session_t *session, int socket);
 
 /**
-* @brief Set packet's opcode.
+* @brief Get monotonic time.
 *
-* @param opcode Opcode to be set.
-* @param packet Pointer to packet.
+* @return Time in microseconds.
+*/
+long time_now();
+
+/**
+* @brief Get retransmission timeout, negotiated timeout or utimeout option takes precedence over estimated RTO.
+*
+* @param session Pointer to session.
+*
+* @return Timeout in microseconds.
+*/
+long timer_timeout(Session_t *session);
+
+/**
+* @brief Start timing newly sent packet or window and arm the timer.
+*
+* @param session Pointer to session.
 *
 * @return void
 */
-void opcode_set(int opcode, char *packet);
+void timer_start(Session_t *session);
 
 /**
-* @brief Get packet's opcode.
+* @brief Push timer deadline after activity without taking RTT sample.
 *
-* @param packet Pointer to packet.
+* @param session Pointer to session.
 *
-* @return Packet's opcode.
+* @return void
 */
-int opcode_get(char *packet);
+void timer_arm(Session_t *session);
 
 /**
-* @brief Set packet's file name.
+* @brief Handle acknowledged progress, update RTT estimate, end backoff of timeout and reset retries.
 *
-* @param file_name File name to be set.
-* @param packet Pointer to packet.
+* @param session Pointer to session.
 *
 * @return void
 */
-void file_name_set(char *file_name, char *packet);
+void timer_ack(Session_t *session);
 
 /**
-* @brief Get packet's file name.
+* @brief Handle expired timer, back off RTO and re-arm for retransmission.
 *
-* @param packet Pointer to packet.
+* @param session Pointer to session.
 *
-* @return Packet's file name.
+* @return True if packet should be retransmitted, false if retries are exhausted.
 */
-char *file_name_get(char *packet);
+bool timer_retry(Session_t *session);
 
 /**
-* @brief Set packet's mode.
+* @brief Stop the timer.
 *
-* @param mode Mode to be set.
-* @param packet Pointer to packet.
+* @param session Pointer to session.
 *
 * @return void
 */
-void mode_set(int mode, char *packet);
+void timer_stop(Session_t *session);
 
 /**
-* @brief Get packet's mode.
+* @brief Wait until socket is readable or session's timer expires.
 *
-* @param packet Pointer to packet.
+* @param session Pointer to session.
+* @param socket Socket file descriptor.
 *
-* @return Packet's mode.
+* @return True if socket is readable, false if timer expired.
 */
-char *mode_get(char *packet);
+bool wait_for_packet(Session_t *session, int socket);
 
 /**
-* @brief Insert empty byte to packet.
+* @brief Prints error message and exits program.
 *
-* @param packet Pointer to packet.
+* @param message Error message.
 *
 * @return void
 */
-void empty_byte_insert(char *packet);
+void error_exit(const char *message);
 
 /**
-* @brief Set packet's block number.
+* @brief Parse port number from string.
 *
-* @param block_number Block number to be set.
-* @param packet Pointer to packet.
+* @param port_str String containing port number.
+*
+* @return Port number.
+*/
+int parse_port(char *port_str);
+
+/**
+* @brief Parse log verbosity level from string.
+*
+* @param level_str String containing level.
+*
+* @return Log level.
+*/
+int parse_log_level(char *level_str);
+
+/**
+* @brief Display client's usage.
 *
 * @return void
 */
-void block_number_set(int block_number, char *packet);
+void display_client_help();
 
 /**
-* @brief Get packet's block number.
+* @brief Display server's usage.
 *
-* @param packet Pointer to packet.
+* @return void
+*/
+void display_server_help();
+
+/**
+* @brief Display load generator's usage.
 *
-* @return Packet's block number.
+* @return void
 */
-int block_number_get(char *packet);
+void display_bench_help();
 
 /**
-* @brief Set packet's data.
+* @brief Display impairment proxy's usage.
 *
-* @param packet Pointer to packet.
-* @param file Pointer to file.
+* @return void
+*/
+void display_proxy_help();
+
+/**
+* @brief Display packet codec microbenchmark's usage.
 *
 * @return void
 */
-void data_set(char *packet, FILE *file);
+void display_codec_bench_help();
 
 /**
-* @brief Get packet's data.
+* @brief Create unbouded socket.
 *
-* @param packet Pointer to packet.
+* @param port Port number.
+* @param addr Pointer to socket address.
 *
-* @return Packet's data.
+* @return Socket file descriptor.
 */
-char *data_get(char *packet, int recvfrom_size);
+int init_socket(int port, struct sockaddr_in *addr);
 
 /**
-* @brief Set packet's error code.
+* @brief Handle SIGINT signal.
 *
-* @param error_code Error code to be set.
-* @param packet Pointer to packet.
+* @param sig Signal number.
 *
 * @return void
 */
-void error_code_set(int error_code, char *packet);
+void sigint_handler(int sig);
 
 /**
-* @brief Get packet's error code.
+* @brief Get packet's opcode.
 *
+* @param session Pointer to session.
 * @param packet Pointer to packet.
 *
-* @return Packet's error code.
+* @return Packet's opcode.
 */
-int error_code_get(char *packet);
+int opcode_get(Session_t *session, char *packet);
 
 /**
-* @brief Set packet's error message.
+* @brief Get packet's block number.
 *
-* @param error_msg Error message to be set.
+* @param session Pointer to session.
 * @param packet Pointer to packet.
 *
-* @return void
+* @return Packet's block number (16 bits as on the wire).
 */
-void error_msg_set(char *error_msg, char *packet);
+int block_number_get(Session_t *session, char *packet);
 
 /**
-* @brief Get packet's error message.
+* @brief Map 16-bit block number from packet to the first block at or after base with the same low 16 bits.
 *
-* @param packet Pointer to packet.
+* @param base Lowest block number the packet may refer to.
+* @param block_number Block number from packet.
+*
+* @return Block number counted from the start of transfer.
+*/
+long block_number_unwrap(long base, int block_number);
+
+/**
+* @brief Get file offset of block, blocks of resumed transfer start at negotiated offset.
+*
+* @param session Pointer to session.
+* @param block_number Block number.
+*
+* @return Offset of block's first byte.
+*/
+off_t block_offset(Session_t *session, long block_number);
+
+/**
+* @brief Get maximum size of block, blocks of byte range end with the range.
+*
+* @param session Pointer to session.
+* @param block_number Block number.
+*
+* @return Blksize, or less for block at end of range.
+*/
+long block_length(Session_t *session, long block_number);
+
+/**
+* @brief Read one block of session's file at its block_offset.
+*
+* @param session Pointer to session.
+* @param block_number Block number.
+* @param buffer Buffer of at least blksize bytes.
+*
+* @return Number of bytes read, less than blksize for last block, -1 on failure.
+*/
+long block_read(Session_t *session, long block_number, char *buffer);
+
+/**
+* @brief Write one block to session's file at its block_offset, netascii blocks are decoded and
+*        appended, so they have to be written in order.
 *
-* @return Packet's error message.
+* @param session Pointer to session.
+* @param block_number Block number.
+* @param buffer Block data.
+* @param size Size of block data.
+*
+* @return True on success, false otherwise.
 */
-char *error_msg_get(char *packet);
+bool block_write(Session_t *session, long block_number, char *buffer, long size);
 
 /**
 * @brief Set packet option's flag, value and order.
 *
+* @param session Pointer to session.
 * @param type Option type.
 * @param value Option value.
 * @param order Option order.
 * @param opcode Opcode.
 *
+* @return True if value is valid for option, false otherwise (see session_error_set).
+*/
+bool option_set(Session_t *session, int type, long int value, int order, int opcode);
+
+/**
+* @brief Decline requested option, options requested after it move one place forward.
+*
+* @param session Pointer to session.
+* @param type Option type.
+*
 * @return void
 */
-void option_set(int type, long int value, int order, int opcode);
+void option_clear(Session_t *session, int type);
 
 /**
 * @brief Get packet option's type.
@@ -308,29 +610,32 @@ int option_get_type(char *name);
 /**
 * @brief Get packet option's value.
 *
+* @param session Pointer to session.
 * @param type Option type.
 *
 * @return Option value.
 */
-long int option_get_value(int type);
+long int option_get_value(Session_t *session, int type);
 
 /**
 * @brief Get packet option's order.
 *
+* @param session Pointer to session.
 * @param type Option type.
 *
 * @return Option order.
 */
-int option_get_order(int type);
+int option_get_order(Session_t *session, int type);
 
 /**
 * @brief Get packet option's flag.
 *
+* @param session Pointer to session.
 * @param type Option type.
 *
 * @return Option flag.
 */
-bool option_get_flag(int type);
+bool option_get_flag(Session_t *session, int type);
 
 /**
 * @brief Get packet option's string name.
@@ -342,165 +647,274 @@ bool option_get_flag(int type);
 char *option_get_name(int type);
 
 /**
-* @brief Load options from packet.
+* @brief Load options of parsed request or OACK.
 *
-* @param packet Pointer to packet.
+* @param session Pointer to session.
+* @param packet Pointer to parsed packet.
+* @param opcode Opcode of packet.
+*
+* @return True if all options are valid, false otherwise (see session_error_set).
+*/
+bool options_load(Session_t *session, Packet_t *packet, int opcode);
+
+/**
+* @brief Clear all option flags and restore default option values.
 *
+* @param session Pointer to session.
 * @return void
 */
-void options_load(char *packet, int opcode);
+void options_reset(Session_t *session);
 
 /**
-* @brief Set options in packet.
+* @brief Get largest blksize whose DATA packets are not fragmented on the way to address, probed with throwaway
+*        socket, used by client before it has a transfer socket.
 *
-* @param packet Pointer to packet.
+* @param addr Destination address.
+*
+* @return Blksize derived from path MTU (IP_MTU of connected socket), -1 if MTU is unknown.
+*/
+long blksize_path_max(struct sockaddr_in *addr);
+
+/**
+* @brief Lower requested blksize so that DATA packets to address are not fragmented, path MTU is read from transfer
+*        socket connected to client for a moment.
+*
+* @param session Pointer to session with loaded request options.
+* @param socket Transfer socket nothing was sent from yet, it is left unconnected.
+* @param addr Client address.
 *
 * @return void
 */
-void options_set(char *packet);
+void blksize_path_cap(Session_t *session, int socket, struct sockaddr_in *addr);
+
+/**
+* @brief Store error that should be reported back for the rejected request.
+*
+* @param session Pointer to session.
+* @param error_code TFTP error code.
+* @param error_msg Error message.
+*
+* @return Always false, so callers can return it directly.
+*/
+bool session_error_set(Session_t *session, int error_code, char *error_msg);
+
+/**
+* @brief Append options to packet in order they were requested.
+*
+* @param session Pointer to session.
+* @param packet Pointer to packet.
+* @param capacity Size of packet buffer.
+* @param pos Size of packet so far.
+*
+* @return New size of packet, -1 if options do not fit.
+*/
+int options_set(Session_t *session, char *packet, int capacity, int pos);
 
 /**
 * @brief Handle request packet.
 *
+* @param session Pointer to session.
 * @param packet Pointer to packet.
+* @param size Size of received packet.
+* @param request Pointer to store parsed request, its strings point into packet.
 *
-* @return void
+* @return True if request is valid, false otherwise (see session_error_set).
 */
-void handle_request_packet(char *packet);
+bool handle_request_packet(Session_t *session, char *packet, int size, Packet_t *request);
 
 /**
 * @brief Send request packet.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
 * @param dest_addr Destination address.
 * @param opcode Opcode.
 * @param file_name File name.
 *
-* @return void
+* @return True if request fits into packet, false otherwise (see session_error_set).
 */
-void send_request_packet(int socket, struct sockaddr_in dest_addr, int opcode, char * file_name);
+bool send_request_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, int opcode, char * file_name);
 
 /**
-* @brief Handle ack packet.
+* @brief Handle ack packet, acknowledged block becomes start of the next window.
 *
+* @param session Pointer to session.
 * @param packet Pointer to packet.
-* @param expected_block_number Expected block number.
 *
-* @return void
+* @return True if ACK acknowledges block inside current window, false if it should be ignored.
 */
-void handle_ack_packet(char *packet, int expected_block_number);
+bool handle_ack_packet(Session_t *session, char *packet);
 
 /**
 * @brief Send ack packet.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
 * @param dest_addr Destination address.
 * @param block_number Block number.
 *
 * @return void
 */
-void send_ack_packet(int socket, struct sockaddr_in dest_addr, int block_number);
+void send_ack_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, long block_number);
 
 /**
-* @brief Handle oack packet.
+* @brief Handle oack packet and replace requested options by negotiated ones.
 *
+* @param session Pointer to session.
 * @param packet Pointer to packet.
+* @param size Size of received packet.
 *
-* @return void
+* @return True if server acknowledged only requested options with valid values, false otherwise.
 */
-void handle_oack_packet(char *packet);
+bool handle_oack_packet(Session_t *session, char *packet, int size);
 
 /**
-* @brief Send oack packet.
+* @brief Send oack packet, ERROR is sent instead when acknowledged options do not fit into it.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
 * @param dest_addr Destination address.
 *
-* @return void
+* @return True if OACK was sent, false if ERROR was sent and transfer has to end.
+*/
+bool send_oack_packet(Session_t *session, int socket, struct sockaddr_in dest_addr);
+
+/**
+* @brief Decide whether out of order block is acknowledged, receiver sends one ACK per gap (RFC 7440).
+*
+* All blocks after a lost one in the same window are out of order, only the first of them is acknowledged. The same
+* block is acknowledged again after half a round trip, window restarted by the first ACK cannot come sooner, so a
+* gap in it does not wait for timeout.
+*
+* @param session Pointer to session.
+*
+* @return True if last in-order block should be acknowledged now.
 */
-void send_oack_packet(int socket, struct sockaddr_in dest_addr);
+bool gap_ack_needed(Session_t *session);
 
 /**
-* @brief Handle data packet.
+* @brief Handle data packet, in-order block is written to session's file.
 *
+* @param session Pointer to session.
 * @param packet Pointer to packet.
-* @param expected_block_number Expected block number.
-* @param file Pointer to file.
+* @param recvfrom_size Size of received packet.
 *
-* @return True if last packet, false otherwise.
+* @return True if block_number should be acknowledged now (window full, last block or gap), false otherwise.
+*         Caller is expected to send the ACK right away, its RTT is timed. When block cannot be written,
+*         false is returned and session's error_msg is set.
 */
-void handle_data_packet(char *packet, int expected_block_number, FILE *file, int recvfrom_size);
+bool handle_data_packet(Session_t *session, char *packet, int recvfrom_size);
+
+/**
+* @brief Build DATA packet, payload is read into buffer after header or referenced in file mapping.
+*
+* @param session Pointer to session.
+* @param block_number Block number.
+* @param buffer Buffer of at least blksize + 4 bytes.
+* @param iov Two iovecs filled with header and payload.
+*
+* @return Payload size, -1 if file could not be read.
+*/
+long data_packet_build(Session_t *session, long block_number, char *buffer, struct iovec *iov);
 
 /**
 * @brief Send data packet.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
 * @param dest_addr Destination address.
 * @param block_number Block number.
-* @param file Pointer to file.
 *
-* @return True if last packet, false otherwise.
+* @return True if packet was sent, false if file could not be read. Session's last flag is set by last packet.
 */
-bool send_data_packet(int socket, struct sockaddr_in dest_addr, int block_number, FILE *file);
+bool send_data_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, long block_number);
 
 /**
-* @brief Send error packet.
+* @brief Send window of DATA packets following last acknowledged block.
+*
+* If some blocks after block_number were already sent, they are retransmitted. Every block is read at its own
+* offset, so nothing has to be rewound.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
 * @param dest_addr Destination address.
-* @param error_code Error code.
-* @param error_msg Error message.
 *
-* @return void
+* @return True on success, false if a block could not be read.
 */
-void send_error_packet(int socket, struct sockaddr_in dest_addr, int error_code, char *error_msg);
+bool send_window(Session_t *session, int socket, struct sockaddr_in dest_addr);
 
 /**
-* @brief Display received packet in a formatted way.
+* @brief Send error packet, transfer is not terminated.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
-* @param source_addr Source address.
-* @param packet Pointer to packet.
+* @param dest_addr Destination address.
+* @param error_code Error code.
+* @param error_msg Error message.
 *
 * @return void
 */
-void display_message(int socket, struct sockaddr_in source_addr, char *packet);
+void send_error_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, int error_code, char *error_msg);
 
 /**
-* @brief Display options in a formatted way.
+* @brief Queue received packet to log if its level is enabled, it is formatted and printed by log writer.
 *
+* @param session Pointer to session.
+* @param socket Socket file descriptor.
+* @param source_addr Source address.
 * @param packet Pointer to packet.
+* @param size Size of packet.
 *
 * @return void
 */
-void display_options(char *packet);
+void display_message(Session_t *session, int socket, struct sockaddr_in source_addr, char *packet, int size);
 
 /**
 * @brief Construct full path to file and open it correctly.
 *
+* @param session Pointer to session.
 * @param socket Socket file descriptor.
-* @param packet Pointer to packet.
+* @param request Pointer to validated request.
 * @param dir_path Directory path.
 * @param source_addr Source address.
 *
-* @return Pointer to file.
+* @return Pointer to file, NULL if request was rejected (error packet was already sent).
 */
-FILE *open_file(int socket, char *packet, char *dir_path, struct sockaddr_in source_addr);
+FILE *open_file(Session_t *session, int socket, Packet_t *request, char *dir_path, struct sockaddr_in source_addr);
+
+long check_memory(char *dir_path);
+
+long check_file_size(char * file_name);
 
 /**
-* @brief Strlen with maximum length.
+* @brief Get size of opened file.
 *
-* @param s String.
-* @param maxlen Maximum length.
+* @param file Pointer to file.
 *
-* @return String length.
+* @return File size, -1 on failure.
 */
-size_t strnlen(const char *s, size_t maxlen);
-
-long check_memory(char *dir_path);
+long file_size_get(FILE *file);
 
-long check_file_size(char * file_name);
+/**
+* @brief Update CRC32C (Castagnoli) with data, SSE4.2 instruction is used when CPU has it.
+*
+* @param crc CRC of preceding data, 0 at start.
+* @param buffer Data.
+* @param size Size of data.
+*
+* @return Updated CRC.
+*/
+uint32_t crc32c_update(uint32_t crc, const char *buffer, long size);
 
-void string_to_lower(char *str);
+/**
+* @brief Compute CRC32C of the last OFFSET_CRC_WINDOW bytes (or fewer at start of file) before offset.
+*
+* @param fd File descriptor.
+* @param end Offset the checked bytes end at.
+* @param crc Pointer to store CRC.
+*
+* @return True on success, false if file is shorter or cannot be read.
+*/
+bool file_tail_crc(int fd, long end, uint32_t *crc);
 
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,241 @@
+//
+// File: cache.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of shared block cache of served files.
+//
+
+#include "../include/cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+* @brief Compare two cache keys.
+*
+* @param a Pointer to first key.
+* @param b Pointer to second key.
+*
+* @return True if both keys identify the same file version.
+*/
+static bool cache_key_equal(CacheKey_t *a, CacheKey_t *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+/**
+* @brief Get hash bucket of file chunk.
+*
+* @param cache Pointer to cache.
+* @param key Key of file version.
+* @param chunk Chunk index.
+*
+* @return Bucket index.
+*/
+static int cache_bucket(Cache_t *cache, CacheKey_t *key, long chunk) {
+    unsigned long hash = 14695981039346656037UL;
+    unsigned long parts[] = { key->dev, key->ino, key->size, key->mtime.tv_sec, key->mtime.tv_nsec, chunk };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        hash = (hash ^ parts[i]) * 1099511628211UL;
+    }
+    return (int)(hash % cache->bucket_count);
+}
+
+/**
+* @brief Lock cache, lock held by a crashed process is taken over.
+*
+* @param cache Pointer to cache.
+*
+* @return void
+*/
+static void cache_lock(Cache_t *cache) {
+    // Owner died in the middle of update, bucket chains may be broken, so cache is emptied.
+    if (pthread_mutex_lock(&cache->lock) == EOWNERDEAD) {
+        memset(cache->buckets, 0xff, cache->bucket_count * sizeof(int));
+        memset(cache->slots, 0, cache->slot_count * sizeof(CacheSlot_t));
+        pthread_mutex_consistent(&cache->lock);
+    }
+}
+
+/**
+* @brief Find cached chunk, cache lock must be held.
+*
+* @param cache Pointer to cache.
+* @param key Key of file version.
+* @param chunk Chunk index.
+*
+* @return Slot index, -1 if chunk is not cached.
+*/
+static int cache_lookup(Cache_t *cache, CacheKey_t *key, long chunk) {
+    for (int i = cache->buckets[cache_bucket(cache, key, chunk)]; i >= 0; i = cache->slots[i].next) {
+        if (cache->slots[i].chunk == chunk && cache_key_equal(&cache->slots[i].key, key)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+* @brief Unlink slot from its hash bucket, cache lock must be held.
+*
+* @param cache Pointer to cache.
+* @param index Slot index.
+*
+* @return void
+*/
+static void cache_unlink(Cache_t *cache, int index) {
+    CacheSlot_t *slot = &cache->slots[index];
+    int *link = &cache->buckets[cache_bucket(cache, &slot->key, slot->chunk)];
+    while (*link != index) {
+        link = &cache->slots[*link].next;
+    }
+    *link = slot->next;
+    slot->used = false;
+}
+
+/**
+* @brief Pick slot for new chunk with clock algorithm, cache lock must be held.
+*
+* @param cache Pointer to cache.
+*
+* @return Free slot index.
+*/
+static int cache_evict(Cache_t *cache) {
+    while (true) {
+        int index = cache->hand;
+        CacheSlot_t *slot = &cache->slots[index];
+        cache->hand = (cache->hand + 1) % cache->slot_count;
+        if (!slot->used) {
+            return index;
+        }
+        // Recently used chunk gets second chance.
+        if (slot->referenced) {
+            slot->referenced = false;
+            continue;
+        }
+        cache_unlink(cache, index);
+        return index;
+    }
+}
+
+Cache_t *cache_create(long budget) {
+    long slot_count = budget / CACHE_CHUNK_SIZE;
+    if (slot_count < 1) {
+        return NULL;
+    }
+    long bucket_count = slot_count * 2;
+    size_t header_size = (sizeof(Cache_t) + 63) & ~63UL;
+    size_t buckets_size = (bucket_count * sizeof(int) + 63) & ~63UL;
+    size_t slots_size = (slot_count * sizeof(CacheSlot_t) + 4095) & ~4095UL;
+    size_t total = header_size + buckets_size + slots_size + slot_count * CACHE_CHUNK_SIZE;
+
+    // Shared anonymous mapping created before fork is visible at the same address in all children.
+    char *memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    Cache_t *cache = (Cache_t *)memory;
+    cache->slot_count = slot_count;
+    cache->bucket_count = bucket_count;
+    cache->hand = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->buckets = (int *)(memory + header_size);
+    cache->slots = (CacheSlot_t *)(memory + header_size + buckets_size);
+    cache->data = memory + header_size + buckets_size + slots_size;
+    memset(cache->buckets, 0xff, bucket_count * sizeof(int));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&cache->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return cache;
+}
+
+bool cache_key_set(CacheKey_t *key, int fd) {
+    struct stat status;
+    if (fstat(fd, &status) < 0) {
+        return false;
+    }
+    memset(key, 0, sizeof(CacheKey_t));
+    key->dev = status.st_dev;
+    key->ino = status.st_ino;
+    key->size = status.st_size;
+    key->mtime = status.st_mtim;
+    return true;
+}
+
+long cache_read(Cache_t *cache, CacheKey_t *key, int fd, char *buffer, off_t offset, long size) {
+    char chunk_data[CACHE_CHUNK_SIZE];
+    long done = 0;
+
+    if (offset + size > key->size) {
+        size = offset >= key->size ? 0 : key->size - offset;
+    }
+    while (done < size) {
+        long chunk = (offset + done) / CACHE_CHUNK_SIZE;
+        long chunk_offset = (offset + done) % CACHE_CHUNK_SIZE;
+        long length = CACHE_CHUNK_SIZE - chunk_offset < size - done ? CACHE_CHUNK_SIZE - chunk_offset : size - done;
+        int index;
+
+        cache_lock(cache);
+        if ((index = cache_lookup(cache, key, chunk)) >= 0 && cache->slots[index].size >= chunk_offset + length) {
+            cache->slots[index].referenced = true;
+            cache->hits++;
+            memcpy(buffer + done, cache->data + (long)index * CACHE_CHUNK_SIZE + chunk_offset, length);
+            pthread_mutex_unlock(&cache->lock);
+            done += length;
+            continue;
+        }
+        cache->misses++;
+        pthread_mutex_unlock(&cache->lock);
+
+        // Whole chunk is read without holding the lock, so slow disk does not stall other transfers.
+        long chunk_size = 0;
+        long expected = key->size - chunk * CACHE_CHUNK_SIZE < CACHE_CHUNK_SIZE ? key->size - chunk * CACHE_CHUNK_SIZE : CACHE_CHUNK_SIZE;
+        while (chunk_size < expected) {
+            ssize_t result = pread(fd, chunk_data + chunk_size, expected - chunk_size, chunk * CACHE_CHUNK_SIZE + chunk_size);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0) {
+                return -1;
+            }
+            if (result == 0) {
+                break;
+            }
+            chunk_size += result;
+        }
+        // File shrank under us, cache nothing and return what is there.
+        if (chunk_size < chunk_offset + length) {
+            length = chunk_size > chunk_offset ? chunk_size - chunk_offset : 0;
+            memcpy(buffer + done, chunk_data + chunk_offset, length);
+            return done + length;
+        }
+        memcpy(buffer + done, chunk_data + chunk_offset, length);
+        done += length;
+
+        cache_lock(cache);
+        // Another transfer may have inserted the same chunk meanwhile.
+        if (cache_lookup(cache, key, chunk) < 0) {
+            index = cache_evict(cache);
+            CacheSlot_t *slot = &cache->slots[index];
+            slot->key = *key;
+            slot->chunk = chunk;
+            slot->size = chunk_size;
+            slot->used = true;
+            slot->referenced = false;
+            int bucket = cache_bucket(cache, key, chunk);
+            slot->next = cache->buckets[bucket];
+            cache->buckets[bucket] = index;
+            memcpy(cache->data + (long)index * CACHE_CHUNK_SIZE, chunk_data, chunk_size);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    return done;
+}
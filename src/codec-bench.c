@@ -0,0 +1,323 @@
+//
+// File: codec-bench.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of packet codec microbenchmark, parser is first run on every truncation of sample
+//              packets and on random malformed packets, then its parse rate is measured per packet type.
+//
+
+#include "../include/codec-bench.h"
+
+// State of xorshift generator of malformed packets.
+static unsigned long rng_state;
+
+// Parse results are summed here, so parsing cannot be optimized out.
+static volatile long sink;
+
+/**
+* @brief Get next pseudo random number.
+*
+* @return Random number.
+*/
+static unsigned long codec_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/**
+* @brief Check that string view lies inside packet and is terminated inside it.
+*
+* @param string String view.
+* @param buffer Packet.
+* @param size Size of packet.
+*
+* @return True if string is inside packet.
+*/
+static bool codec_string_inside(char *string, char *buffer, int size) {
+    return string >= buffer && string < buffer + size && memchr(string, '\0', buffer + size - string) != NULL;
+}
+
+/**
+* @brief Check that every view of successfully parsed packet lies inside packet.
+*
+* @param buffer Packet.
+* @param size Size of packet.
+* @param packet Parsed packet.
+* @param result Parse result.
+*
+* @return True if parse result is consistent with packet.
+*/
+static bool codec_check(char *buffer, int size, Packet_t *packet, int result) {
+    if (result != CODEC_OK) {
+        return result == CODEC_TRUNCATED || result == CODEC_UNTERMINATED || result == CODEC_BAD_OPCODE ||
+               result == CODEC_TOO_MANY_OPTIONS;
+    }
+    if (packet->num_options < 0 || packet->num_options > CODEC_OPTIONS_MAX) {
+        return false;
+    }
+    switch (packet->opcode) {
+        case RRQ:
+        case WRQ:
+            if (!codec_string_inside(packet->file_name, buffer, size) || !codec_string_inside(packet->mode, buffer, size)) {
+                return false;
+            }
+            // fall through
+        case OACK:
+            for (int i = 0; i < packet->num_options; i++) {
+                if (!codec_string_inside(packet->options[i].name, buffer, size) ||
+                    !codec_string_inside(packet->options[i].value, buffer, size)) {
+                    return false;
+                }
+            }
+            return true;
+        case DATA:
+            return size >= OPCODE_SIZE + BLOCK_NUMBER_SIZE && packet->data == buffer + OPCODE_SIZE + BLOCK_NUMBER_SIZE &&
+                   packet->data + packet->data_size == buffer + size;
+        case ACK:
+            return size >= OPCODE_SIZE + BLOCK_NUMBER_SIZE;
+        case ERROR:
+            return codec_string_inside(packet->error_msg, buffer, size);
+        default:
+            return false;
+    }
+}
+
+/**
+* @brief Parse copy of packet in buffer of exactly its size, so reads past its end hit unmapped or poisoned memory.
+*
+* @param buffer Packet.
+* @param size Size of packet.
+* @param rejected Pointer to number of rejected packets.
+*
+* @return True if parse result is consistent with packet.
+*/
+static bool codec_validate(char *buffer, int size, long *rejected) {
+    Packet_t packet;
+    char *copy = malloc(size > 0 ? size : 1);
+    bool valid;
+    int result;
+    if (copy == NULL) {
+        error_exit("Packet malloc failed.");
+    }
+    memcpy(copy, buffer, size);
+    result = packet_parse(copy, size, &packet);
+    valid = codec_check(copy, size, &packet, result);
+    *rejected += result != CODEC_OK;
+    free(copy);
+    return valid;
+}
+
+/**
+* @brief Build sample packets, one per packet type.
+*
+* @param samples Array of at least six samples.
+*
+* @return Number of samples.
+*/
+static int codec_samples_build(CodecSample_t *samples) {
+    CodecSample_t *sample = samples;
+    int pos;
+
+    sample->name = "rrq";
+    pos = packet_build_request(sample->packet, CODEC_BENCH_PACKET_MAX, RRQ, "images/boot/vmlinuz", "octet");
+    pos = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, BLKSIZE_NAME, "1468");
+    pos = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, TSIZE_NAME, "0");
+    pos = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, TIMEOUT_NAME, "2");
+    sample->size = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, WINDOWSIZE_NAME, "16");
+    sample++;
+
+    sample->name = "wrq";
+    pos = packet_build_request(sample->packet, CODEC_BENCH_PACKET_MAX, WRQ, "upload.txt", "netascii");
+    sample->size = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, TSIZE_NAME, "1048576");
+    sample++;
+
+    sample->name = "data";
+    pos = packet_build_data(sample->packet, CODEC_BENCH_PACKET_MAX, 42);
+    memset(sample->packet + pos, 'x', DEFAULT_DATA_SIZE);
+    sample->size = pos + DEFAULT_DATA_SIZE;
+    sample++;
+
+    sample->name = "ack";
+    sample->size = packet_build_ack(sample->packet, CODEC_BENCH_PACKET_MAX, 42);
+    sample++;
+
+    sample->name = "oack";
+    pos = packet_put_u16(sample->packet, CODEC_BENCH_PACKET_MAX, 0, OACK);
+    pos = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, BLKSIZE_NAME, "1468");
+    pos = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, TSIZE_NAME, "123456");
+    sample->size = packet_put_option(sample->packet, CODEC_BENCH_PACKET_MAX, pos, WINDOWSIZE_NAME, "16");
+    sample++;
+
+    sample->name = "error";
+    sample->size = packet_build_error(sample->packet, CODEC_BENCH_PACKET_MAX, ERR_FILE_NOT_FOUND, "File not found.");
+    sample++;
+
+    return sample - samples;
+}
+
+/**
+* @brief Check that complete samples parse into the fields they were built from.
+*
+* @param samples Array of samples.
+*
+* @return Number of mismatching samples.
+*/
+static int codec_samples_check(CodecSample_t *samples) {
+    Packet_t packet;
+    int failures = 0;
+    if (packet_parse(samples[0].packet, samples[0].size, &packet) != CODEC_OK || packet.opcode != RRQ ||
+        strcmp(packet.file_name, "images/boot/vmlinuz") != 0 || strcmp(packet.mode, "octet") != 0 || packet.num_options != 4 ||
+        strcmp(packet.options[3].name, WINDOWSIZE_NAME) != 0 || strcmp(packet.options[3].value, "16") != 0) {
+        failures++;
+    }
+    if (packet_parse(samples[1].packet, samples[1].size, &packet) != CODEC_OK || packet.opcode != WRQ ||
+        strcmp(packet.mode, "netascii") != 0 || packet.num_options != 1) {
+        failures++;
+    }
+    if (packet_parse(samples[2].packet, samples[2].size, &packet) != CODEC_OK || packet.opcode != DATA ||
+        packet.block_number != 42 || packet.data_size != DEFAULT_DATA_SIZE) {
+        failures++;
+    }
+    if (packet_parse(samples[3].packet, samples[3].size, &packet) != CODEC_OK || packet.opcode != ACK || packet.block_number != 42) {
+        failures++;
+    }
+    if (packet_parse(samples[4].packet, samples[4].size, &packet) != CODEC_OK || packet.opcode != OACK || packet.num_options != 3 ||
+        strcmp(packet.options[1].value, "123456") != 0) {
+        failures++;
+    }
+    if (packet_parse(samples[5].packet, samples[5].size, &packet) != CODEC_OK || packet.opcode != ERROR ||
+        packet.error_code != ERR_FILE_NOT_FOUND || strcmp(packet.error_msg, "File not found.") != 0) {
+        failures++;
+    }
+    return failures;
+}
+
+/**
+* @brief Measure parse rate of sample.
+*
+* @param sample Pointer to sample.
+* @param packets Number of parsed packets.
+*
+* @return Elapsed time in nanoseconds.
+*/
+static long codec_measure(CodecSample_t *sample, long packets) {
+    struct timespec start, end;
+    Packet_t packet;
+    long sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < packets; i++) {
+        sum += packet_parse(sample->packet, sample->size, &packet) + packet.num_options;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sink += sum;
+    return (end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec;
+}
+
+/**
+*
+* @brief Main function of packet codec microbenchmark.
+*
+* @param argc Number of command line arguments.
+* @param argv Command line arguments array.
+*
+* @return Program exit code, failure if parser accepted inconsistent packet.
+*
+*/
+int main(int argc, char *argv[]) {
+    CodecBenchArgs_t codec_args;
+    CodecSample_t samples[6];
+    char buffer[CODEC_BENCH_PACKET_MAX];
+    long validated = 0, rejected = 0, elapsed;
+    int num_samples, failures, size;
+
+    init_args(&codec_args);
+    parse_args(argc, argv, &codec_args);
+    rng_state = codec_args.seed;
+
+    num_samples = codec_samples_build(samples);
+    failures = codec_samples_check(samples);
+    // Every truncation of every sample.
+    for (int i = 0; i < num_samples; i++) {
+        for (size = 0; size <= samples[i].size; size++) {
+            failures += !codec_validate(samples[i].packet, size, &rejected);
+            validated++;
+        }
+    }
+    // Random packets, half are mutated samples and half are random bytes behind valid opcode.
+    for (long i = 0; i < codec_args.fuzz; i++) {
+        if (i % 2 == 0) {
+            CodecSample_t *sample = &samples[codec_random() % num_samples];
+            size = codec_random() % (sample->size + 1);
+            memcpy(buffer, sample->packet, size);
+            for (int flips = codec_random() % 4; flips > 0 && size > 0; flips--) {
+                buffer[codec_random() % size] = codec_random() % 3 == 0 ? '\0' : (char)codec_random();
+            }
+        }
+        else {
+            size = codec_random() % (CODEC_BENCH_PACKET_MAX + 1);
+            for (int j = 0; j < size; j++) {
+                buffer[j] = codec_random() % 4 == 0 ? '\0' : (char)codec_random();
+            }
+            if (size >= OPCODE_SIZE) {
+                codec_put_u16(buffer, codec_random() % 8);
+            }
+        }
+        failures += !codec_validate(buffer, size, &rejected);
+        validated++;
+    }
+
+    printf("{\"validated\":%ld,\"rejected\":%ld,\"failures\":%d,\"packets\":%ld", validated, rejected, failures, codec_args.packets);
+    for (int i = 0; i < num_samples; i++) {
+        elapsed = codec_measure(&samples[i], codec_args.packets);
+        printf(",\"%s_ns\":%.2f,\"%s_pps\":%.0f", samples[i].name, (double)elapsed / codec_args.packets, samples[i].name,
+               elapsed > 0 ? codec_args.packets * 1e9 / elapsed : 0);
+    }
+    printf("}\n");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void init_args(CodecBenchArgs_t *codec_args) {
+    codec_args->packets = CODEC_BENCH_PACKETS_DEFAULT;
+    codec_args->fuzz = CODEC_BENCH_FUZZ_DEFAULT;
+    codec_args->seed = CODEC_BENCH_SEED_DEFAULT;
+}
+
+void parse_args(int argc, char *argv[], CodecBenchArgs_t *codec_args) {
+    if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+        display_codec_bench_help();
+        exit(EXIT_SUCCESS);
+    }
+    int opt;
+    char *endptr = NULL;
+    while ((opt = getopt(argc, argv, "n:f:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                codec_args->packets = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || codec_args->packets < 1) {
+                    error_exit("Invalid number of packets.");
+                }
+                break;
+            case 'f':
+                codec_args->fuzz = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || codec_args->fuzz < 0) {
+                    error_exit("Invalid number of random packets.");
+                }
+                break;
+            case 's':
+                codec_args->seed = strtoul(optarg, &endptr, 10);
+                // Xorshift never leaves zero state.
+                if (*endptr != '\0' || codec_args->seed == 0) {
+                    error_exit("Invalid seed.");
+                }
+                break;
+            default:
+                error_exit("Invalid option.");
+        }
+    }
+    if (optind < argc) {
+        error_exit("Invalid number of arguments.");
+    }
+}
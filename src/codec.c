@@ -0,0 +1,177 @@
+//
+// File: codec.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of TFTP packet codec.
+//
+
+#include "../include/utils.h"
+
+/**
+* @brief Take NUL terminated string starting at position.
+*
+* @param buffer Packet.
+* @param size Size of packet.
+* @param pos Pointer to position, it is moved past the NUL byte.
+* @param string Pointer to store view of string.
+*
+* @return CODEC_OK or reason string is malformed.
+*/
+static int codec_string(char *buffer, int size, int *pos, char **string) {
+    char *end;
+    if (*pos >= size) {
+        return CODEC_TRUNCATED;
+    }
+    if ((end = memchr(buffer + *pos, '\0', size - *pos)) == NULL) {
+        return CODEC_UNTERMINATED;
+    }
+    *string = buffer + *pos;
+    *pos = end - buffer + 1;
+    return CODEC_OK;
+}
+
+/**
+* @brief Take option name and value pairs up to the end of packet.
+*
+* @param buffer Packet.
+* @param size Size of packet.
+* @param pos Position of first option name.
+* @param packet Pointer to parsed packet.
+*
+* @return CODEC_OK or reason options are malformed.
+*/
+static int codec_options(char *buffer, int size, int pos, Packet_t *packet) {
+    PacketOption_t *option;
+    int result;
+    while (pos < size) {
+        if (packet->num_options == CODEC_OPTIONS_MAX) {
+            return CODEC_TOO_MANY_OPTIONS;
+        }
+        option = &packet->options[packet->num_options];
+        if ((result = codec_string(buffer, size, &pos, &option->name)) != CODEC_OK) {
+            return result;
+        }
+        // Zero padding some implementations send after last option ends the list.
+        if (option->name[0] == '\0') {
+            break;
+        }
+        if ((result = codec_string(buffer, size, &pos, &option->value)) != CODEC_OK) {
+            return result;
+        }
+        packet->num_options++;
+    }
+    return CODEC_OK;
+}
+
+int packet_parse(char *buffer, int size, Packet_t *packet) {
+    int pos = OPCODE_SIZE;
+    int result;
+
+    packet->num_options = 0;
+    if (size < OPCODE_SIZE) {
+        return CODEC_TRUNCATED;
+    }
+    packet->opcode = codec_get_u16(buffer);
+    switch (packet->opcode) {
+        case RRQ:
+        case WRQ:
+            if ((result = codec_string(buffer, size, &pos, &packet->file_name)) != CODEC_OK ||
+                (result = codec_string(buffer, size, &pos, &packet->mode)) != CODEC_OK) {
+                return result;
+            }
+            return codec_options(buffer, size, pos, packet);
+        case DATA:
+            if (size < OPCODE_SIZE + BLOCK_NUMBER_SIZE) {
+                return CODEC_TRUNCATED;
+            }
+            packet->block_number = codec_get_u16(buffer + OPCODE_SIZE);
+            packet->data = buffer + OPCODE_SIZE + BLOCK_NUMBER_SIZE;
+            packet->data_size = size - OPCODE_SIZE - BLOCK_NUMBER_SIZE;
+            return CODEC_OK;
+        case ACK:
+            if (size < OPCODE_SIZE + BLOCK_NUMBER_SIZE) {
+                return CODEC_TRUNCATED;
+            }
+            packet->block_number = codec_get_u16(buffer + OPCODE_SIZE);
+            return CODEC_OK;
+        case ERROR:
+            if (size < OPCODE_SIZE + ERROR_CODE_SIZE) {
+                return CODEC_TRUNCATED;
+            }
+            packet->error_code = codec_get_u16(buffer + OPCODE_SIZE);
+            pos += ERROR_CODE_SIZE;
+            return codec_string(buffer, size, &pos, &packet->error_msg);
+        case OACK:
+            return codec_options(buffer, size, pos, packet);
+        default:
+            return CODEC_BAD_OPCODE;
+    }
+}
+
+char *codec_error_msg(int result) {
+    switch (result) {
+        case CODEC_OK:
+            return "Success.";
+        case CODEC_TRUNCATED:
+            return "Packet truncated.";
+        case CODEC_UNTERMINATED:
+            return "String not terminated.";
+        case CODEC_BAD_OPCODE:
+            return "Illegal TFTP operation.";
+        case CODEC_TOO_MANY_OPTIONS:
+            return "Too many options.";
+        default:
+            return "Malformed packet.";
+    }
+}
+
+int packet_put_u16(char *buffer, int capacity, int pos, long value) {
+    if (pos < 0 || pos + 2 > capacity) {
+        return -1;
+    }
+    codec_put_u16(buffer + pos, value);
+    return pos + 2;
+}
+
+int packet_put_string(char *buffer, int capacity, int pos, const char *string) {
+    int len;
+    if (pos < 0 || pos >= capacity) {
+        return -1;
+    }
+    len = strnlen(string, capacity - pos);
+    if (pos + len + 1 > capacity) {
+        return -1;
+    }
+    memcpy(buffer + pos, string, len + 1);
+    return pos + len + 1;
+}
+
+int packet_put_option(char *buffer, int capacity, int pos, const char *name, const char *value) {
+    return packet_put_string(buffer, capacity, packet_put_string(buffer, capacity, pos, name), value);
+}
+
+int packet_build_request(char *buffer, int capacity, int opcode, const char *file_name, const char *mode) {
+    int pos = packet_put_u16(buffer, capacity, 0, opcode);
+    return packet_put_string(buffer, capacity, packet_put_string(buffer, capacity, pos, file_name), mode);
+}
+
+int packet_build_ack(char *buffer, int capacity, long block_number) {
+    return packet_put_u16(buffer, capacity, packet_put_u16(buffer, capacity, 0, ACK), block_number);
+}
+
+int packet_build_data(char *buffer, int capacity, long block_number) {
+    return packet_put_u16(buffer, capacity, packet_put_u16(buffer, capacity, 0, DATA), block_number);
+}
+
+int packet_build_error(char *buffer, int capacity, int error_code, const char *error_msg) {
+    int pos = packet_put_u16(buffer, capacity, packet_put_u16(buffer, capacity, 0, ERROR), error_code);
+    int len;
+    if (pos < 0 || pos >= capacity) {
+        return -1;
+    }
+    len = strnlen(error_msg, capacity - pos - 1);
+    memcpy(buffer + pos, error_msg, len);
+    buffer[pos + len] = '\0';
+    return pos + len + 1;
+}
@@ -0,0 +1,318 @@
+//
+// File: compress.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of compressed transfers, LZ codec in the style of LZ4, files are compressed frame by
+//              frame as they are sent and decompressed block by block.
+//
+
+#include "../include/compress.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Shortest back reference, shorter repeats are cheaper as literals.
+#define LZ_MIN_MATCH 4
+// Lengths that do not fit into 4 bits of token continue in bytes of 255.
+#define LZ_RUN_MASK 15
+#define LZ_HASH_BITS 14
+// Search step grows by one every 2^LZ_SKIP_SHIFT bytes without match, incompressible data is skipped quickly.
+#define LZ_SKIP_SHIFT 5
+
+// Compressed files of this process, every frame holds one whole chunk except the last, so frames are the same for every reader.
+static EncodeCache_t compress_cache = {
+    .name = "compress", .encode = compress_frame, .chunk = COMPRESS_CHUNK,
+    .output_max = COMPRESS_HEADER + COMPRESS_CHUNK + COMPRESS_CHUNK / 255 + 16, .max = COMPRESS_CACHE_MAX
+};
+
+/**
+* @brief Read 32-bit value from unaligned address.
+*
+* @param data Pointer to data.
+*
+* @return Value in host byte order.
+*/
+static uint32_t lz_read32(const char *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/**
+* @brief Hash of 4 bytes, index to table of last positions (Knuth's multiplicative hash).
+*
+* @param sequence 4 bytes read as one value.
+*
+* @return Table index.
+*/
+static uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+* @brief Write length that did not fit into token as bytes of 255 and remainder.
+*
+* @param output Output buffer.
+* @param length Length minus LZ_RUN_MASK.
+*
+* @return Number of written bytes.
+*/
+static size_t lz_write_length(unsigned char *output, size_t length) {
+    size_t out = 0;
+    for (; length >= 255; length -= 255) {
+        output[out++] = 255;
+    }
+    output[out++] = length;
+    return out;
+}
+
+/**
+* @brief Write one sequence, literals followed by back reference, last sequence of data has literals only.
+*
+* @param output Output buffer.
+* @param literals Literal bytes.
+* @param literal_length Number of literal bytes.
+* @param offset Distance of match, 0 for last sequence.
+* @param match_length Length of match.
+*
+* @return Number of written bytes.
+*/
+static size_t lz_write_sequence(unsigned char *output, const char *literals, size_t literal_length, size_t offset, size_t match_length) {
+    unsigned char *token = output;
+    size_t out = 1;
+    size_t match_code = offset != 0 ? match_length - LZ_MIN_MATCH : 0;
+
+    *token = (literal_length < LZ_RUN_MASK ? literal_length : LZ_RUN_MASK) << 4;
+    if (literal_length >= LZ_RUN_MASK) {
+        out += lz_write_length(output + out, literal_length - LZ_RUN_MASK);
+    }
+    memcpy(output + out, literals, literal_length);
+    out += literal_length;
+    if (offset == 0) {
+        return out;
+    }
+    output[out++] = offset & 0xFF;
+    output[out++] = offset >> 8;
+    *token |= match_code < LZ_RUN_MASK ? match_code : LZ_RUN_MASK;
+    if (match_code >= LZ_RUN_MASK) {
+        out += lz_write_length(output + out, match_code - LZ_RUN_MASK);
+    }
+    return out;
+}
+
+size_t lz_compress(const char *input, size_t size, char *output) {
+    // Positions fit into 16 bits as input is at most one chunk, empty slot points to position 0 and is verified.
+    uint16_t table[1 << LZ_HASH_BITS];
+    unsigned char *out = (unsigned char *)output;
+    size_t in = 0, anchor = 0, written = 0, candidate, length;
+    uint32_t sequence, hash;
+
+    memset(table, 0, sizeof(table));
+    while (in + LZ_MIN_MATCH <= size) {
+        sequence = lz_read32(input + in);
+        hash = lz_hash(sequence);
+        candidate = table[hash];
+        table[hash] = in;
+        if (candidate >= in || lz_read32(input + candidate) != sequence) {
+            in += 1 + ((in - anchor) >> LZ_SKIP_SHIFT);
+            continue;
+        }
+        length = LZ_MIN_MATCH;
+        while (in + length < size && input[candidate + length] == input[in + length]) {
+            length++;
+        }
+        written += lz_write_sequence(out + written, input + anchor, in - anchor, in - candidate, length);
+        in += length;
+        anchor = in;
+    }
+    return written + lz_write_sequence(out + written, input + anchor, size - anchor, 0, 0);
+}
+
+/**
+* @brief Read length continuing in bytes of 255.
+*
+* @param input Compressed bytes.
+* @param size Number of compressed bytes.
+* @param in Pointer to position in input, advanced past length.
+* @param length Pointer to length, bytes are added to it.
+*
+* @return True on success, false if input ends inside length.
+*/
+static bool lz_read_length(const unsigned char *input, size_t size, size_t *in, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*in >= size) {
+            return false;
+        }
+        byte = input[(*in)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+long lz_decompress(const char *input, size_t size, char *output, size_t capacity) {
+    const unsigned char *data = (const unsigned char *)input;
+    size_t in = 0, out = 0, literal_length, match_length, offset;
+    unsigned char token;
+
+    while (in < size) {
+        token = data[in++];
+        literal_length = token >> 4;
+        if (literal_length == LZ_RUN_MASK && !lz_read_length(data, size, &in, &literal_length)) {
+            return -1;
+        }
+        if (literal_length > size - in || literal_length > capacity - out) {
+            return -1;
+        }
+        memcpy(output + out, data + in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        // Last sequence has no match.
+        if (in == size) {
+            break;
+        }
+        if (size - in < 2) {
+            return -1;
+        }
+        offset = data[in] | data[in + 1] << 8;
+        in += 2;
+        match_length = token & LZ_RUN_MASK;
+        if (match_length == LZ_RUN_MASK && !lz_read_length(data, size, &in, &match_length)) {
+            return -1;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || match_length > capacity - out) {
+            return -1;
+        }
+        // Overlapping match repeats its own output, it is copied byte by byte.
+        if (offset >= match_length) {
+            memcpy(output + out, output + out - offset, match_length);
+            out += match_length;
+        }
+        else {
+            for (size_t i = 0; i < match_length; i++, out++) {
+                output[out] = output[out - offset];
+            }
+        }
+    }
+    return out;
+}
+
+size_t compress_frame(const char *input, size_t size, char *output) {
+    size_t payload = lz_compress(input, size, output + COMPRESS_HEADER);
+    uint32_t header;
+    if (payload >= size) {
+        memcpy(output + COMPRESS_HEADER, input, size);
+        payload = size;
+        header = size | COMPRESS_STORED;
+    }
+    else {
+        header = payload;
+    }
+    output[0] = header & 0xFF;
+    output[1] = (header >> 8) & 0xFF;
+    output[2] = (header >> 16) & 0xFF;
+    output[3] = header >> 24;
+    return COMPRESS_HEADER + payload;
+}
+
+/**
+* @brief Decompress complete frame.
+*
+* @param decoder Pointer to decoder state.
+* @param frame Frame including header.
+* @param output Pointer to store decompressed chunk.
+* @param output_size Pointer to store size of decompressed chunk.
+*
+* @return 1 on success, -1 if frame is corrupted.
+*/
+static int compress_decode_frame(CompressDecoder_t *decoder, const char *frame, const char **output, size_t *output_size) {
+    const unsigned char *header = (const unsigned char *)frame;
+    uint32_t value = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    long size;
+    // Stored chunk is written straight from frame.
+    if (value & COMPRESS_STORED) {
+        *output = frame + COMPRESS_HEADER;
+        *output_size = value & ~COMPRESS_STORED;
+        return 1;
+    }
+    if (decoder->output == NULL && (decoder->output = malloc(COMPRESS_CHUNK)) == NULL) {
+        return -1;
+    }
+    if ((size = lz_decompress(frame + COMPRESS_HEADER, value, decoder->output, COMPRESS_CHUNK)) < 0) {
+        return -1;
+    }
+    *output = decoder->output;
+    *output_size = size;
+    return 1;
+}
+
+/**
+* @brief Get payload size of frame from its header.
+*
+* @param header Frame header.
+*
+* @return Payload size, -1 if it is larger than any valid frame.
+*/
+static long compress_payload_size(const char *header) {
+    const unsigned char *data = (const unsigned char *)header;
+    uint32_t value = (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24) & ~COMPRESS_STORED;
+    return value > COMPRESS_CHUNK ? -1 : (long)value;
+}
+
+int compress_decode(CompressDecoder_t *decoder, const char **input, size_t *size, const char **output, size_t *output_size) {
+    long payload;
+    size_t need, take;
+    // Frame inside one block is decoded in place, without copying.
+    if (decoder->frame_size == 0 && *size >= COMPRESS_HEADER) {
+        if ((payload = compress_payload_size(*input)) < 0) {
+            return -1;
+        }
+        if (*size >= COMPRESS_HEADER + (size_t)payload) {
+            const char *frame = *input;
+            *input += COMPRESS_HEADER + payload;
+            *size -= COMPRESS_HEADER + payload;
+            return compress_decode_frame(decoder, frame, output, output_size);
+        }
+    }
+    if (*size == 0) {
+        return 0;
+    }
+    if (decoder->frame == NULL && (decoder->frame = malloc(COMPRESS_FRAME_MAX)) == NULL) {
+        return -1;
+    }
+    // Header first, then rest of frame, both may be split by block boundary.
+    while (*size > 0) {
+        if (decoder->frame_size < COMPRESS_HEADER) {
+            need = COMPRESS_HEADER - decoder->frame_size;
+        }
+        else {
+            need = COMPRESS_HEADER + compress_payload_size(decoder->frame) - decoder->frame_size;
+        }
+        take = need < *size ? need : *size;
+        memcpy(decoder->frame + decoder->frame_size, *input, take);
+        decoder->frame_size += take;
+        *input += take;
+        *size -= take;
+        if (decoder->frame_size == COMPRESS_HEADER && compress_payload_size(decoder->frame) < 0) {
+            return -1;
+        }
+        if (decoder->frame_size >= COMPRESS_HEADER &&
+            decoder->frame_size == COMPRESS_HEADER + (size_t)compress_payload_size(decoder->frame)) {
+            decoder->frame_size = 0;
+            return compress_decode_frame(decoder, decoder->frame, output, output_size);
+        }
+    }
+    return 0;
+}
+
+void compress_decoder_free(CompressDecoder_t *decoder) {
+    free(decoder->frame);
+    free(decoder->output);
+    decoder->frame = NULL;
+    decoder->output = NULL;
+}
+
+EncodeStream_t *compress_open(int fd) {
+    return encodestream_open(&compress_cache, fd);
+}
@@ -0,0 +1,381 @@
+//
+// File: encodecache.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of cache of encoded files, least recently used encodings are dropped to stay within limit.
+//
+
+#include "../include/encodecache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+bool encodecache_write(int fd, const char *buffer, size_t size) {
+    ssize_t result;
+    while (size > 0) {
+        if ((result = write(fd, buffer, size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += result;
+        size -= result;
+    }
+    return true;
+}
+
+/**
+* @brief Check whether source file has the key of entry, so its encoding belongs to the file.
+*
+* @param entry Pointer to entry.
+* @param status Status of source file.
+*
+* @return True if device, inode, size and mtime match.
+*/
+static bool encodecache_match(EncodeEntry_t *entry, struct stat *status) {
+    return entry->dev == status->st_dev && entry->ino == status->st_ino && entry->size == status->st_size &&
+           entry->mtime.tv_sec == status->st_mtim.tv_sec && entry->mtime.tv_nsec == status->st_mtim.tv_nsec;
+}
+
+/**
+* @brief Find cached encoding of file.
+*
+* @param cache Pointer to cache.
+* @param status Status of source file.
+*
+* @return Pointer to entry, NULL on miss.
+*/
+static EncodeEntry_t *encodecache_find(EncodeCache_t *cache, struct stat *status) {
+    for (int i = 0; i < ENCODECACHE_ENTRIES; i++) {
+        EncodeEntry_t *entry = &cache->entries[i];
+        if (entry->fd >= 0 && !entry->filling && encodecache_match(entry, status)) {
+            entry->last_used = ++cache->clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief Drop least recently used complete encodings until size more bytes fit within limit.
+*
+* @param cache Pointer to cache.
+* @param size Number of bytes to be added.
+*
+* @return True if bytes fit, false if entries being filled alone leave no room.
+*/
+static bool encodecache_room(EncodeCache_t *cache, off_t size) {
+    EncodeEntry_t *oldest;
+    off_t total;
+    while (true) {
+        total = 0;
+        oldest = NULL;
+        for (int i = 0; i < ENCODECACHE_ENTRIES; i++) {
+            EncodeEntry_t *entry = &cache->entries[i];
+            if (entry->fd < 0) {
+                continue;
+            }
+            total += entry->encoded_size;
+            if (!entry->filling && (oldest == NULL || entry->last_used < oldest->last_used)) {
+                oldest = entry;
+            }
+        }
+        if (total + size <= cache->max) {
+            return true;
+        }
+        if (oldest == NULL) {
+            return false;
+        }
+        // Transfers keep their own duplicate of descriptor, dropped entry stays readable for them.
+        close(oldest->fd);
+        oldest->fd = -1;
+    }
+}
+
+/**
+* @brief Get free entry, least recently used complete encoding is dropped if there is none.
+*
+* @param cache Pointer to cache.
+*
+* @return Pointer to entry, NULL if all entries are being filled.
+*/
+static EncodeEntry_t *encodecache_slot(EncodeCache_t *cache) {
+    EncodeEntry_t *oldest = NULL;
+    for (int i = 0; i < ENCODECACHE_ENTRIES; i++) {
+        EncodeEntry_t *entry = &cache->entries[i];
+        if (entry->fd < 0) {
+            return entry;
+        }
+        if (!entry->filling && (oldest == NULL || entry->last_used < oldest->last_used)) {
+            oldest = entry;
+        }
+    }
+    if (oldest != NULL) {
+        close(oldest->fd);
+        oldest->fd = -1;
+    }
+    return oldest;
+}
+
+/**
+* @brief Set key of entry to source file.
+*
+* @param cache Pointer to cache.
+* @param entry Pointer to entry.
+* @param status Status of source file.
+*
+* @return void
+*/
+static void encodecache_key_set(EncodeCache_t *cache, EncodeEntry_t *entry, struct stat *status) {
+    entry->dev = status->st_dev;
+    entry->ino = status->st_ino;
+    entry->size = status->st_size;
+    entry->mtime = status->st_mtim;
+    entry->last_used = ++cache->clock;
+}
+
+/**
+* @brief Mark all entries of cache free on its first use.
+*
+* @param cache Pointer to cache.
+*
+* @return void
+*/
+static void encodecache_init(EncodeCache_t *cache) {
+    if (!cache->ready) {
+        for (int i = 0; i < ENCODECACHE_ENTRIES; i++) {
+            cache->entries[i].fd = -1;
+        }
+        cache->ready = true;
+    }
+}
+
+/**
+* @brief Stop caching encoding of stream, partial encoding is dropped.
+*
+* @param stream Pointer to stream.
+*
+* @return void
+*/
+static void encodestream_unfill(EncodeStream_t *stream) {
+    if (stream->fill != NULL) {
+        close(stream->fill->fd);
+        stream->fill->fd = -1;
+        stream->fill->filling = false;
+        stream->fill = NULL;
+    }
+}
+
+/**
+* @brief Encode one chunk of source into stream's output buffer.
+*
+* @param stream Pointer to stream.
+* @param chunk Chunk number.
+*
+* @return Number of source bytes, less than chunk size only at end of file, -1 on failure.
+*/
+static long encodestream_chunk(EncodeStream_t *stream, long chunk) {
+    size_t length = stream->cache->chunk, size = 0;
+    off_t offset = (off_t)chunk * length;
+    ssize_t result;
+    while (size < length) {
+        if ((result = pread(stream->fd, stream->input + size, length - size, offset + size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        size += result;
+    }
+    // Empty chunk at end of file has no encoding, not even a header.
+    stream->output_size = size == 0 ? 0 : stream->cache->encode(stream->input, size, stream->output);
+    stream->chunk = chunk;
+    return size;
+}
+
+/**
+* @brief Encode chunk following the last encoded one and append it to cache entry being filled.
+*
+* @param stream Pointer to stream.
+*
+* @return True on success, false if source cannot be read.
+*/
+static bool encodestream_next(EncodeStream_t *stream) {
+    EncodeCache_t *cache = stream->cache;
+    struct stat status;
+    long size;
+    if (stream->count == stream->capacity) {
+        long capacity = stream->capacity * 2;
+        off_t *index = realloc(stream->index, (capacity + 1) * sizeof(off_t));
+        if (index == NULL) {
+            return false;
+        }
+        stream->index = index;
+        stream->capacity = capacity;
+    }
+    if ((size = encodestream_chunk(stream, stream->count)) < 0) {
+        return false;
+    }
+    stream->index[stream->count + 1] = stream->index[stream->count] + stream->output_size;
+    stream->count++;
+    stream->complete = size < (long)cache->chunk;
+    // Chunks are appended in order only, encoding that does not fit is not cached at all.
+    if (stream->fill != NULL) {
+        if (!encodecache_room(cache, stream->output_size) ||
+            !encodecache_write(stream->fill->fd, stream->output, stream->output_size)) {
+            encodestream_unfill(stream);
+        }
+        else {
+            stream->fill->encoded_size += stream->output_size;
+        }
+    }
+    // File changed while it was read has no consistent encoding, it is not served to anyone else.
+    if (stream->complete && stream->fill != NULL) {
+        if (fstat(stream->fd, &status) < 0 || !encodecache_match(stream->fill, &status)) {
+            encodestream_unfill(stream);
+        }
+        else {
+            stream->fill->filling = false;
+            stream->fill->last_used = ++cache->clock;
+            stream->fill = NULL;
+        }
+    }
+    return true;
+}
+
+EncodeStream_t *encodestream_open(EncodeCache_t *cache, int fd) {
+    EncodeStream_t *stream = calloc(1, sizeof(EncodeStream_t));
+    EncodeEntry_t *entry;
+    struct stat status;
+
+    encodecache_init(cache);
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->cache = cache;
+    stream->fd = fd;
+    stream->cached_fd = -1;
+    stream->chunk = -1;
+    if (fstat(fd, &status) < 0) {
+        free(stream);
+        return NULL;
+    }
+    if ((entry = encodecache_find(cache, &status)) != NULL) {
+        if ((stream->cached_fd = dup(entry->fd)) < 0) {
+            free(stream);
+            return NULL;
+        }
+        stream->cached_size = entry->encoded_size;
+        return stream;
+    }
+    stream->capacity = 16;
+    stream->index = calloc(stream->capacity + 1, sizeof(off_t));
+    stream->input = malloc(cache->chunk);
+    stream->output = malloc(cache->output_max);
+    if (stream->index == NULL || stream->input == NULL || stream->output == NULL) {
+        encodestream_close(stream);
+        return NULL;
+    }
+    // Only one stream fills entry of a file, others read while it is filled encode on their own.
+    if (S_ISREG(status.st_mode) && status.st_size <= cache->max) {
+        for (int i = 0; i < ENCODECACHE_ENTRIES; i++) {
+            if (cache->entries[i].fd >= 0 && cache->entries[i].filling && encodecache_match(&cache->entries[i], &status)) {
+                entry = &cache->entries[i];
+                break;
+            }
+        }
+        if (entry == NULL && (entry = encodecache_slot(cache)) != NULL &&
+            (entry->fd = memfd_create(cache->name, MFD_CLOEXEC)) >= 0) {
+            encodecache_key_set(cache, entry, &status);
+            entry->encoded_size = 0;
+            entry->filling = true;
+            stream->fill = entry;
+        }
+    }
+    // First DATA needs the first chunk anyway, file that fits into it knows its encoded size right away.
+    if (!encodestream_next(stream)) {
+        encodestream_close(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+long encodestream_read(EncodeStream_t *stream, char *buffer, long size, off_t offset) {
+    long done = 0, length, low, high, middle;
+    ssize_t result;
+    if (stream->cached_fd >= 0) {
+        while (done < size) {
+            if ((result = pread(stream->cached_fd, buffer + done, size - done, offset + done)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            if (result == 0) {
+                break;
+            }
+            done += result;
+        }
+        return done;
+    }
+    while (done < size) {
+        while (!stream->complete && offset + done >= stream->index[stream->count]) {
+            if (!encodestream_next(stream)) {
+                return -1;
+            }
+        }
+        if (offset + done >= stream->index[stream->count]) {
+            break;
+        }
+        // Last chunk starting at or before offset, empty chunks are skipped over.
+        low = 0;
+        high = stream->count - 1;
+        while (low < high) {
+            middle = (low + high + 1) / 2;
+            if (stream->index[middle] <= offset + done) {
+                low = middle;
+            }
+            else {
+                high = middle - 1;
+            }
+        }
+        // Retransmission reaching back into earlier chunk encodes it again, it must come out the same.
+        if (stream->chunk != low && (encodestream_chunk(stream, low) < 0 ||
+                                     (off_t)stream->output_size != stream->index[low + 1] - stream->index[low])) {
+            return -1;
+        }
+        length = stream->index[low + 1] - (offset + done);
+        length = length < size - done ? length : size - done;
+        memcpy(buffer + done, stream->output + (offset + done - stream->index[low]), length);
+        done += length;
+    }
+    return done;
+}
+
+off_t encodestream_size(EncodeStream_t *stream) {
+    if (stream->cached_fd >= 0) {
+        return stream->cached_size;
+    }
+    return stream->complete ? stream->index[stream->count] : -1;
+}
+
+void encodestream_close(EncodeStream_t *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    encodestream_unfill(stream);
+    if (stream->cached_fd >= 0) {
+        close(stream->cached_fd);
+    }
+    free(stream->index);
+    free(stream->input);
+    free(stream->output);
+    free(stream);
+}
@@ -0,0 +1,289 @@
+//
+// File: filecache.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of cache of served files' metadata and descriptors kept coherent by inotify.
+//
+
+#include "../include/filecache.h"
+#include "../include/metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// Events that may change contents, metadata or existence of a name.
+#define FILECACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+* @brief Get hash bucket of name.
+*
+* @param name File name.
+*
+* @return Bucket index.
+*/
+static unsigned int filecache_bucket(const char *name) {
+    unsigned int hash = 2166136261U;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619U;
+    }
+    return hash % FILECACHE_BUCKETS;
+}
+
+/**
+* @brief Close cached descriptor of entry.
+*
+* @param files Pointer to cache.
+* @param entry Pointer to entry.
+*
+* @return void
+*/
+static void filecache_close_fd(FileCache_t *files, FileEntry_t *entry) {
+    if (entry->fd >= 0) {
+        close(entry->fd);
+        entry->fd = -1;
+        files->open_fds--;
+    }
+}
+
+/**
+* @brief Free entry's resources.
+*
+* @param files Pointer to cache.
+* @param entry Pointer to entry.
+*
+* @return void
+*/
+static void filecache_free(FileCache_t *files, FileEntry_t *entry) {
+    filecache_close_fd(files, entry);
+    free(entry->name);
+    free(entry);
+}
+
+/**
+* @brief Remove entry from hash and LRU list, referenced entry is only marked stale.
+*
+* @param files Pointer to cache.
+* @param entry Pointer to entry.
+*
+* @return void
+*/
+static void filecache_remove(FileCache_t *files, FileEntry_t *entry) {
+    FileEntry_t **link = &files->buckets[filecache_bucket(entry->name)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else {
+        files->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else {
+        files->lru_tail = entry->lru_prev;
+    }
+    files->entries--;
+    if (entry->refs > 0) {
+        entry->stale = true;
+        return;
+    }
+    filecache_free(files, entry);
+}
+
+/**
+* @brief Move entry to head of LRU list.
+*
+* @param files Pointer to cache.
+* @param entry Pointer to entry.
+*
+* @return void
+*/
+static void filecache_touch(FileCache_t *files, FileEntry_t *entry) {
+    if (files->lru_head == entry) {
+        return;
+    }
+    entry->lru_prev->lru_next = entry->lru_next;
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else {
+        files->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = files->lru_head;
+    files->lru_head->lru_prev = entry;
+    files->lru_head = entry;
+}
+
+/**
+* @brief Find entry by name.
+*
+* @param files Pointer to cache.
+* @param name File name.
+*
+* @return Pointer to entry, NULL if name is not cached.
+*/
+static FileEntry_t *filecache_find(FileCache_t *files, const char *name) {
+    for (FileEntry_t *entry = files->buckets[filecache_bucket(name)]; entry != NULL; entry = entry->hash_next) {
+        if (strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief Keep number of entries and cached descriptors within limits, starting from least recently used.
+*
+* @param files Pointer to cache.
+*
+* @return void
+*/
+static void filecache_trim(FileCache_t *files) {
+    FileEntry_t *entry = files->lru_tail, *prev;
+    while (entry != NULL && (files->entries > FILECACHE_MAX_ENTRIES || files->open_fds > FILECACHE_MAX_FDS)) {
+        prev = entry->lru_prev;
+        if (files->entries > FILECACHE_MAX_ENTRIES && entry->refs == 0) {
+            filecache_remove(files, entry);
+        }
+        else if (files->open_fds > FILECACHE_MAX_FDS) {
+            filecache_close_fd(files, entry);
+        }
+        entry = prev;
+    }
+}
+
+FileCache_t *filecache_create(char *dir_path) {
+    FileCache_t *files = calloc(1, sizeof(FileCache_t));
+    if (files == NULL) {
+        return NULL;
+    }
+    if ((files->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        free(files);
+        return NULL;
+    }
+    if (inotify_add_watch(files->inotify_fd, dir_path, FILECACHE_EVENTS) < 0) {
+        close(files->inotify_fd);
+        free(files);
+        return NULL;
+    }
+    files->dir_path = dir_path;
+    return files;
+}
+
+FileEntry_t *filecache_get(FileCache_t *files, char *name) {
+    char full_path[PATH_MAX];
+    struct stat status;
+    FileEntry_t *entry;
+
+    // Only names directly in watched directory are kept coherent.
+    if (strchr(name, '/') != NULL || name[0] == '\0') {
+        return NULL;
+    }
+    if ((entry = filecache_find(files, name)) != NULL) {
+        files->hits++;
+        metrics_add(METRIC_FILECACHE_HITS, 1);
+        filecache_touch(files, entry);
+        entry->refs++;
+        return entry;
+    }
+    files->misses++;
+    metrics_add(METRIC_FILECACHE_MISSES, 1);
+    if (snprintf(full_path, sizeof(full_path), "%s/%s", files->dir_path, name) >= (int)sizeof(full_path)) {
+        return NULL;
+    }
+    if ((entry = calloc(1, sizeof(FileEntry_t))) == NULL || (entry->name = strdup(name)) == NULL) {
+        free(entry);
+        return NULL;
+    }
+    entry->fd = open(full_path, O_RDONLY | O_CLOEXEC);
+    if (entry->fd < 0 && errno != ENOENT) {
+        filecache_free(files, entry);
+        return NULL;
+    }
+    if (entry->fd >= 0) {
+        files->open_fds++;
+        if (fstat(entry->fd, &status) < 0 || !S_ISREG(status.st_mode)) {
+            filecache_free(files, entry);
+            return NULL;
+        }
+        entry->exists = true;
+        entry->dev = status.st_dev;
+        entry->ino = status.st_ino;
+        entry->size = status.st_size;
+        entry->mtime = status.st_mtim;
+    }
+    unsigned int bucket = filecache_bucket(name);
+    entry->hash_next = files->buckets[bucket];
+    files->buckets[bucket] = entry;
+    entry->lru_next = files->lru_head;
+    if (files->lru_head != NULL) {
+        files->lru_head->lru_prev = entry;
+    }
+    else {
+        files->lru_tail = entry;
+    }
+    files->lru_head = entry;
+    files->entries++;
+    entry->refs++;
+    filecache_trim(files);
+    return entry;
+}
+
+FILE *filecache_open(FileCache_t *files, FileEntry_t *entry) {
+    char full_path[PATH_MAX];
+    int fd;
+    FILE *file;
+    if (entry->fd >= 0) {
+        fd = dup(entry->fd);
+    }
+    else {
+        snprintf(full_path, sizeof(full_path), "%s/%s", files->dir_path, entry->name);
+        fd = open(full_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    if ((file = fdopen(fd, "r")) == NULL) {
+        close(fd);
+    }
+    return file;
+}
+
+void filecache_release(FileCache_t *files, FileEntry_t *entry) {
+    if (--entry->refs == 0 && entry->stale) {
+        filecache_free(files, entry);
+    }
+}
+
+void filecache_process_events(FileCache_t *files) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    FileEntry_t *entry;
+    ssize_t size;
+
+    while ((size = read(files->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + size; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event *)ptr;
+            // Lost events or directory itself replaced, nothing cached can be trusted.
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                while (files->lru_head != NULL) {
+                    filecache_remove(files, files->lru_head);
+                }
+                continue;
+            }
+            if (event->len > 0 && (entry = filecache_find(files, event->name)) != NULL) {
+                filecache_remove(files, entry);
+            }
+        }
+    }
+}
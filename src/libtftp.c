@@ -0,0 +1,1068 @@
+//
+// File: libtftp.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of libtftp, client side transfer state machine driven by epoll and timerfd.
+//
+
+#include "../include/libtftp.h"
+#include "../include/utils.h"
+#include "../include/multicast.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+// Events handled by one epoll_wait of tftp_client_process.
+#define TFTP_EVENTS_MAX 64
+// Initial capacity of timer queue, it grows with number of running transfers.
+#define TFTP_TIMERS_INITIAL 16
+
+/**
+* @brief States of a single client transfer.
+*/
+typedef enum TftpState {
+    TFTP_WAIT_RESPONSE, // Request sent, first OACK, DATA or ACK is expected.
+    TFTP_RECEIVING,     // GET, next DATA is expected.
+    TFTP_SENDING,       // PUT, ACK of sent window is expected.
+    TFTP_MULTICAST,     // GET, blocks come from multicast group.
+    TFTP_DONE           // Transfer finished or failed, it is freed by the end of tftp_client_process.
+} TftpState_t;
+
+struct TftpTransfer {
+    int socket;
+    // Socket of joined multicast group, -1 otherwise.
+    int group_socket;
+    MulticastReceiver_t *receiver;
+    // Address request is sent to and server's TID once it responds.
+    struct sockaddr_in request_addr;
+    struct sockaddr_in server;
+    TftpState_t state;
+    int opcode;
+    char file_name[MAX_FILE_NAME_LEN];
+    // Bytes held by receiver when resumed download started (0 for upload), -1 if transfer is not resumed.
+    long resume;
+    // Offset confirmed by server's answer.
+    long offset;
+    // Requested byte range, range_length is -1 if whole file was requested, and whether server acknowledged it.
+    long range_start;
+    long range_length;
+    bool ranged;
+    // Server acknowledged compress.
+    bool compressed;
+    Session_t session;
+    void (*done)(TftpTransfer_t *transfer, int result);
+    void *user;
+    int result;
+    // Error reported by finished transfer, message is copied as ERROR packet is gone by then.
+    int error_code;
+    char error_msg[DEFAULT_PACKET_SIZE];
+    // Position in timer queue, -1 if timer is stopped.
+    int timer_index;
+    struct TftpTransfer *prev;
+    struct TftpTransfer *next;
+};
+
+struct TftpClient {
+    int epoll_fd;
+    // Expires at the earliest retransmission deadline, so one descriptor covers packets and timers.
+    int timer_fd;
+    TftpTransfer_t *transfers;
+    // Transfers finished inside tftp_client_process, freed when no event can refer to them anymore.
+    TftpTransfer_t *finished;
+    int active;
+    bool processing;
+    // Binary min-heap of running transfers ordered by retransmission deadline.
+    TftpTransfer_t **timers;
+    int timer_count;
+    int timer_capacity;
+    const char *error;
+};
+
+/**
+* @brief Swap two transfers in timer queue.
+*
+* @param client Pointer to client.
+* @param i Index of first transfer.
+* @param j Index of second transfer.
+*
+* @return void
+*/
+static void tftp_timer_swap(TftpClient_t *client, int i, int j) {
+    TftpTransfer_t *transfer = client->timers[i];
+    client->timers[i] = client->timers[j];
+    client->timers[j] = transfer;
+    client->timers[i]->timer_index = i;
+    client->timers[j]->timer_index = j;
+}
+
+/**
+* @brief Restore heap order around index after deadline change.
+*
+* @param client Pointer to client.
+* @param index Index of changed transfer.
+*
+* @return void
+*/
+static void tftp_timer_sift(TftpClient_t *client, int index) {
+    // Move up while earlier than parent.
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (client->timers[parent]->session.timer.deadline <= client->timers[index]->session.timer.deadline) {
+            break;
+        }
+        tftp_timer_swap(client, parent, index);
+        index = parent;
+    }
+    // Move down while later than any child.
+    while (true) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < client->timer_count &&
+            client->timers[left]->session.timer.deadline < client->timers[smallest]->session.timer.deadline) {
+            smallest = left;
+        }
+        if (right < client->timer_count &&
+            client->timers[right]->session.timer.deadline < client->timers[smallest]->session.timer.deadline) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        tftp_timer_swap(client, smallest, index);
+        index = smallest;
+    }
+}
+
+/**
+* @brief Insert, move or remove transfer in timer queue according to its current deadline.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void tftp_timer_update(TftpClient_t *client, TftpTransfer_t *transfer) {
+    TftpTransfer_t **timers;
+    int index = transfer->timer_index;
+    if (transfer->session.timer.deadline == 0 || transfer->state == TFTP_DONE) {
+        // Remove by moving last item to its place.
+        if (index < 0) {
+            return;
+        }
+        transfer->timer_index = -1;
+        if (index != --client->timer_count) {
+            client->timers[index] = client->timers[client->timer_count];
+            client->timers[index]->timer_index = index;
+            tftp_timer_sift(client, index);
+        }
+        return;
+    }
+    if (index < 0) {
+        if (client->timer_count == client->timer_capacity) {
+            if ((timers = realloc(client->timers, 2 * client->timer_capacity * sizeof(TftpTransfer_t *))) == NULL) {
+                return;
+            }
+            client->timers = timers;
+            client->timer_capacity *= 2;
+        }
+        index = client->timer_count++;
+        client->timers[index] = transfer;
+        transfer->timer_index = index;
+    }
+    tftp_timer_sift(client, index);
+}
+
+/**
+* @brief Set timer descriptor to the earliest deadline of running transfers.
+*
+* @param client Pointer to client.
+*
+* @return void
+*/
+static void tftp_timer_arm(TftpClient_t *client) {
+    struct itimerspec spec;
+    long deadline;
+    memset(&spec, 0, sizeof(spec));
+    if (client->timer_count > 0) {
+        // Deadlines are CLOCK_MONOTONIC microseconds like the timer, zero value would disarm it.
+        deadline = client->timers[0]->session.timer.deadline;
+        spec.it_value.tv_sec = deadline / 1000000;
+        spec.it_value.tv_nsec = (deadline % 1000000) * 1000 + 1;
+    }
+    timerfd_settime(client->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/**
+* @brief Stop transfer, close its file and move it to finished transfers, done callback is not called.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param result TFTP_OK, TFTP_FAILED or TFTP_REJECTED.
+* @param error_code TFTP error code.
+* @param error_msg Error message, NULL on success.
+*
+* @return void
+*/
+static void tftp_transfer_end(TftpClient_t *client, TftpTransfer_t *transfer, int result, int error_code, const char *error_msg) {
+    Session_t *session = &transfer->session;
+    if (transfer->state == TFTP_DONE) {
+        return;
+    }
+    transfer->result = result;
+    if (error_msg != NULL) {
+        transfer->error_code = error_code;
+        snprintf(transfer->error_msg, sizeof(transfer->error_msg), "%s", error_msg);
+    }
+    transfer->state = TFTP_DONE;
+    timer_stop(session);
+    tftp_timer_update(client, transfer);
+    epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, transfer->socket, NULL);
+    if (transfer->group_socket >= 0) {
+        epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, transfer->group_socket, NULL);
+        close(transfer->group_socket);
+        transfer->group_socket = -1;
+    }
+    free(transfer->receiver);
+    transfer->receiver = NULL;
+    session_close(session);
+
+    if (transfer->prev != NULL) {
+        transfer->prev->next = transfer->next;
+    }
+    else {
+        client->transfers = transfer->next;
+    }
+    if (transfer->next != NULL) {
+        transfer->next->prev = transfer->prev;
+    }
+    transfer->prev = NULL;
+    transfer->next = client->finished;
+    client->finished = transfer;
+    client->active--;
+}
+
+/**
+* @brief Finish transfer and report its result to done callback.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param result TFTP_OK, TFTP_FAILED or TFTP_REJECTED.
+* @param error_code TFTP error code.
+* @param error_msg Error message, NULL on success.
+*
+* @return void
+*/
+static void tftp_transfer_finish(TftpClient_t *client, TftpTransfer_t *transfer, int result, int error_code, const char *error_msg) {
+    if (transfer->state == TFTP_DONE) {
+        return;
+    }
+    tftp_transfer_end(client, transfer, result, error_code, error_msg);
+    if (transfer->done != NULL) {
+        transfer->done(transfer, result);
+    }
+}
+
+/**
+* @brief Tell server why transfer failed and finish it.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param error_code TFTP error code.
+* @param error_msg Error message.
+*
+* @return void
+*/
+static void tftp_transfer_abort(TftpClient_t *client, TftpTransfer_t *transfer, int error_code, char *error_msg) {
+    send_error_packet(&transfer->session, transfer->socket, transfer->server, error_code, error_msg);
+    tftp_transfer_finish(client, transfer, TFTP_FAILED, error_code, error_msg);
+}
+
+/**
+* @brief Finish transfer ended by server's ERROR.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param packet ERROR packet.
+* @param size Size of packet.
+*
+* @return void
+*/
+static void tftp_transfer_rejected(TftpClient_t *client, TftpTransfer_t *transfer, char *packet, int size) {
+    Packet_t error;
+    if (packet_parse(packet, size, &error) != CODEC_OK) {
+        tftp_transfer_finish(client, transfer, TFTP_REJECTED, ERR_NOT_DEFINED, "Malformed ERROR packet.");
+        return;
+    }
+    tftp_transfer_finish(client, transfer, TFTP_REJECTED, error.error_code, error.error_msg);
+}
+
+/**
+* @brief Join multicast group acknowledged in OACK (RFC 2090), only master client ACKs.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void tftp_multicast_start(TftpClient_t *client, TftpTransfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = transfer };
+
+    if ((transfer->receiver = calloc(1, sizeof(MulticastReceiver_t))) == NULL) {
+        tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Receiver malloc failed.");
+        return;
+    }
+    if ((transfer->group_socket = multicast_socket_open(&session->multicast_addr, &transfer->server)) < 0 ||
+        epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, transfer->group_socket, &event) < 0) {
+        tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Failed to join multicast group.");
+        return;
+    }
+    transfer->state = TFTP_MULTICAST;
+    // Master asks for the first block it misses, other members only listen.
+    if (session->options[MULTICAST].value == 1) {
+        send_ack_packet(session, transfer->socket, transfer->server, 0);
+    }
+    timer_start(session);
+}
+
+/**
+* @brief Handle packet of multicast transfer, blocks come from group in any order and only master client ACKs.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param socket Socket packet was received on.
+* @param size Size of packet.
+*
+* @return void
+*/
+static void tftp_multicast_packet(TftpClient_t *client, TftpTransfer_t *transfer, int socket, int size) {
+    Session_t *session = &transfer->session;
+    MulticastReceiver_t *receiver = transfer->receiver;
+    char *packet = session->packet;
+    int blksize = session->options[BLKSIZE].value;
+    bool master = session->options[MULTICAST].value == 1, in_order;
+    int block_number;
+
+    switch (codec_get_u16(packet)) {
+        case DATA:
+            block_number = codec_get_u16(packet + OPCODE_SIZE);
+            if (block_number == 0 || size > blksize + 4) {
+                break;
+            }
+            in_order = false;
+            if (multicast_block_set(receiver, block_number)) {
+                display_message(session, socket, transfer->server, packet, size);
+                if (!block_write(session, block_number, packet + OPCODE_SIZE + BLOCK_NUMBER_SIZE, size - 4)) {
+                    tftp_transfer_abort(client, transfer, ERR_DISK_FULL, "Failed to write file.");
+                    return;
+                }
+                if (size < blksize + 4) {
+                    receiver->last_block = block_number;
+                }
+                in_order = block_number == session->block_number + 1;
+                session->block_number = multicast_block_prefix(receiver, session->block_number);
+                session->window_count++;
+            }
+            // Any DATA shows server is alive, only master acknowledges.
+            if (!master) {
+                timer_ack(session);
+                timer_arm(session);
+                break;
+            }
+            if (receiver->last_block != 0 && session->block_number == receiver->last_block) {
+                break;
+            }
+            if (session->timer.sent_at != 0) {
+                timer_ack(session);
+            }
+            else if (in_order) {
+                session->timer.retries = 0;
+            }
+            // Same policy as unicast receiver, ACK per window and once per gap.
+            if (!in_order) {
+                if (!gap_ack_needed(session)) {
+                    timer_arm(session);
+                    break;
+                }
+            }
+            else if (session->window_count < session->options[WINDOWSIZE].value) {
+                timer_arm(session);
+                break;
+            }
+            session->window_count = 0;
+            send_ack_packet(session, transfer->socket, transfer->server, session->block_number);
+            timer_start(session);
+            break;
+        case OACK:
+            // Server hands transfer over to us or answers our keepalive, OACK filling whole buffer may be cut off.
+            if (size == session->packet_size || !handle_oack_packet(session, packet, size) || !session->options[MULTICAST].flag) {
+                tftp_transfer_abort(client, transfer, ERR_OPTION_NEGOTIATION, "Invalid OACK.");
+                return;
+            }
+            display_message(session, socket, transfer->server, packet, size);
+            timer_ack(session);
+            if (session->options[MULTICAST].value == 1) {
+                session->window_count = 0;
+                send_ack_packet(session, transfer->socket, transfer->server, session->block_number);
+                timer_start(session);
+            }
+            else {
+                timer_arm(session);
+            }
+            break;
+        case ERROR:
+            display_message(session, socket, transfer->server, packet, size);
+            tftp_transfer_rejected(client, transfer, packet, size);
+            return;
+        default:
+            break;
+    }
+    // Last ACK finishes transfer of master, other members leave group with it.
+    if (receiver->last_block != 0 && session->block_number >= receiver->last_block) {
+        send_ack_packet(session, transfer->socket, transfer->server, receiver->last_block);
+        tftp_transfer_finish(client, transfer, TFTP_OK, 0, NULL);
+    }
+}
+
+/**
+* @brief Check offset answered to resumed transfer, download keeps only as many bytes as server confirmed.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+*
+* @return True if transfer continues, false if it was aborted.
+*/
+static bool tftp_transfer_resume(TftpClient_t *client, TftpTransfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    long offset = session->options[OFFSET].value;
+    uint32_t crc;
+    if (transfer->resume < 0) {
+        return true;
+    }
+    transfer->offset = offset;
+    // Server keeps offset if our bytes match its file and starts over at 0 otherwise.
+    if (transfer->opcode == RRQ) {
+        if (offset != 0 && offset != transfer->resume) {
+            tftp_transfer_abort(client, transfer, ERR_OPTION_NEGOTIATION, "Invalid offset.");
+            return false;
+        }
+        if (ftruncate(fileno(session->file), offset) < 0) {
+            tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Failed to truncate file.");
+            return false;
+        }
+        return true;
+    }
+    // Part of file server already holds must be the beginning of ours.
+    if (offset > 0 && (!file_tail_crc(fileno(session->file), offset, &crc) || crc != session->offset_crc)) {
+        tftp_transfer_abort(client, transfer, ERR_FILE_ALREADY_EXISTS, "Server file differs.");
+        return false;
+    }
+    return true;
+}
+
+/**
+* @brief Settle compression answered by server, upload goes on with uncompressed file if server did not acknowledge it.
+*
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void tftp_transfer_compressed(TftpTransfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    transfer->compressed = session->options[COMPRESS].flag;
+    // Encoded octet upload is the compressed one, netascii upload keeps its encoding.
+    if (!transfer->compressed && session->mode == OCTET) {
+        encodestream_close(session->encoded);
+        session->encoded = NULL;
+    }
+}
+
+/**
+* @brief Handle OACK answering our request.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param size Size of packet.
+*
+* @return void
+*/
+static void tftp_transfer_oack(TftpClient_t *client, TftpTransfer_t *transfer, int size) {
+    Session_t *session = &transfer->session;
+    // Server retransmits OACK until it gets first ACK or DATA, reader answers it again, sender's window timer covers it.
+    // Duplicated or delayed OACK arriving later is ignored.
+    if (transfer->state != TFTP_WAIT_RESPONSE) {
+        if (transfer->opcode == RRQ && session->block_number == 0) {
+            send_ack_packet(session, transfer->socket, transfer->server, 0);
+        }
+        return;
+    }
+    if (!handle_oack_packet(session, session->packet, size)) {
+        tftp_transfer_abort(client, transfer, ERR_OPTION_NEGOTIATION, "Invalid OACK.");
+        return;
+    }
+    display_message(session, transfer->socket, transfer->server, session->packet, size);
+    if (!tftp_transfer_resume(client, transfer)) {
+        return;
+    }
+    // Acknowledged range must be the requested one, otherwise blocks would land at wrong offsets.
+    if (session->options[RANGE].flag) {
+        if (session->options[RANGE].value != transfer->range_start || session->range_length != transfer->range_length) {
+            tftp_transfer_abort(client, transfer, ERR_OPTION_NEGOTIATION, "Invalid range.");
+            return;
+        }
+        transfer->ranged = true;
+    }
+    tftp_transfer_compressed(transfer);
+    if (!session_packet_alloc(session)) {
+        tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Packet malloc failed.");
+        return;
+    }
+    timer_ack(session);
+    if (transfer->opcode == WRQ) {
+        transfer->state = TFTP_SENDING;
+        if (!send_window(session, transfer->socket, transfer->server)) {
+            tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Failed to read file.");
+        }
+        return;
+    }
+    // Server accepted multicast, whole file is received from group.
+    if (session->options[MULTICAST].flag) {
+        tftp_multicast_start(client, transfer);
+        return;
+    }
+    transfer->state = TFTP_RECEIVING;
+    send_ack_packet(session, transfer->socket, transfer->server, 0);
+    timer_start(session);
+}
+
+/**
+* @brief Handle packet received on transfer's socket.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param socket Socket packet was received on.
+* @param source_addr Address packet came from.
+* @param size Size of packet.
+*
+* @return void
+*/
+static void tftp_transfer_packet(TftpClient_t *client, TftpTransfer_t *transfer, int socket, struct sockaddr_in source_addr, int size) {
+    Session_t *session = &transfer->session;
+    char *packet = session->packet;
+    int opcode;
+
+    // Runt datagram has no block number or error code, it is dropped like packet from other host.
+    if (source_addr.sin_addr.s_addr != transfer->server.sin_addr.s_addr || size < OPCODE_SIZE + BLOCK_NUMBER_SIZE) {
+        return;
+    }
+    if (transfer->state == TFTP_MULTICAST) {
+        if (source_addr.sin_port == transfer->server.sin_port) {
+            tftp_multicast_packet(client, transfer, socket, size);
+        }
+        return;
+    }
+    // Server's TID is chosen by its first response, other ports are rejected afterwards.
+    if (transfer->state == TFTP_WAIT_RESPONSE) {
+        transfer->server.sin_port = source_addr.sin_port;
+    }
+    else if (source_addr.sin_port != transfer->server.sin_port) {
+        send_error_packet(session, socket, source_addr, ERR_UNKNOWN_TRANSFER_ID, "Unknown transfer ID.");
+        return;
+    }
+    opcode = codec_get_u16(packet);
+    if (opcode == ERROR) {
+        display_message(session, socket, transfer->server, packet, size);
+        tftp_transfer_rejected(client, transfer, packet, size);
+        return;
+    }
+    if (opcode == OACK) {
+        tftp_transfer_oack(client, transfer, size);
+        return;
+    }
+    if (opcode != (transfer->opcode == RRQ ? DATA : ACK)) {
+        tftp_transfer_finish(client, transfer, TFTP_FAILED, ERR_ILLEGAL_OPERATION, "Invalid opcode.");
+        return;
+    }
+    // Server ignored requested options, resumed transfer starts over and compressed upload is sent uncompressed.
+    if (transfer->state == TFTP_WAIT_RESPONSE) {
+        options_reset(session);
+        if (!tftp_transfer_resume(client, transfer)) {
+            return;
+        }
+        tftp_transfer_compressed(transfer);
+    }
+
+    if (transfer->opcode == RRQ) {
+        transfer->state = TFTP_RECEIVING;
+        display_message(session, socket, transfer->server, packet, size);
+        if (handle_data_packet(session, packet, size)) {
+            send_ack_packet(session, socket, transfer->server, session->block_number);
+        }
+        else if (session->error_msg != NULL) {
+            tftp_transfer_abort(client, transfer, session->error_code, session->error_msg);
+            return;
+        }
+        if (session->last) {
+            tftp_transfer_finish(client, transfer, TFTP_OK, 0, NULL);
+        }
+        return;
+    }
+    // ACKs outside of current window and duplicates are ignored.
+    if (!handle_ack_packet(session, packet)) {
+        return;
+    }
+    transfer->state = TFTP_SENDING;
+    display_message(session, socket, transfer->server, packet, size);
+    if (session->last && session->block_number == session->block_sent) {
+        tftp_transfer_finish(client, transfer, TFTP_OK, 0, NULL);
+        return;
+    }
+    if (!send_window(session, socket, transfer->server)) {
+        tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Failed to read file.");
+    }
+}
+
+/**
+* @brief Receive and handle all packets waiting on socket of transfer.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param socket Transfer's socket or its multicast group socket.
+*
+* @return void
+*/
+static void tftp_transfer_receive(TftpClient_t *client, TftpTransfer_t *transfer, int socket) {
+    struct sockaddr_in source_addr;
+    socklen_t source_addr_size;
+    int size;
+
+    while (transfer->state != TFTP_DONE) {
+        source_addr_size = sizeof(source_addr);
+        if ((size = recvfrom(socket, transfer->session.packet, transfer->session.packet_size, MSG_DONTWAIT,
+                             (struct sockaddr *)&source_addr, &source_addr_size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                tftp_transfer_finish(client, transfer, TFTP_FAILED, ERR_NOT_DEFINED, "Recvfrom failed on client side.");
+            }
+            break;
+        }
+        tftp_transfer_packet(client, transfer, socket, source_addr, size);
+    }
+    tftp_timer_update(client, transfer);
+}
+
+/**
+* @brief Handle expired retransmission timer of transfer.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void tftp_transfer_timeout(TftpClient_t *client, TftpTransfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    if (!timer_retry(session)) {
+        tftp_transfer_finish(client, transfer, TFTP_FAILED, ERR_NOT_DEFINED, "Transfer timed out.");
+        return;
+    }
+    switch (transfer->state) {
+        case TFTP_WAIT_RESPONSE:
+            send_request_packet(session, transfer->socket, transfer->request_addr, transfer->opcode, transfer->file_name);
+            break;
+        case TFTP_RECEIVING:
+            // Last ACK tells server which block we expect.
+            session->gap_acked_at = 0;
+            send_ack_packet(session, transfer->socket, transfer->server, session->block_number);
+            break;
+        case TFTP_SENDING:
+            if (!send_window(session, transfer->socket, transfer->server)) {
+                tftp_transfer_abort(client, transfer, ERR_NOT_DEFINED, "Failed to read file.");
+            }
+            break;
+        case TFTP_MULTICAST:
+            // Master repeats which block it needs, member asks whether server is still alive.
+            send_ack_packet(session, transfer->socket, transfer->server, session->block_number);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+* @brief Deallocate transfers finished since last call.
+*
+* @param client Pointer to client.
+*
+* @return void
+*/
+static void tftp_client_reap(TftpClient_t *client) {
+    TftpTransfer_t *transfer;
+    while ((transfer = client->finished) != NULL) {
+        client->finished = transfer->next;
+        close(transfer->socket);
+        free(transfer);
+    }
+}
+
+/**
+* @brief Set options of request on session in the order they are sent.
+*
+* @param transfer Pointer to transfer.
+* @param request Pointer to request.
+*
+* @return True if all options are valid, false otherwise (see session_error_set).
+*/
+static bool tftp_transfer_options(TftpTransfer_t *transfer, TftpRequest_t *request) {
+    Session_t *session = &transfer->session;
+    int opcode = transfer->opcode;
+    int order = 0;
+    long blksize = request->blksize;
+    long size = 0;
+
+    if (blksize == TFTP_BLKSIZE_AUTO && (blksize = blksize_path_max(&transfer->request_addr)) == -1) {
+        return session_error_set(session, ERR_NOT_DEFINED, "Failed to get path MTU.");
+    }
+    if (blksize != 0 && !option_set(session, BLKSIZE, blksize, order++, opcode)) {
+        return false;
+    }
+    if (request->tsize) {
+        // Upload announces size of data on the wire, download asks server for it. Encoded upload knows its size
+        // only if encoding is cached or file fits into its first chunk, otherwise it goes without tsize.
+        if (opcode == WRQ && session->encoded != NULL) {
+            size = encodestream_size(session->encoded);
+        }
+        else if (opcode == WRQ && (size = session->file != NULL ? file_size_get(session->file) : request->size) == -1) {
+            return session_error_set(session, ERR_NOT_DEFINED, "Failed to get file size.");
+        }
+        if (size >= 0 && !option_set(session, TSIZE, size, order++, opcode)) {
+            return false;
+        }
+    }
+    if (request->windowsize != 0 && !option_set(session, WINDOWSIZE, request->windowsize, order++, opcode)) {
+        return false;
+    }
+    if (request->timeout != 0 && !option_set(session, TIMEOUT, request->timeout, order++, opcode)) {
+        return false;
+    }
+    if (request->utimeout != 0 && !option_set(session, UTIMEOUT, request->utimeout, order++, opcode)) {
+        return false;
+    }
+    if (request->multicast && !option_set(session, MULTICAST, 0, order++, opcode)) {
+        return false;
+    }
+    if (request->range) {
+        if (!option_set(session, RANGE, request->range_start, order++, opcode)) {
+            return false;
+        }
+        if (request->range_length < 0 || request->range_length > LONG_MAX - request->range_start) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid range value.");
+        }
+        session->range_length = request->range_length;
+        transfer->range_start = request->range_start;
+        transfer->range_length = request->range_length;
+    }
+    if (request->resume) {
+        // Download offers bytes it holds with their CRC, upload learns from OACK how much server holds.
+        if (opcode == RRQ && ((size = file_size_get(session->file)) == -1 ||
+                              !file_tail_crc(fileno(session->file), size, &session->offset_crc))) {
+            return session_error_set(session, ERR_NOT_DEFINED, "Failed to read file.");
+        }
+        transfer->resume = opcode == RRQ ? size : 0;
+        if (!option_set(session, OFFSET, transfer->resume, order++, opcode)) {
+            return false;
+        }
+    }
+    if (request->compress && !option_set(session, COMPRESS, 1, order++, opcode)) {
+        return false;
+    }
+    return true;
+}
+
+/**
+* @brief Validate request and prepare transfer's session and socket.
+*
+* @param client Pointer to client.
+* @param transfer Pointer to transfer.
+* @param request Pointer to request.
+*
+* @return True if transfer is ready to send request, false otherwise (see session_error_set).
+*/
+static bool tftp_transfer_init(TftpClient_t *client, TftpTransfer_t *transfer, TftpRequest_t *request) {
+    Session_t *session = &transfer->session;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = transfer };
+
+    if (request->type != TFTP_GET && request->type != TFTP_PUT) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid transfer type.");
+    }
+    if (request->file_name == NULL || request->file_name[0] == '\0') {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "File name cannot be empty.");
+    }
+    if (strlen(request->file_name) >= MAX_FILE_NAME_LEN) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "File name too long.");
+    }
+    strcpy(transfer->file_name, request->file_name);
+    if (session->file == NULL && (request->type == TFTP_GET ? request->write == NULL : request->read == NULL)) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Missing file or data callback.");
+    }
+    if (request->netascii) {
+        // Multicast blocks arrive out of order, netascii can only be decoded in order.
+        if (request->multicast) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Multicast cannot be combined with netascii.");
+        }
+        // Netascii upload is sent from encoding of file made as blocks are read.
+        session->mode = NETASCII;
+        if (request->type == TFTP_PUT) {
+            if (session->file == NULL) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Netascii upload needs file.");
+            }
+            if ((session->encoded = netascii_open(fileno(session->file))) == NULL) {
+                return session_error_set(session, ERR_NOT_DEFINED, "Failed to encode file.");
+            }
+        }
+    }
+    if (request->resume) {
+        if (session->file == NULL) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Resume needs file.");
+        }
+        // Offset counts raw bytes of one receiver.
+        if (request->netascii || request->multicast) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Resume cannot be combined with netascii or multicast.");
+        }
+    }
+    // Range is part of plain file read by one client.
+    if (request->range && (request->netascii || request->multicast || request->resume)) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Range cannot be combined with netascii, multicast or resume.");
+    }
+    if (request->compress) {
+        // Compressed stream has its own framing, it is not split by file offsets and not shared by a group.
+        if (request->netascii || request->multicast || request->resume || request->range) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Compress cannot be combined with netascii, multicast, resume or range.");
+        }
+        // Upload is sent from frames compressed as blocks are read, plain file is sent to server without the extension.
+        if (request->type == TFTP_PUT) {
+            if (session->file == NULL) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Compressed upload needs file.");
+            }
+            if ((session->encoded = compress_open(fileno(session->file))) == NULL) {
+                return session_error_set(session, ERR_NOT_DEFINED, "Failed to compress file.");
+            }
+        }
+    }
+    if (!tftp_transfer_options(transfer, request)) {
+        return false;
+    }
+    // Buffer must fit the largest blksize server may acknowledge.
+    if (!session_packet_alloc(session)) {
+        return session_error_set(session, ERR_NOT_DEFINED, "Packet malloc failed.");
+    }
+    if ((transfer->socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+        return session_error_set(session, ERR_NOT_DEFINED, "Failed to create socket.");
+    }
+    if (epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, transfer->socket, &event) < 0) {
+        return session_error_set(session, ERR_NOT_DEFINED, "Failed to watch socket.");
+    }
+    return true;
+}
+
+void tftp_request_init(TftpRequest_t *request) {
+    memset(request, 0, sizeof(TftpRequest_t));
+    request->type = TFTP_GET;
+    request->server.sin_family = AF_INET;
+    request->server.sin_port = htons(DEFAULT_PORT_NUM);
+}
+
+TftpClient_t *tftp_client_create(void) {
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    TftpClient_t *client = calloc(1, sizeof(TftpClient_t));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    client->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    client->timers = calloc(TFTP_TIMERS_INITIAL, sizeof(TftpTransfer_t *));
+    client->timer_capacity = TFTP_TIMERS_INITIAL;
+    client->error = "Success.";
+    if (client->epoll_fd < 0 || client->timer_fd < 0 || client->timers == NULL ||
+        epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, client->timer_fd, &event) < 0) {
+        tftp_client_destroy(client);
+        return NULL;
+    }
+    return client;
+}
+
+void tftp_client_destroy(TftpClient_t *client) {
+    while (client->transfers != NULL) {
+        tftp_transfer_cancel(client, client->transfers);
+    }
+    tftp_client_reap(client);
+    if (client->epoll_fd >= 0) {
+        close(client->epoll_fd);
+    }
+    if (client->timer_fd >= 0) {
+        close(client->timer_fd);
+    }
+    free(client->timers);
+    free(client);
+}
+
+int tftp_client_fd(TftpClient_t *client) {
+    return client->epoll_fd;
+}
+
+int tftp_client_process(TftpClient_t *client) {
+    struct epoll_event events[TFTP_EVENTS_MAX];
+    TftpTransfer_t *transfer;
+    uint64_t expirations;
+    long now;
+    int count;
+
+    if ((count = epoll_wait(client->epoll_fd, events, TFTP_EVENTS_MAX, 0)) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+        count = 0;
+    }
+    // Transfers finishing from now on stay allocated, later events of this batch may still point to them.
+    client->processing = true;
+    for (int i = 0; i < count; i++) {
+        if ((transfer = events[i].data.ptr) == NULL) {
+            // Read only resets readiness of descriptor, expired timers are found in timer queue below.
+            read(client->timer_fd, &expirations, sizeof(expirations));
+            continue;
+        }
+        // Either socket of multicast transfer may be ready, both are drained.
+        tftp_transfer_receive(client, transfer, transfer->socket);
+        if (transfer->state != TFTP_DONE && transfer->group_socket >= 0) {
+            tftp_transfer_receive(client, transfer, transfer->group_socket);
+        }
+    }
+    now = time_now();
+    while (client->timer_count > 0 && client->timers[0]->session.timer.deadline <= now) {
+        transfer = client->timers[0];
+        tftp_transfer_timeout(client, transfer);
+        tftp_timer_update(client, transfer);
+    }
+    client->processing = false;
+    tftp_client_reap(client);
+    tftp_timer_arm(client);
+    return client->active;
+}
+
+int tftp_client_run(TftpClient_t *client) {
+    struct pollfd poll_fd = { .fd = client->epoll_fd, .events = POLLIN, .revents = 0 };
+    int active;
+    while ((active = tftp_client_process(client)) > 0) {
+        if (poll(&poll_fd, 1, -1) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+    return active < 0 ? -1 : 0;
+}
+
+const char *tftp_client_error(TftpClient_t *client) {
+    return client->error;
+}
+
+TftpTransfer_t *tftp_transfer_start(TftpClient_t *client, TftpRequest_t *request) {
+    TftpTransfer_t *transfer = calloc(1, sizeof(TftpTransfer_t));
+    Session_t *session;
+    if (transfer == NULL) {
+        if (request->file != NULL && request->file != stdin) {
+            fclose(request->file);
+        }
+        client->error = "Transfer malloc failed.";
+        return NULL;
+    }
+    session = &transfer->session;
+    session_init(session);
+    session->file = request->file;
+    session->reader = request->read;
+    session->writer = request->write;
+    session->user = request->user;
+    transfer->socket = -1;
+    transfer->group_socket = -1;
+    transfer->timer_index = -1;
+    transfer->resume = -1;
+    transfer->range_length = -1;
+    transfer->opcode = request->type;
+    transfer->request_addr = request->server;
+    transfer->server = request->server;
+    transfer->done = request->done;
+    transfer->user = request->user;
+
+    if (!tftp_transfer_init(client, transfer, request) ||
+        !send_request_packet(session, transfer->socket, transfer->request_addr, transfer->opcode, transfer->file_name)) {
+        client->error = session->error_msg;
+        session_close(session);
+        if (transfer->socket >= 0) {
+            close(transfer->socket);
+        }
+        free(transfer);
+        return NULL;
+    }
+    timer_start(session);
+    transfer->state = TFTP_WAIT_RESPONSE;
+    transfer->next = client->transfers;
+    if (client->transfers != NULL) {
+        client->transfers->prev = transfer;
+    }
+    client->transfers = transfer;
+    client->active++;
+    tftp_timer_update(client, transfer);
+    if (!client->processing) {
+        tftp_timer_arm(client);
+    }
+    return transfer;
+}
+
+void tftp_transfer_cancel(TftpClient_t *client, TftpTransfer_t *transfer) {
+    if (transfer->state == TFTP_DONE) {
+        return;
+    }
+    send_error_packet(&transfer->session, transfer->socket, transfer->server, ERR_NOT_DEFINED, "Transfer cancelled.");
+    tftp_transfer_end(client, transfer, TFTP_FAILED, ERR_NOT_DEFINED, "Transfer cancelled.");
+    if (!client->processing) {
+        tftp_client_reap(client);
+        tftp_timer_arm(client);
+    }
+}
+
+void *tftp_transfer_user(TftpTransfer_t *transfer) {
+    return transfer->user;
+}
+
+long tftp_transfer_size(TftpTransfer_t *transfer) {
+    // Requested tsize of download is 0 until server answers.
+    if (transfer->state == TFTP_WAIT_RESPONSE || !transfer->session.options[TSIZE].flag) {
+        return -1;
+    }
+    return transfer->session.options[TSIZE].value;
+}
+
+bool tftp_transfer_range(TftpTransfer_t *transfer) {
+    return transfer->ranged;
+}
+
+bool tftp_transfer_compress(TftpTransfer_t *transfer) {
+    return transfer->compressed;
+}
+
+long tftp_transfer_offset(TftpTransfer_t *transfer) {
+    return transfer->offset;
+}
+
+int tftp_transfer_error_code(TftpTransfer_t *transfer) {
+    return transfer->error_code;
+}
+
+const char *tftp_transfer_error(TftpTransfer_t *transfer) {
+    return transfer->result == TFTP_OK ? NULL : transfer->error_msg;
+}
+
+void tftp_log_init(int level) {
+    log_init(level);
+}
@@ -0,0 +1,419 @@
+//
+// File: log.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of asynchronous packet log, producers only copy packet fields into their ring,
+//              formatting and writing to stderr is done by background thread in batches.
+//
+
+#include "../include/utils.h"
+#include <stdarg.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Nothing is logged until log_init, so programs embedding libtftp stay quiet by default.
+int log_level = LOG_NONE;
+
+static LogRing_t *log_rings[LOG_MAX_THREADS];
+static int log_ring_count = 0;
+static __thread LogRing_t *log_ring = NULL;
+// Destructor of key gives ring of exiting thread back.
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+
+// Bumped by producer whose ring was empty, writer sleeps on it while all rings are empty.
+static uint32_t log_wake = 0;
+
+// Taken by whoever drains rings, writer thread or log_flush, never by producers.
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool log_started = false;
+
+// Text waiting for write.
+static char log_batch[LOG_BATCH_SIZE];
+static int log_batch_len = 0;
+
+/**
+* @brief Give ring of exiting thread back, records still queued in it are drained by writer as usual.
+*
+* @param ring Pointer to ring.
+*
+* @return void
+*/
+static void log_ring_release(void *ring) {
+    __atomic_store_n(&((LogRing_t *)ring)->owned, false, __ATOMIC_RELEASE);
+    log_ring = NULL;
+}
+
+/**
+* @brief Create key whose destructor releases ring of exiting thread.
+*
+* @return void
+*/
+static void log_ring_key_create() {
+    pthread_key_create(&log_ring_key, log_ring_release);
+}
+
+/**
+* @brief Get ring of calling thread, ring released by exited thread is taken over, otherwise new one is registered.
+*
+* @return Pointer to ring, NULL if all rings are owned by running threads.
+*/
+static LogRing_t *log_ring_get() {
+    LogRing_t *ring;
+    bool owned = false;
+    int count;
+    if (log_ring != NULL) {
+        return log_ring;
+    }
+    pthread_once(&log_ring_once, log_ring_key_create);
+    count = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count && log_ring == NULL; i++) {
+        ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+        // Head left by previous owner is seen before the new owner moves it.
+        if (ring != NULL && __atomic_compare_exchange_n(&ring->owned, &owned, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            log_ring = ring;
+        }
+        owned = false;
+    }
+    while (log_ring == NULL) {
+        if (count >= LOG_MAX_THREADS) {
+            return NULL;
+        }
+        if (!__atomic_compare_exchange_n(&log_ring_count, &count, count + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if ((ring = calloc(1, sizeof(LogRing_t))) == NULL) {
+            // Slot stays empty, drain skips it.
+            return NULL;
+        }
+        ring->owned = true;
+        __atomic_store_n(&log_rings[count], ring, __ATOMIC_RELEASE);
+        log_ring = ring;
+    }
+    pthread_setspecific(log_ring_key, log_ring);
+    return log_ring;
+}
+
+/**
+* @brief Wake writer sleeping in log_wait.
+*
+* @return void
+*/
+static void log_wake_writer() {
+    __atomic_fetch_add(&log_wake, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &log_wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+* @brief Get size of NUL terminated strings at the start of payload.
+*
+* @param payload Packet after opcode.
+* @param max Size of payload, at most LOG_PAYLOAD_MAX.
+* @param fixed Number of strings that are always present (file name and mode of request).
+*
+* @return Size of strings with their NUL bytes and terminating empty option name, at most max.
+*/
+static int log_strings_size(char *payload, int max, int fixed) {
+    int pos = 0;
+    for (int i = 0; pos < max; i++) {
+        // Option list ends with empty name, name and value always come in pairs.
+        if (i >= fixed && (i - fixed) % 2 == 0 && payload[pos] == '\0') {
+            return pos + 1;
+        }
+        pos += strnlen(payload + pos, max - pos) + 1;
+    }
+    return max;
+}
+
+void log_packet(int opcode, char *packet, int size, struct sockaddr_in *src_addr, int dest_port) {
+    LogRing_t *ring = log_ring_get();
+    LogRecord_t *record;
+    uint64_t head, tail, offset, needed, start;
+    int max = size - OPCODE_SIZE < LOG_PAYLOAD_MAX ? size - OPCODE_SIZE : LOG_PAYLOAD_MAX;
+    int payload_size;
+
+    // Records of DATA, ACK and ERROR always carry block number or error code.
+    if (ring == NULL || max < BLOCK_NUMBER_SIZE) {
+        return;
+    }
+    switch (opcode) {
+        case DATA:
+        case ACK:
+            payload_size = BLOCK_NUMBER_SIZE;
+            break;
+        case ERROR:
+            payload_size = ERROR_CODE_SIZE + strnlen(packet + OPCODE_SIZE + ERROR_CODE_SIZE, max - ERROR_CODE_SIZE);
+            break;
+        case RRQ:
+        case WRQ:
+            payload_size = log_strings_size(packet + OPCODE_SIZE, max, 2);
+            break;
+        case OACK:
+            payload_size = log_strings_size(packet + OPCODE_SIZE, max, 0);
+            break;
+        default:
+            return;
+    }
+    // Records are 8 byte aligned, so end of ring always has room for skip marker.
+    needed = (sizeof(LogRecord_t) + payload_size + 7) & ~7UL;
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    start = head;
+    offset = head & (LOG_RING_SIZE - 1);
+    if (offset + needed > LOG_RING_SIZE) {
+        if (LOG_RING_SIZE - (head - tail) < LOG_RING_SIZE - offset + needed) {
+            ring->dropped++;
+            return;
+        }
+        ((LogRecord_t *)(ring->buffer + offset))->size = 0;
+        head += LOG_RING_SIZE - offset;
+        offset = 0;
+    }
+    else if (LOG_RING_SIZE - (head - tail) < needed) {
+        ring->dropped++;
+        return;
+    }
+    record = (LogRecord_t *)(ring->buffer + offset);
+    record->size = needed;
+    record->opcode = opcode;
+    record->payload_size = payload_size;
+    record->src_ip = src_addr->sin_addr;
+    record->src_port = ntohs(src_addr->sin_port);
+    record->dest_port = dest_port;
+    memcpy(record->payload, packet + OPCODE_SIZE, payload_size);
+    // Writer sees the record only after all its bytes.
+    __atomic_store_n(&ring->head, head + needed, __ATOMIC_SEQ_CST);
+    // Ring was empty, writer may be asleep. Otherwise writer has not drained older records yet and will see this one too,
+    // either tail read here or head read by writer observes the other store.
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == start) {
+        log_wake_writer();
+    }
+}
+
+/**
+* @brief Write batched text to stderr, write is used directly so no stdio lock is ever held by writer.
+*
+* @return void
+*/
+static void log_batch_write() {
+    int written = 0, result;
+    while (written < log_batch_len) {
+        if ((result = write(STDERR_FILENO, log_batch + written, log_batch_len - written)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += result;
+    }
+    log_batch_len = 0;
+}
+
+/**
+* @brief Append formatted text to batch, full batch is written first.
+*
+* @param format Printf format.
+*
+* @return void
+*/
+static void log_append(const char *format, ...) {
+    va_list args;
+    int size;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_start(args, format);
+        size = vsnprintf(log_batch + log_batch_len, LOG_BATCH_SIZE - log_batch_len, format, args);
+        va_end(args);
+        if (size < LOG_BATCH_SIZE - log_batch_len) {
+            log_batch_len += size;
+            return;
+        }
+        log_batch_write();
+    }
+}
+
+/**
+* @brief Append options of request or OACK as name=value pairs.
+*
+* @param record Pointer to record.
+* @param pos Position of the first option name in payload.
+*
+* @return void
+*/
+static void log_append_options(LogRecord_t *record, int pos) {
+    char *name, *value;
+    while (pos < record->payload_size && record->payload[pos] != '\0') {
+        name = record->payload + pos;
+        pos += strnlen(name, record->payload_size - pos) + 1;
+        value = pos < record->payload_size ? record->payload + pos : "";
+        pos += strnlen(value, record->payload_size - pos) + 1;
+        log_append(" %s=%s", name, value);
+    }
+    log_append("\n");
+}
+
+/**
+* @brief Format record as the line display_message used to print.
+*
+* @param record Pointer to record.
+*
+* @return void
+*/
+static void log_format(LogRecord_t *record) {
+    char ip[INET_ADDRSTRLEN];
+    char *payload = record->payload;
+    int block_number = ((unsigned char)payload[0] << 8) | (unsigned char)payload[1];
+    int pos;
+
+    // Strings of payload may be cut off, they are never read past payload size.
+    inet_ntop(AF_INET, &record->src_ip, ip, sizeof(ip));
+    switch (record->opcode) {
+        case RRQ:
+        case WRQ:
+            pos = strnlen(payload, record->payload_size);
+            log_append("%s: %s:%d \"%.*s\" ", record->opcode == RRQ ? "RRQ" : "WRQ", ip, record->src_port, pos, payload);
+            pos++;
+            // Mode is case insensitive, it is shown in lower case.
+            for (; pos < record->payload_size && payload[pos] != '\0'; pos++) {
+                log_append("%c", tolower((unsigned char)payload[pos]));
+            }
+            log_append_options(record, pos + 1);
+            break;
+        case DATA:
+            log_append("DATA: %s:%d:%d %d\n", ip, record->src_port, record->dest_port, block_number);
+            break;
+        case ACK:
+            log_append("ACK: %s:%d %d\n", ip, record->src_port, block_number);
+            break;
+        case ERROR:
+            log_append("ERROR: %s:%d:%d %d \"%.*s\"\n", ip, record->src_port, record->dest_port, block_number,
+                       record->payload_size - ERROR_CODE_SIZE, payload + ERROR_CODE_SIZE);
+            break;
+        case OACK:
+            log_append("OACK: %s:%d", ip, record->src_port);
+            log_append_options(record, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+* @brief Format all records queued in all rings, caller holds drain lock.
+*
+* @return True if anything was drained.
+*/
+static bool log_drain() {
+    int count = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+    bool drained = false;
+    LogRing_t *ring;
+    LogRecord_t *record;
+    uint64_t head, tail, offset;
+
+    for (int i = 0; i < count && i < LOG_MAX_THREADS; i++) {
+        if ((ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+        tail = ring->tail;
+        head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        while (tail < head) {
+            offset = tail & (LOG_RING_SIZE - 1);
+            record = (LogRecord_t *)(ring->buffer + offset);
+            if (record->size == 0) {
+                tail += LOG_RING_SIZE - offset;
+                continue;
+            }
+            log_format(record);
+            tail += record->size;
+            drained = true;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->dropped_reported) {
+            log_append("Log: %lu records dropped, ring was full.\n", (unsigned long)(dropped - ring->dropped_reported));
+            ring->dropped_reported = dropped;
+        }
+    }
+    if (log_batch_len > 0) {
+        log_batch_write();
+    }
+    return drained;
+}
+
+/**
+* @brief Background writer, drains rings until process exits and sleeps while they are empty.
+*
+* @param arg Unused.
+*
+* @return Never returns.
+*/
+static void *log_writer(void *arg) {
+    uint32_t wake;
+    bool drained;
+    (void)arg;
+    while (true) {
+        // Record queued after this load bumps log_wake, so the wait below returns at once instead of missing it.
+        wake = __atomic_load_n(&log_wake, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&log_drain_lock);
+        drained = log_drain();
+        pthread_mutex_unlock(&log_drain_lock);
+        if (!drained) {
+            syscall(SYS_futex, &log_wake, FUTEX_WAIT_PRIVATE, wake, NULL, NULL, 0);
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief Start background writer with all signals blocked, so signal handlers always run on the main thread.
+*
+* @return void
+*/
+static void log_writer_start() {
+    pthread_t thread;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if (pthread_create(&thread, NULL, log_writer, NULL) == 0) {
+        pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+* @brief Reset log in forked child, only the forking thread survives fork and records queued by parent are its own.
+*
+* @return void
+*/
+static void log_atfork_child() {
+    pthread_mutex_t unlocked = PTHREAD_MUTEX_INITIALIZER;
+    log_drain_lock = unlocked;
+    for (int i = 0; i < log_ring_count && i < LOG_MAX_THREADS; i++) {
+        if (log_rings[i] != NULL) {
+            log_rings[i]->tail = log_rings[i]->head;
+            log_rings[i]->dropped_reported = log_rings[i]->dropped;
+            // Threads owning other rings do not exist in child.
+            log_rings[i]->owned = log_rings[i] == log_ring;
+        }
+    }
+    log_batch_len = 0;
+    log_writer_start();
+}
+
+void log_init(int level) {
+    log_level = level;
+    if (level == LOG_NONE || log_started) {
+        return;
+    }
+    log_started = true;
+    atexit(log_flush);
+    pthread_atfork(NULL, NULL, log_atfork_child);
+    log_writer_start();
+}
+
+void log_flush() {
+    pthread_mutex_lock(&log_drain_lock);
+    log_drain();
+    pthread_mutex_unlock(&log_drain_lock);
+}
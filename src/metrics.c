@@ -0,0 +1,277 @@
+//
+// File: metrics.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of server metrics, counters are summed over CPU slots only when they are scraped.
+//
+
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+Metrics_t *metrics = NULL;
+
+// Exported text, one scrape at a time is served.
+static char metrics_text[65536];
+static int metrics_text_len;
+
+Metrics_t *metrics_create(char *mode, int workers, long max_transfers, Cache_t *cache) {
+    Metrics_t *shared = mmap(NULL, sizeof(Metrics_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return NULL;
+    }
+    // Anonymous mapping starts zeroed, only settings are filled in.
+    snprintf(shared->mode, sizeof(shared->mode), "%s", mode);
+    shared->workers = workers;
+    shared->max_transfers = max_transfers;
+    shared->cache = cache;
+    shared->start_time = time(NULL);
+    metrics = shared;
+    return shared;
+}
+
+/**
+* @brief Append formatted text to exported text, output past buffer end is cut off.
+*
+* @param format Printf format.
+*
+* @return void
+*/
+static void metrics_append(const char *format, ...) {
+    va_list args;
+    int size;
+    if (metrics_text_len >= (int)sizeof(metrics_text)) {
+        return;
+    }
+    va_start(args, format);
+    size = vsnprintf(metrics_text + metrics_text_len, sizeof(metrics_text) - metrics_text_len, format, args);
+    va_end(args);
+    // Text that did not fit is dropped whole, so exported length never runs past buffer and no line is cut.
+    if (size < 0 || size >= (int)sizeof(metrics_text) - metrics_text_len) {
+        metrics_text[metrics_text_len] = '\0';
+        return;
+    }
+    metrics_text_len += size;
+}
+
+/**
+* @brief Append metric with its help and type lines.
+*
+* @param name Metric name.
+* @param type Prometheus type (counter or gauge).
+* @param help Description.
+* @param value Value.
+*
+* @return void
+*/
+static void metrics_append_metric(const char *name, const char *type, const char *help, long value) {
+    metrics_append("# HELP %s %s\n# TYPE %s %s\n%s %ld\n", name, help, name, type, name, value);
+}
+
+/**
+* @brief Sum counter over all CPU slots.
+*
+* @param counter Counter index.
+*
+* @return Sum of counter.
+*/
+static long metrics_sum(int counter) {
+    long sum = 0;
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        sum += __atomic_load_n(&metrics->slots[i].counters[counter], __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+/**
+* @brief Render all metrics in Prometheus text format into exported text.
+*
+* @return void
+*/
+static void metrics_render() {
+    long started = metrics_sum(METRIC_TRANSFERS_RRQ) + metrics_sum(METRIC_TRANSFERS_WRQ);
+    long finished = metrics_sum(METRIC_TRANSFERS_FINISHED);
+    long busy;
+
+    metrics_text_len = 0;
+    metrics_append("# HELP tftp_info Server mode.\n# TYPE tftp_info gauge\ntftp_info{mode=\"%s\"} 1\n", metrics->mode);
+    metrics_append_metric("tftp_start_time_seconds", "gauge", "Start time of server since epoch.", metrics->start_time);
+    metrics_append_metric("tftp_workers", "gauge", "Worker processes, 0 for single process.", metrics->workers);
+    metrics_append_metric("tftp_max_transfers", "gauge", "Limit of concurrent transfers per event loop.", metrics->max_transfers);
+    // Counters are read one after another, transfer finishing in between must not show up as negative gauge.
+    metrics_append_metric("tftp_transfers_active", "gauge", "Transfers in progress.", started > finished ? started - finished : 0);
+    metrics_append("# HELP tftp_transfers_total Transfers started.\n# TYPE tftp_transfers_total counter\n");
+    metrics_append("tftp_transfers_total{opcode=\"rrq\"} %ld\n", metrics_sum(METRIC_TRANSFERS_RRQ));
+    metrics_append("tftp_transfers_total{opcode=\"wrq\"} %ld\n", metrics_sum(METRIC_TRANSFERS_WRQ));
+    metrics_append_metric("tftp_transfers_completed_total", "counter", "Transfers that moved the whole file.",
+                          metrics_sum(METRIC_TRANSFERS_COMPLETED));
+    metrics_append_metric("tftp_transfers_failed_total", "counter", "Transfers that ended without moving the whole file.",
+                          metrics_sum(METRIC_TRANSFERS_FAILED));
+    metrics_append_metric("tftp_packets_sent_total", "counter", "Datagrams sent.", metrics_sum(METRIC_PACKETS_SENT));
+    metrics_append_metric("tftp_packets_received_total", "counter", "Datagrams received.", metrics_sum(METRIC_PACKETS_RECEIVED));
+    metrics_append_metric("tftp_bytes_sent_total", "counter", "DATA payload bytes sent.", metrics_sum(METRIC_BYTES_SENT));
+    metrics_append_metric("tftp_bytes_received_total", "counter", "DATA payload bytes received.", metrics_sum(METRIC_BYTES_RECEIVED));
+    metrics_append_metric("tftp_retransmits_total", "counter", "Retransmissions after timeout or lost block.",
+                          metrics_sum(METRIC_RETRANSMITS));
+    metrics_append_metric("tftp_timeouts_total", "counter", "Transfers given up after retries.", metrics_sum(METRIC_TIMEOUTS));
+    metrics_append_metric("tftp_oacks_sent_total", "counter", "OACK packets sent.", metrics_sum(METRIC_OACKS));
+    metrics_append("# HELP tftp_errors_sent_total ERROR packets sent by error code.\n# TYPE tftp_errors_sent_total counter\n");
+    for (int code = 0; code < METRIC_ERROR_CODES; code++) {
+        metrics_append("tftp_errors_sent_total{code=\"%d\"} %ld\n", code, metrics_sum(METRIC_ERRORS + code));
+    }
+    metrics_append_metric("tftp_filecache_hits_total", "counter", "Requests resolved from metadata cache.",
+                          metrics_sum(METRIC_FILECACHE_HITS));
+    metrics_append_metric("tftp_filecache_misses_total", "counter", "Requests resolved from file system.",
+                          metrics_sum(METRIC_FILECACHE_MISSES));
+    if (metrics->cache != NULL) {
+        metrics_append_metric("tftp_cache_hits_total", "counter", "Block cache chunk hits.", metrics->cache->hits);
+        metrics_append_metric("tftp_cache_misses_total", "counter", "Block cache chunk misses.", metrics->cache->misses);
+    }
+    metrics_append_metric("tftp_forks_total", "counter", "Transfer processes forked.", metrics_sum(METRIC_FORKS));
+    metrics_append("# HELP tftp_busy_seconds_total Time event loops spent handling events by CPU.\n"
+                   "# TYPE tftp_busy_seconds_total counter\n");
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        if ((busy = __atomic_load_n(&metrics->slots[i].counters[METRIC_BUSY_US], __ATOMIC_RELAXED)) > 0) {
+            metrics_append("tftp_busy_seconds_total{cpu=\"%d\"} %.6f\n", i, busy / 1e6);
+        }
+    }
+}
+
+/**
+* @brief Write whole buffer to connection.
+*
+* @param fd Connection socket.
+* @param buffer Data.
+* @param size Size of data.
+*
+* @return void
+*/
+static void metrics_write(int fd, const char *buffer, int size) {
+    ssize_t result;
+    while (size > 0) {
+        if ((result = write(fd, buffer, size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buffer += result;
+        size -= result;
+    }
+}
+
+/**
+* @brief Answer one scrape, request is read up to its end (or for at most a second) and ignored.
+*
+* @param fd Connection socket.
+*
+* @return void
+*/
+static void metrics_answer(int fd) {
+    char request[4096], header[256];
+    struct pollfd poll_fd = { fd, POLLIN, 0 };
+    int size = 0, result, header_len;
+
+    while (size < (int)sizeof(request) - 1 && poll(&poll_fd, 1, 1000) > 0) {
+        if ((result = read(fd, request + size, sizeof(request) - 1 - size)) <= 0) {
+            break;
+        }
+        size += result;
+        request[size] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+    metrics_render();
+    header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %d\r\nConnection: close\r\n\r\n", metrics_text_len);
+    metrics_write(fd, header, header_len);
+    metrics_write(fd, metrics_text, metrics_text_len);
+}
+
+/**
+* @brief Create listening socket of endpoint.
+*
+* @param endpoint Path of UNIX socket, or TCP port on loopback if endpoint is a number.
+*
+* @return Socket file descriptor, -1 on failure.
+*/
+static int metrics_listen(char *endpoint) {
+    struct sockaddr_un unix_addr;
+    struct sockaddr_in inet_addr;
+    char *endptr = NULL;
+    long port = strtol(endpoint, &endptr, 10);
+    int enable = 1;
+    int fd;
+
+    if (*endptr == '\0' && endptr != endpoint) {
+        if (port < 1 || port > 65535 || (fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+            return -1;
+        }
+        memset(&inet_addr, 0, sizeof(inet_addr));
+        inet_addr.sin_family = AF_INET;
+        inet_addr.sin_port = htons(port);
+        inet_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if (bind(fd, (struct sockaddr *)&inet_addr, sizeof(inet_addr)) < 0 || listen(fd, METRICS_BACKLOG) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    if (strlen(endpoint) >= sizeof(unix_addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = AF_UNIX;
+    strcpy(unix_addr.sun_path, endpoint);
+    // Socket left behind by previous run is replaced.
+    unlink(endpoint);
+    if (bind(fd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) < 0 || listen(fd, METRICS_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool metrics_serve(char *endpoint) {
+    int listen_fd, fd;
+    pid_t pid;
+
+    if (metrics == NULL || (listen_fd = metrics_listen(endpoint)) < 0) {
+        return false;
+    }
+    if ((pid = fork()) < 0) {
+        close(listen_fd);
+        return false;
+    }
+    if (pid > 0) {
+        close(listen_fd);
+        return true;
+    }
+    // Scrapes are answered by own process, so they never wait for or delay transfers.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    while (true) {
+        if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+            continue;
+        }
+        metrics_answer(fd);
+        close(fd);
+    }
+}
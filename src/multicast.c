@@ -0,0 +1,142 @@
+//
+// File: multicast.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of multicast transfers (RFC 2090), server side groups and client side block tracking.
+//
+
+#include "../include/multicast.h"
+
+/**
+* @brief Get local address the kernel uses for reaching peer, multicast is sent and joined on its interface.
+*
+* @param peer Peer address.
+* @param local Pointer to store local address.
+*
+* @return True on success, false if peer is not reachable.
+*/
+static bool multicast_local_addr(struct sockaddr_in *peer, struct in_addr *local) {
+    struct sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    int sock_fd;
+    bool result;
+    // Connecting datagram socket only looks up the route, nothing is sent.
+    if ((sock_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        return false;
+    }
+    result = connect(sock_fd, (struct sockaddr *)peer, sizeof(*peer)) == 0 &&
+             getsockname(sock_fd, (struct sockaddr *)&addr, &addr_size) == 0;
+    close(sock_fd);
+    if (result) {
+        *local = addr.sin_addr;
+    }
+    return result;
+}
+
+MulticastGroup_t *multicast_group_create(char *file_name, int socket, struct in_addr group_addr, struct sockaddr_in *client_addr,
+                                         long file_size, long blksize) {
+    struct sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    struct in_addr interface;
+    int enable = 1, disable = 0;
+    MulticastGroup_t *group;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    // Clients on server's host bind the same port on group address, and server's socket must not get
+    // copies of its own DATA once such client joins.
+    if (setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+        setsockopt(socket, IPPROTO_IP, IP_MULTICAST_ALL, &disable, sizeof(disable)) < 0 ||
+        bind(socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(socket, (struct sockaddr *)&addr, &addr_size) < 0) {
+        return NULL;
+    }
+    if (!multicast_local_addr(client_addr, &interface) ||
+        setsockopt(socket, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) < 0) {
+        return NULL;
+    }
+    if ((group = calloc(1, sizeof(MulticastGroup_t))) == NULL) {
+        return NULL;
+    }
+    strncpy(group->file_name, file_name, MAX_FILE_NAME_LEN);
+    group->addr.sin_family = AF_INET;
+    group->addr.sin_addr = group_addr;
+    group->addr.sin_port = addr.sin_port;
+    group->file_size = file_size;
+    group->last_block = file_size / blksize + 1;
+    return group;
+}
+
+void multicast_group_free(MulticastGroup_t *group) {
+    free(group->members);
+    free(group);
+}
+
+int multicast_member_find(MulticastGroup_t *group, struct sockaddr_in *addr) {
+    for (int i = 0; i < group->count; i++) {
+        if (group->members[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && group->members[i].addr.sin_port == addr->sin_port) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool multicast_member_add(MulticastGroup_t *group, struct sockaddr_in *addr, Option_t *options) {
+    if (group->count == group->capacity) {
+        int capacity = group->capacity == 0 ? 8 : 2 * group->capacity;
+        MulticastMember_t *members = realloc(group->members, capacity * sizeof(MulticastMember_t));
+        if (members == NULL) {
+            return false;
+        }
+        group->members = members;
+        group->capacity = capacity;
+    }
+    group->members[group->count].addr = *addr;
+    memcpy(group->members[group->count].options, options, sizeof(group->members[group->count].options));
+    group->count++;
+    return true;
+}
+
+void multicast_member_remove(MulticastGroup_t *group, int index) {
+    memmove(&group->members[index], &group->members[index + 1], (group->count - index - 1) * sizeof(MulticastMember_t));
+    group->count--;
+}
+
+int multicast_socket_open(struct sockaddr_in *group_addr, struct sockaddr_in *server_addr) {
+    struct ip_mreq request;
+    int enable = 1;
+    int sock_fd;
+
+    if ((sock_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        return -1;
+    }
+    request.imr_multiaddr = group_addr->sin_addr;
+    // Several clients on one host share group port, binding group address keeps other groups out.
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+        bind(sock_fd, (struct sockaddr *)group_addr, sizeof(*group_addr)) < 0 ||
+        !multicast_local_addr(server_addr, &request.imr_interface) ||
+        setsockopt(sock_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0) {
+        close(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+bool multicast_block_set(MulticastReceiver_t *receiver, long block_number) {
+    unsigned char bit = 1 << (block_number % 8);
+    if (receiver->received[block_number / 8] & bit) {
+        return false;
+    }
+    receiver->received[block_number / 8] |= bit;
+    return true;
+}
+
+long multicast_block_prefix(MulticastReceiver_t *receiver, long block_number) {
+    while (block_number < MULTICAST_MAX_BLOCKS &&
+           (receiver->received[(block_number + 1) / 8] & (1 << ((block_number + 1) % 8)))) {
+        block_number++;
+    }
+    return block_number;
+}
@@ -0,0 +1,112 @@
+//
+// File: netascii.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of netascii transcoding, files are encoded chunk by chunk as they are sent and decoded
+//              block by block.
+//
+
+#include "../include/netascii.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Encoded files of this process, every chunk encodes on its own as line ends expand independently of each other.
+static EncodeCache_t netascii_cache = {
+    .name = "netascii", .encode = netascii_encode, .chunk = NETASCII_CHUNK, .output_max = 2 * NETASCII_CHUNK, .max = NETASCII_CACHE_MAX
+};
+
+/**
+* @brief Find the first CR or LF, 16 bytes are compared at once with SSE2, 8 bytes as one word without it.
+*
+* @param data Input bytes.
+* @param size Number of input bytes.
+*
+* @return Index of the first CR or LF, size if there is none.
+*/
+static size_t netascii_scan(const char *data, size_t size) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#else
+    const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    uint64_t word, cr, lf;
+    for (; i + 8 <= size; i += 8) {
+        memcpy(&word, data + i, sizeof(word));
+        // Byte equal to CR or LF turns into zero, zero bytes are detected by borrow into their high bit.
+        cr = word ^ (ones * '\r');
+        lf = word ^ (ones * '\n');
+        if (((cr - ones) & ~cr & highs) || ((lf - ones) & ~lf & highs)) {
+            break;
+        }
+    }
+#endif
+    while (i < size && data[i] != '\r' && data[i] != '\n') {
+        i++;
+    }
+    return i;
+}
+
+size_t netascii_encode(const char *input, size_t size, char *output) {
+    size_t in = 0, out = 0, run;
+    while (in < size) {
+        // Text between line ends is copied as is.
+        run = netascii_scan(input + in, size - in);
+        memcpy(output + out, input + in, run);
+        in += run;
+        out += run;
+        if (in == size) {
+            break;
+        }
+        output[out++] = '\r';
+        output[out++] = input[in++] == '\n' ? '\n' : '\0';
+    }
+    return out;
+}
+
+size_t netascii_decode(NetasciiDecoder_t *decoder, const char *input, size_t size, char *output) {
+    size_t in = 0, out = 0, run;
+    const char *cr;
+    // CR split from its pair by block boundary.
+    if (decoder->pending_cr && size > 0) {
+        decoder->pending_cr = false;
+        output[out++] = input[0] == '\n' ? '\n' : '\r';
+        if (input[0] == '\n' || input[0] == '\0') {
+            in++;
+        }
+    }
+    while (in < size) {
+        cr = memchr(input + in, '\r', size - in);
+        run = cr == NULL ? size - in : (size_t)(cr - (input + in));
+        memcpy(output + out, input + in, run);
+        in += run;
+        out += run;
+        if (in == size) {
+            break;
+        }
+        if (in + 1 == size) {
+            decoder->pending_cr = true;
+            break;
+        }
+        // Bare CR is not valid netascii, it is kept as it is.
+        output[out++] = input[in + 1] == '\n' ? '\n' : '\r';
+        in += input[in + 1] == '\n' || input[in + 1] == '\0' ? 2 : 1;
+    }
+    return out;
+}
+
+EncodeStream_t *netascii_open(int fd) {
+    return encodestream_open(&netascii_cache, fd);
+}
@@ -0,0 +1,657 @@
+//
+// File: tftp-bench.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of TFTP load generator, many transfers are driven from one epoll loop.
+//
+
+#include "../include/tftp-bench.h"
+
+// Payload of written files and buffer for received datagrams.
+static char send_buffer[BLKSIZE_MAX + 4];
+static char recv_buffer[BLKSIZE_MAX + 4];
+
+/**
+* @brief Append option name and value to request packet.
+*
+* @param packet Request packet of REQUEST_PACKET_SIZE bytes.
+* @param pos Current size of packet, -1 is passed through.
+* @param name Option name.
+* @param value Option value.
+*
+* @return New size of packet, -1 if option does not fit.
+*/
+static int bench_option_append(char *packet, int pos, char *name, long value) {
+    char text[MAX_STR_LEN];
+    snprintf(text, sizeof(text), "%ld", value);
+    return packet_put_option(packet, REQUEST_PACKET_SIZE, pos, name, text);
+}
+
+/**
+* @brief Send datagram to server and arm retransmission of transfer.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+* @param packet Datagram.
+* @param size Size of datagram.
+*
+* @return void
+*/
+static void bench_send(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer, char *packet, int size) {
+    // Full socket buffer behaves as lost datagram, retransmission recovers it.
+    if (sendto(transfer->socket, packet, size, 0, (struct sockaddr *)&transfer->server_address, sizeof(transfer->server_address)) >= 0) {
+        stats->packets_sent++;
+    }
+    // Timeout doubles with every retransmission like timer of client and server, so transfer outlasts server's backoff.
+    transfer->deadline = time_now() + (bench_args->rto << transfer->retries);
+}
+
+/**
+* @brief Send RRQ or WRQ of transfer.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void bench_send_request(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer) {
+    char packet[REQUEST_PACKET_SIZE];
+    int pos = packet_build_request(packet, sizeof(packet), transfer->opcode, transfer->file_name, "octet");
+
+    if (bench_args->blksize != 0) {
+        pos = bench_option_append(packet, pos, BLKSIZE_NAME, bench_args->blksize);
+    }
+    if (bench_args->windowsize != 0) {
+        pos = bench_option_append(packet, pos, WINDOWSIZE_NAME, bench_args->windowsize);
+    }
+    if (transfer->opcode == WRQ) {
+        pos = bench_option_append(packet, pos, TSIZE_NAME, transfer->size);
+    }
+    // Request that does not fit is never sent, transfer then runs out of retries.
+    if (pos < 0) {
+        return;
+    }
+    bench_send(bench_args, stats, transfer, packet, pos);
+}
+
+/**
+* @brief Send ACK of the last in-order block.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void bench_send_ack(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer) {
+    char packet[OPCODE_SIZE + BLOCK_NUMBER_SIZE];
+    bench_send(bench_args, stats, transfer, packet, packet_build_ack(packet, sizeof(packet), transfer->block_number));
+}
+
+/**
+* @brief Send window of DATA following the last acknowledged block.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void bench_send_window(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer) {
+    long size;
+    transfer->block_sent = transfer->block_number + transfer->windowsize;
+    if (transfer->block_sent > transfer->last_block) {
+        transfer->block_sent = transfer->last_block;
+    }
+    for (long block_number = transfer->block_number + 1; block_number <= transfer->block_sent; block_number++) {
+        size = block_number < transfer->last_block ? transfer->blksize : transfer->size - (transfer->last_block - 1) * transfer->blksize;
+        // Content of written files does not matter, header is rewritten in front of the same payload.
+        packet_build_data(send_buffer, OPCODE_SIZE + BLOCK_NUMBER_SIZE, block_number);
+        bench_send(bench_args, stats, transfer, send_buffer, size + 4);
+    }
+}
+
+/**
+* @brief Start new transfer in free slot.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to free slot.
+* @param index Index of transfer in run.
+* @param epoll_fd Epoll instance.
+* @param slot Index of slot, stored in epoll event.
+*
+* @return True on success, false if socket could not be created.
+*/
+static bool bench_start(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer, int index, int epoll_fd, int slot) {
+    struct epoll_event event;
+    int buffer_size = 1024 * 1024;
+    bool mixed = bench_args->num_files > 0 && bench_args->num_sizes > 0;
+    // Mixed run alternates reads and writes.
+    int round = mixed ? index / 2 : index;
+
+    memset(transfer, 0, sizeof(BenchTransfer_t));
+    transfer->index = index;
+    transfer->server_address = bench_args->server_address;
+    transfer->blksize = BLKSIZE_DEFAULT;
+    transfer->windowsize = WINDOWSIZE_DEFAULT;
+    transfer->started_at = time_now();
+    if (bench_args->num_files > 0 && (!mixed || index % 2 == 0)) {
+        transfer->opcode = RRQ;
+        snprintf(transfer->file_name, sizeof(transfer->file_name), "%s", bench_args->files[round % bench_args->num_files]);
+        stats->reads++;
+    }
+    else {
+        transfer->opcode = WRQ;
+        transfer->size = bench_args->sizes[round % bench_args->num_sizes];
+        snprintf(transfer->file_name, sizeof(transfer->file_name), "%s-%d-%d", bench_args->prefix, (int)getpid(), index);
+        stats->writes++;
+    }
+    if ((transfer->socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        return false;
+    }
+    // Large windows arrive in bursts, bigger receive buffer keeps generator from dropping them.
+    setsockopt(transfer->socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    event.events = EPOLLIN;
+    event.data.u32 = slot;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, transfer->socket, &event) < 0) {
+        close(transfer->socket);
+        return false;
+    }
+    transfer->active = true;
+    bench_send_request(bench_args, stats, transfer);
+    return true;
+}
+
+/**
+* @brief End transfer and record its result.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+* @param error_msg Reason of failure, NULL if transfer completed.
+*
+* @return void
+*/
+static void bench_finish(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer, char *error_msg) {
+    char path[MAX_DIR_PATH_LEN + MAX_FILE_NAME_LEN + 2];
+    long now = time_now();
+
+    close(transfer->socket);
+    transfer->active = false;
+    if (error_msg != NULL) {
+        fprintf(stderr, "Transfer %d of %s failed: %s\n", transfer->index, transfer->file_name, error_msg);
+        stats->failed++;
+        return;
+    }
+    stats->ttfb[stats->completed] = transfer->first_byte_at - transfer->started_at;
+    stats->completion[stats->completed] = now - transfer->started_at;
+    stats->completed++;
+    stats->bytes += transfer->bytes;
+    if (transfer->opcode == WRQ && bench_args->dir_path != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", bench_args->dir_path, transfer->file_name);
+        unlink(path);
+    }
+}
+
+/**
+* @brief Apply options acknowledged by server.
+*
+* @param transfer Pointer to transfer.
+* @param packet OACK packet.
+* @param size Size of packet.
+*
+* @return void
+*/
+static void bench_options_load(BenchTransfer_t *transfer, char *packet, int size) {
+    Packet_t oack;
+    if (packet_parse(packet, size, &oack) != CODEC_OK) {
+        return;
+    }
+    for (int i = 0; i < oack.num_options; i++) {
+        if (strcasecmp(oack.options[i].name, BLKSIZE_NAME) == 0) {
+            transfer->blksize = strtol(oack.options[i].value, NULL, 10);
+        }
+        else if (strcasecmp(oack.options[i].name, WINDOWSIZE_NAME) == 0) {
+            transfer->windowsize = strtol(oack.options[i].value, NULL, 10);
+        }
+    }
+}
+
+/**
+* @brief Handle datagram received by transfer.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+* @param source_address Sender of datagram.
+* @param size Size of datagram.
+*
+* @return void
+*/
+static void bench_receive(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer, struct sockaddr_in *source_address,
+                          int size) {
+    char *packet = recv_buffer;
+    int opcode;
+    long block_number;
+
+    if (source_address->sin_addr.s_addr != transfer->server_address.sin_addr.s_addr || size < OPCODE_SIZE + BLOCK_NUMBER_SIZE) {
+        return;
+    }
+    if (!transfer->tid_known) {
+        transfer->server_address.sin_port = source_address->sin_port;
+        transfer->tid_known = true;
+    }
+    else if (source_address->sin_port != transfer->server_address.sin_port) {
+        return;
+    }
+    opcode = codec_get_u16(packet);
+    block_number = block_number_unwrap(transfer->block_number, codec_get_u16(packet + OPCODE_SIZE));
+    switch (opcode) {
+        case ERROR:
+            packet[size - 1] = '\0';
+            bench_finish(bench_args, stats, transfer, packet + OPCODE_SIZE + ERROR_CODE_SIZE);
+            return;
+        case OACK:
+            if (transfer->block_number != 0 || transfer->block_sent != 0) {
+                return;
+            }
+            bench_options_load(transfer, packet, size);
+            if (transfer->blksize < BLKSIZE_MIN || transfer->blksize > BLKSIZE_MAX ||
+                transfer->windowsize < WINDOWSIZE_MIN || transfer->windowsize > WINDOWSIZE_MAX) {
+                bench_finish(bench_args, stats, transfer, "Invalid OACK.");
+                return;
+            }
+            if (transfer->opcode == RRQ) {
+                bench_send_ack(bench_args, stats, transfer);
+                return;
+            }
+            // Server accepting WRQ is its first answer, OACK stands for ACK 0.
+            block_number = 0;
+            // fall through
+        case ACK:
+            if (transfer->opcode != WRQ || block_number < transfer->block_number || block_number > transfer->block_sent) {
+                return;
+            }
+            if (transfer->first_byte_at == 0) {
+                transfer->first_byte_at = time_now();
+                transfer->last_block = transfer->size / transfer->blksize + 1;
+            }
+            // Duplicate ACK is left to retransmission timer.
+            if (block_number == transfer->block_number && block_number != 0) {
+                return;
+            }
+            transfer->bytes += (block_number - transfer->block_number) * transfer->blksize;
+            transfer->block_number = block_number;
+            transfer->retries = 0;
+            if (block_number == transfer->last_block) {
+                transfer->bytes = transfer->size;
+                bench_finish(bench_args, stats, transfer, NULL);
+                return;
+            }
+            // ACK short of the window means server missed the block after it, window is sent again from there.
+            bench_send_window(bench_args, stats, transfer);
+            return;
+        case DATA:
+            if (transfer->opcode != RRQ || block_number == 0) {
+                return;
+            }
+            if (block_number != transfer->block_number + 1) {
+                // The first block after gap is acknowledged once, rest of window is dropped by server anyway.
+                if (block_number > transfer->block_number && !transfer->gap_acked) {
+                    transfer->gap_acked = true;
+                    transfer->window_count = 0;
+                    bench_send_ack(bench_args, stats, transfer);
+                }
+                return;
+            }
+            if (transfer->first_byte_at == 0) {
+                transfer->first_byte_at = time_now();
+            }
+            transfer->block_number = block_number;
+            transfer->bytes += size - 4;
+            transfer->gap_acked = false;
+            transfer->retries = 0;
+            transfer->deadline = time_now() + bench_args->rto;
+            if (size - 4 < transfer->blksize) {
+                bench_send_ack(bench_args, stats, transfer);
+                bench_finish(bench_args, stats, transfer, NULL);
+            }
+            else if (++transfer->window_count >= transfer->windowsize) {
+                transfer->window_count = 0;
+                bench_send_ack(bench_args, stats, transfer);
+            }
+            return;
+        default:
+            return;
+    }
+}
+
+/**
+* @brief Retransmit last request, ACK or window of transfer whose timer expired.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void bench_timeout(BenchArgs_t *bench_args, BenchStats_t *stats, BenchTransfer_t *transfer) {
+    if (++transfer->retries > MAX_RETRIES) {
+        bench_finish(bench_args, stats, transfer, "Transfer timed out.");
+        return;
+    }
+    stats->retransmissions++;
+    if (!transfer->tid_known) {
+        bench_send_request(bench_args, stats, transfer);
+    }
+    else if (transfer->opcode == RRQ) {
+        transfer->gap_acked = false;
+        transfer->window_count = 0;
+        bench_send_ack(bench_args, stats, transfer);
+    }
+    else {
+        bench_send_window(bench_args, stats, transfer);
+    }
+}
+
+/**
+* @brief Compare two longs for qsort.
+*
+* @param a Pointer to the first long.
+* @param b Pointer to the second long.
+*
+* @return Negative, zero or positive value like strcmp.
+*/
+static int bench_compare(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+* @brief Print percentiles of sorted samples as JSON object.
+*
+* @param name Key of object.
+* @param samples Sorted samples in microseconds.
+* @param count Number of samples.
+*
+* @return void
+*/
+static void bench_percentiles_print(char *name, long *samples, int count) {
+    const int percentiles[] = {50, 90, 99};
+    printf("\"%s\":{", name);
+    for (int i = 0; i < 3; i++) {
+        // Nearest rank, sample below which the given percentage of samples lies.
+        int rank = (percentiles[i] * count + 99) / 100;
+        printf("\"p%d\":%ld,", percentiles[i], count == 0 ? 0 : samples[rank - 1]);
+    }
+    printf("\"max\":%ld}", count == 0 ? 0 : samples[count - 1]);
+}
+
+/**
+* @brief Print results of run as one line of JSON.
+*
+* @param bench_args Pointer to load generator arguments.
+* @param stats Pointer to run results.
+* @param elapsed Duration of run in microseconds.
+*
+* @return void
+*/
+static void bench_report(BenchArgs_t *bench_args, BenchStats_t *stats, long elapsed) {
+    double seconds = elapsed / 1e6;
+    qsort(stats->ttfb, stats->completed, sizeof(long), bench_compare);
+    qsort(stats->completion, stats->completed, sizeof(long), bench_compare);
+    printf("{\"transfers\":%d,\"concurrency\":%d,\"rate\":%g,\"blksize\":%ld,\"windowsize\":%ld,", bench_args->transfers,
+           bench_args->concurrency, bench_args->rate, bench_args->blksize == 0 ? BLKSIZE_DEFAULT : bench_args->blksize,
+           bench_args->windowsize == 0 ? WINDOWSIZE_DEFAULT : bench_args->windowsize);
+    printf("\"reads\":%d,\"writes\":%d,\"completed\":%d,\"failed\":%d,\"bytes\":%ld,\"elapsed_us\":%ld,", stats->reads,
+           stats->writes, stats->completed, stats->failed, stats->bytes, elapsed);
+    printf("\"throughput_bytes_per_s\":%.0f,\"transfers_per_s\":%.2f,", stats->bytes / seconds, stats->completed / seconds);
+    printf("\"packets_sent\":%ld,\"packets_received\":%ld,\"retransmissions\":%ld,", stats->packets_sent, stats->packets_received,
+           stats->retransmissions);
+    bench_percentiles_print("ttfb_us", stats->ttfb, stats->completed);
+    printf(",");
+    bench_percentiles_print("completion_us", stats->completion, stats->completed);
+    printf("}\n");
+}
+
+/**
+*
+* @brief Main function of TFTP load generator.
+*
+* @param argc Number of command line arguments.
+* @param argv Command line arguments array.
+*
+* @return Program exit code, failure if any transfer failed.
+*
+*/
+int main(int argc, char *argv[]) {
+    BenchArgs_t bench_args;
+    BenchStats_t stats;
+    BenchTransfer_t *transfers;
+    struct epoll_event events[64];
+    struct sockaddr_in source_address;
+    socklen_t source_address_size;
+    int epoll_fd, ready, size, started = 0, active = 0, slot = 0, wait_ms;
+    long now, start_time, next_event;
+
+    init_args(&bench_args);
+    parse_args(argc, argv, &bench_args);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.ttfb = malloc(bench_args.transfers * sizeof(long));
+    stats.completion = malloc(bench_args.transfers * sizeof(long));
+    transfers = calloc(bench_args.concurrency, sizeof(BenchTransfer_t));
+    if (stats.ttfb == NULL || stats.completion == NULL || transfers == NULL) {
+        error_exit("Bench malloc failed.");
+    }
+    memset(send_buffer, 'b', sizeof(send_buffer));
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        error_exit("Epoll create failed.");
+    }
+
+    start_time = time_now();
+    while (stats.completed + stats.failed < bench_args.transfers) {
+        now = time_now();
+        // Open loop with rate, transfers are started on schedule as long as concurrency allows.
+        while (started < bench_args.transfers && active < bench_args.concurrency &&
+               (bench_args.rate == 0 || now >= start_time + (long)(started * 1e6 / bench_args.rate))) {
+            while (transfers[slot].active) {
+                slot = (slot + 1) % bench_args.concurrency;
+            }
+            if (!bench_start(&bench_args, &stats, &transfers[slot], started, epoll_fd, slot)) {
+                error_exit("Failed to create socket.");
+            }
+            started++;
+            active++;
+        }
+
+        // Wait until the nearest retransmission or scheduled start.
+        next_event = now + RTO_MAX;
+        if (bench_args.rate != 0 && started < bench_args.transfers && active < bench_args.concurrency) {
+            next_event = start_time + (long)(started * 1e6 / bench_args.rate);
+        }
+        for (int i = 0; i < bench_args.concurrency; i++) {
+            if (transfers[i].active && transfers[i].deadline < next_event) {
+                next_event = transfers[i].deadline;
+            }
+        }
+        wait_ms = next_event <= now ? 0 : (int)((next_event - now + 999) / 1000);
+        if ((ready = epoll_wait(epoll_fd, events, 64, wait_ms)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_exit("Epoll wait failed.");
+        }
+        for (int i = 0; i < ready; i++) {
+            BenchTransfer_t *transfer = &transfers[events[i].data.u32];
+            while (transfer->active) {
+                source_address_size = sizeof(source_address);
+                if ((size = recvfrom(transfer->socket, recv_buffer, sizeof(recv_buffer), 0, (struct sockaddr *)&source_address,
+                                     &source_address_size)) < 0) {
+                    break;
+                }
+                stats.packets_received++;
+                bench_receive(&bench_args, &stats, transfer, &source_address, size);
+            }
+            if (!transfer->active) {
+                active--;
+            }
+        }
+
+        now = time_now();
+        for (int i = 0; i < bench_args.concurrency; i++) {
+            if (transfers[i].active && transfers[i].deadline <= now) {
+                bench_timeout(&bench_args, &stats, &transfers[i]);
+                if (!transfers[i].active) {
+                    active--;
+                }
+            }
+        }
+    }
+
+    bench_report(&bench_args, &stats, time_now() - start_time);
+    close(epoll_fd);
+    free(transfers);
+    free(stats.ttfb);
+    free(stats.completion);
+    return stats.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+* @brief Parse comma separated list.
+*
+* @param list List string, it is split in place.
+* @param items Array to store items.
+*
+* @return Number of items.
+*/
+static int bench_list_parse(char *list, char **items) {
+    int count = 0;
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (count == BENCH_LIST_MAX) {
+            error_exit("Too many list items.");
+        }
+        items[count++] = item;
+    }
+    return count;
+}
+
+/**
+* @brief Parse size in bytes with optional K or M suffix.
+*
+* @param size_str Size string.
+*
+* @return Size in bytes.
+*/
+static long bench_size_parse(char *size_str) {
+    char *endptr = NULL;
+    long size = strtol(size_str, &endptr, 10);
+    if (*endptr == 'K' || *endptr == 'k') {
+        size *= 1024;
+        endptr++;
+    }
+    else if (*endptr == 'M' || *endptr == 'm') {
+        size *= 1024 * 1024;
+        endptr++;
+    }
+    if (*endptr != '\0' || endptr == size_str || size < 0) {
+        error_exit("Invalid file size.");
+    }
+    return size;
+}
+
+void init_args(BenchArgs_t *bench_args) {
+    memset(bench_args, 0, sizeof(BenchArgs_t));
+    bench_args->server_address.sin_family = AF_INET;
+    bench_args->server_address.sin_port = htons(DEFAULT_PORT_NUM);
+    bench_args->server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bench_args->transfers = BENCH_TRANSFERS_DEFAULT;
+    bench_args->concurrency = BENCH_CONCURRENCY_DEFAULT;
+    bench_args->rto = BENCH_RTO_DEFAULT;
+    bench_args->prefix = BENCH_PREFIX_DEFAULT;
+}
+
+void parse_args(int argc, char *argv[], BenchArgs_t *bench_args) {
+    if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+        display_bench_help();
+        exit(EXIT_SUCCESS);
+    }
+    int opt;
+    char *endptr = NULL, *sizes[BENCH_LIST_MAX];
+    while ((opt = getopt(argc, argv, "h:p:n:c:r:f:s:b:w:u:t:d:")) != -1) {
+        switch (opt) {
+            case 'h':
+                if (inet_pton(AF_INET, optarg, &bench_args->server_address.sin_addr) != 1) {
+                    error_exit("Invalid server address.");
+                }
+                break;
+            case 'p':
+                bench_args->server_address.sin_port = htons(parse_port(optarg));
+                break;
+            case 'n':
+                bench_args->transfers = (int)strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || bench_args->transfers < 1) {
+                    error_exit("Invalid number of transfers.");
+                }
+                break;
+            case 'c':
+                bench_args->concurrency = (int)strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || bench_args->concurrency < 1 || bench_args->concurrency > BENCH_CONCURRENCY_MAX) {
+                    error_exit("Invalid concurrency.");
+                }
+                break;
+            case 'r':
+                bench_args->rate = strtod(optarg, &endptr);
+                if (*endptr != '\0' || bench_args->rate < 0) {
+                    error_exit("Invalid request rate.");
+                }
+                break;
+            case 'f':
+                bench_args->num_files = bench_list_parse(optarg, bench_args->files);
+                break;
+            case 's':
+                bench_args->num_sizes = bench_list_parse(optarg, sizes);
+                for (int i = 0; i < bench_args->num_sizes; i++) {
+                    bench_args->sizes[i] = bench_size_parse(sizes[i]);
+                }
+                break;
+            case 'b':
+                bench_args->blksize = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || bench_args->blksize < BLKSIZE_MIN || bench_args->blksize > BLKSIZE_MAX) {
+                    error_exit("Invalid blksize.");
+                }
+                break;
+            case 'w':
+                bench_args->windowsize = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || bench_args->windowsize < WINDOWSIZE_MIN || bench_args->windowsize > WINDOWSIZE_MAX) {
+                    error_exit("Invalid windowsize.");
+                }
+                break;
+            case 'u':
+                bench_args->rto = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || bench_args->rto < RTO_MIN || bench_args->rto > RTO_MAX) {
+                    error_exit("Invalid retransmission timeout.");
+                }
+                break;
+            case 't':
+                bench_args->prefix = optarg;
+                break;
+            case 'd':
+                bench_args->dir_path = optarg;
+                break;
+            default:
+                error_exit("Invalid option.");
+        }
+    }
+    if (optind < argc) {
+        error_exit("Invalid number of arguments.");
+    }
+    if (bench_args->num_files == 0 && bench_args->num_sizes == 0) {
+        error_exit("Missing -f or -s.");
+    }
+}
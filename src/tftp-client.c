@@ -9,8 +9,24 @@
 #include "../include/tftp-client.h"
 
 /**
+* @brief Store result of transfer, local failure is reported, server's ERROR was already logged.
 *
-* @brief Main function of TFTP client.
+* @param transfer Pointer to finished transfer.
+* @param result Result of transfer.
+*
+* @return void
+*/
+static void client_done(TftpTransfer_t *transfer, int result) {
+    int *status = tftp_transfer_user(transfer);
+    *status = result;
+    if (result == TFTP_FAILED) {
+        fprintf(stdout, "Error: %s\n", tftp_transfer_error(transfer));
+    }
+}
+
+/**
+*
+* @brief Main function of TFTP client, single transfer or batch of transfers run by libtftp.
 *
 * @param argc Number of command line arguments.
 * @param argv Command line arguments array.
@@ -19,18 +35,11 @@
 *
 */
 int main(int argc, char *argv[]) {
-    // Server address.
-    struct sockaddr_in server_address;
-    memset(&server_address, 0, sizeof(server_address));
-    size_t server_address_size = sizeof(server_address);
-
-    // Packet attributes.
-    char *packet = calloc(DEFAULT_PACKET_SIZE, sizeof(char));
-    opcode = WRQ;
-    out_block_number = 0;
-    packet_pos = 0;
-    last = false;
-    int recvfrom_size;
+    TftpRequest_t request;
+    TftpClient_t *client;
+    int opcode = WRQ;
+    int result = TFTP_FAILED;
+    int status;
 
     // Initialize client arguments structure and its members.
     ClientArgs_t *client_args;
@@ -42,108 +51,60 @@ int main(int argc, char *argv[]) {
 
     // Parse command line arguments.
     parse_args(argc, argv, client_args, &opcode);
+    log_init(client_args->log_level);
 
-    // Handle client data stream.
-    file = client_data_stream(opcode, client_args);
-
-    // Create socket.
-    int sock_fd = init_socket(client_args->port, &server_address);
-
-    // Convert IP address from text to binary form.
-    inet_pton(AF_INET, client_args->host_name, &server_address.sin_addr);    
-
-    if (opcode == RRQ) {
-        send_request_packet(sock_fd, server_address, RRQ, client_args->file_path);
-        packet = realloc(packet, options[BLKSIZE].value + 4);
-        while (true) {
-            memset(packet, 0, options[BLKSIZE].value + 4);
-            if ((recvfrom_size = recvfrom(sock_fd, (char *)packet, options[BLKSIZE].value + 4, MSG_WAITALL, (struct sockaddr *)&server_address, (socklen_t *)&server_address_size)) < 0) {
-                error_exit("Recvfrom failed on client side.");
-            }
-            opcode = opcode_get(packet);
-            packet_pos = 0;
-            switch(opcode) {
-                case DATA:
-                    handle_data_packet(packet, ++out_block_number, file, recvfrom_size);
-                    break;
-                case ERROR:
-                    display_message(sock_fd, server_address, packet);
-                    fclose(file);
-                    exit(EXIT_FAILURE);
-                case OACK:
-                    handle_oack_packet(packet);
-                    recvfrom_size = options[BLKSIZE].value + 4;
-                    break;
-                default:
-                    error_exit("Invalid opcode.");
-            }
-            display_message(sock_fd, server_address, packet);
-            memset(packet, 0, options[BLKSIZE].value + 4);
-
-            send_ack_packet(sock_fd, server_address, out_block_number);
+    tftp_request_init(&request);
+    request.server.sin_port = htons(client_args->port);
+    if (inet_pton(AF_INET, client_args->host_name, &request.server.sin_addr) != 1) {
+        error_exit("Invalid IP address.");
+    }
+    request.netascii = client_args->netascii;
+    request.blksize = client_args->blksize;
+    request.tsize = client_args->tsize;
+    request.windowsize = client_args->windowsize;
+    request.timeout = client_args->timeout;
+    request.utimeout = client_args->utimeout;
+    request.multicast = client_args->multicast;
+    request.resume = client_args->resume;
+    request.compress = client_args->compress;
 
-            if (recvfrom_size < options[BLKSIZE].value + 4) {
-                fclose(file);
-                break;
-            }
-        }
+    if ((client = tftp_client_create()) == NULL) {
+        error_exit("Failed to create client.");
     }
-    else if (opcode == WRQ) {
-        send_request_packet(sock_fd, server_address, WRQ, client_args->dest_file_path);
-        packet = realloc(packet, options[BLKSIZE].value + 4);
-        if (recvfrom(sock_fd, (char *)packet, options[BLKSIZE].value + 4, MSG_WAITALL, (struct sockaddr *)&server_address, (socklen_t *)&server_address_size) < 0) {
-            error_exit("Recvfrom failed on client side.");
+    if (client_args->segments > 0) {
+        request.file_name = client_args->file_path;
+        status = segmented_download(client_args, &request);
+    }
+    else if (client_args->manifest_path[0] != '\0') {
+        ClientBatch_t batch = { .client = client, .request = request };
+        FILE *manifest = stdin;
+        if (strcmp(client_args->manifest_path, "-") != 0 && (manifest = fopen(client_args->manifest_path, "r")) == NULL) {
+            error_exit("Failed to open manifest.");
         }
-        opcode = opcode_get(packet);
-        packet_pos = 0;
-        switch (opcode) {
-            case ACK:
-                handle_ack_packet(packet, 0);
-                break;
-            case ERROR:
-                display_message(sock_fd, server_address, packet);
-                fclose(file);
-                exit(EXIT_FAILURE);
-            case OACK:
-                handle_oack_packet(packet);
-                break;
-            default:
-                error_exit("Invalid opcode.");
-        }
-        display_message(sock_fd, server_address, packet);
-        while(true) {
-            memset(packet, 0, options[BLKSIZE].value + 4);
-            last = send_data_packet(sock_fd, server_address, ++out_block_number, file);
-            memset(packet, 0, options[BLKSIZE].value + 4);
-            if (recvfrom(sock_fd, (char *)packet, options[BLKSIZE].value + 4, MSG_WAITALL, (struct sockaddr *)&server_address, (socklen_t *)&server_address_size) < 0) {
-                error_exit("Recvfrom failed on client side.");
-            }
-            opcode = opcode_get(packet);
-            packet_pos = 0;
-            switch (opcode) {
-                case ACK:
-                    handle_ack_packet(packet, out_block_number);
-                    display_message(sock_fd, server_address, packet);
-                    break;
-                case ERROR:
-                    display_message(sock_fd, server_address, packet);
-                    fclose(file);
-                    exit(EXIT_FAILURE);
-                default:
-                    error_exit("Invalid opcode.");
-            }
-            if (last == true) {
-                fclose(file);
-                break;
-            }
+        batch_load(&batch, manifest);
+        if (manifest != stdin) {
+            fclose(manifest);
         }
+        status = batch_run(&batch, client_args->jobs);
+        free(batch.jobs);
     }
     else {
-        error_exit("Invalid request.");
+        request.type = opcode == RRQ ? TFTP_GET : TFTP_PUT;
+        request.file_name = opcode == RRQ ? client_args->file_path : client_args->dest_file_path;
+        request.file = client_data_stream(opcode, client_args);
+        request.done = client_done;
+        request.user = &result;
+        if (tftp_transfer_start(client, &request) == NULL) {
+            error_exit(tftp_client_error(client));
+        }
+        if (tftp_client_run(client) < 0) {
+            error_exit("Poll failed.");
+        }
+        status = result == TFTP_OK ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    shutdown(sock_fd, SHUT_RDWR);
-    close(sock_fd);
-    return EXIT_SUCCESS;
+    tftp_client_destroy(client);
+    free_args(client_args);
+    return status;
 }
 
 void init_args(ClientArgs_t *client_args) {
@@ -151,7 +112,21 @@ void init_args(ClientArgs_t *client_args) {
     client_args->port = DEFAULT_PORT_NUM;
     client_args->file_path = calloc(MAX_FILE_NAME_LEN, sizeof(char));
     client_args->dest_file_path = calloc(MAX_FILE_NAME_LEN, sizeof(char));
-    if (client_args->host_name == NULL || client_args->file_path == NULL || client_args->dest_file_path == NULL) {
+    client_args->blksize = 0;
+    client_args->tsize = false;
+    client_args->windowsize = 0;
+    client_args->timeout = 0;
+    client_args->utimeout = 0;
+    client_args->multicast = false;
+    client_args->netascii = false;
+    client_args->resume = false;
+    client_args->compress = false;
+    client_args->segments = 0;
+    client_args->log_level = LOG_DEFAULT;
+    client_args->manifest_path = calloc(MAX_FILE_NAME_LEN, sizeof(char));
+    client_args->jobs = BATCH_JOBS_DEFAULT;
+    if (client_args->host_name == NULL || client_args->file_path == NULL || client_args->dest_file_path == NULL ||
+        client_args->manifest_path == NULL) {
         error_exit("Client args member malloc failed.");
     }
 }
@@ -160,6 +135,7 @@ void free_args(ClientArgs_t *client_args) {
     free(client_args->host_name);
     free(client_args->file_path);
     free(client_args->dest_file_path);
+    free(client_args->manifest_path);
     free(client_args);
 }
 
@@ -168,12 +144,13 @@ void parse_args(int argc, char *argv[], ClientArgs_t *client_args, int *opcode)
         display_client_help();
         exit(EXIT_SUCCESS);
     }
-    if (argc > 9 || argc < 5) { 
+    if (argc < 5) { 
         error_exit("Invalid number of arguments.");
     }
     int opt;
-    bool h_flag = false, p_flag = false, f_flag = false, t_flag = false;
-    while ((opt = getopt(argc, argv, ":h:p:f:t:")) != -1) {
+    char *endptr = NULL;
+    bool h_flag = false, p_flag = false, f_flag = false, t_flag = false, b_flag = false, w_flag = false, o_flag = false, u_flag = false, l_flag = false, B_flag = false, j_flag = false, P_flag = false;
+    while ((opt = getopt(argc, argv, ":h:p:f:t:b:sw:o:u:marcl:B:j:P:")) != -1) {
         switch (opt) {
             case 'h':
                 if (h_flag) {
@@ -205,6 +182,103 @@ void parse_args(int argc, char *argv[], ClientArgs_t *client_args, int *opcode)
                 strcpy(client_args->dest_file_path, optarg);
                 t_flag = true;
                 break;
+            case 'b':
+                if (b_flag) {
+                    error_exit("Duplicate flag -b.");
+                }
+                if (strcmp(optarg, "auto") == 0) {
+                    client_args->blksize = TFTP_BLKSIZE_AUTO;
+                }
+                else {
+                    client_args->blksize = strtol(optarg, &endptr, 10);
+                    if (*endptr != '\0' || client_args->blksize < BLKSIZE_MIN || client_args->blksize > BLKSIZE_MAX) {
+                        error_exit("Invalid blksize.");
+                    }
+                }
+                b_flag = true;
+                break;
+            case 's':
+                client_args->tsize = true;
+                break;
+            case 'w':
+                if (w_flag) {
+                    error_exit("Duplicate flag -w.");
+                }
+                client_args->windowsize = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || client_args->windowsize < WINDOWSIZE_MIN || client_args->windowsize > WINDOWSIZE_MAX) {
+                    error_exit("Invalid windowsize.");
+                }
+                w_flag = true;
+                break;
+            case 'o':
+                if (o_flag) {
+                    error_exit("Duplicate flag -o.");
+                }
+                client_args->timeout = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || client_args->timeout < TIMEOUT_MIN || client_args->timeout > TIMEOUT_MAX) {
+                    error_exit("Invalid timeout.");
+                }
+                o_flag = true;
+                break;
+            case 'u':
+                if (u_flag) {
+                    error_exit("Duplicate flag -u.");
+                }
+                client_args->utimeout = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || client_args->utimeout < UTIMEOUT_MIN || client_args->utimeout > UTIMEOUT_MAX) {
+                    error_exit("Invalid utimeout.");
+                }
+                u_flag = true;
+                break;
+            case 'm':
+                client_args->multicast = true;
+                break;
+            case 'a':
+                client_args->netascii = true;
+                break;
+            case 'r':
+                client_args->resume = true;
+                break;
+            case 'c':
+                client_args->compress = true;
+                break;
+            case 'l':
+                if (l_flag) {
+                    error_exit("Duplicate flag -l.");
+                }
+                client_args->log_level = parse_log_level(optarg);
+                l_flag = true;
+                break;
+            case 'B':
+                if (B_flag) {
+                    error_exit("Duplicate flag -B.");
+                }
+                if (strlen(optarg) >= MAX_FILE_NAME_LEN) {
+                    error_exit("Manifest path too long.");
+                }
+                strcpy(client_args->manifest_path, optarg);
+                B_flag = true;
+                break;
+            case 'j':
+                if (j_flag) {
+                    error_exit("Duplicate flag -j.");
+                }
+                client_args->jobs = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || client_args->jobs < 1 || client_args->jobs > BATCH_JOBS_MAX) {
+                    error_exit("Invalid number of jobs.");
+                }
+                j_flag = true;
+                break;
+            case 'P':
+                if (P_flag) {
+                    error_exit("Duplicate flag -P.");
+                }
+                client_args->segments = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || client_args->segments < 1 || client_args->segments > SEGMENTS_MAX) {
+                    error_exit("Invalid number of segments.");
+                }
+                P_flag = true;
+                break;
             case ':':
                 error_exit("Missing argument.");
                 break;
@@ -212,7 +286,7 @@ void parse_args(int argc, char *argv[], ClientArgs_t *client_args, int *opcode)
                 error_exit("Argument error.");
         }
         if (argv[optind] != NULL) {
-            if ((strcmp(argv[optind], "-h") != 0) && (strcmp(argv[optind], "-p") != 0) && (strcmp(argv[optind], "-f") != 0) && (strcmp(argv[optind], "-t") != 0)) {
+            if (argv[optind][0] != '-') {
                 error_exit("Flag must have only one argument.");
             }
         }
@@ -220,23 +294,449 @@ void parse_args(int argc, char *argv[], ClientArgs_t *client_args, int *opcode)
     if (h_flag == false) {
         error_exit("Missing flag -h.");
     }
-    if (t_flag == false) {
+    if (j_flag && !B_flag) {
+        error_exit("Flag -j requires -B.");
+    }
+    if (B_flag && (f_flag || t_flag)) {
+        error_exit("Flag -B cannot be combined with -f or -t.");
+    }
+    if (t_flag == false && !B_flag) {
         error_exit("Missing flag -t.");
     }
+    // Batch requests multicast for its reads only.
+    if (client_args->multicast && *opcode != RRQ && !B_flag) {
+        error_exit("Flag -m requires -f.");
+    }
+    // Multicast blocks arrive out of order, netascii can only be decoded in order.
+    if (client_args->multicast && client_args->netascii) {
+        error_exit("Flag -m cannot be combined with -a.");
+    }
+    // Offset counts raw bytes of one receiver.
+    if (client_args->resume && (client_args->multicast || client_args->netascii)) {
+        error_exit("Flag -r cannot be combined with -m or -a.");
+    }
+    // Ranges are raw bytes of one file read over unicast sessions.
+    if (P_flag && (*opcode != RRQ || B_flag)) {
+        error_exit("Flag -P requires -f.");
+    }
+    if (P_flag && (client_args->multicast || client_args->netascii || client_args->resume)) {
+        error_exit("Flag -P cannot be combined with -m, -a or -r.");
+    }
+    // Compressed stream has its own framing, it is not split by file offsets and not shared by a group.
+    if (client_args->compress && (client_args->multicast || client_args->netascii || client_args->resume || P_flag)) {
+        error_exit("Flag -c cannot be combined with -m, -a, -r or -P.");
+    }
 }
 
 FILE *client_data_stream(int opcode, ClientArgs_t *client_args) {
+    FILE *file;
     if (opcode == RRQ) {
-        if (access(client_args->dest_file_path, F_OK) != -1) {
+        bool exists = access(client_args->dest_file_path, F_OK) != -1;
+        if (exists && !client_args->resume) {
             error_exit("File already exists.");
         }
-        file = fopen(client_args->dest_file_path, "w");
+        // Resumed download continues existing file, it is read for CRC and truncated to what server confirms.
+        file = fopen(client_args->dest_file_path, exists ? "r+" : "w");
         if (file == NULL) {
             error_exit("Failed to open file.");
         }
     }
     else {
         file = stdin;
+        // Blocks are read at their offsets, so data from pipe is spooled to temporary file first.
+        if (fseek(file, 0, SEEK_CUR) < 0) {
+            if ((file = tmpfile()) == NULL) {
+                error_exit("Failed to create temporary file.");
+            }
+            char buffer[BUFSIZ];
+            size_t size;
+            while ((size = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+                if (fwrite(buffer, 1, size, file) != size) {
+                    error_exit("Failed to write temporary file.");
+                }
+            }
+            rewind(file);
+        }
     }
     return file;
-}
\ No newline at end of file
+}
+/**
+* @brief Get last component of path.
+*
+* @param path Path to file.
+*
+* @return Pointer to file name inside path.
+*/
+static const char *batch_base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+/**
+* @brief Exit with error message that refers to line of manifest.
+*
+* @param line Line number.
+* @param message Error message.
+*
+* @return void
+*/
+static void batch_line_error(long line, const char *message) {
+    char buffer[MAX_STR_LEN];
+    snprintf(buffer, sizeof(buffer), "Manifest line %ld: %s", line, message);
+    errno = 0;
+    error_exit(buffer);
+}
+
+void batch_load(ClientBatch_t *batch, FILE *manifest) {
+    char *line = NULL;
+    size_t line_size = 0;
+    long line_number = 0;
+
+    while (getline(&line, &line_size, manifest) != -1) {
+        char *tokens[4];
+        char *save = NULL;
+        char *comment = strchr(line, '#');
+        int count = 0;
+        BatchJob_t *job;
+        const char *remote, *local;
+
+        line_number++;
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save)) {
+            if (count == 4) {
+                batch_line_error(line_number, "Too many fields.");
+            }
+            tokens[count++] = token;
+        }
+        if (count == 0) {
+            continue;
+        }
+        if (batch->count == batch->capacity) {
+            long capacity = batch->capacity == 0 ? 64 : batch->capacity * 2;
+            BatchJob_t *jobs = realloc(batch->jobs, capacity * sizeof(BatchJob_t));
+            if (jobs == NULL) {
+                error_exit("Batch jobs realloc failed.");
+            }
+            batch->jobs = jobs;
+            batch->capacity = capacity;
+        }
+        job = &batch->jobs[batch->count];
+        memset(job, 0, sizeof(BatchJob_t));
+        job->line = line_number;
+        job->batch = batch;
+
+        // Bare name reads file into current directory.
+        if (count == 1) {
+            job->type = TFTP_GET;
+            remote = tokens[0];
+            local = batch_base_name(remote);
+        }
+        else if (strcmp(tokens[0], "get") == 0 && count <= 3) {
+            job->type = TFTP_GET;
+            remote = tokens[1];
+            local = count == 3 ? tokens[2] : batch_base_name(remote);
+        }
+        else if (strcmp(tokens[0], "put") == 0 && count <= 3) {
+            job->type = TFTP_PUT;
+            local = tokens[1];
+            remote = count == 3 ? tokens[2] : batch_base_name(local);
+        }
+        else {
+            batch_line_error(line_number, "Expected \"get remote [local]\" or \"put local [remote]\".");
+        }
+        if (strlen(remote) >= MAX_FILE_NAME_LEN || strlen(local) >= MAX_FILE_NAME_LEN) {
+            batch_line_error(line_number, "File name too long.");
+        }
+        if (*remote == '\0' || *local == '\0') {
+            batch_line_error(line_number, "File name cannot be empty.");
+        }
+        strcpy(job->remote, remote);
+        strcpy(job->local, local);
+        batch->count++;
+    }
+    free(line);
+    if (ferror(manifest)) {
+        error_exit("Failed to read manifest.");
+    }
+}
+
+/**
+* @brief Print throughput of bytes moved in given time.
+*
+* @param bytes Number of bytes.
+* @param duration Duration in microseconds.
+*
+* @return void
+*/
+static void batch_print_rate(long bytes, long duration) {
+    double seconds = duration / 1000000.0;
+    fprintf(stdout, "%ld bytes in %.3f s (%.2f MiB/s)\n", bytes, seconds,
+        seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0);
+}
+
+/**
+* @brief Record result of finished or unstartable job and print it.
+*
+* @param batch Pointer to batch.
+* @param job Pointer to job.
+* @param result Result of job.
+* @param error_msg Error message, NULL on success.
+*
+* @return void
+*/
+static void batch_finish(ClientBatch_t *batch, BatchJob_t *job, int result, const char *error_msg) {
+    struct stat file_stat;
+    job->result = result;
+    job->duration = time_now() - job->start;
+    if (job->type == TFTP_GET) {
+        fprintf(stdout, "get %s -> %s: ", job->remote, job->local);
+    }
+    else {
+        fprintf(stdout, "put %s -> %s: ", job->local, job->remote);
+    }
+    if (result != TFTP_OK) {
+        // Partial download would block rerun of the same manifest, resumed batch continues it instead.
+        if (job->created && !batch->request.resume) {
+            unlink(job->local);
+        }
+        batch->failed++;
+        fprintf(stdout, "Error: %s\n", error_msg);
+        return;
+    }
+    if (job->type == TFTP_GET) {
+        job->bytes = stat(job->local, &file_stat) == 0 ? file_stat.st_size : 0;
+    }
+    job->bytes -= job->offset;
+    batch->bytes += job->bytes;
+    batch_print_rate(job->bytes, job->duration);
+}
+
+/**
+* @brief Record result of finished job and start next one in its place.
+*
+* @param transfer Pointer to finished transfer.
+* @param result Result of transfer.
+*
+* @return void
+*/
+static void batch_done(TftpTransfer_t *transfer, int result);
+
+/**
+* @brief Start pending jobs until limit of running ones is reached, jobs that cannot start fail at once.
+*
+* @param batch Pointer to batch.
+*
+* @return void
+*/
+static void batch_fill(ClientBatch_t *batch) {
+    while (batch->running < batch->limit && batch->next < batch->count) {
+        BatchJob_t *job = &batch->jobs[batch->next++];
+        TftpRequest_t request = batch->request;
+        FILE *file;
+
+        job->start = time_now();
+        if (job->type == TFTP_GET) {
+            bool exists = access(job->local, F_OK) != -1;
+            if (exists && !request.resume) {
+                batch_finish(batch, job, TFTP_FAILED, "File already exists.");
+                continue;
+            }
+            if ((file = fopen(job->local, exists ? "r+" : "w")) == NULL) {
+                batch_finish(batch, job, TFTP_FAILED, "Failed to open file.");
+                continue;
+            }
+            job->created = !exists;
+        }
+        else {
+            if ((file = fopen(job->local, "r")) == NULL) {
+                batch_finish(batch, job, TFTP_FAILED, "Failed to open file.");
+                continue;
+            }
+            job->bytes = file_size_get(file);
+            request.multicast = false;
+        }
+        request.type = job->type;
+        request.file_name = job->remote;
+        request.file = file;
+        request.done = batch_done;
+        request.user = job;
+        if (tftp_transfer_start(batch->client, &request) == NULL) {
+            batch_finish(batch, job, TFTP_FAILED, tftp_client_error(batch->client));
+            continue;
+        }
+        batch->running++;
+    }
+}
+
+static void batch_done(TftpTransfer_t *transfer, int result) {
+    BatchJob_t *job = tftp_transfer_user(transfer);
+    ClientBatch_t *batch = job->batch;
+    batch->running--;
+    job->offset = tftp_transfer_offset(transfer);
+    batch_finish(batch, job, result, tftp_transfer_error(transfer));
+    batch_fill(batch);
+}
+
+int batch_run(ClientBatch_t *batch, long jobs) {
+    long start = time_now();
+    batch->limit = jobs;
+    batch_fill(batch);
+    if (tftp_client_run(batch->client) < 0) {
+        error_exit("Poll failed.");
+    }
+    fprintf(stdout, "Batch: %ld jobs, %ld failed, ", batch->count, batch->failed);
+    batch_print_rate(batch->bytes, time_now() - start);
+    return batch->failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+* @brief Write block of segment to shared destination at its offset.
+*
+* @param user Pointer to segment.
+* @param buffer Block data.
+* @param size Size of block data.
+* @param offset Offset of block in file.
+*
+* @return True on success, false otherwise.
+*/
+static bool segment_write(void *user, const char *buffer, long size, long offset) {
+    Segment_t *segment = user;
+    long written = 0;
+    ssize_t result;
+    while (written < size) {
+        if ((result = pwrite(segment->fd, buffer + written, size - written, offset + written)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += result;
+    }
+    return true;
+}
+
+/**
+* @brief Store result of segment's transfer, transfer is freed right after.
+*
+* @param transfer Pointer to finished transfer.
+* @param result Result of transfer.
+*
+* @return void
+*/
+static void segment_done(TftpTransfer_t *transfer, int result) {
+    Segment_t *segment = tftp_transfer_user(transfer);
+    segment->result = result;
+    segment->ranged = tftp_transfer_range(transfer);
+    segment->size = tftp_transfer_size(transfer);
+    if (result != TFTP_OK) {
+        segment->error_code = tftp_transfer_error_code(transfer);
+        snprintf(segment->error, sizeof(segment->error), "%s", tftp_transfer_error(transfer));
+    }
+}
+
+/**
+* @brief Run transfer of one segment with own client, segments share nothing but destination descriptor.
+*
+* @param arg Pointer to segment.
+*
+* @return NULL
+*/
+static void *segment_run(void *arg) {
+    Segment_t *segment = arg;
+    TftpClient_t *client = tftp_client_create();
+    segment->result = TFTP_FAILED;
+    if (client == NULL) {
+        snprintf(segment->error, sizeof(segment->error), "Failed to create client.");
+        return NULL;
+    }
+    segment->request.write = segment_write;
+    segment->request.done = segment_done;
+    segment->request.user = segment;
+    if (tftp_transfer_start(client, &segment->request) == NULL) {
+        snprintf(segment->error, sizeof(segment->error), "%s", tftp_client_error(client));
+    }
+    else if (tftp_client_run(client) < 0) {
+        snprintf(segment->error, sizeof(segment->error), "Poll failed.");
+    }
+    tftp_client_destroy(client);
+    return NULL;
+}
+
+/**
+* @brief Check result of segment, local failure is reported, server's ERROR was already logged.
+*
+* @param segment Pointer to segment.
+*
+* @return True if segment succeeded, false otherwise.
+*/
+static bool segment_check(Segment_t *segment) {
+    if (segment->result == TFTP_FAILED) {
+        fprintf(stdout, "Error: %s\n", segment->error);
+    }
+    return segment->result == TFTP_OK;
+}
+
+int segmented_download(ClientArgs_t *client_args, TftpRequest_t *request) {
+    Segment_t probe = { .request = *request, .fd = -1 };
+    Segment_t *segments;
+    long count = client_args->segments, length, started = 0;
+    bool ok = true;
+
+    if (access(client_args->dest_file_path, F_OK) != -1) {
+        error_exit("File already exists.");
+    }
+    if ((probe.fd = open(client_args->dest_file_path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) {
+        error_exit("Failed to open file.");
+    }
+    // Empty range learns file size and whether server has the extension, server without it sends whole file.
+    probe.request.type = TFTP_GET;
+    probe.request.tsize = true;
+    probe.request.range = true;
+    probe.request.range_start = 0;
+    probe.request.range_length = 0;
+    segment_run(&probe);
+    if ((probe.result == TFTP_REJECTED && (probe.error_code == ERR_ILLEGAL_OPERATION || probe.error_code == ERR_OPTION_NEGOTIATION)) ||
+        (probe.result == TFTP_OK && probe.ranged && probe.size == -1)) {
+        // Server rejecting unknown option or range without tsize gets plain request, file is read over one session.
+        probe.request.range = false;
+        probe.request.tsize = request->tsize;
+        segment_run(&probe);
+        ok = segment_check(&probe);
+    }
+    else if (!segment_check(&probe)) {
+        ok = false;
+    }
+    else if (probe.ranged && probe.size > 0) {
+        if ((segments = calloc(count, sizeof(Segment_t))) == NULL) {
+            error_exit("Segments malloc failed.");
+        }
+        length = (probe.size + count - 1) / count;
+        if (ftruncate(probe.fd, probe.size) < 0) {
+            error_exit("Failed to allocate file.");
+        }
+        for (long i = 0; i < count && i * length < probe.size; i++) {
+            segments[i].request = probe.request;
+            segments[i].request.tsize = false;
+            segments[i].request.range_start = i * length;
+            segments[i].request.range_length = probe.size - i * length < length ? probe.size - i * length : length;
+            segments[i].fd = probe.fd;
+            if (pthread_create(&segments[i].thread, NULL, segment_run, &segments[i]) != 0) {
+                error_exit("Failed to start segment thread.");
+            }
+            started++;
+        }
+        for (long i = 0; i < started; i++) {
+            pthread_join(segments[i].thread, NULL);
+            ok = segment_check(&segments[i]) && ok;
+        }
+        free(segments);
+    }
+    close(probe.fd);
+    // Download with holes is of no use, it is removed.
+    if (!ok) {
+        unlink(client_args->dest_file_path);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,454 @@
+//
+// File: tftp-proxy.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of UDP impairment proxy, datagrams between TFTP client and server are dropped,
+//              duplicated, delayed and reordered on the way.
+//
+
+#include "../include/tftp-proxy.h"
+
+static ProxyArgs_t proxy_args;
+static ProxyFlow_t flows[PROXY_MAX_FLOWS];
+static ProxyLink_t links[2];
+
+// Min-heap of datagrams waiting for delivery, ordered by delivery time and arrival.
+static ProxyPacket_t **queue = NULL;
+static int queue_size = 0, queue_capacity = 0;
+static long sequence = 0;
+
+static uint64_t random_state;
+static volatile sig_atomic_t stop = 0;
+
+/**
+* @brief Stop proxy loop, statistics are printed before exit.
+*
+* @param sig Signal number.
+*
+* @return void
+*/
+static void proxy_stop(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+/**
+* @brief Draw random number from seeded xorshift generator, runs with the same seed impair the same datagrams.
+*
+* @return Random number in range [0, 1).
+*/
+static double proxy_random() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return ((random_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+* @brief Compare two queued datagrams.
+*
+* @param a Pointer to the first datagram.
+* @param b Pointer to the second datagram.
+*
+* @return True if a is delivered before b.
+*/
+static bool proxy_packet_before(ProxyPacket_t *a, ProxyPacket_t *b) {
+    return a->deliver_at < b->deliver_at || (a->deliver_at == b->deliver_at && a->sequence < b->sequence);
+}
+
+/**
+* @brief Insert datagram into delivery queue.
+*
+* @param packet Pointer to datagram.
+*
+* @return void
+*/
+static void proxy_queue_push(ProxyPacket_t *packet) {
+    int i, parent;
+    if (queue_size == queue_capacity) {
+        queue_capacity = queue_capacity == 0 ? 1024 : 2 * queue_capacity;
+        if ((queue = realloc(queue, queue_capacity * sizeof(ProxyPacket_t *))) == NULL) {
+            error_exit("Queue malloc failed.");
+        }
+    }
+    for (i = queue_size++; i > 0 && proxy_packet_before(packet, queue[parent = (i - 1) / 2]); i = parent) {
+        queue[i] = queue[parent];
+    }
+    queue[i] = packet;
+}
+
+/**
+* @brief Remove the first datagram from delivery queue.
+*
+* @return Pointer to datagram.
+*/
+static ProxyPacket_t *proxy_queue_pop() {
+    ProxyPacket_t *first = queue[0], *last = queue[--queue_size];
+    int i = 0, child;
+    while ((child = 2 * i + 1) < queue_size) {
+        if (child + 1 < queue_size && proxy_packet_before(queue[child + 1], queue[child])) {
+            child++;
+        }
+        if (!proxy_packet_before(queue[child], last)) {
+            break;
+        }
+        queue[i] = queue[child];
+        i = child;
+    }
+    queue[i] = last;
+    return first;
+}
+
+/**
+* @brief Pass datagram through emulated link, it is dropped or queued once or twice with its delivery time.
+*
+* @param flow Index of flow.
+* @param direction PROXY_TO_SERVER or PROXY_TO_CLIENT.
+* @param data Datagram.
+* @param size Size of datagram.
+*
+* @return void
+*/
+static void proxy_impair(int flow, int direction, char *data, int size) {
+    ProxyLink_t *link = &links[direction];
+    ProxyPacket_t *packet;
+    long now = time_now(), deliver_at;
+    int copies = 1;
+
+    link->received++;
+    if (proxy_random() * 100 < proxy_args.loss) {
+        link->lost++;
+        return;
+    }
+    if (proxy_random() * 100 < proxy_args.duplicate) {
+        link->duplicated++;
+        copies = 2;
+    }
+    for (int i = 0; i < copies; i++) {
+        if (link->queued >= proxy_args.queue_limit) {
+            link->overflowed++;
+            continue;
+        }
+        // Datagram waits behind those already on the link, then travels for delay with jitter.
+        deliver_at = now;
+        if (proxy_args.bandwidth > 0) {
+            if (link->busy_until < now) {
+                link->busy_until = now;
+            }
+            link->busy_until += size * 8 * 1000L / proxy_args.bandwidth;
+            deliver_at = link->busy_until;
+        }
+        deliver_at += proxy_args.delay;
+        if (proxy_args.jitter > 0) {
+            deliver_at += (long)((2 * proxy_random() - 1) * proxy_args.jitter);
+        }
+        if (proxy_random() * 100 < proxy_args.reorder) {
+            link->reordered++;
+            deliver_at += proxy_args.reorder_delay;
+        }
+        if ((packet = malloc(sizeof(ProxyPacket_t) + size)) == NULL) {
+            error_exit("Packet malloc failed.");
+        }
+        packet->deliver_at = deliver_at < now ? now : deliver_at;
+        packet->sequence = sequence++;
+        packet->flow = flow;
+        packet->direction = direction;
+        packet->size = size;
+        memcpy(packet->data, data, size);
+        proxy_queue_push(packet);
+        link->queued++;
+        flows[flow].queued++;
+    }
+}
+
+/**
+* @brief Send datagrams whose delivery time has come.
+*
+* @return void
+*/
+static void proxy_deliver() {
+    ProxyPacket_t *packet;
+    ProxyFlow_t *flow;
+    long now = time_now();
+    while (queue_size > 0 && queue[0]->deliver_at <= now) {
+        packet = proxy_queue_pop();
+        flow = &flows[packet->flow];
+        if (packet->direction == PROXY_TO_SERVER) {
+            sendto(flow->upstream, packet->data, packet->size, 0, (struct sockaddr *)&flow->server_address, sizeof(flow->server_address));
+        }
+        else {
+            sendto(flow->downstream, packet->data, packet->size, 0, (struct sockaddr *)&flow->client_address, sizeof(flow->client_address));
+        }
+        links[packet->direction].queued--;
+        links[packet->direction].sent++;
+        flow->queued--;
+        free(packet);
+    }
+}
+
+/**
+* @brief Find flow of client or open new one with own upstream and downstream socket.
+*
+* @param client_address Client address.
+* @param epoll_fd Epoll instance.
+*
+* @return Index of flow, -1 if there is no free flow.
+*/
+static int proxy_flow_get(struct sockaddr_in *client_address, int epoll_fd) {
+    struct sockaddr_in addr;
+    struct epoll_event event;
+    int free_flow = -1;
+    ProxyFlow_t *flow;
+
+    for (int i = 0; i < PROXY_MAX_FLOWS; i++) {
+        if (!flows[i].active) {
+            free_flow = free_flow < 0 ? i : free_flow;
+        }
+        else if (flows[i].client_address.sin_addr.s_addr == client_address->sin_addr.s_addr &&
+                 flows[i].client_address.sin_port == client_address->sin_port) {
+            return i;
+        }
+    }
+    if (free_flow < 0) {
+        return -1;
+    }
+    flow = &flows[free_flow];
+    memset(flow, 0, sizeof(ProxyFlow_t));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((flow->upstream = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+        (flow->downstream = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(flow->upstream, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        bind(flow->downstream, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        error_exit("Failed to create flow socket.");
+    }
+    // Event data is flow index with direction the socket receives for.
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t)free_flow << 1 | PROXY_TO_CLIENT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, flow->upstream, &event);
+    event.data.u64 = (uint64_t)free_flow << 1 | PROXY_TO_SERVER;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, flow->downstream, &event);
+    flow->client_address = *client_address;
+    flow->server_address = proxy_args.server_address;
+    flow->active = true;
+    return free_flow;
+}
+
+/**
+* @brief Close flows idle for PROXY_FLOW_IDLE with nothing waiting for delivery.
+*
+* @return void
+*/
+static void proxy_flows_expire() {
+    long now = time_now();
+    for (int i = 0; i < PROXY_MAX_FLOWS; i++) {
+        if (flows[i].active && flows[i].queued == 0 && now - flows[i].last_active > PROXY_FLOW_IDLE) {
+            close(flows[i].upstream);
+            close(flows[i].downstream);
+            flows[i].active = false;
+        }
+    }
+}
+
+/**
+* @brief Print statistics of both directions as one line of JSON.
+*
+* @return void
+*/
+static void proxy_report() {
+    const char *names[2] = {"to_server", "to_client"};
+    printf("{");
+    for (int i = 0; i < 2; i++) {
+        printf("\"%s\":{\"received\":%ld,\"sent\":%ld,\"lost\":%ld,\"overflowed\":%ld,\"duplicated\":%ld,\"reordered\":%ld}%s", names[i],
+               links[i].received, links[i].sent, links[i].lost, links[i].overflowed, links[i].duplicated, links[i].reordered,
+               i == 0 ? "," : "}\n");
+    }
+    fflush(stdout);
+}
+
+/**
+*
+* @brief Main function of UDP impairment proxy.
+*
+* @param argc Number of command line arguments.
+* @param argv Command line arguments array.
+*
+* @return Program exit code.
+*
+*/
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr, source_address;
+    socklen_t source_address_size;
+    struct epoll_event event, events[64];
+    char buffer[BLKSIZE_MAX + 4];
+    int listen_fd, epoll_fd, ready, size, index, direction, wait_ms;
+    long now, last_expire;
+    ProxyFlow_t *flow;
+
+    init_args(&proxy_args);
+    parse_args(argc, argv, &proxy_args);
+    random_state = proxy_args.seed;
+    signal(SIGINT, proxy_stop);
+    signal(SIGTERM, proxy_stop);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    listen_fd = init_socket(proxy_args.port, &addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        error_exit("Failed to bind socket.");
+    }
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        error_exit("Epoll create failed.");
+    }
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+    event.events = EPOLLIN;
+    // Listening socket is marked by index past the last flow.
+    event.data.u64 = (uint64_t)PROXY_MAX_FLOWS << 1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    last_expire = time_now();
+    while (!stop) {
+        now = time_now();
+        wait_ms = queue_size == 0 ? 1000 : queue[0]->deliver_at <= now ? 0 : (int)((queue[0]->deliver_at - now + 999) / 1000);
+        if ((ready = epoll_wait(epoll_fd, events, 64, wait_ms)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_exit("Epoll wait failed.");
+        }
+        for (int i = 0; i < ready; i++) {
+            index = events[i].data.u64 >> 1;
+            direction = events[i].data.u64 & 1;
+            while (true) {
+                source_address_size = sizeof(source_address);
+                int fd = index == PROXY_MAX_FLOWS ? listen_fd : direction == PROXY_TO_SERVER ? flows[index].downstream : flows[index].upstream;
+                if ((size = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_address, &source_address_size)) < 0) {
+                    break;
+                }
+                if (index == PROXY_MAX_FLOWS) {
+                    // Request (or its retransmission) goes to server's listening port through client's flow.
+                    int flow_index = proxy_flow_get(&source_address, epoll_fd);
+                    if (flow_index < 0) {
+                        continue;
+                    }
+                    flow = &flows[flow_index];
+                    flow->server_address.sin_port = proxy_args.server_address.sin_port;
+                    flow->last_active = time_now();
+                    proxy_impair(flow_index, PROXY_TO_SERVER, buffer, size);
+                    continue;
+                }
+                flow = &flows[index];
+                if (direction == PROXY_TO_SERVER) {
+                    if (source_address.sin_addr.s_addr != flow->client_address.sin_addr.s_addr ||
+                        source_address.sin_port != flow->client_address.sin_port) {
+                        continue;
+                    }
+                }
+                else {
+                    if (source_address.sin_addr.s_addr != proxy_args.server_address.sin_addr.s_addr) {
+                        continue;
+                    }
+                    // Server answered from its TID, client's next datagrams on downstream socket go there.
+                    flow->server_address.sin_port = source_address.sin_port;
+                }
+                flow->last_active = time_now();
+                proxy_impair(index, direction, buffer, size);
+            }
+        }
+        proxy_deliver();
+        if (time_now() - last_expire > PROXY_FLOW_IDLE / 10) {
+            proxy_flows_expire();
+            last_expire = time_now();
+        }
+    }
+
+    proxy_report();
+    return EXIT_SUCCESS;
+}
+
+/**
+* @brief Parse non-negative number.
+*
+* @param value_str Number string.
+* @param max Upper limit.
+* @param error_msg Message printed if number is invalid.
+*
+* @return Parsed number.
+*/
+static double proxy_number_parse(char *value_str, double max, char *error_msg) {
+    char *endptr = NULL;
+    double value = strtod(value_str, &endptr);
+    if (*endptr != '\0' || endptr == value_str || value < 0 || value > max) {
+        error_exit(error_msg);
+    }
+    return value;
+}
+
+void init_args(ProxyArgs_t *proxy_args) {
+    memset(proxy_args, 0, sizeof(ProxyArgs_t));
+    proxy_args->port = PROXY_PORT_DEFAULT;
+    proxy_args->server_address.sin_family = AF_INET;
+    proxy_args->server_address.sin_port = htons(DEFAULT_PORT_NUM);
+    proxy_args->server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    proxy_args->reorder_delay = PROXY_REORDER_DELAY_DEFAULT * 1000L;
+    proxy_args->queue_limit = PROXY_QUEUE_DEFAULT;
+    proxy_args->seed = PROXY_SEED_DEFAULT;
+}
+
+void parse_args(int argc, char *argv[], ProxyArgs_t *proxy_args) {
+    if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+        display_proxy_help();
+        exit(EXIT_SUCCESS);
+    }
+    int opt;
+    while ((opt = getopt(argc, argv, "l:h:p:L:d:j:D:r:R:b:q:s:")) != -1) {
+        switch (opt) {
+            case 'l':
+                proxy_args->port = parse_port(optarg);
+                break;
+            case 'h':
+                if (inet_pton(AF_INET, optarg, &proxy_args->server_address.sin_addr) != 1) {
+                    error_exit("Invalid server address.");
+                }
+                break;
+            case 'p':
+                proxy_args->server_address.sin_port = htons(parse_port(optarg));
+                break;
+            case 'L':
+                proxy_args->loss = proxy_number_parse(optarg, 100, "Invalid loss.");
+                break;
+            case 'd':
+                proxy_args->delay = (long)(proxy_number_parse(optarg, 60000, "Invalid delay.") * 1000);
+                break;
+            case 'j':
+                proxy_args->jitter = (long)(proxy_number_parse(optarg, 60000, "Invalid jitter.") * 1000);
+                break;
+            case 'D':
+                proxy_args->duplicate = proxy_number_parse(optarg, 100, "Invalid duplication.");
+                break;
+            case 'r':
+                proxy_args->reorder = proxy_number_parse(optarg, 100, "Invalid reordering.");
+                break;
+            case 'R':
+                proxy_args->reorder_delay = (long)(proxy_number_parse(optarg, 60000, "Invalid reordering delay.") * 1000);
+                break;
+            case 'b':
+                proxy_args->bandwidth = (long)proxy_number_parse(optarg, 100000000, "Invalid bandwidth.");
+                break;
+            case 'q':
+                proxy_args->queue_limit = (int)proxy_number_parse(optarg, 1000000, "Invalid queue limit.");
+                break;
+            case 's':
+                // Xorshift state must not be zero.
+                proxy_args->seed = (uint64_t)proxy_number_parse(optarg, 1e18, "Invalid seed.") | 1;
+                break;
+            default:
+                error_exit("Invalid option.");
+        }
+    }
+    if (optind < argc) {
+        error_exit("Invalid number of arguments.");
+    }
+}
@@ -19,15 +19,6 @@
 *
 */
 int main(int argc, char *argv[]) {
-    // Server and client address structures.                 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    struct sockaddr_in client_address;                  
-    size_t client_address_size = sizeof(client_address);
-
-    // Packet buffer for incoming and outgoing packets.
-    char *packet = calloc(DEFAULT_PACKET_SIZE, sizeof(char));      
-    
     // Initialize server arguments structure and its members.
     ServerArgs_t *server_args;
     server_args = malloc(sizeof(ServerArgs_t));
@@ -39,7 +30,50 @@ int main(int argc, char *argv[]) {
     // Parse command line arguments.
     parse_args(argc, argv, server_args);
 
-    int socket = init_socket(server_args->port, &server_addr);
+    // Handle SIGINT signal.
+    signal(SIGINT, sigint_handler);
+
+    // Cache is created before any fork, so all processes share it.
+    if (server_args->cache_size > 0) {
+        if ((server_args->transfer_config.cache = cache_create(server_args->cache_size * 1024 * 1024)) == NULL) {
+            error_exit("Failed to create cache.");
+        }
+    }
+    // Metrics are shared the same way, endpoint is served by its own process.
+    if (server_args->metrics_endpoint != NULL) {
+        char *mode = server_args->mode == MODE_FORK ? MODE_FORK_NAME : server_args->mode == MODE_URING ? MODE_URING_NAME : MODE_EPOLL_NAME;
+        if (metrics_create(mode, server_args->workers, server_args->max_transfers, server_args->transfer_config.cache) == NULL) {
+            error_exit("Failed to create metrics.");
+        }
+        if (!metrics_serve(server_args->metrics_endpoint)) {
+            error_exit("Failed to open metrics endpoint.");
+        }
+    }
+
+    // Log writer is started last, so metrics process does not get one.
+    log_init(server_args->log_level);
+
+    if (server_args->workers > 0) {
+        run_workers(server_args);
+    }
+    else {
+        run_server(bind_listener(server_args->port, false), server_args);
+    }
+    free_args(server_args);
+    return EXIT_SUCCESS;
+}
+
+int bind_listener(int port, bool reuse_port) {
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    int enable = 1;
+
+    int socket = init_socket(port, &server_addr);
+
+    // Every worker binds its own socket to the same port, kernel spreads requests among them.
+    if (reuse_port && setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        error_exit("Failed to set SO_REUSEPORT.");
+    }
 
     // Bind server to all interfaces.
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -47,173 +81,618 @@ int main(int argc, char *argv[]) {
     if (bind(socket, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         error_exit("Bind failed.");
     }
+    return socket;
+}
 
-    // Process id
+void run_server(int listen_fd, ServerArgs_t *server_args) {
+    if (server_args->mode == MODE_FORK) {
+        run_fork_server(listen_fd, server_args);
+    }
+    else if (server_args->mode == MODE_URING) {
+        if (!run_uring_loop(listen_fd, server_args)) {
+            fprintf(stderr, "Io_uring not available, falling back to epoll.\n");
+            run_event_loop(listen_fd, server_args);
+        }
+    }
+    else {
+        run_event_loop(listen_fd, server_args);
+    }
+}
+
+/**
+* @brief Start worker process with its own listening socket, optionally pinned to CPU.
+*
+* @param server_args Pointer to ServerArgs_t struct.
+* @param cpu CPU the worker is pinned to, ignored if pinning is disabled.
+*
+* @return Process id of worker.
+*/
+static pid_t start_worker(ServerArgs_t *server_args, int cpu) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        error_exit("Worker fork failed.");
+    }
+    if (pid > 0) {
+        return pid;
+    }
+    // Worker must not outlive the supervising process.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1) {
+        exit(EXIT_FAILURE);
+    }
+    int listen_fd = bind_listener(server_args->port, true);
+    if (server_args->pin_workers) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) < 0) {
+            error_exit("Failed to pin worker to CPU.");
+        }
+        // Prefer requests whose packets were processed by the same CPU.
+        if (setsockopt(listen_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+            fprintf(stderr, "Worker %d: SO_INCOMING_CPU not supported (%s).\n", cpu, strerror(errno));
+        }
+    }
+    run_server(listen_fd, server_args);
+    exit(EXIT_SUCCESS);
+}
+
+void run_workers(ServerArgs_t *server_args) {
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int status;
+    pid_t pid;
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    pid_t *workers = calloc(server_args->workers, sizeof(pid_t));
+    if (workers == NULL) {
+        error_exit("Workers malloc failed.");
+    }
+    for (int i = 0; i < server_args->workers; i++) {
+        workers[i] = start_worker(server_args, i % cpus);
+    }
+    // Restart workers that died, so the number of listeners stays constant.
+    while (true) {
+        if ((pid = wait(&status)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_exit("Wait for workers failed.");
+        }
+        for (int i = 0; i < server_args->workers; i++) {
+            if (workers[i] == pid) {
+                fprintf(stderr, "Worker %d (pid %d) exited, restarting.\n", i, pid);
+                workers[i] = start_worker(server_args, i % cpus);
+                break;
+            }
+        }
+    }
+}
+
+void run_fork_server(int listen_fd, ServerArgs_t *server_args) {
+    struct sockaddr_in client_address;
+    socklen_t client_address_size;
+    int recvfrom_size;
+    bool done;
     pid_t pid;
 
+    // Packet buffer for incoming and outgoing packets.
+    char *packet = calloc(BLKSIZE_MAX + 4, sizeof(char));
+    if (packet == NULL) {
+        error_exit("Packet malloc failed.");
+    }
+
+    // Finished children are reaped automatically.
+    signal(SIGCHLD, SIG_IGN);
+
     // Listen for incoming client connections.
     while (true) {
-        // Handle SIGINT signal.
-        signal(SIGINT, sigint_handler);
-
-        memset(packet, 0, REQUEST_PACKET_SIZE);
-        packet_pos = 0;
+        client_address_size = sizeof(client_address);
 
         // Listen for incoming request packets.
-        if ((recvfrom(socket, (char *)packet, REQUEST_PACKET_SIZE, MSG_WAITALL, (struct sockaddr *)&client_address,
-                      (socklen_t *) &client_address_size)) < 0) {
-            printf("errno: %d\n", errno);
-            printf("error: %s\n", strerror(errno));
+        if ((recvfrom_size = recvfrom(listen_fd, packet, REQUEST_PACKET_SIZE, 0, (struct sockaddr *)&client_address,
+                                      &client_address_size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             error_exit("Recvfrom failed on server side.");
         }
 
+        metrics_add(METRIC_PACKETS_RECEIVED, 1);
+        metrics_add(METRIC_FORKS, 1);
         pid = fork();
         if (pid < 0) {
             error_exit("Server fork failed.");
         }
         else if (pid == 0) {
-            // Request packet attributes.
-            int opcode;
-            int out_block_number = 0;
-            int recvfrom_size;
-            int sock_fd;
-            options[TIMEOUT].flag = false;
-            options[TSIZE].flag = false;
-            options[BLKSIZE].flag = false;
-            options[TIMEOUT].value = 0;
-            options[TSIZE].value = 0;
-            options[BLKSIZE].value = 512;
-            options[TIMEOUT].order = -1;
-            options[TSIZE].order = -1;
-            options[BLKSIZE].order = -1;
-
-            // Pointer to the current position in packet.
-            packet_pos = 0;
-            // Last packet flag.
-            last = false;
-
-            // Initialize socket.
-            sock_fd = init_socket(0, &server_addr);
-
-            // Generate random port number to respond from.
-            server_addr.sin_port = htons(0);
-
-            // Handle request packet from client and display it.
-            handle_request_packet(packet);
-            display_message(sock_fd, client_address, packet); 
-
-            file = open_file(sock_fd, packet, server_args->dir_path, client_address);
-            opcode = opcode_get(packet);
-            packet_pos = 0;
-            if (opcode == RRQ) {
-                if (options[TIMEOUT].flag || options[TSIZE].flag || options[BLKSIZE].flag) {
-                    send_oack_packet(sock_fd, client_address);
-                    if (recvfrom(sock_fd, (char *)packet, options[BLKSIZE].value + 4, MSG_WAITALL, (struct sockaddr *)&client_address, (socklen_t *) &client_address_size) < 0) {
-                        send_error_packet(sock_fd, client_address, 0, "Recvfrom failed on server side.");
-                    }
-                    opcode = opcode_get(packet);
-                    packet_pos = 0;
-                    switch (opcode) {
-                        case ACK:
-                            handle_ack_packet(packet, 0);
-                            display_message(sock_fd, client_address, packet);
-                            break;
-                        case ERROR:
-                            display_message(sock_fd, client_address, packet);
-                            fclose(file);
-                            error_exit("Client error.");
-                            break;
-                        default:
-                            send_error_packet(sock_fd, client_address, ERR_ILLEGAL_OPERATION, "Expected ACK or ERROR.");
-                    }
+            close(listen_fd);
+            Transfer_t *transfer = transfer_start(packet, recvfrom_size, client_address, &server_args->transfer_config);
+            if (transfer == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            done = transfer->state == DONE;
+            while (!done) {
+                // Retransmit or give up when nothing arrives before deadline.
+                if (!wait_for_packet(&transfer->session, transfer->socket)) {
+                    done = transfer_timeout(transfer);
+                    continue;
                 }
-                packet = realloc(packet, options[BLKSIZE].value + 4);
-                while(true) {
-                    memset(packet, 0, options[BLKSIZE].value + 4);
-                    last = send_data_packet(sock_fd, client_address, ++out_block_number, file);
-                    if (recvfrom(sock_fd, (char *)packet, options[BLKSIZE].value + 4, MSG_WAITALL, (struct sockaddr *)&client_address,
-                                (socklen_t *) &client_address_size) < 0) {
-                        send_error_packet(sock_fd, client_address, 0, "Recvfrom failed on server side.");
-                    }
-                    opcode = opcode_get(packet);
-                    packet_pos = 0;
-                    switch (opcode) {
-                        case ACK:
-                            handle_ack_packet(packet, out_block_number);
-                            display_message(sock_fd, client_address, packet);
-                            break;
-                        case ERROR:
-                            display_message(sock_fd, client_address, packet);
-                            fclose(file);
-                            error_exit("Client error.");
-                            break;
-                        default:
-                            error_exit("Invalid opcode.");
-                    }                    
-                    if (last == true) {
-                        fclose(file);
-                        break;
+                client_address_size = sizeof(client_address);
+                if ((recvfrom_size = recvfrom(transfer->socket, packet, transfer->session.options[BLKSIZE].value + 4, 0,
+                                              (struct sockaddr *)&client_address, &client_address_size)) < 0) {
+                    if (errno == EINTR) {
+                        continue;
                     }
+                    transfer_free(transfer);
+                    error_exit("Recvfrom failed on server side.");
                 }
+                done = transfer_handle_packet(transfer, packet, recvfrom_size, client_address);
             }
-            else if (opcode == WRQ) {
-                if (options[TIMEOUT].flag || options[TSIZE].flag || options[BLKSIZE].flag) {
-                    send_oack_packet(sock_fd, client_address);
-                }
-                else {
-                    send_ack_packet(sock_fd, client_address, 0);
-                }
-                packet = realloc(packet, options[BLKSIZE].value + 4);
-                while (true) {
-                    memset(packet, 0, options[BLKSIZE].value + 4);
-                    if ((recvfrom_size = recvfrom(sock_fd, (char *)packet, options[BLKSIZE].value + 4, MSG_WAITALL, (struct sockaddr *)&client_address,
-                                (socklen_t *) &client_address_size)) < 0) {
-                        send_error_packet(sock_fd, client_address, 0, "Recvfrom failed on server side.");
-                    }
-                    opcode = opcode_get(packet);
-                    packet_pos = 0;
-                    switch (opcode) {
-                        case DATA:
-                            handle_data_packet(packet, ++out_block_number, file, recvfrom_size);
-                            display_message(sock_fd, client_address, packet);
-                            memset(packet, 0, options[BLKSIZE].value + 4);
-                            break;
-                        case ERROR:
-                            display_message(sock_fd, client_address, packet);
-                            fclose(file);
-                            error_exit("Client error.");
-                            break;
-                        default:
-                            send_error_packet(sock_fd, client_address, ERR_ILLEGAL_OPERATION, "Expected DATA or ERROR.");
-                    }
+            transfer_free(transfer);
+            exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+/**
+* @brief Start transfer for request unless it duplicates running transfer or server is full.
+*
+* @param listen_fd Socket receiving request packets.
+* @param packet Request packet.
+* @param size Size of request packet.
+* @param client_address Address request came from.
+* @param server_args Pointer to ServerArgs_t struct.
+* @param transfers Head of list of active transfers.
+* @param active_transfers Number of active transfers.
+*
+* @return Started transfer, NULL if request was ignored or rejected.
+*/
+static Transfer_t *accept_request(int listen_fd, char *packet, int size, struct sockaddr_in client_address, ServerArgs_t *server_args,
+                                  Transfer_t *transfers, int active_transfers) {
+    Transfer_t *transfer;
+    // Session used only for rejecting requests on listening socket.
+    Session_t session;
+
+    metrics_add(METRIC_PACKETS_RECEIVED, 1);
+    // Retransmitted request of running transfer is answered by the transfer itself, request for file
+    // that is already multicast joins its group.
+    for (transfer = transfers; transfer != NULL; transfer = transfer->next) {
+        if (transfer_join(transfer, packet, size, client_address)) {
+            return NULL;
+        }
+        if (transfer->client_addr.sin_addr.s_addr == client_address.sin_addr.s_addr &&
+            transfer->client_addr.sin_port == client_address.sin_port) {
+            return NULL;
+        }
+    }
+    if (active_transfers >= server_args->max_transfers) {
+        session_init(&session);
+        send_error_packet(&session, listen_fd, client_address, ERR_NOT_DEFINED, "Server busy.");
+        return NULL;
+    }
+    return transfer_start(packet, size, client_address, &server_args->transfer_config);
+}
+
+/**
+* @brief Insert transfer at the head of active transfers list.
+*
+* @param transfer Pointer to transfer.
+* @param transfers Pointer to head of list of active transfers.
+* @param active_transfers Pointer to number of active transfers.
+*
+* @return void
+*/
+static void transfer_list_insert(Transfer_t *transfer, Transfer_t **transfers, int *active_transfers) {
+    transfer->prev = NULL;
+    transfer->next = *transfers;
+    if (*transfers != NULL) {
+        (*transfers)->prev = transfer;
+    }
+    *transfers = transfer;
+    (*active_transfers)++;
+}
+
+/**
+* @brief Unlink transfer from active transfers list.
+*
+* @param transfer Pointer to transfer.
+* @param transfers Pointer to head of list of active transfers.
+* @param active_transfers Pointer to number of active transfers.
+*
+* @return void
+*/
+static void transfer_list_remove(Transfer_t *transfer, Transfer_t **transfers, int *active_transfers) {
+    if (transfer->prev != NULL) {
+        transfer->prev->next = transfer->next;
+    }
+    else {
+        *transfers = transfer->next;
+    }
+    if (transfer->next != NULL) {
+        transfer->next->prev = transfer->prev;
+    }
+    (*active_transfers)--;
+}
+
+/**
+* @brief Receive all pending request packets and start their transfers.
+*
+* @param epoll_fd Epoll instance file descriptor.
+* @param listen_fd Socket receiving request packets.
+* @param server_args Pointer to ServerArgs_t struct.
+* @param transfers Pointer to head of list of active transfers.
+* @param active_transfers Pointer to number of active transfers.
+* @param timers Pointer to timer queue.
+*
+* @return void
+*/
+static void accept_requests(int epoll_fd, int listen_fd, ServerArgs_t *server_args,
+                            Transfer_t **transfers, int *active_transfers, TimerQueue_t *timers) {
+    Batch_t *batch = server_args->transfer_config.batch;
+    struct sockaddr_in client_address;
+    struct epoll_event event;
+    Transfer_t *transfer;
+    char *packet;
+    int count;
+
+    while (true) {
+        // Burst of requests is read with one call, each is then handled on its own.
+        if ((count = batch_recv(batch, listen_fd, REQUEST_PACKET_SIZE)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            error_exit("Recvmmsg failed on server side.");
+        }
+        for (int i = 0; i < count; i++) {
+            packet = batch_packet(batch, i);
+            client_address = batch->recv_addrs[i];
+            if ((transfer = accept_request(listen_fd, packet, batch->recv_msgs[i].msg_len, client_address, server_args, *transfers,
+                                           *active_transfers)) == NULL) {
+                continue;
+            }
+            socket_nonblocking(transfer->socket);
+            event.events = EPOLLIN;
+            event.data.ptr = transfer;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, transfer->socket, &event) < 0) {
+                send_error_packet(&transfer->session, transfer->socket, client_address, ERR_NOT_DEFINED, "Server busy.");
+                transfer_free(transfer);
+                continue;
+            }
+            transfer_list_insert(transfer, transfers, active_transfers);
+            timer_queue_update(timers, transfer);
+        }
+        // Short batch means the queue is drained.
+        if (count < batch->capacity) {
+            return;
+        }
+    }
+}
+
+/**
+* @brief Remove transfer from epoll and active transfers list and deallocate it.
+*
+* @param epoll_fd Epoll instance file descriptor.
+* @param transfer Pointer to transfer.
+* @param transfers Pointer to head of list of active transfers.
+* @param active_transfers Pointer to number of active transfers.
+* @param timers Pointer to timer queue.
+*
+* @return void
+*/
+static void finish_transfer(int epoll_fd, Transfer_t *transfer, Transfer_t **transfers, int *active_transfers,
+                            TimerQueue_t *timers) {
+    timer_stop(&transfer->session);
+    timer_queue_update(timers, transfer);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, transfer->socket, NULL);
+    transfer_list_remove(transfer, transfers, active_transfers);
+    transfer_free(transfer);
+}
+
+/**
+* @brief Receive all pending packets of transfer and advance its state machine.
+*
+* @param transfer Pointer to transfer.
+* @param batch Pointer to receive batch.
+*
+* @return True if transfer is finished, false otherwise.
+*/
+static bool service_transfer(Transfer_t *transfer, Batch_t *batch) {
+    int count;
+
+    // Epoll reports pending zero-copy completions as EPOLLERR.
+    zerocopy_drain(&transfer->session, transfer->socket);
+    while (true) {
+        // Whole window of DATA or ACKs sent by a windowed client is read with one call.
+        if ((count = batch_recv(batch, transfer->socket, transfer->session.options[BLKSIZE].value + 4)) < 0) {
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+        for (int i = 0; i < count; i++) {
+            if (transfer_handle_packet(transfer, batch_packet(batch, i), batch->recv_msgs[i].msg_len, batch->recv_addrs[i])) {
+                return true;
+            }
+        }
+        if (count < batch->capacity) {
+            return false;
+        }
+    }
+}
+
+// Batch of event loop, reported when process exits.
+static Batch_t *stats_batch = NULL;
+
+/**
+* @brief Print average number of datagrams per recvmmsg and sendmmsg call.
+*
+* @return void
+*/
+static void print_batch_stats(void) {
+    fprintf(stderr, "Batch (size %d): received %ld datagrams in %ld calls (%.2f per call), "
+            "sent %ld datagrams in %ld calls (%.2f per call).\n",
+            stats_batch->capacity,
+            stats_batch->recv_packets, stats_batch->recv_calls,
+            stats_batch->recv_calls > 0 ? (double)stats_batch->recv_packets / stats_batch->recv_calls : 0.0,
+            stats_batch->send_packets, stats_batch->send_calls,
+            stats_batch->send_calls > 0 ? (double)stats_batch->send_packets / stats_batch->send_calls : 0.0);
+}
+
+void run_event_loop(int listen_fd, ServerArgs_t *server_args) {
+    struct epoll_event event;
+    struct epoll_event events[MAX_EVENTS];
+    Transfer_t *transfers = NULL;
+    Transfer_t *transfer;
+    TimerQueue_t timers;
+    int active_transfers = 0;
+    int epoll_fd, ready, timeout;
+    long now, woke;
+
+    // One set of batch buffers shared by all transfers, each slot sized for the largest blksize.
+    Batch_t *batch = batch_create(server_args->batch_size);
+    if (batch == NULL) {
+        error_exit("Batch malloc failed.");
+    }
+    server_args->transfer_config.batch = batch;
+    stats_batch = batch;
+    atexit(print_batch_stats);
+
+    if ((epoll_fd = epoll_create1(0)) < 0) {
+        error_exit("Epoll create failed.");
+    }
+    socket_nonblocking(listen_fd);
+    // Listening socket is recognized by NULL transfer pointer.
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0) {
+        error_exit("Epoll ctl failed.");
+    }
+    timer_queue_init(&timers, server_args->max_transfers);
+
+    // Metadata cache belongs to this process, its inotify descriptor is recognized by cache pointer.
+    FileCache_t *files = filecache_create(server_args->transfer_config.dir_path);
+    if (files != NULL) {
+        event.events = EPOLLIN;
+        event.data.ptr = files;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, files->inotify_fd, &event) == 0) {
+            server_args->transfer_config.files = files;
+        }
+    }
+
+    while (true) {
+        // Sleep until the earliest retransmission deadline, rounded up to milliseconds.
+        timeout = -1;
+        if ((transfer = timer_queue_peek(&timers)) != NULL) {
+            now = time_now();
+            timeout = transfer->session.timer.deadline > now ? (transfer->session.timer.deadline - now + 999) / 1000 : 0;
+        }
+        if ((ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_exit("Epoll wait failed.");
+        }
+        woke = time_now();
+        for (int i = 0; i < ready; i++) {
+            transfer = events[i].data.ptr;
+            if (transfer == NULL) {
+                accept_requests(epoll_fd, listen_fd, server_args, &transfers, &active_transfers, &timers);
+            }
+            else if (events[i].data.ptr == files) {
+                filecache_process_events(files);
+            }
+            else if (service_transfer(transfer, batch)) {
+                finish_transfer(epoll_fd, transfer, &transfers, &active_transfers, &timers);
+            }
+            else {
+                timer_queue_update(&timers, transfer);
+            }
+        }
+        // Retransmit for transfers whose deadline expired, drop those out of retries.
+        now = time_now();
+        while ((transfer = timer_queue_peek(&timers)) != NULL && transfer->session.timer.deadline <= now) {
+            if (transfer_timeout(transfer)) {
+                finish_transfer(epoll_fd, transfer, &transfers, &active_transfers, &timers);
+            }
+            else {
+                timer_queue_update(&timers, transfer);
+            }
+        }
+        // Time outside of epoll_wait is utilization of this CPU.
+        metrics_add(METRIC_BUSY_US, time_now() - woke);
+    }
+}
+
+// Ring of uring engine, reported when process exits.
+static Uring_t *stats_ring = NULL;
+
+/**
+* @brief Print number of operations per io_uring_enter call.
+*
+* @return void
+*/
+static void print_uring_stats(void) {
+    fprintf(stderr, "Io_uring: submitted %ld and completed %ld operations in %ld io_uring_enter calls (%.2f per call).\n",
+            stats_ring->submitted, stats_ring->completed, stats_ring->enter_calls,
+            stats_ring->enter_calls > 0 ? (double)stats_ring->submitted / stats_ring->enter_calls : 0.0);
+}
+
+/**
+* @brief Remove transfer from active transfers list, it is deallocated once its last queued operation completes.
+*
+* @param transfer Pointer to transfer.
+* @param transfers Pointer to head of list of active transfers.
+* @param active_transfers Pointer to number of active transfers.
+* @param timers Pointer to timer queue.
+*
+* @return void
+*/
+static void finish_uring_transfer(Transfer_t *transfer, Transfer_t **transfers, int *active_transfers, TimerQueue_t *timers) {
+    timer_stop(&transfer->session);
+    transfer->state = DONE;
+    timer_queue_update(timers, transfer);
+    transfer_list_remove(transfer, transfers, active_transfers);
+    if (uring_session_close(transfer->session.uring)) {
+        transfer_free(transfer);
+    }
+}
+
+bool run_uring_loop(int listen_fd, ServerArgs_t *server_args) {
+    Uring_t *ring = calloc(1, sizeof(Uring_t));
+    Transfer_t *transfers = NULL;
+    Transfer_t *transfer;
+    TimerQueue_t timers;
+    UringSession_t *us;
+    UringOp_t *op;
+    int active_transfers = 0;
+    int listen_index, result, type;
+    long now, timeout, woke;
+    bool done;
+
+    // Socket and file of every transfer plus listener are registered.
+    if (ring == NULL || !uring_init(ring, 2 * server_args->max_transfers + 1)) {
+        free(ring);
+        return false;
+    }
+    if ((listen_index = uring_file_register(ring, listen_fd)) < 0) {
+        error_exit("Io_uring file register failed.");
+    }
+    server_args->transfer_config.uring = ring;
+    stats_ring = ring;
+    atexit(print_uring_stats);
+    timer_queue_init(&timers, server_args->max_transfers);
+
+    // Several receives wait on listener, so a burst of requests completes in one pass.
+    for (int i = 0; i < server_args->batch_size; i++) {
+        op = uring_op_alloc(URING_OP_LISTEN, NULL, REQUEST_PACKET_SIZE);
+        uring_recv(ring, op, listen_index);
+    }
+    // Metadata cache events are polled on the ring too.
+    FileCache_t *files = filecache_create(server_args->transfer_config.dir_path);
+    if (files != NULL) {
+        server_args->transfer_config.files = files;
+        op = uring_op_alloc(URING_OP_POLL, NULL, 0);
+        uring_poll(ring, op, files->inotify_fd);
+    }
 
-                    send_ack_packet(sock_fd, client_address, out_block_number);
-                    if (recvfrom_size < options[BLKSIZE].value + 4) {
-                        fclose(file);
-                        break;
+    while (true) {
+        timeout = -1;
+        if ((transfer = timer_queue_peek(&timers)) != NULL) {
+            now = time_now();
+            timeout = transfer->session.timer.deadline > now ? transfer->session.timer.deadline - now : 0;
+        }
+        // Everything queued in previous pass is submitted by the same call that waits for completions.
+        uring_submit_and_wait(ring, timeout);
+        woke = time_now();
+        while ((op = uring_complete_next(ring, &result)) != NULL) {
+            if (op->type == URING_OP_LISTEN) {
+                if (result >= 0) {
+                    transfer = accept_request(listen_fd, op->buffer, result, op->addr, server_args, transfers, active_transfers);
+                    if (transfer != NULL) {
+                        transfer_list_insert(transfer, &transfers, &active_transfers);
+                        uring_session_recv(transfer->session.uring);
+                        timer_queue_update(&timers, transfer);
                     }
                 }
+                uring_recv(ring, op, listen_index);
+                continue;
+            }
+            if (op->type == URING_OP_POLL) {
+                filecache_process_events(files);
+                uring_poll(ring, op, files->inotify_fd);
+                continue;
+            }
+            type = op->type;
+            if ((us = uring_session_complete(op, result)) == NULL) {
+                continue;
+            }
+            transfer = us->context;
+            if (us->closing) {
+                if (us->inflight == 0) {
+                    transfer_free(transfer);
+                }
+                continue;
+            }
+            done = false;
+            if (type == URING_OP_RECV && result >= 0) {
+                done = transfer_handle_packet(transfer, us->recv_op->buffer, result, us->recv_op->addr);
+            }
+            // Queued read or write failed after the packet that caused it was handled.
+            if (us->failed && transfer->state != DONE) {
+                send_error_packet(&transfer->session, transfer->socket, transfer->client_addr, us->error_code, us->error_msg);
+                done = true;
+            }
+            if (done || transfer->state == DONE) {
+                finish_uring_transfer(transfer, &transfers, &active_transfers, &timers);
+                continue;
+            }
+            uring_session_recv(us);
+            timer_queue_update(&timers, transfer);
+        }
+        // Retransmit for transfers whose deadline expired, drop those out of retries.
+        now = time_now();
+        while ((transfer = timer_queue_peek(&timers)) != NULL && transfer->session.timer.deadline <= now) {
+            if (transfer_timeout(transfer)) {
+                finish_uring_transfer(transfer, &transfers, &active_transfers, &timers);
             }
             else {
-                send_error_packet(sock_fd, client_address, ERR_ILLEGAL_OPERATION, "Expected RRQ or WRQ.");
-                exit(EXIT_FAILURE);
+                timer_queue_update(&timers, transfer);
             }
-            shutdown(sock_fd, SHUT_RDWR);
-            close(sock_fd);
         }
+        metrics_add(METRIC_BUSY_US, time_now() - woke);
+    }
+    return true;
+}
+
+void socket_nonblocking(int sock_fd) {
+    int flags = fcntl(sock_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        error_exit("Failed to set socket non-blocking.");
     }
 }
 
 void init_args(ServerArgs_t *server_args) {
     server_args->port = DEFAULT_PORT_NUM;
-    server_args->dir_path = malloc(MAX_STR_LEN);
-    if (server_args->dir_path == NULL) {
+    server_args->mode = MODE_EPOLL;
+    server_args->max_transfers = MAX_TRANSFERS_DEFAULT;
+    server_args->workers = 0;
+    server_args->pin_workers = false;
+    server_args->cache_size = 0;
+    server_args->batch_size = BATCH_DEFAULT;
+    server_args->metrics_endpoint = NULL;
+    server_args->log_level = LOG_DEFAULT;
+    server_args->transfer_config.zero_copy = false;
+    server_args->transfer_config.resume_uploads = false;
+    server_args->transfer_config.cache = NULL;
+    server_args->transfer_config.files = NULL;
+    server_args->transfer_config.batch = NULL;
+    server_args->transfer_config.uring = NULL;
+    server_args->transfer_config.multicast_addr.s_addr = htonl(INADDR_ANY);
+    server_args->transfer_config.dir_path = malloc(MAX_STR_LEN);
+    if (server_args->transfer_config.dir_path == NULL) {
         error_exit("Server args dir path malloc failed.");
     }
 }
 
 void free_args(ServerArgs_t *server_args) {
-    free(server_args->dir_path);
+    free(server_args->transfer_config.dir_path);
     free(server_args);
 }
 
@@ -222,21 +701,10 @@ void parse_args(int argc, char *argv[], ServerArgs_t *server_args) {
         display_server_help();
         exit(EXIT_SUCCESS);
     }
-    if (argc > 4 || argc < 2) { 
-        error_exit("Invalid number of arguments.");
-    }
-    if (argc == 2) {
-        strcpy(server_args->dir_path, argv[1]);
-        DIR *dir = opendir(server_args->dir_path);
-        if (dir == NULL) {
-            error_exit("Failed to open directory.");
-        }
-        closedir(dir);
-        return;
-    }
     int opt;
-    bool p_flag = false;
-    while ((opt = getopt(argc, argv, "p:")) != -1) {
+    char *endptr = NULL;
+    bool p_flag = false, m_flag = false, n_flag = false, j_flag = false, c_flag = false, b_flag = false, M_flag = false, e_flag = false, l_flag = false;
+    while ((opt = getopt(argc, argv, "p:m:n:j:azrc:b:M:e:l:")) != -1) {
         switch (opt) {
             case 'p':
                 if (p_flag) {
@@ -245,19 +713,125 @@ void parse_args(int argc, char *argv[], ServerArgs_t *server_args) {
                 server_args->port = parse_port(optarg);
                 p_flag = true;
                 break;
+            case 'm':
+                if (m_flag) {
+                    error_exit("Duplicate flag -m.");
+                }
+                if (strcmp(optarg, MODE_EPOLL_NAME) == 0) {
+                    server_args->mode = MODE_EPOLL;
+                }
+                else if (strcmp(optarg, MODE_FORK_NAME) == 0) {
+                    server_args->mode = MODE_FORK;
+                }
+                else if (strcmp(optarg, MODE_URING_NAME) == 0) {
+                    server_args->mode = MODE_URING;
+                }
+                else {
+                    error_exit("Invalid server mode.");
+                }
+                m_flag = true;
+                break;
+            case 'n':
+                if (n_flag) {
+                    error_exit("Duplicate flag -n.");
+                }
+                server_args->max_transfers = (int)strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || server_args->max_transfers < 1) {
+                    error_exit("Invalid maximum number of transfers.");
+                }
+                n_flag = true;
+                break;
+            case 'j':
+                if (j_flag) {
+                    error_exit("Duplicate flag -j.");
+                }
+                server_args->workers = (int)strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || server_args->workers < 0 || server_args->workers > MAX_WORKERS) {
+                    error_exit("Invalid number of workers.");
+                }
+                // Zero means one worker per online CPU.
+                if (server_args->workers == 0) {
+                    server_args->workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                j_flag = true;
+                break;
+            case 'a':
+                server_args->pin_workers = true;
+                break;
+            case 'z':
+                server_args->transfer_config.zero_copy = true;
+                break;
+            case 'r':
+                server_args->transfer_config.resume_uploads = true;
+                break;
+            case 'c':
+                if (c_flag) {
+                    error_exit("Duplicate flag -c.");
+                }
+                server_args->cache_size = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || server_args->cache_size < 1 || server_args->cache_size > CACHE_SIZE_MAX) {
+                    error_exit("Invalid cache size.");
+                }
+                c_flag = true;
+                break;
+            case 'b':
+                if (b_flag) {
+                    error_exit("Duplicate flag -b.");
+                }
+                server_args->batch_size = (int)strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || server_args->batch_size < 1 || server_args->batch_size > BATCH_MAX) {
+                    error_exit("Invalid batch size.");
+                }
+                b_flag = true;
+                break;
+            case 'M':
+                if (M_flag) {
+                    error_exit("Duplicate flag -M.");
+                }
+                if (inet_pton(AF_INET, optarg, &server_args->transfer_config.multicast_addr) != 1 ||
+                    !IN_MULTICAST(ntohl(server_args->transfer_config.multicast_addr.s_addr))) {
+                    error_exit("Invalid multicast address.");
+                }
+                M_flag = true;
+                break;
+            case 'e':
+                if (e_flag) {
+                    error_exit("Duplicate flag -e.");
+                }
+                server_args->metrics_endpoint = optarg;
+                e_flag = true;
+                break;
+            case 'l':
+                if (l_flag) {
+                    error_exit("Duplicate flag -l.");
+                }
+                server_args->log_level = parse_log_level(optarg);
+                l_flag = true;
+                break;
             default:
                 error_exit("Invalid option.");
         }
     }
-    if (optind < argc) {
-        strcpy(server_args->dir_path, argv[optind]);
-        DIR *dir = opendir(server_args->dir_path);
+    if (optind == argc - 1) {
+        strncpy(server_args->transfer_config.dir_path, argv[optind], MAX_DIR_PATH_LEN);
+        server_args->transfer_config.dir_path[MAX_DIR_PATH_LEN] = '\0';
+        DIR *dir = opendir(server_args->transfer_config.dir_path);
         if (dir == NULL) {
             error_exit("Failed to open directory.");
         }
         closedir(dir);
     } 
+    else if (optind < argc) {
+        error_exit("Invalid number of arguments.");
+    }
     else {
         error_exit("Missing directory path.");
     }
+    if (server_args->pin_workers && server_args->workers == 0) {
+        error_exit("Flag -a requires -j.");
+    }
+    // Clients are grouped by the process serving them, process per transfer has nothing to group.
+    if (M_flag && server_args->mode == MODE_FORK) {
+        error_exit("Flag -M requires event loop mode.");
+    }
 }
\ No newline at end of file
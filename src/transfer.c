@@ -0,0 +1,652 @@
+//
+// File: transfer.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of server side transfer state machine.
+//
+
+#include "../include/transfer.h"
+
+/**
+* @brief Check whether client requested any option, so OACK has to be sent.
+*
+* @param session Pointer to session.
+*
+* @return True if any option flag is set, false otherwise.
+*/
+static bool options_requested(Session_t *session) {
+    for (int i = 0; i < NUM_OPTIONS; i++) {
+        if (option_get_flag(session, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* @brief Prepare opened RRQ file for reading, mapping takes precedence over cache, without either DATA is read with pread.
+*
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void transfer_read_setup(Transfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    // Encoding is read through its own chunk buffer.
+    if (transfer->opcode != RRQ || session->encoded != NULL) {
+        return;
+    }
+    if (transfer->config->zero_copy) {
+        session_map_file(session, transfer->socket);
+    }
+    if (transfer->config->cache != NULL && session->map == NULL &&
+        cache_key_set(&session->cache_key, fileno(session->file))) {
+        session->cache = transfer->config->cache;
+    }
+}
+
+/**
+* @brief Resolve requested file, names in root directory are answered from metadata cache without touching the file.
+*
+* Missing file of RRQ and existing file of WRQ are rejected from cache for every request. Only octet RRQ from the
+* start is also served from it, netascii and compress need encoding, resumed read and upload check CRC of file,
+* so those open it right away.
+*
+* @param transfer Pointer to transfer.
+* @param request Pointer to validated request.
+*
+* @return True if request can proceed, false if it was rejected (error packet was already sent).
+*/
+static bool transfer_open(Transfer_t *transfer, Packet_t *request) {
+    Session_t *session = &transfer->session;
+    FileCache_t *files = transfer->config->files;
+
+    // Resumed upload writes into existing file, offset is declined unless server allows it.
+    if (transfer->opcode == WRQ && !transfer->config->resume_uploads) {
+        option_clear(session, OFFSET);
+    }
+    if (files != NULL && (transfer->entry = filecache_get(files, request->file_name)) != NULL) {
+        if (transfer->opcode == RRQ && !transfer->entry->exists) {
+            send_error_packet(session, transfer->socket, transfer->client_addr, ERR_FILE_NOT_FOUND, "File not found.");
+            return false;
+        }
+        if (transfer->opcode == WRQ && transfer->entry->exists && !session->options[OFFSET].flag) {
+            send_error_packet(session, transfer->socket, transfer->client_addr, ERR_FILE_ALREADY_EXISTS, "File already exists.");
+            return false;
+        }
+        if (transfer->opcode == RRQ && session->mode == OCTET && !session->options[OFFSET].flag &&
+            !session->options[COMPRESS].flag) {
+            if (session->options[TSIZE].flag) {
+                session->options[TSIZE].value = transfer->entry->size;
+            }
+            return true;
+        }
+        filecache_release(files, transfer->entry);
+        transfer->entry = NULL;
+    }
+    session->file = open_file(session, transfer->socket, request, transfer->config->dir_path, transfer->client_addr);
+    if (session->file == NULL) {
+        return false;
+    }
+    transfer_read_setup(transfer);
+    return true;
+}
+
+/**
+* @brief Send next window of DATA packets of RRQ transfer.
+*
+* @param transfer Pointer to transfer.
+*
+* @return True if transfer failed, false otherwise.
+*/
+static bool transfer_send_window(Transfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    transfer->state = WAIT_ACK;
+    // File of cached entry is opened on first DATA, so a tsize probe aborted after OACK never opens it.
+    if (session->file == NULL) {
+        session->file = filecache_open(transfer->config->files, transfer->entry);
+        filecache_release(transfer->config->files, transfer->entry);
+        transfer->entry = NULL;
+        if (session->file == NULL) {
+            send_error_packet(session, transfer->socket, transfer->client_addr, ERR_FILE_NOT_FOUND, "File not found.");
+            transfer->state = DONE;
+            return true;
+        }
+        transfer_read_setup(transfer);
+    }
+    // Multicast DATA goes to the whole group, master client only drives the window by its ACKs.
+    if (!send_window(session, transfer->socket, transfer->group != NULL ? transfer->group->addr : transfer->client_addr)) {
+        send_error_packet(session, transfer->socket, transfer->client_addr, ERR_NOT_DEFINED, "Failed to read file.");
+        transfer->state = DONE;
+        return true;
+    }
+    return false;
+}
+
+/**
+* @brief Turn RRQ into multicast transfer with requesting client as master, its group is joined by later requests.
+*
+* @param transfer Pointer to transfer.
+* @param file_name Requested file name.
+*
+* @return True if group was created, false if multicast has to be declined.
+*/
+static bool transfer_group_create(Transfer_t *transfer, char *file_name) {
+    Session_t *session = &transfer->session;
+    long blksize = session->options[BLKSIZE].value;
+    struct stat status;
+    long size;
+
+    if (transfer->config->multicast_addr.s_addr == htonl(INADDR_ANY)) {
+        return false;
+    }
+    if (transfer->entry != NULL) {
+        size = transfer->entry->size;
+    }
+    // Group needs size of whole encoding up front.
+    else if (session->encoded != NULL) {
+        if ((size = encodestream_size(session->encoded)) == -1) {
+            return false;
+        }
+    }
+    else if (fstat(fileno(session->file), &status) == 0) {
+        size = status.st_size;
+    }
+    else {
+        return false;
+    }
+    if (size / blksize + 1 > MULTICAST_MAX_BLOCKS) {
+        return false;
+    }
+    transfer->group = multicast_group_create(file_name, transfer->socket, transfer->config->multicast_addr,
+                                             &transfer->client_addr, size, blksize);
+    if (transfer->group == NULL) {
+        return false;
+    }
+    session->multicast_addr = transfer->group->addr;
+    session->options[MULTICAST].value = 1;
+    if (!multicast_member_add(transfer->group, &transfer->client_addr, session->options)) {
+        multicast_group_free(transfer->group);
+        transfer->group = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+* @brief Remove master client of multicast transfer and hand the transfer over to the next member.
+*
+* New master is told by OACK with master flag set and answers with ACK of blocks it already has.
+*
+* @param transfer Pointer to transfer.
+*
+* @return True if no member is left and transfer is finished, false otherwise.
+*/
+static bool transfer_promote(Transfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    MulticastGroup_t *group = transfer->group;
+    multicast_member_remove(group, 0);
+    if (group->count == 0) {
+        transfer->state = DONE;
+        return true;
+    }
+    transfer->client_addr = group->members[0].addr;
+    // Master's own options, blksize and windowsize are the same for all members.
+    memcpy(session->options, group->members[0].options, sizeof(session->options));
+    session->options[MULTICAST].value = 1;
+    session->block_number = 0;
+    session->block_sent = 0;
+    session->last = false;
+    session->restarted_at = 0;
+    session->timer.retries = 0;
+    // Member whose OACK does not fit got ERROR, the next one is promoted.
+    if (!send_oack_packet(session, transfer->socket, transfer->client_addr)) {
+        return transfer_promote(transfer);
+    }
+    timer_start(session);
+    transfer->state = WAIT_OACK_ACK;
+    return false;
+}
+
+/**
+* @brief Send OACK to member of multicast transfer, it acknowledges member's options and tells whether it is master.
+*
+* @param transfer Pointer to transfer.
+* @param member Index of member.
+*
+* @return void
+*/
+static void transfer_member_oack(Transfer_t *transfer, int member) {
+    Session_t *session = &transfer->session;
+    Option_t options[NUM_OPTIONS];
+    bool sent;
+    memcpy(options, session->options, sizeof(options));
+    memcpy(session->options, transfer->group->members[member].options, sizeof(session->options));
+    session->options[MULTICAST].value = member == 0;
+    sent = send_oack_packet(session, transfer->socket, transfer->group->members[member].addr);
+    memcpy(session->options, options, sizeof(options));
+    // Member got ERROR instead, it is no longer part of group.
+    if (!sent) {
+        multicast_member_remove(transfer->group, member);
+    }
+}
+
+/**
+* @brief Handle packet of multicast member that is not master client.
+*
+* Member ACKs the last block once it has the whole file and leaves, any other ACK asks whether server is still
+* alive and is answered by OACK.
+*
+* @param transfer Pointer to transfer.
+* @param member Index of member.
+* @param opcode Opcode of packet.
+* @param block_number Block number of packet.
+*
+* @return Always false, transfer goes on.
+*/
+static bool transfer_member_packet(Transfer_t *transfer, int member, int opcode, int block_number) {
+    if (opcode == ERROR || (opcode == ACK && block_number == transfer->group->last_block)) {
+        multicast_member_remove(transfer->group, member);
+    }
+    else if (opcode == ACK) {
+        transfer_member_oack(transfer, member);
+    }
+    return false;
+}
+
+/**
+* @brief Set deadline of DALLY state, called after every last ACK sent.
+*
+* @param transfer Pointer to transfer.
+*
+* @return void
+*/
+static void transfer_dally(Transfer_t *transfer) {
+    long timeout = DALLY_TIMEOUTS * timer_timeout(&transfer->session);
+    transfer->state = DALLY;
+    transfer->session.timer.deadline = time_now() + (timeout > DALLY_MIN ? timeout : DALLY_MIN);
+}
+
+/**
+* @brief Reject packet that does not fit into current state and finish transfer.
+*
+* @param transfer Pointer to transfer.
+*
+* @return Always true, transfer is finished.
+*/
+static bool transfer_fail(Transfer_t *transfer) {
+    send_error_packet(&transfer->session, transfer->socket, transfer->client_addr, ERR_ILLEGAL_OPERATION, "Illegal TFTP operation.");
+    transfer->state = DONE;
+    return true;
+}
+
+Transfer_t *transfer_start(char *packet, int size, struct sockaddr_in client_addr, TransferConfig_t *config) {
+    Packet_t request;
+    Transfer_t *transfer = calloc(1, sizeof(Transfer_t));
+    if (transfer == NULL) {
+        return NULL;
+    }
+    // Respond from new socket, kernel assigns random port (TID) on first send.
+    if ((transfer->socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        free(transfer);
+        return NULL;
+    }
+    transfer->client_addr = client_addr;
+    transfer->config = config;
+    transfer->timer_index = -1;
+    Session_t *session = &transfer->session;
+    session_init(session);
+    session->batch = config->batch;
+
+    if (!handle_request_packet(session, packet, size, &request)) {
+        send_error_packet(session, transfer->socket, client_addr, session->error_code, session->error_msg);
+        transfer_free(transfer);
+        return NULL;
+    }
+    // DATA packets must not be fragmented on the way to client.
+    blksize_path_cap(session, transfer->socket, &client_addr);
+    // Everything sent from now on is queued on the ring.
+    if (config->uring != NULL && !uring_session_attach(config->uring, session, transfer->socket, transfer)) {
+        send_error_packet(session, transfer->socket, client_addr, ERR_NOT_DEFINED, "Server busy.");
+        transfer_free(transfer);
+        return NULL;
+    }
+    display_message(session, transfer->socket, client_addr, packet, size);
+
+    transfer->opcode = request.opcode;
+    // Counted once file is looked up, so rejected requests show up as failed transfers.
+    metrics_add(transfer->opcode == RRQ ? METRIC_TRANSFERS_RRQ : METRIC_TRANSFERS_WRQ, 1);
+    if (!transfer_open(transfer, &request)) {
+        transfer_free(transfer);
+        return NULL;
+    }
+    if (session->options[MULTICAST].flag && !transfer_group_create(transfer, request.file_name)) {
+        // Declined option is left out of OACK and transfer runs as unicast.
+        option_clear(session, MULTICAST);
+    }
+
+    transfer->oack_sent = options_requested(session);
+
+    if (transfer->opcode == RRQ) {
+        if (transfer->oack_sent) {
+            if (!send_oack_packet(session, transfer->socket, client_addr)) {
+                transfer_free(transfer);
+                return NULL;
+            }
+            timer_start(session);
+            transfer->state = WAIT_OACK_ACK;
+        }
+        // File of cached entry may be gone by now, transfer that already failed is never handed to caller.
+        else if (transfer_send_window(transfer)) {
+            transfer_free(transfer);
+            return NULL;
+        }
+    }
+    else {
+        if (transfer->oack_sent) {
+            if (!send_oack_packet(session, transfer->socket, client_addr)) {
+                transfer_free(transfer);
+                return NULL;
+            }
+        }
+        else {
+            send_ack_packet(session, transfer->socket, client_addr, 0);
+        }
+        timer_start(session);
+        transfer->state = WAIT_DATA;
+    }
+    return transfer;
+}
+
+bool transfer_join(Transfer_t *transfer, char *packet, int size, struct sockaddr_in client_addr) {
+    Session_t *session = &transfer->session;
+    MulticastGroup_t *group = transfer->group;
+    Session_t request;
+    Packet_t parsed;
+    int member;
+
+    if (group == NULL || transfer->state == DONE) {
+        return false;
+    }
+    if ((member = multicast_member_find(group, &client_addr)) == 0) {
+        // Master's retransmitted request, transfer retransmits OACK by itself.
+        return true;
+    }
+    if (member < 0) {
+        session_init(&request);
+        if (!handle_request_packet(&request, packet, size, &parsed) || !request.options[MULTICAST].flag) {
+            return false;
+        }
+        // DATA goes to group address, not member's own path, so member only has to accept group's blksize.
+        if (strncmp(parsed.file_name, group->file_name, MAX_FILE_NAME_LEN) != 0 || request.mode != session->mode ||
+            request.options[BLKSIZE].value < session->options[BLKSIZE].value ||
+            request.options[WINDOWSIZE].value != session->options[WINDOWSIZE].value) {
+            return false;
+        }
+        request.options[BLKSIZE].value = session->options[BLKSIZE].value;
+        if (request.options[TSIZE].flag) {
+            request.options[TSIZE].value = group->file_size;
+        }
+        if (!multicast_member_add(group, &client_addr, request.options)) {
+            return false;
+        }
+        member = group->count - 1;
+        display_message(&request, transfer->socket, client_addr, packet, size);
+    }
+    transfer_member_oack(transfer, member);
+    return true;
+}
+
+bool transfer_handle_packet(Transfer_t *transfer, char *packet, int recvfrom_size, struct sockaddr_in source_addr) {
+    Session_t *session = &transfer->session;
+    int opcode, block_number, member = 0;
+
+    metrics_add(METRIC_PACKETS_RECEIVED, 1);
+    // Packets from other TIDs must not disturb the transfer.
+    if (transfer->group != NULL) {
+        member = multicast_member_find(transfer->group, &source_addr);
+    }
+    else if (source_addr.sin_addr.s_addr != transfer->client_addr.sin_addr.s_addr ||
+             source_addr.sin_port != transfer->client_addr.sin_port) {
+        member = -1;
+    }
+    if (member < 0) {
+        send_error_packet(session, transfer->socket, source_addr, ERR_UNKNOWN_TRANSFER_ID, "Unknown transfer ID.");
+        return false;
+    }
+
+    if (recvfrom_size < OPCODE_SIZE + BLOCK_NUMBER_SIZE) {
+        return transfer_fail(transfer);
+    }
+    opcode = codec_get_u16(packet);
+    block_number = codec_get_u16(packet + OPCODE_SIZE);
+
+    if (member > 0) {
+        return transfer_member_packet(transfer, member, opcode, block_number);
+    }
+    if (opcode == ERROR) {
+        display_message(session, transfer->socket, source_addr, packet, recvfrom_size);
+        if (transfer->group != NULL) {
+            return transfer_promote(transfer);
+        }
+        transfer->state = DONE;
+        return true;
+    }
+
+    switch (transfer->state) {
+        case WAIT_OACK_ACK:
+        case WAIT_ACK:
+            if (opcode != ACK) {
+                break;
+            }
+            // Multicast master may already hold blocks it received as ordinary member, its ACK then skips them.
+            if (transfer->group != NULL && block_number > session->block_sent && block_number <= transfer->group->last_block) {
+                session->block_sent = block_number;
+                session->last = block_number == transfer->group->last_block;
+            }
+            // ACKs outside of current window and duplicates are ignored.
+            if (handle_ack_packet(session, packet)) {
+                display_message(session, transfer->socket, source_addr, packet, recvfrom_size);
+                if (session->last && session->block_number == session->block_sent) {
+                    transfer->completed = true;
+                    if (transfer->group != NULL) {
+                        return transfer_promote(transfer);
+                    }
+                    transfer->state = DONE;
+                    return true;
+                }
+                return transfer_send_window(transfer);
+            }
+            return false;
+        case WAIT_DATA:
+            if (opcode != DATA || recvfrom_size > session->options[BLKSIZE].value + 4) {
+                break;
+            }
+            if (block_number_unwrap(session->block_number + 1, block_number) == session->block_number + 1) {
+                display_message(session, transfer->socket, source_addr, packet, recvfrom_size);
+            }
+            if (handle_data_packet(session, packet, recvfrom_size)) {
+                send_ack_packet(session, transfer->socket, transfer->client_addr, session->block_number);
+            }
+            else if (session->error_msg != NULL) {
+                send_error_packet(session, transfer->socket, transfer->client_addr, session->error_code, session->error_msg);
+                transfer->state = DONE;
+                return true;
+            }
+            if (session->last) {
+                // Stay around for a while in case last ACK gets lost.
+                transfer->completed = true;
+                transfer_dally(transfer);
+            }
+            return false;
+        case DALLY:
+            // Sender did not get last ACK and retransmitted its last window, ACK only its final block.
+            if (opcode == DATA) {
+                if (block_number_unwrap(session->block_number, block_number) == session->block_number) {
+                    send_ack_packet(session, transfer->socket, transfer->client_addr, session->block_number);
+                    transfer_dally(transfer);
+                }
+                return false;
+            }
+            break;
+        case DONE:
+            return true;
+    }
+    return transfer_fail(transfer);
+}
+
+bool transfer_timeout(Transfer_t *transfer) {
+    Session_t *session = &transfer->session;
+    if (transfer->state == DALLY || transfer->state == DONE) {
+        transfer->state = DONE;
+        timer_stop(session);
+        return true;
+    }
+    if (!timer_retry(session)) {
+        send_error_packet(session, transfer->socket, transfer->client_addr, ERR_NOT_DEFINED, "Transfer timed out.");
+        // Unresponsive master does not stop the rest of multicast group.
+        if (transfer->group != NULL) {
+            return transfer_promote(transfer);
+        }
+        transfer->state = DONE;
+        return true;
+    }
+    switch (transfer->state) {
+        case WAIT_OACK_ACK:
+            if (!send_oack_packet(session, transfer->socket, transfer->client_addr)) {
+                transfer->state = DONE;
+                return true;
+            }
+            break;
+        case WAIT_ACK:
+            // Retransmit everything after last acknowledged block.
+            return transfer_send_window(transfer);
+        case WAIT_DATA:
+            // Retransmit our last response, it tells sender which block we expect.
+            if (session->block_number == 0 && transfer->oack_sent) {
+                if (!send_oack_packet(session, transfer->socket, transfer->client_addr)) {
+                    transfer->state = DONE;
+                    return true;
+                }
+            }
+            else {
+                session->gap_acked_at = 0;
+                send_ack_packet(session, transfer->socket, transfer->client_addr, session->block_number);
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+/**
+* @brief Swap two transfers in timer queue.
+*
+* @param queue Pointer to timer queue.
+* @param i Index of first transfer.
+* @param j Index of second transfer.
+*
+* @return void
+*/
+static void timer_queue_swap(TimerQueue_t *queue, int i, int j) {
+    Transfer_t *transfer = queue->items[i];
+    queue->items[i] = queue->items[j];
+    queue->items[j] = transfer;
+    queue->items[i]->timer_index = i;
+    queue->items[j]->timer_index = j;
+}
+
+/**
+* @brief Restore heap order around index after deadline change.
+*
+* @param queue Pointer to timer queue.
+* @param index Index of changed transfer.
+*
+* @return void
+*/
+static void timer_queue_sift(TimerQueue_t *queue, int index) {
+    // Move up while earlier than parent.
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (queue->items[parent]->session.timer.deadline <= queue->items[index]->session.timer.deadline) {
+            break;
+        }
+        timer_queue_swap(queue, parent, index);
+        index = parent;
+    }
+    // Move down while later than any child.
+    while (true) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < queue->size && queue->items[left]->session.timer.deadline < queue->items[smallest]->session.timer.deadline) {
+            smallest = left;
+        }
+        if (right < queue->size && queue->items[right]->session.timer.deadline < queue->items[smallest]->session.timer.deadline) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        timer_queue_swap(queue, smallest, index);
+        index = smallest;
+    }
+}
+
+void timer_queue_init(TimerQueue_t *queue, int capacity) {
+    queue->items = calloc(capacity, sizeof(Transfer_t *));
+    if (queue->items == NULL) {
+        error_exit("Timer queue malloc failed.");
+    }
+    queue->size = 0;
+    queue->capacity = capacity;
+}
+
+void timer_queue_update(TimerQueue_t *queue, Transfer_t *transfer) {
+    int index = transfer->timer_index;
+    if (transfer->session.timer.deadline == 0 || transfer->state == DONE) {
+        // Remove by moving last item to its place.
+        if (index < 0) {
+            return;
+        }
+        transfer->timer_index = -1;
+        if (index != --queue->size) {
+            queue->items[index] = queue->items[queue->size];
+            queue->items[index]->timer_index = index;
+            timer_queue_sift(queue, index);
+        }
+        return;
+    }
+    if (index < 0) {
+        if (queue->size == queue->capacity) {
+            return;
+        }
+        index = queue->size++;
+        queue->items[index] = transfer;
+        transfer->timer_index = index;
+    }
+    timer_queue_sift(queue, index);
+}
+
+Transfer_t *timer_queue_peek(TimerQueue_t *queue) {
+    return queue->size > 0 ? queue->items[0] : NULL;
+}
+
+void transfer_free(Transfer_t *transfer) {
+    // Transfers rejected before their request was parsed were never counted as started.
+    if (transfer->opcode != 0) {
+        metrics_add(METRIC_TRANSFERS_FINISHED, 1);
+        metrics_add(transfer->completed ? METRIC_TRANSFERS_COMPLETED : METRIC_TRANSFERS_FAILED, 1);
+    }
+    if (transfer->entry != NULL) {
+        filecache_release(transfer->config->files, transfer->entry);
+    }
+    if (transfer->group != NULL) {
+        multicast_group_free(transfer->group);
+    }
+    session_close(&transfer->session);
+    close(transfer->socket);
+    free(transfer);
+}
@@ -0,0 +1,587 @@
+//
+// File: uring.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Implementation of io_uring backend of server data path (raw syscalls, no liburing).
+//
+
+#include "../include/utils.h"
+#include <stdint.h>
+#include <sys/syscall.h>
+
+/**
+* @brief Unmap rings and close ring descriptor.
+*
+* @param ring Pointer to ring.
+*
+* @return void
+*/
+static void uring_destroy(Uring_t *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->arena != NULL && ring->arena != MAP_FAILED) {
+        munmap(ring->arena, URING_ARENA_SIZE);
+    }
+    free(ring->arena_used);
+    free(ring->free_files);
+    close(ring->fd);
+    memset(ring, 0, sizeof(Uring_t));
+    ring->fd = -1;
+}
+
+/**
+* @brief Check that kernel supports all operations used by the backend.
+*
+* @param ring Pointer to ring.
+*
+* @return True if all operations are supported.
+*/
+static bool uring_probe(Uring_t *ring) {
+    int ops[] = { IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED,
+                  IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL };
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    bool supported = probe != NULL && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+bool uring_init(Uring_t *ring, int files) {
+    struct io_uring_params params;
+    struct iovec arena;
+    memset(ring, 0, sizeof(Uring_t));
+    memset(&params, 0, sizeof(params));
+
+    if ((ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) < 0) {
+        return false;
+    }
+    // Wait with timeout needs EXT_ARG, completions must never be dropped.
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP) || !uring_probe(ring)) {
+        uring_destroy(ring);
+        return false;
+    }
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_size = ring->sq_size > ring->cq_size ? ring->sq_size : ring->cq_size;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        uring_destroy(ring);
+        return false;
+    }
+    ring->cq_ptr = ring->sq_ptr;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_destroy(ring);
+        return false;
+    }
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // One registered buffer, block slots of all transfers are carved out of it.
+    ring->arena = mmap(NULL, URING_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->arena_pages = URING_ARENA_SIZE / URING_PAGE_SIZE;
+    ring->arena_used = calloc(ring->arena_pages, sizeof(unsigned char));
+    if (ring->arena == MAP_FAILED || ring->arena_used == NULL) {
+        uring_destroy(ring);
+        return false;
+    }
+    arena.iov_base = ring->arena;
+    arena.iov_len = URING_ARENA_SIZE;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &arena, 1) < 0) {
+        uring_destroy(ring);
+        return false;
+    }
+
+    // Sparse file table, sockets and files of transfers are put in and out of it.
+    int *table = malloc(files * sizeof(int));
+    ring->free_files = malloc(files * sizeof(int));
+    if (table == NULL || ring->free_files == NULL) {
+        free(table);
+        uring_destroy(ring);
+        return false;
+    }
+    for (int i = 0; i < files; i++) {
+        table[i] = -1;
+        ring->free_files[i] = files - 1 - i;
+    }
+    ring->free_file_count = files;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, table, files) < 0) {
+        free(table);
+        uring_destroy(ring);
+        return false;
+    }
+    free(table);
+    return true;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring_t *ring) {
+    unsigned tail = *ring->sq_tail;
+    // Queue is full, hand it to kernel first.
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        uring_submit_and_wait(ring, 0);
+    }
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+/**
+* @brief Get SQE appended to current link chain, it runs only after previous one succeeded.
+*
+* @param ring Pointer to ring.
+*
+* @return Pointer to zeroed SQE.
+*/
+static struct io_uring_sqe *uring_get_linked_sqe(Uring_t *ring) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    // Full queue was submitted by uring_get_sqe, chain then restarts with this entry.
+    if (ring->link != NULL) {
+        ring->link->flags |= IOSQE_IO_LINK;
+    }
+    ring->link = sqe;
+    return sqe;
+}
+
+void uring_link_end(Uring_t *ring) {
+    ring->link = NULL;
+}
+
+void uring_submit_and_wait(Uring_t *ring, long timeout) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    unsigned wait = 0;
+    int result;
+
+    // Do not sleep while completions are waiting to be processed.
+    if (timeout != 0 && *ring->cq_head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        flags |= IORING_ENTER_GETEVENTS;
+        wait = 1;
+    }
+    if (to_submit == 0 && wait == 0) {
+        return;
+    }
+    memset(&arg, 0, sizeof(arg));
+    if (timeout > 0) {
+        ts.tv_sec = timeout / 1000000;
+        ts.tv_nsec = (timeout % 1000000) * 1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    // Submitted entries can no longer be linked to.
+    ring->link = NULL;
+    result = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait, flags, &arg, sizeof(arg));
+    ring->enter_calls++;
+    if (result > 0) {
+        ring->submitted += result;
+    }
+    if (result < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+        error_exit("Io_uring enter failed.");
+    }
+}
+
+UringOp_t *uring_complete_next(Uring_t *ring, int *result) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    UringOp_t *op = (UringOp_t *)(uintptr_t)cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->completed++;
+    return op;
+}
+
+int uring_file_register(Uring_t *ring, int fd) {
+    struct io_uring_files_update update;
+    if (ring->free_file_count == 0) {
+        return -1;
+    }
+    int index = ring->free_files[--ring->free_file_count];
+    memset(&update, 0, sizeof(update));
+    update.offset = index;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+        ring->free_files[ring->free_file_count++] = index;
+        return -1;
+    }
+    return index;
+}
+
+void uring_file_unregister(Uring_t *ring, int index) {
+    struct io_uring_files_update update;
+    int fd = -1;
+    memset(&update, 0, sizeof(update));
+    update.offset = index;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+    syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    ring->free_files[ring->free_file_count++] = index;
+}
+
+UringOp_t *uring_op_alloc(int type, UringSession_t *owner, int size) {
+    UringOp_t *op = malloc(sizeof(UringOp_t) + size);
+    if (op == NULL) {
+        error_exit("Uring op malloc failed.");
+    }
+    memset(op, 0, sizeof(UringOp_t));
+    op->type = type;
+    op->owner = owner;
+    op->slot = -1;
+    op->buffer_size = size;
+    return op;
+}
+
+/**
+* @brief Fill SENDMSG entry for operation's prepared iovecs.
+*
+* @param sqe Pointer to SQE.
+* @param op Send operation.
+* @param count Number of iovecs.
+* @param index Registered index of socket.
+*
+* @return void
+*/
+static void uring_prep_send(struct io_uring_sqe *sqe, UringOp_t *op, int count, int index) {
+    op->msg.msg_name = &op->addr;
+    op->msg.msg_namelen = sizeof(op->addr);
+    op->msg.msg_iov = op->iov;
+    op->msg.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = index;
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_CONFIRM;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+}
+
+void uring_recv(Uring_t *ring, UringOp_t *op, int index) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    op->iov[0].iov_base = op->buffer;
+    op->iov[0].iov_len = op->buffer_size;
+    op->msg.msg_name = &op->addr;
+    op->msg.msg_namelen = sizeof(op->addr);
+    op->msg.msg_iov = op->iov;
+    op->msg.msg_iovlen = 1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+}
+
+void uring_poll(Uring_t *ring, UringOp_t *op, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+}
+
+/**
+* @brief Find run of free arena pages, first fit.
+*
+* @param ring Pointer to ring.
+* @param count Number of pages.
+*
+* @return Index of first page, -1 if arena has no such run.
+*/
+static int uring_arena_alloc(Uring_t *ring, int count) {
+    int run = 0;
+    for (int i = 0; i < ring->arena_pages; i++) {
+        run = ring->arena_used[i] ? 0 : run + 1;
+        if (run == count) {
+            memset(ring->arena_used + i - count + 1, 1, count);
+            return i - count + 1;
+        }
+    }
+    return -1;
+}
+
+bool uring_session_attach(Uring_t *ring, Session_t *session, int socket, void *context) {
+    UringSession_t *us = calloc(1, sizeof(UringSession_t));
+    if (us == NULL) {
+        return false;
+    }
+    us->ring = ring;
+    us->session = session;
+    us->context = context;
+    us->file_index = -1;
+    us->first_page = -1;
+    if ((us->socket_index = uring_file_register(ring, socket)) < 0) {
+        free(us);
+        return false;
+    }
+    // Slots sized to negotiated blksize, one per block of window; without free arena every block is copied.
+    long window = session->options[WINDOWSIZE].value;
+    us->slot_size = session->options[BLKSIZE].value + 4;
+    us->slot_count = window < URING_SESSION_SLOTS ? window : URING_SESSION_SLOTS;
+    us->page_count = (int)(((long)us->slot_count * us->slot_size + URING_PAGE_SIZE - 1) / URING_PAGE_SIZE);
+    if ((us->first_page = uring_arena_alloc(ring, us->page_count)) < 0) {
+        us->slot_count = 0;
+    }
+    else {
+        us->slots = ring->arena + (long)us->first_page * URING_PAGE_SIZE;
+    }
+    for (int i = 0; i < us->slot_count; i++) {
+        us->free_slots[us->free_slot_count++] = i;
+    }
+    us->recv_op = uring_op_alloc(URING_OP_RECV, us, us->slot_size);
+    session->uring = us;
+    return true;
+}
+
+void uring_session_detach(Session_t *session) {
+    UringSession_t *us = session->uring;
+    // Sends queued for this socket must reach kernel before it is closed.
+    uring_submit_and_wait(us->ring, 0);
+    uring_file_unregister(us->ring, us->socket_index);
+    if (us->file_index >= 0) {
+        uring_file_unregister(us->ring, us->file_index);
+    }
+    if (us->first_page >= 0) {
+        memset(us->ring->arena_used + us->first_page, 0, us->page_count);
+    }
+    free(us->recv_op);
+    free(us);
+    session->uring = NULL;
+}
+
+void uring_session_recv(UringSession_t *us) {
+    if (us->closing || us->recv_armed) {
+        return;
+    }
+    uring_recv(us->ring, us->recv_op, us->socket_index);
+    us->recv_armed = true;
+    us->inflight++;
+}
+
+bool uring_session_close(UringSession_t *us) {
+    us->closing = true;
+    if (us->recv_armed) {
+        UringOp_t *op = uring_op_alloc(URING_OP_CANCEL, NULL, 0);
+        struct io_uring_sqe *sqe = uring_get_sqe(us->ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uint64_t)(uintptr_t)us->recv_op;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+    }
+    return us->inflight == 0;
+}
+
+/**
+* @brief Record failure of async file operation, engine reports it to client.
+*
+* @param us Pointer to session's io_uring state.
+* @param error_code TFTP error code.
+* @param error_msg Error message.
+*
+* @return void
+*/
+static void uring_session_fail(UringSession_t *us, int error_code, char *error_msg) {
+    if (!us->failed) {
+        us->failed = true;
+        us->error_code = error_code;
+        us->error_msg = error_msg;
+    }
+}
+
+UringSession_t *uring_session_complete(UringOp_t *op, int result) {
+    UringSession_t *us = op->owner;
+    if (us == NULL) {
+        free(op);
+        return NULL;
+    }
+    us->inflight--;
+    switch (op->type) {
+        case URING_OP_RECV:
+            // Operation is reused for next packet.
+            us->recv_armed = false;
+            return us;
+        case URING_OP_READ:
+            // Short read breaks the link, so the DATA packet is never sent with stale bytes.
+            if (result != op->expected) {
+                uring_session_fail(us, ERR_NOT_DEFINED, "Failed to read file.");
+            }
+            break;
+        case URING_OP_SEND:
+            // Failed or canceled send is a lost packet, timer retransmits it.
+            if (op->slot >= 0) {
+                us->free_slots[us->free_slot_count++] = op->slot;
+            }
+            break;
+        case URING_OP_WRITE:
+            us->writes--;
+            us->free_slots[us->free_slot_count++] = op->slot;
+            if (result != op->expected) {
+                uring_session_fail(us, ERR_DISK_FULL, "Failed to write file.");
+            }
+            else if (us->writes == 0 && us->ack_pending && !us->failed && !us->closing) {
+                us->ack_pending = false;
+                send_ack_packet(us->session, us->ack_socket, us->ack_dest, us->ack_block);
+            }
+            break;
+        default:
+            break;
+    }
+    free(op);
+    return us;
+}
+
+void uring_send(UringSession_t *us, struct iovec *iov, int count, struct sockaddr_in *dest_addr) {
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        size += iov[i].iov_len;
+    }
+    UringOp_t *op = uring_op_alloc(URING_OP_SEND, NULL, size);
+    size = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(op->buffer + size, iov[i].iov_base, iov[i].iov_len);
+        size += iov[i].iov_len;
+    }
+    op->iov[0].iov_base = op->buffer;
+    op->iov[0].iov_len = size;
+    op->addr = *dest_addr;
+    uring_prep_send(uring_get_sqe(us->ring), op, 1, us->socket_index);
+}
+
+/**
+* @brief Register session's file on first file operation.
+*
+* @param us Pointer to session's io_uring state.
+*
+* @return True if file is registered.
+*/
+static bool uring_session_file(UringSession_t *us) {
+    struct stat status;
+    if (us->file_index >= 0) {
+        return true;
+    }
+    if (us->session->file == NULL || fstat(fileno(us->session->file), &status) < 0) {
+        return false;
+    }
+    us->file_size = status.st_size;
+    us->file_index = uring_file_register(us->ring, fileno(us->session->file));
+    return us->file_index >= 0;
+}
+
+long uring_data_queue(UringSession_t *us, struct sockaddr_in *dest_addr, long block_number) {
+    Session_t *session = us->session;
+    struct io_uring_sqe *sqe;
+    UringOp_t *op;
+    long length = block_length(session, block_number);
+    off_t offset = block_offset(session, block_number);
+    long size;
+
+    if (session->map == NULL && session->cache == NULL && session->encoded == NULL && us->free_slot_count > 0 &&
+        uring_session_file(us)) {
+        // Payload is read into registered slot right after header, linked send goes out only if read succeeded.
+        int slot = us->free_slots[--us->free_slot_count];
+        char *buffer = us->slots + (long)slot * us->slot_size;
+        size = offset >= us->file_size ? 0 : us->file_size - offset;
+        size = size < length ? size : length;
+        packet_build_data(buffer, OPCODE_SIZE + BLOCK_NUMBER_SIZE, block_number);
+        if (size > 0) {
+            op = uring_op_alloc(URING_OP_READ, us, 0);
+            op->expected = size;
+            sqe = uring_get_linked_sqe(us->ring);
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->fd = us->file_index;
+            sqe->flags |= IOSQE_FIXED_FILE;
+            sqe->addr = (uint64_t)(uintptr_t)(buffer + 4);
+            sqe->len = size;
+            sqe->off = offset;
+            sqe->buf_index = 0;
+            sqe->user_data = (uint64_t)(uintptr_t)op;
+            us->inflight++;
+        }
+        op = uring_op_alloc(URING_OP_SEND, us, 0);
+        op->slot = slot;
+        op->iov[0].iov_base = buffer;
+        op->iov[0].iov_len = size + 4;
+        op->addr = *dest_addr;
+        uring_prep_send(uring_get_linked_sqe(us->ring), op, 1, us->socket_index);
+        us->inflight++;
+        return size;
+    }
+    // Mapping or cache serve payload from memory, mapped payload is referenced so session must outlive the send.
+    op = uring_op_alloc(URING_OP_SEND, session->map != NULL ? us : NULL, length + 4);
+    if ((size = data_packet_build(session, block_number, op->buffer, op->iov)) < 0) {
+        free(op);
+        return -1;
+    }
+    op->addr = *dest_addr;
+    uring_prep_send(uring_get_linked_sqe(us->ring), op, 2, us->socket_index);
+    if (op->owner != NULL) {
+        us->inflight++;
+    }
+    return size;
+}
+
+bool uring_block_write(UringSession_t *us, long block_number, char *buffer, long size) {
+    if (size == 0) {
+        return true;
+    }
+    if (us->free_slot_count == 0 || !uring_session_file(us)) {
+        return false;
+    }
+    int slot = us->free_slots[--us->free_slot_count];
+    char *data = us->slots + (long)slot * us->slot_size;
+    memcpy(data, buffer, size);
+    UringOp_t *op = uring_op_alloc(URING_OP_WRITE, us, 0);
+    op->slot = slot;
+    op->expected = size;
+    struct io_uring_sqe *sqe = uring_get_sqe(us->ring);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = us->file_index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = size;
+    sqe->off = block_offset(us->session, block_number);
+    sqe->buf_index = 0;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    us->inflight++;
+    us->writes++;
+    return true;
+}
+
+bool uring_ack_defer(UringSession_t *us, int socket, struct sockaddr_in *dest_addr, long block_number) {
+    if (us->writes == 0) {
+        return false;
+    }
+    // ACK promises the block is on disk, only the latest one is kept.
+    us->ack_pending = true;
+    us->ack_block = block_number;
+    us->ack_socket = socket;
+    us->ack_dest = *dest_addr;
+    return true;
+}
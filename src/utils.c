@@ -8,11 +8,361 @@
 
 #include "../include/utils.h"
 
-int packet_pos = 0;
-bool last = false;
+void session_init(Session_t *session) {
+    memset(session, 0, sizeof(Session_t));
+    options_reset(session);
+    session->mode = OCTET;
+    session->log_socket = -1;
+    session->error_code = ERR_NOT_DEFINED;
+    session->timer.rto = RTO_INITIAL;
+}
+
+bool session_packet_alloc(Session_t *session) {
+    int size = session->options[BLKSIZE].value + 4;
+    // OACK is received into the same buffer, small blksize must not cut options off it.
+    if (size < DEFAULT_PACKET_SIZE) {
+        size = DEFAULT_PACKET_SIZE;
+    }
+    if (session->packet != NULL && session->packet_size >= size) {
+        return true;
+    }
+    char *packet = realloc(session->packet, size);
+    if (packet == NULL) {
+        return false;
+    }
+    session->packet = packet;
+    session->packet_size = size;
+    return true;
+}
+
+void session_close(Session_t *session) {
+    if (session->uring != NULL) {
+        uring_session_detach(session);
+    }
+    // Mapping stays valid until now, so pending zero-copy sends never see unmapped pages.
+    if (session->map != NULL) {
+        munmap(session->map, session->map_size);
+        session->map = NULL;
+    }
+    encodestream_close(session->encoded);
+    session->encoded = NULL;
+    if (session->file != NULL && session->file != stdin) {
+        fclose(session->file);
+    }
+    session->file = NULL;
+    compress_decoder_free(&session->compress);
+    free(session->packet);
+    session->packet = NULL;
+    session->packet_size = 0;
+}
+
+Batch_t *batch_create(int capacity) {
+    Batch_t *batch = calloc(1, sizeof(Batch_t));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->capacity = capacity;
+    batch->recv_msgs = calloc(capacity, sizeof(struct mmsghdr));
+    batch->recv_iovs = calloc(capacity, sizeof(struct iovec));
+    batch->recv_addrs = calloc(capacity, sizeof(struct sockaddr_in));
+    batch->recv_buffer = malloc((size_t)capacity * BATCH_SLOT_SIZE);
+    batch->send_msgs = calloc(capacity, sizeof(struct mmsghdr));
+    batch->send_iovs = calloc(2 * capacity, sizeof(struct iovec));
+    batch->send_buffer = malloc((size_t)capacity * BATCH_SLOT_SIZE);
+    if (batch->recv_msgs == NULL || batch->recv_iovs == NULL || batch->recv_addrs == NULL || batch->recv_buffer == NULL ||
+        batch->send_msgs == NULL || batch->send_iovs == NULL || batch->send_buffer == NULL) {
+        batch_free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+void batch_free(Batch_t *batch) {
+    free(batch->recv_msgs);
+    free(batch->recv_iovs);
+    free(batch->recv_addrs);
+    free(batch->recv_buffer);
+    free(batch->send_msgs);
+    free(batch->send_iovs);
+    free(batch->send_buffer);
+    free(batch);
+}
+
+int batch_recv(Batch_t *batch, int socket, int size) {
+    int count;
+    for (int i = 0; i < batch->capacity; i++) {
+        batch->recv_iovs[i].iov_base = batch->recv_buffer + (size_t)i * BATCH_SLOT_SIZE;
+        batch->recv_iovs[i].iov_len = size;
+        batch->recv_msgs[i].msg_hdr.msg_iov = &batch->recv_iovs[i];
+        batch->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->recv_msgs[i].msg_hdr.msg_name = &batch->recv_addrs[i];
+        batch->recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->recv_msgs[i].msg_hdr.msg_control = NULL;
+        batch->recv_msgs[i].msg_hdr.msg_controllen = 0;
+    }
+    while ((count = recvmmsg(socket, batch->recv_msgs, batch->capacity, MSG_DONTWAIT, NULL)) < 0 && errno == EINTR);
+    if (count > 0) {
+        batch->recv_calls++;
+        batch->recv_packets += count;
+    }
+    return count;
+}
 
-// Set default values for options.
-Option_t options[NUM_OPTIONS];
+char *batch_packet(Batch_t *batch, int index) {
+    return batch->recv_buffer + (size_t)index * BATCH_SLOT_SIZE;
+}
+
+/**
+* @brief Send queued DATA packets of session with as few sendmmsg calls as possible.
+*
+* @param session Pointer to session.
+* @param socket Socket file descriptor.
+* @param dest_addr Destination address.
+* @param count Number of queued packets.
+*
+* @return void
+*/
+static void batch_send(Session_t *session, int socket, struct sockaddr_in *dest_addr, int count) {
+    Batch_t *batch = session->batch;
+    int flags = MSG_CONFIRM;
+    int sent = 0, result;
+    if (session->zero_copy) {
+        flags |= MSG_ZEROCOPY;
+    }
+    for (int i = 0; i < count; i++) {
+        memset(&batch->send_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        batch->send_msgs[i].msg_hdr.msg_name = dest_addr;
+        batch->send_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->send_msgs[i].msg_hdr.msg_iov = &batch->send_iovs[2 * i];
+        batch->send_msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    // Kernel may stop after part of batch, rest is sent by next call.
+    while (sent < count) {
+        if ((result = sendmmsg(socket, batch->send_msgs + sent, count - sent, flags)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Notification memory limit reached, rest is sent by copy.
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                zerocopy_drain(session, socket);
+                flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+            // Lost packets are recovered by retransmission.
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "Sendmmsg failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+        batch->send_calls++;
+        batch->send_packets += result;
+        sent += result;
+    }
+}
+
+bool session_map_file(Session_t *session, int socket) {
+    struct stat status;
+    int enable = 1;
+    if (fstat(fileno(session->file), &status) < 0 || status.st_size == 0) {
+        return false;
+    }
+    void *map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fileno(session->file), 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, status.st_size, MADV_SEQUENTIAL);
+    session->map = map;
+    session->map_size = status.st_size;
+    if (session->options[BLKSIZE].value >= ZEROCOPY_MIN_BLKSIZE) {
+        session->zero_copy = setsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+    }
+    return true;
+}
+
+void zerocopy_drain(Session_t *session, int socket) {
+    char control[CMSG_SPACE(64)];
+    struct msghdr msg;
+    if (!session->zero_copy) {
+        return;
+    }
+    // Mapping outlives every send, so completions are only consumed to keep error queue empty.
+    while (true) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+    }
+}
+
+long time_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+long timer_timeout(Session_t *session) {
+    if (session->options[UTIMEOUT].flag) {
+        return session->options[UTIMEOUT].value;
+    }
+    if (session->options[TIMEOUT].flag) {
+        return session->options[TIMEOUT].value * 1000000L;
+    }
+    return session->timer.rto;
+}
+
+void timer_start(Session_t *session) {
+    long now = time_now();
+    session->timer.sent_at = now;
+    session->timer.retransmitted = false;
+    session->timer.deadline = now + timer_timeout(session);
+}
+
+void timer_arm(Session_t *session) {
+    session->timer.deadline = time_now() + timer_timeout(session);
+}
+
+void timer_ack(Session_t *session) {
+    Timer_t *timer = &session->timer;
+    if (timer->sent_at != 0 && !timer->retransmitted) {
+        long rtt = time_now() - timer->sent_at;
+        if (timer->srtt == 0) {
+            timer->srtt = rtt;
+            timer->rttvar = rtt / 2;
+        }
+        else {
+            timer->rttvar = (3 * timer->rttvar + labs(timer->srtt - rtt)) / 4;
+            timer->srtt = (7 * timer->srtt + rtt) / 8;
+        }
+    }
+    // Progress ends backoff even without sample, restarted windows would otherwise keep doubled timeout for good.
+    if (timer->srtt != 0) {
+        timer->rto = timer->srtt + (4 * timer->rttvar > RTO_GRANULARITY ? 4 * timer->rttvar : RTO_GRANULARITY);
+        if (timer->rto < RTO_MIN) {
+            timer->rto = RTO_MIN;
+        }
+        if (timer->rto > RTO_MAX) {
+            timer->rto = RTO_MAX;
+        }
+    }
+    timer->sent_at = 0;
+    timer->retries = 0;
+    timer->deadline = 0;
+}
+
+bool timer_retry(Session_t *session) {
+    Timer_t *timer = &session->timer;
+    if (++timer->retries > MAX_RETRIES) {
+        timer->deadline = 0;
+        metrics_add(METRIC_TIMEOUTS, 1);
+        return false;
+    }
+    metrics_add(METRIC_RETRANSMITS, 1);
+    // Negotiated timeout is used as is, estimated one is doubled on every retransmission.
+    timer->rto = timer->rto * 2 > RTO_MAX ? RTO_MAX : timer->rto * 2;
+    timer->retransmitted = true;
+    timer->deadline = time_now() + timer_timeout(session);
+    return true;
+}
+
+void timer_stop(Session_t *session) {
+    session->timer.deadline = 0;
+}
+
+bool wait_for_packet(Session_t *session, int socket) {
+    struct pollfd poll_fd = { .fd = socket, .events = POLLIN, .revents = 0 };
+    long remaining;
+    int ready;
+    while (true) {
+        remaining = session->timer.deadline == 0 ? -1 : session->timer.deadline - time_now();
+        if (session->timer.deadline != 0 && remaining <= 0) {
+            return false;
+        }
+        // Round up, so poll never returns before deadline.
+        if ((ready = poll(&poll_fd, 1, remaining < 0 ? -1 : (int)((remaining + 999) / 1000))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_exit("Poll failed.");
+        }
+        if (ready > 0) {
+            // Only zero-copy completions arrived.
+            if (!(poll_fd.revents & POLLIN)) {
+                zerocopy_drain(session, socket);
+                continue;
+            }
+            return true;
+        }
+    }
+}
+
+/**
+* @brief Send packet, failure is not fatal as lost packets are recovered by retransmission.
+*
+* @param session Pointer to session.
+* @param socket Socket file descriptor.
+* @param packet Pointer to packet.
+* @param size Packet size.
+* @param dest_addr Destination address.
+*
+* @return True if packet was sent, false otherwise.
+*/
+static bool packet_send(Session_t *session, int socket, char *packet, int size, struct sockaddr_in dest_addr) {
+    metrics_add(METRIC_PACKETS_SENT, 1);
+    if (session->uring != NULL) {
+        struct iovec iov = { packet, size };
+        uring_send(session->uring, &iov, 1, &dest_addr);
+        return true;
+    }
+    if (sendto(socket, packet, size, MSG_CONFIRM, (const struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            fprintf(stderr, "Sendto failed: %s\n", strerror(errno));
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+* @brief Send DATA packet whose header and payload are in separate buffers.
+*
+* @param session Pointer to session.
+* @param socket Socket file descriptor.
+* @param iov Header and payload buffers.
+* @param dest_addr Destination address.
+*
+* @return True if packet was sent, false otherwise.
+*/
+static bool packet_send_iov(Session_t *session, int socket, struct iovec *iov, struct sockaddr_in dest_addr) {
+    struct msghdr msg;
+    if (session->uring != NULL) {
+        uring_send(session->uring, iov, 2, &dest_addr);
+        return true;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &dest_addr;
+    msg.msg_namelen = sizeof(dest_addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (session->zero_copy && iov[1].iov_len >= ZEROCOPY_MIN_BLKSIZE) {
+        if (sendmsg(socket, &msg, MSG_CONFIRM | MSG_ZEROCOPY) >= 0) {
+            return true;
+        }
+        // Notification memory limit reached, send this packet by copy.
+        if (errno != ENOBUFS) {
+            return false;
+        }
+        zerocopy_drain(session, socket);
+    }
+    if (sendmsg(socket, &msg, MSG_CONFIRM) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            fprintf(stderr, "Sendmsg failed: %s\n", strerror(errno));
+        }
+        return false;
+    }
+    return true;
+}
 
 void error_exit(const char *message) {
     (errno == 0) ? fprintf(stdout, "Error: %s\n", message) : fprintf(stdout, "Error: %s (%s)\n", message, strerror(errno));
@@ -20,34 +370,107 @@ void error_exit(const char *message) {
 }
 
 int parse_port(char *port_str) {
-    char *endptr = malloc(MAX_STR_LEN);
-    if (endptr == NULL) {
-        error_exit("Port string malloc failed.");
-    }
+    char *endptr = NULL;
     // Convert port string to int.
     int port = (int)strtol(port_str, &endptr, 10);
-    if (*endptr != '\0' || port > 65535 || port < 1) {
+    if (*endptr != '\0' || endptr == port_str || port > 65535 || port < 1) {
         error_exit("Invalid port number.");
     }
     return port;
 }
 
+int parse_log_level(char *level_str) {
+    char *endptr = NULL;
+    int level = (int)strtol(level_str, &endptr, 10);
+    if (*endptr != '\0' || endptr == level_str || level < LOG_NONE || level > LOG_PACKET) {
+        error_exit("Invalid log level.");
+    }
+    return level;
+}
+
 void display_client_help() {
-    printf("Usage: bin/tftp-client -h hostname [-p port] [-f filepath] -t dest_filepath\n");
+    printf("Usage: bin/tftp-client -h hostname [-p port] [-f filepath] -t dest_filepath [-b blksize|auto] [-s] [-w windowsize] [-o timeout] [-u utimeout] [-m] [-a] [-r] [-c] [-P segments] [-l level]\n");
+    printf("       bin/tftp-client -h hostname [-p port] -B manifest|- [-j jobs] [-b blksize|auto] [-s] [-w windowsize] [-o timeout] [-u utimeout] [-m] [-a] [-r] [-c] [-l level]\n");
     printf("Options:\n");
     printf("  -h  IP address or host name of the TFTP server.\n");
     printf("  -p  Port number of the TFTP server.\n");
     printf("  -f  Path to the file on the TFTP server.\n");
     printf("  -t  Path to the destination file.\n");
+    printf("  -b  Block size in bytes (RFC 2348), auto picks the largest one not fragmented on path to server.\n");
+    printf("  -s  Exchange transfer size with server (RFC 2349).\n");
+    printf("  -w  Number of DATA packets sent before waiting for ACK (RFC 7440).\n");
+    printf("  -o  Retransmission timeout in seconds (RFC 2349), estimated from RTT if not set.\n");
+    printf("  -u  Retransmission timeout in microseconds (utimeout extension).\n");
+    printf("  -m  Read file by multicast together with other clients (RFC 2090).\n");
+    printf("  -a  Transfer text file in netascii mode, line ends are converted to CR LF on the wire.\n");
+    printf("  -r  Resume interrupted transfer, only bytes missing at destination are sent (offset extension).\n");
+    printf("  -c  Send data compressed with built-in LZ codec, server caches compressed copies of files (compress extension).\n");
+    printf("  -P  Read file over given number of concurrent sessions, one byte range each (range extension).\n");
+    printf("  -l  Log level, 0 nothing, 1 requests, OACKs and ERRORs (default), 2 every DATA and ACK as well.\n");
+    printf("  -B  Run transfers listed in manifest file or on stdin (-), one \"get remote [local]\", \"put local [remote]\" or remote name per line.\n");
+    printf("  -j  Number of batch transfers running at once, default 8.\n");
 }
 
 void display_server_help() {
-    printf("Usage: bin/tftp-server [-p port] root_dirpath\n");
+    printf("Usage: bin/tftp-server [-p port] [-m epoll|fork|uring] [-n max_transfers] [-j workers [-a]] [-z] [-r] [-c cache_mb] [-b batch] [-M group_addr] [-e endpoint] [-l level] root_dirpath\n");
     printf("Options:\n");
     printf("  -p  Port number of the TFTP server.\n");
+    printf("  -m  Server mode, single process epoll event loop (default), process per transfer or io_uring event loop.\n");
+    printf("  -n  Maximum number of concurrent transfers in event loop mode.\n");
+    printf("  -j  Number of worker processes with own SO_REUSEPORT socket, 0 for one per CPU.\n");
+    printf("  -a  Pin every worker to its own CPU.\n");
+    printf("  -z  Send files from memory mapping, with MSG_ZEROCOPY for blksize 8192 and above.\n");
+    printf("  -r  Let clients resume uploads into existing files (offset extension), off by default.\n");
+    printf("  -c  Size of block cache for served files in megabytes, shared by all transfers and processes.\n");
+    printf("  -b  Maximum number of datagrams per recvmmsg/sendmmsg call (epoll) or receives waiting on listener (uring), default 32.\n");
+    printf("  -M  Multicast address for clients requesting multicast option (RFC 2090).\n");
+    printf("  -e  Serve metrics in Prometheus text format over HTTP on UNIX socket path or loopback TCP port.\n");
+    printf("  -l  Log level, 0 nothing, 1 requests, OACKs and ERRORs (default), 2 every DATA and ACK as well.\n");
     printf("  -d  Path to the directory with files.\n");
 }
 
+void display_bench_help() {
+    printf("Usage: bin/tftp-bench [-h hostname] [-p port] [-n transfers] [-c concurrency] [-r rate] [-f files] [-s sizes] [-b blksize] [-w windowsize] [-u utimeout] [-t prefix] [-d root_dirpath]\n");
+    printf("Options:\n");
+    printf("  -h  IP address of the TFTP server, default 127.0.0.1.\n");
+    printf("  -p  Port number of the TFTP server.\n");
+    printf("  -n  Total number of transfers, default 100.\n");
+    printf("  -c  Number of transfers running at once, default 10.\n");
+    printf("  -r  New transfers per second, by default a new transfer starts whenever one finishes.\n");
+    printf("  -f  Comma separated files read by RRQ.\n");
+    printf("  -s  Comma separated sizes of files written by WRQ, with optional K or M suffix. With -f reads and writes alternate.\n");
+    printf("  -b  Requested blksize (RFC 2348).\n");
+    printf("  -w  Requested windowsize (RFC 7440).\n");
+    printf("  -u  Retransmission timeout in microseconds, default 1000000.\n");
+    printf("  -t  Name prefix of written files, default bench.\n");
+    printf("  -d  Server root directory, written files are removed from it after transfer.\n");
+}
+
+void display_proxy_help() {
+    printf("Usage: bin/tftp-proxy [-l listen_port] [-h hostname] [-p port] [-L loss] [-d delay] [-j jitter] [-D duplicate] [-r reorder [-R reorder_delay]] [-b bandwidth] [-q queue] [-s seed]\n");
+    printf("Options:\n");
+    printf("  -l  Port clients send requests to, default 6970.\n");
+    printf("  -h  IP address of the TFTP server, default 127.0.0.1.\n");
+    printf("  -p  Port number of the TFTP server.\n");
+    printf("  -L  Percentage of lost datagrams.\n");
+    printf("  -d  One way delay in milliseconds.\n");
+    printf("  -j  Jitter in milliseconds, delay of every datagram varies by up to this much.\n");
+    printf("  -D  Percentage of duplicated datagrams.\n");
+    printf("  -r  Percentage of datagrams held back so later ones overtake them.\n");
+    printf("  -R  Extra delay of held back datagrams in milliseconds, default 10.\n");
+    printf("  -b  Bandwidth of each direction in kbit/s, unlimited by default.\n");
+    printf("  -q  Datagrams waiting in each direction, further ones are dropped, default 1000.\n");
+    printf("  -s  Seed of random generator, runs with the same seed and traffic impair the same datagrams.\n");
+}
+
+void display_codec_bench_help() {
+    printf("Usage: bin/codec-bench [-n packets] [-f fuzz] [-s seed]\n");
+    printf("Options:\n");
+    printf("  -n  Packets parsed per packet type when measuring parse rate, default 10000000.\n");
+    printf("  -f  Random malformed packets parsed before measuring, default 1000000.\n");
+    printf("  -s  Seed of random packets, default 1.\n");
+}
+
 int init_socket(int port, struct sockaddr_in *server_addr) {
     int sock_fd;
     if ((sock_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
@@ -64,182 +487,270 @@ void sigint_handler(int sig) {
     exit(EXIT_SUCCESS);
 }
 
-void opcode_set(int opcode, char *packet) {
-    // Save opcode inside packet in network byte order.
-    *(int *)packet = htons(opcode);
-    packet_pos += OPCODE_SIZE;
-}
-
-int opcode_get(char *packet) {
-    int opcode;
-    // Get opcode from packet.
-    memcpy(&opcode, packet, OPCODE_SIZE);
-    // Convert opcode to host byte order.
-    opcode = ntohs(opcode);
-    packet_pos += OPCODE_SIZE;
+int opcode_get(Session_t *session, char *packet) {
+    int opcode = codec_get_u16(packet + session->packet_pos);
+    session->packet_pos += OPCODE_SIZE;
     return opcode;
 }
 
-void file_name_set(char *file_name, char *packet) {
-    // Save file name inside packet.
-    if (strlen(file_name) == MAX_FILE_NAME_LEN) {
-        error_exit("File name too long.");
-    }
-    strncpy(packet_pos + packet, file_name, MAX_FILE_NAME_LEN);
-    packet_pos += strnlen(file_name, MAX_FILE_NAME_LEN);
-}
-
-char *file_name_get(char *packet) {
-    char *file_name = calloc(MAX_FILE_NAME_LEN, sizeof(char));
-    // Get file name from packet.
-    file_name = packet_pos + packet;
-    packet_pos += strlen(file_name) + 1;
-    return file_name;
-}
-
-void mode_set(int mode, char *packet) {
-    // Save mode inside packet.
-    if (mode == OCTET) {
-        strcpy(packet_pos + packet, "octet");
-        packet_pos += strlen("octet");
-    }
-    else if (mode == NETASCII) {
-        strcpy(packet_pos + packet, "netascii");
-        packet_pos += strlen("netascii");
-    }
-    else {
-        error_exit("Mode not supported.");
-    }
-}
-
-char *mode_get(char *packet) {
-    char *mode = calloc(MAX_MODE_LEN, sizeof(char));
-    // Get mode from packet.
-    mode = packet_pos + packet;
-    string_to_lower(mode);
-    packet_pos += strlen(mode) + 1;
-    return mode;
+int block_number_get(Session_t *session, char *packet) {
+    int block_number = codec_get_u16(packet + session->packet_pos);
+    session->packet_pos += BLOCK_NUMBER_SIZE;
+    return block_number;
 }
 
-void empty_byte_insert(char *packet) {
-    packet[packet_pos++] = '\0';
+long block_number_unwrap(long base, int block_number) {
+    return base + ((block_number - base) & 0xFFFF);
 }
 
-void block_number_set(int block_number, char *packet) {
-    // Save block number inside packet in network byte order.
-    *(int *)(packet + packet_pos) = htons(block_number);
-    packet_pos += BLOCK_NUMBER_SIZE;
+off_t block_offset(Session_t *session, long block_number) {
+    // Offset and range start are 0 unless transfer was resumed or serves part of file.
+    return (off_t)session->options[OFFSET].value + (off_t)session->options[RANGE].value +
+           (off_t)(block_number - 1) * session->options[BLKSIZE].value;
 }
 
-int block_number_get(char *packet) {
-    int block_number;
-    // Get block number from packet.
-    memcpy(&block_number, packet + packet_pos, BLOCK_NUMBER_SIZE);
-    // Convert block number to host byte order.
-    block_number = ntohs(block_number);
-    packet_pos += BLOCK_NUMBER_SIZE;
-    return block_number;
+long block_length(Session_t *session, long block_number) {
+    long blksize = session->options[BLKSIZE].value;
+    off_t left;
+    if (!session->options[RANGE].flag) {
+        return blksize;
+    }
+    left = session->options[RANGE].value + session->range_length - block_offset(session, block_number);
+    return left < 0 ? 0 : left < blksize ? left : blksize;
 }
 
-void data_set(char *packet, FILE *file) {
-    int c;
-    while ((c = fgetc(file)) != EOF) {
-        packet[packet_pos++] = (char)c;
-        if (packet_pos == options[BLKSIZE].value + 4) {
+long block_read(Session_t *session, long block_number, char *buffer) {
+    long length = block_length(session, block_number);
+    off_t offset = block_offset(session, block_number);
+    long size = 0;
+    ssize_t result;
+    if (session->encoded != NULL) {
+        return encodestream_read(session->encoded, buffer, length, offset);
+    }
+    if (session->reader != NULL) {
+        return session->reader(session->user, buffer, length, offset);
+    }
+    if (session->cache != NULL) {
+        return cache_read(session->cache, &session->cache_key, fileno(session->file), buffer, offset, length);
+    }
+    // Block is addressed by its offset, so retransmission does not depend on file position.
+    while (size < length) {
+        if ((result = pread(fileno(session->file), buffer + size, length - size, offset + size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (result == 0) {
             break;
         }
+        size += result;
     }
+    return size;
 }
 
-char *data_get(char *packet, int recvfrom_size) {
-    char *data = packet + packet_pos;
-    packet_pos += recvfrom_size - 4;
-    return data;
-}
-
-void error_code_set(int error_code, char *packet) {
-    // Save error code inside packet in network byte order.
-    *(int *)(packet + packet_pos) = htons(error_code);
-    packet_pos += ERROR_CODE_SIZE;
-}
-
-int error_code_get(char *packet) {
-    int error_code;
-    // Get error code from packet.
-    memcpy(&error_code, packet + packet_pos, ERROR_CODE_SIZE);
-    // Convert error code to host byte order.
-    error_code = ntohs(error_code);
-    packet_pos += ERROR_CODE_SIZE;
-    return error_code;
+/**
+* @brief Write data at offset of file, through writer callback if session has one.
+*
+* @param session Pointer to session.
+* @param buffer Data.
+* @param size Size of data.
+* @param offset Offset in file.
+*
+* @return True on success, false otherwise.
+*/
+static bool data_write(Session_t *session, const char *buffer, long size, off_t offset) {
+    long written = 0;
+    ssize_t result;
+    if (session->writer != NULL) {
+        return session->writer(session->user, buffer, size, offset);
+    }
+    while (written < size) {
+        if ((result = pwrite(fileno(session->file), buffer + written, size - written, offset + written)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += result;
+    }
+    return true;
 }
 
-void error_msg_set(char *error_message, char *packet) {
-    // Save error message inside packet.
-    strcpy(packet + packet_pos, error_message);
-    packet_pos += strlen(error_message);
+/**
+* @brief Decompress received block, every completed frame is written right after the previous one.
+*
+* @param session Pointer to session.
+* @param buffer Block data.
+* @param size Size of block data.
+*
+* @return True on success, false otherwise (error is set for corrupted stream).
+*/
+static bool compressed_block_write(Session_t *session, const char *buffer, long size) {
+    CompressDecoder_t *decoder = &session->compress;
+    size_t left = size, output_size;
+    const char *output;
+    int result;
+    while ((result = compress_decode(decoder, &buffer, &left, &output, &output_size)) == 1) {
+        if (!data_write(session, output, output_size, decoder->offset)) {
+            return false;
+        }
+        decoder->offset += output_size;
+    }
+    // Stream must not end inside frame.
+    if (result < 0 || (size < session->options[BLKSIZE].value && decoder->frame_size != 0)) {
+        return session_error_set(session, ERR_NOT_DEFINED, "Corrupted compressed data.");
+    }
+    return true;
 }
 
-char *error_msg_get(char *packet) {
-    char *error_msg = malloc(MAX_STR_LEN);
-    // Get error message from packet.
-    error_msg = packet + packet_pos;
-    packet_pos += strlen(error_msg);
-    return error_msg;
+bool block_write(Session_t *session, long block_number, char *buffer, long size) {
+    off_t offset = block_offset(session, block_number);
+    char decoded[session->mode == NETASCII ? size + 1 : 1];
+    if (session->options[COMPRESS].flag) {
+        return compressed_block_write(session, buffer, size);
+    }
+    // Decoded block is shorter than the encoded one, it goes right after previous block.
+    if (session->mode == NETASCII) {
+        bool last = size < session->options[BLKSIZE].value;
+        size = netascii_decode(&session->netascii, buffer, size, decoded);
+        // CR ending the file has no pair, it is written as is.
+        if (last && session->netascii.pending_cr) {
+            decoded[size++] = '\r';
+        }
+        buffer = decoded;
+        offset = session->netascii.offset;
+        session->netascii.offset += size;
+    }
+    // Queued write reports failure later, ACK is held back until then.
+    else if (session->uring != NULL && uring_block_write(session->uring, block_number, buffer, size)) {
+        return true;
+    }
+    return data_write(session, buffer, size, offset);
 }
 
-void option_set(int type, long int value, int order, int opcode) {
+bool option_set(Session_t *session, int type, long int value, int order, int opcode) {
     switch (type) {
         case TIMEOUT:
-            if (value < 1 || value > 255) {
-                error_exit("Invalid timeout value.");
+            if (value < TIMEOUT_MIN || value > TIMEOUT_MAX) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid timeout value.");
+            }
+            break;
+        case UTIMEOUT:
+            if (value < UTIMEOUT_MIN || value > UTIMEOUT_MAX) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid utimeout value.");
             }
             break;
         case TSIZE:
             if (opcode == RRQ && value != 0) {
-                error_exit("Read request tsize must be 0.");
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Read request tsize must be 0.");
             }
-            if (value < 0 || value > 428998656) {
-                error_exit("Invalid tsize value.");
+            if (value < 0) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid tsize value.");
             }
             break;
         case BLKSIZE:
-            if (value < 8 || value > 65464) {
-                error_exit("Invalid blksize value.");
+            if (value < BLKSIZE_MIN || value > BLKSIZE_MAX) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid blksize value.");
+            }
+            break;
+        case WINDOWSIZE:
+            if (value < WINDOWSIZE_MIN || value > WINDOWSIZE_MAX) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid windowsize value.");
+            }
+            break;
+        case MULTICAST:
+            if (opcode == WRQ) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Multicast is supported for read requests only.");
+            }
+            if (value != 0 && value != 1) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid multicast value.");
+            }
+            break;
+        case OFFSET:
+            if (value < 0) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid offset value.");
+            }
+            break;
+        case RANGE:
+            if (opcode == WRQ) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Range is supported for read requests only.");
+            }
+            if (value < 0) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid range value.");
+            }
+            break;
+        case COMPRESS:
+            if (value != 1) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Unsupported compress codec.");
             }
             break;
         default:
-            error_exit("Invalid option type.");
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid option.");
     }
-    options[type].flag = true;
-    options[type].value = value;
-    options[type].order = order;
+    session->options[type].flag = true;
+    session->options[type].value = value;
+    session->options[type].order = order;
+    return true;
+}
+
+void option_clear(Session_t *session, int type) {
+    if (!session->options[type].flag) {
+        return;
+    }
+    for (int i = 0; i < NUM_OPTIONS; i++) {
+        if (session->options[i].flag && session->options[i].order > session->options[type].order) {
+            session->options[i].order--;
+        }
+    }
+    session->options[type].flag = false;
+    session->options[type].value = 0;
+    session->options[type].order = -1;
 }
 
 int option_get_type(char *name) {
-    if (strcmp(name, TIMEOUT_NAME) == 0) {
+    if (strcasecmp(name, TIMEOUT_NAME) == 0) {
         return TIMEOUT;
     }
-    else if (strcmp(name, TSIZE_NAME) == 0) {
+    else if (strcasecmp(name, TSIZE_NAME) == 0) {
         return TSIZE;
     }
-    else if (strcmp(name, BLKSIZE_NAME) == 0) {
+    else if (strcasecmp(name, BLKSIZE_NAME) == 0) {
         return BLKSIZE;
     }
+    else if (strcasecmp(name, WINDOWSIZE_NAME) == 0) {
+        return WINDOWSIZE;
+    }
+    else if (strcasecmp(name, UTIMEOUT_NAME) == 0) {
+        return UTIMEOUT;
+    }
+    else if (strcasecmp(name, MULTICAST_NAME) == 0) {
+        return MULTICAST;
+    }
+    else if (strcasecmp(name, OFFSET_NAME) == 0) {
+        return OFFSET;
+    }
+    else if (strcasecmp(name, RANGE_NAME) == 0) {
+        return RANGE;
+    }
+    else if (strcasecmp(name, COMPRESS_NAME) == 0) {
+        return COMPRESS;
+    }
     else {
         return -1;
     }
 }
 
-long int option_get_value(int type) {
-    return options[type].value;
+long int option_get_value(Session_t *session, int type) {
+    return session->options[type].value;
 }
 
-int option_get_order(int type) {
-    return options[type].order;
+int option_get_order(Session_t *session, int type) {
+    return session->options[type].order;
 }
 
-bool option_get_flag(int type) {
-    return options[type].flag;
+bool option_get_flag(Session_t *session, int type) {
+    return session->options[type].flag;
 }
 
 char *option_get_name(int type) {
@@ -250,371 +761,732 @@ char *option_get_name(int type) {
             return TSIZE_NAME;
         case BLKSIZE:
             return BLKSIZE_NAME;
+        case WINDOWSIZE:
+            return WINDOWSIZE_NAME;
+        case UTIMEOUT:
+            return UTIMEOUT_NAME;
+        case MULTICAST:
+            return MULTICAST_NAME;
+        case OFFSET:
+            return OFFSET_NAME;
+        case RANGE:
+            return RANGE_NAME;
+        case COMPRESS:
+            return COMPRESS_NAME;
         default:
             return NULL;
     }
 }
 
-void options_load(char *packet, int opcode) {
+/**
+* @brief Load value of multicast option, request carries empty value and OACK "addr,port,mc".
+*
+* @param session Pointer to session.
+* @param value Option value.
+* @param opcode Opcode of packet.
+* @param master Pointer to store master client flag.
+*
+* @return True if value is valid, false otherwise.
+*/
+static bool multicast_option_load(Session_t *session, char *value, int opcode, long *master) {
+    char address[INET_ADDRSTRLEN];
+    char *separator, *endptr;
+    long port;
+    if (opcode != OACK) {
+        *master = 0;
+        return value[0] == '\0';
+    }
+    if ((separator = strchr(value, ',')) == NULL || separator - value >= INET_ADDRSTRLEN) {
+        return false;
+    }
+    memcpy(address, value, separator - value);
+    address[separator - value] = '\0';
+    memset(&session->multicast_addr, 0, sizeof(session->multicast_addr));
+    session->multicast_addr.sin_family = AF_INET;
+    if (inet_pton(AF_INET, address, &session->multicast_addr.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(session->multicast_addr.sin_addr.s_addr))) {
+        return false;
+    }
+    port = strtol(separator + 1, &endptr, 10);
+    if (*endptr != ',' || port < 1 || port > 65535) {
+        return false;
+    }
+    session->multicast_addr.sin_port = htons(port);
+    *master = strtol(endptr + 1, &endptr, 10);
+    return *endptr == '\0' && (*master == 0 || *master == 1);
+}
+
+/**
+* @brief Load value of offset option, "0" or number of bytes followed by their CRC32C in hex ("bytes,crc").
+*
+* @param session Pointer to session.
+* @param value Option value.
+* @param offset Pointer to store number of bytes.
+*
+* @return True if value is valid, false otherwise.
+*/
+static bool offset_option_load(Session_t *session, char *value, long *offset) {
+    char *endptr;
+    unsigned long crc;
+    errno = 0;
+    *offset = strtol(value, &endptr, 10);
+    if (endptr == value || errno == ERANGE || *offset < 0) {
+        return false;
+    }
+    session->offset_crc = 0;
+    if (*offset == 0) {
+        return *endptr == '\0';
+    }
+    if (*endptr != ',' || !isxdigit((unsigned char)endptr[1])) {
+        return false;
+    }
+    crc = strtoul(endptr + 1, &endptr, 16);
+    if (*endptr != '\0' || crc > UINT32_MAX) {
+        return false;
+    }
+    session->offset_crc = crc;
+    return true;
+}
+
+/**
+* @brief Load value of range option, first byte and length of range ("start,length").
+*
+* @param session Pointer to session.
+* @param value Option value.
+* @param start Pointer to store first byte.
+*
+* @return True if value is valid, false otherwise.
+*/
+static bool range_option_load(Session_t *session, char *value, long *start) {
+    char *endptr;
+    errno = 0;
+    *start = strtol(value, &endptr, 10);
+    if (endptr == value || *endptr != ',' || errno == ERANGE || *start < 0) {
+        return false;
+    }
+    value = endptr + 1;
+    session->range_length = strtol(value, &endptr, 10);
+    // End of range is computed from start and length, it must not overflow.
+    return endptr != value && *endptr == '\0' && errno != ERANGE && session->range_length >= 0 &&
+           session->range_length <= LONG_MAX - *start;
+}
+
+bool options_load(Session_t *session, Packet_t *packet, int opcode) {
     char *endptr = NULL;
-    char name[MAX_STR_LEN];
+    char *value;
     int type;
-    long int value;
-    static int order = 0;
-    while (packet[packet_pos] != '\0') {
-        strncpy(name, packet + packet_pos, MAX_STR_LEN - 1);
-        string_to_lower(name);
-        type = option_get_type(name);
+    long int number;
+    int order = 0;
+    for (int i = 0; i < packet->num_options; i++) {
+        // Option names are case insensitive, they are compared in place.
+        type = option_get_type(packet->options[i].name);
+        value = packet->options[i].value;
         if (type == -1) {
-            error_exit("Unsupported option.");
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Unsupported option.");
         }
-        if (option_get_flag(type) == true) {
-            error_exit("Duplicate option.");
+        if (option_get_flag(session, type) == true) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Duplicate option.");
         }
-        packet_pos += strnlen(name, MAX_STR_LEN) + 1;
-        value = strtol(packet + packet_pos, &endptr, 10);
-        if (*endptr != '\0') {
-            error_exit("Invalid option value.");
+        // Multicast value is not a number, it is checked separately.
+        if (type == MULTICAST) {
+            if (opcode == WRQ) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Multicast is supported for read requests only.");
+            }
+            if (!multicast_option_load(session, value, opcode, &number)) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid multicast value.");
+            }
+            option_set(session, type, number, order++, opcode);
+            continue;
         }
-        if (strcmp(name, TIMEOUT_NAME) == 0) {
-            if (value < 1 || value > 255) {
-                error_exit("Invalid timeout value.");
+        if (type == OFFSET) {
+            if (!offset_option_load(session, value, &number)) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid offset value.");
             }
+            option_set(session, type, number, order++, opcode);
+            continue;
         }
-        else if (strcmp(name, TSIZE_NAME) == 0) {
-            if (opcode == RRQ && value != 0) {
-                error_exit("Read request tsize must be 0.");
+        if (type == RANGE) {
+            if (!range_option_load(session, value, &number)) {
+                return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid range value.");
             }
-            if (value < 0 || value > 428998656) {
-                error_exit("Invalid tsize value.");
+            if (!option_set(session, type, number, order++, opcode)) {
+                return false;
             }
+            continue;
         }
-        else if (strcmp(name, BLKSIZE_NAME) == 0) {
-            if (value < 8 || value > 65464) {
-                error_exit("Invalid blksize value.");
+        // Codec is named, the only one is stored as 1.
+        if (type == COMPRESS) {
+            if (!option_set(session, type, strcasecmp(value, COMPRESS_CODEC_NAME) == 0 ? 1 : 0, order++, opcode)) {
+                return false;
             }
+            continue;
         }
-        else {
-            error_exit("Invalid option.");
+        errno = 0;
+        number = strtol(value, &endptr, 10);
+        if (*endptr != '\0' || endptr == value || errno == ERANGE) {
+            return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid option value.");
+        }
+        if (!option_set(session, type, number, order++, opcode)) {
+            return false;
         }
-        option_set(type, value, order++, opcode);
-        packet_pos += strlen(packet + packet_pos) + 1;
     }
+    // Offset counts raw file bytes of one receiver, encoded stream and group transfer have no such offset.
+    if (session->options[OFFSET].flag && session->mode == NETASCII) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Offset requires octet mode.");
+    }
+    if (session->options[OFFSET].flag && session->options[MULTICAST].flag) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Offset cannot be combined with multicast.");
+    }
+    // Range is part of plain file read by one client.
+    if (session->options[RANGE].flag &&
+        (session->mode == NETASCII || session->options[MULTICAST].flag || session->options[OFFSET].flag)) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Range cannot be combined with netascii, multicast or offset.");
+    }
+    // Compressed stream has its own framing, it is not split by file offsets and not shared by a group.
+    if (session->options[COMPRESS].flag && (session->mode == NETASCII || session->options[MULTICAST].flag ||
+                                            session->options[OFFSET].flag || session->options[RANGE].flag)) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Compress cannot be combined with netascii, multicast, offset or range.");
+    }
+    return true;
 }
 
-void options_set(char *packet) {
+void options_reset(Session_t *session) {
+    for (int i = 0; i < NUM_OPTIONS; i++) {
+        session->options[i].flag = false;
+        session->options[i].value = 0;
+        session->options[i].order = -1;
+    }
+    session->options[BLKSIZE].value = BLKSIZE_DEFAULT;
+    session->options[WINDOWSIZE].value = WINDOWSIZE_DEFAULT;
+    session->offset_crc = 0;
+    session->range_length = 0;
+}
+
+/**
+* @brief Get largest blksize whose DATA packets fit into MTU of connected socket.
+*
+* @param socket Connected UDP socket.
+*
+* @return Blksize derived from IP_MTU, -1 if MTU is unknown.
+*/
+static long blksize_socket_max(int socket) {
+    int mtu;
+    socklen_t mtu_size = sizeof(mtu);
+    long blksize;
+    if (getsockopt(socket, IPPROTO_IP, IP_MTU, &mtu, &mtu_size) < 0) {
+        return -1;
+    }
+    blksize = mtu - IP_HEADER_SIZE - UDP_HEADER_SIZE - OPCODE_SIZE - BLOCK_NUMBER_SIZE;
+    if (blksize < BLKSIZE_MIN) {
+        return BLKSIZE_MIN;
+    }
+    return blksize > BLKSIZE_MAX ? BLKSIZE_MAX : blksize;
+}
+
+long blksize_path_max(struct sockaddr_in *addr) {
+    long blksize = -1;
+    // Connecting UDP socket sends nothing, it only looks up route whose MTU is then read.
+    int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock_fd < 0) {
+        return -1;
+    }
+    if (connect(sock_fd, (struct sockaddr *)addr, sizeof(*addr)) == 0) {
+        blksize = blksize_socket_max(sock_fd);
+    }
+    close(sock_fd);
+    return blksize;
+}
+
+void blksize_path_cap(Session_t *session, int socket, struct sockaddr_in *addr) {
+    struct sockaddr unspec = { .sa_family = AF_UNSPEC };
+    long blksize;
+    if (!session->options[BLKSIZE].flag || connect(socket, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        return;
+    }
+    blksize = blksize_socket_max(socket);
+    // Transfer socket must still receive from other TIDs and multicast members, nothing was sent from it yet.
+    connect(socket, &unspec, sizeof(unspec));
+    // Client accepts any blksize up to the requested one (RFC 2348), so smaller value is offered in OACK.
+    if (blksize != -1 && session->options[BLKSIZE].value > blksize) {
+        session->options[BLKSIZE].value = blksize;
+    }
+}
+
+bool session_error_set(Session_t *session, int error_code, char *error_msg) {
+    session->error_code = error_code;
+    session->error_msg = error_msg;
+    return false;
+}
+
+int options_set(Session_t *session, char *packet, int capacity, int pos) {
+    char value[MAX_STR_LEN];
     int order = 0;
     for (int i = 0; i < NUM_OPTIONS; i++) {
-        if (option_get_flag(i) == true) {
-            if (option_get_order(i) == order) {
+        if (option_get_flag(session, i) == true) {
+            if (option_get_order(session, i) == order) {
                 order++;
-                // Copy option name to packet.
-                strcpy(packet + packet_pos, option_get_name(i));
-                // Increment pointer position in packet.
-                packet_pos += strlen(option_get_name(i)) + 1;
-                // Copy option value to packet.
-                sprintf(packet + packet_pos, "%ld", option_get_value(i));
-                // Increment pointer position in packet.
-                packet_pos += strlen(packet + packet_pos) + 1;
+                // Multicast request carries empty value.
+                if (i == MULTICAST && session->multicast_addr.sin_port == 0) {
+                    value[0] = '\0';
+                }
+                else if (i == MULTICAST) {
+                    snprintf(value, sizeof(value), "%s,%d,%ld", inet_ntoa(session->multicast_addr.sin_addr),
+                             ntohs(session->multicast_addr.sin_port), option_get_value(session, i));
+                }
+                else if (i == COMPRESS) {
+                    snprintf(value, sizeof(value), "%s", COMPRESS_CODEC_NAME);
+                }
+                else if (i == RANGE) {
+                    snprintf(value, sizeof(value), "%ld,%ld", option_get_value(session, i), session->range_length);
+                }
+                else if (i == OFFSET && option_get_value(session, i) != 0) {
+                    snprintf(value, sizeof(value), "%ld,%08x", option_get_value(session, i), (unsigned)session->offset_crc);
+                }
+                else {
+                    snprintf(value, sizeof(value), "%ld", option_get_value(session, i));
+                }
+                pos = packet_put_option(packet, capacity, pos, option_get_name(i), value);
                 i = -1;
             }
         }
     }
+    return pos;
 }
 
-void handle_request_packet(char *packet) {
-    int opcode;
-    char file_name[MAX_FILE_NAME_LEN + 1];
-    char mode[MAX_MODE_LEN + 1];
+/**
+* @brief Check that file name stays inside root directory, it is neither absolute nor has ".." component.
+*
+* @param name File name.
+*
+* @return True if name is relative and never climbs up.
+*/
+static bool file_name_inside(const char *name) {
+    const char *part = name;
+    if (name[0] == '/') {
+        return false;
+    }
+    while (part != NULL) {
+        if (part[0] == '.' && part[1] == '.' && (part[2] == '/' || part[2] == '\0')) {
+            return false;
+        }
+        if ((part = strchr(part, '/')) != NULL) {
+            part++;
+        }
+    }
+    return true;
+}
+
+bool handle_request_packet(Session_t *session, char *packet, int size, Packet_t *request) {
+    int result;
 
-    opcode = opcode_get(packet);
-    if (opcode != RRQ && opcode != WRQ) {
-        error_exit("Invalid opcode, server expected RRQ or WRQ.");
+    // Request filling the whole receive buffer may have been cut off.
+    if (size >= REQUEST_PACKET_SIZE) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Request packet too long.");
+    }
+    if ((result = packet_parse(packet, size, request)) != CODEC_OK) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, codec_error_msg(result));
+    }
+    if (request->opcode != RRQ && request->opcode != WRQ) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid opcode, server expected RRQ or WRQ.");
+    }
+    if (request->file_name[0] == '\0') {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "File name cannot be empty.");
     }
-    
-    strncpy(file_name, file_name_get(packet), MAX_FILE_NAME_LEN);
-    if (strlen(file_name) == 0) {
-        error_exit("File name cannot be empty.");
+    if (strlen(request->file_name) > MAX_FILE_NAME_LEN) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "File name too long.");
     }
-    strncpy(mode, mode_get(packet), MAX_MODE_LEN);
-    if (strcmp(mode, "octet") != 0 && strcmp(mode, "netascii") != 0) {
-        error_exit("Unsupported mode.");
+    // Name is joined to root directory, resumed upload would otherwise write into any file server can write.
+    if (!file_name_inside(request->file_name)) {
+        return session_error_set(session, ERR_ACCESS_VIOLATION, "Access violation.");
     }
-    options_load(packet, opcode);
-    if (packet_pos == REQUEST_PACKET_SIZE) {
-        error_exit("Request packet too long.");
+    // Mode is case insensitive.
+    if (strcasecmp(request->mode, "octet") != 0 && strcasecmp(request->mode, "netascii") != 0) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Unsupported mode.");
     }
-    packet_pos = 0;
+    session->mode = strcasecmp(request->mode, "netascii") == 0 ? NETASCII : OCTET;
+    return options_load(session, request, request->opcode);
 }
 
-void send_request_packet(int socket, struct sockaddr_in dest_addr, int opcode, char *file_name) {
+bool send_request_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, int opcode, char *file_name) {
     char packet[REQUEST_PACKET_SIZE];
-    memset(packet, 0, REQUEST_PACKET_SIZE);
-
-    // Set packet attributes.
-    opcode_set(opcode, packet);
-    file_name_set(file_name, packet);
-    empty_byte_insert(packet);
-    // Octet mode is default.
-    mode_set(OCTET, packet);
-    empty_byte_insert(packet);
-    options[TIMEOUT].flag = false;
-    options[TSIZE].flag = false;
-    options[BLKSIZE].flag = false;
-    options[TIMEOUT].value = 0;
-    options[TSIZE].value = 0;
-    options[BLKSIZE].value = 512;
-    options[TIMEOUT].order = -1;
-    options[TSIZE].order = -1;
-    options[BLKSIZE].order = -1;
-    // Set options.
-    // Remove after testing.
-    // option_set(TSIZE, 0, 2, 0);
-    // option_set(TIMEOUT, 5, 0, 0);
-    // option_set(BLKSIZE, 60000, 1, 0);
-    // options_set(packet);
-    // Remove after testing.
-    
-    if (sendto(socket, packet, packet_pos, MSG_CONFIRM, (const struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-        error_exit("Sendto failed.");
-    }
-    packet_pos = 0;
-}
-
-void handle_ack_packet(char *packet, int expected_block_number) {
-    int opcode, block_number;
-
-    opcode = opcode_get(packet);
-    if (opcode != ACK) {
-        error_exit("Invalid opcode, server expected ACK.");
-    }
-    block_number = block_number_get(packet);
-    if (block_number != expected_block_number) {
-        error_exit("Invalid ack block number.");
-    }
-    packet_pos = 0;
-}
-
-void send_ack_packet(int socket, struct sockaddr_in dest_addr, int block_number) {
-    char packet[DEFAULT_PACKET_SIZE];
-    memset(packet, 0, DEFAULT_PACKET_SIZE);
-    packet_pos = 0;
-
-    opcode_set(ACK, packet);
-    block_number_set(block_number, packet);
+    int size;
 
-    if (sendto(socket, packet, packet_pos, MSG_CONFIRM, (const struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-        error_exit("Sendto failed.");
+    if (strlen(file_name) >= MAX_FILE_NAME_LEN) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "File name too long.");
+    }
+    size = packet_build_request(packet, sizeof(packet), opcode, file_name, session->mode == NETASCII ? "netascii" : "octet");
+    // Options requested by caller with option_set.
+    if ((size = options_set(session, packet, sizeof(packet), size)) < 0) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Request packet too long.");
     }
-    packet_pos = 0;
+    packet_send(session, socket, packet, size, dest_addr);
+    return true;
 }
 
-void handle_oack_packet(char *packet) {
+bool handle_ack_packet(Session_t *session, char *packet) {
     int opcode;
+    long block_number, now;
 
-    opcode = opcode_get(packet);
-    if (opcode != OACK) {
-        error_exit("Invalid opcode, server expected OACK.");
+    session->packet_pos = 0;
+    opcode = opcode_get(session, packet);
+    // Valid ACK lies between last acknowledged and last sent block, older ones land past block_sent.
+    block_number = block_number_unwrap(session->block_number, block_number_get(session, packet));
+    session->packet_pos = 0;
+    if (opcode != ACK || block_number < session->block_number || block_number > session->block_sent) {
+        return false;
+    }
+    // Duplicate ACK must not retransmit every time it arrives (Sorcerer's Apprentice), in lock-step mode it is
+    // ignored. In window mode receiver ACKs every new gap, the same block again when restarted window lost it too,
+    // but not sooner than half a round trip after the restart. Copies arriving sooner are ignored.
+    now = time_now();
+    if (block_number == session->block_number && block_number != session->block_sent) {
+        if (session->options[WINDOWSIZE].value == 1 ||
+            (session->restarted_at != 0 && now - session->restarted_at < session->timer.srtt / 2)) {
+            return false;
+        }
+    }
+    else {
+        timer_ack(session);
+    }
+    session->restarted_at = block_number != session->block_sent ? now : 0;
+    session->block_number = block_number;
+    return true;
+}
+
+void send_ack_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, long block_number) {
+    if (session->uring != NULL && uring_ack_defer(session->uring, socket, &dest_addr, block_number)) {
+        return;
     }
-    packet_pos = 0;
+    char packet[OPCODE_SIZE + BLOCK_NUMBER_SIZE];
+    packet_send(session, socket, packet, packet_build_ack(packet, sizeof(packet), block_number), dest_addr);
 }
 
-void send_oack_packet(int socket, struct sockaddr_in dest_addr) {
+bool handle_oack_packet(Session_t *session, char *packet, int size) {
+    Option_t requested[NUM_OPTIONS];
+    Packet_t oack;
+    int result;
+    memcpy(requested, session->options, sizeof(requested));
+
+    if ((result = packet_parse(packet, size, &oack)) != CODEC_OK) {
+        return session_error_set(session, ERR_OPTION_NEGOTIATION, codec_error_msg(result));
+    }
+    if (oack.opcode != OACK) {
+        return session_error_set(session, ERR_ILLEGAL_OPERATION, "Invalid opcode, client expected OACK.");
+    }
+    options_reset(session);
+    if (!options_load(session, &oack, OACK)) {
+        session->error_code = ERR_OPTION_NEGOTIATION;
+        return false;
+    }
+    for (int i = 0; i < NUM_OPTIONS; i++) {
+        if (session->options[i].flag && !requested[i].flag) {
+            return session_error_set(session, ERR_OPTION_NEGOTIATION, "Option was not requested.");
+        }
+    }
+    // Server may only lower requested blksize (RFC 2348).
+    if (session->options[BLKSIZE].value > requested[BLKSIZE].value) {
+        return session_error_set(session, ERR_OPTION_NEGOTIATION, "Blksize larger than requested.");
+    }
+    return true;
+}
+
+bool send_oack_packet(Session_t *session, int socket, struct sockaddr_in dest_addr) {
     char packet[DEFAULT_PACKET_SIZE];
-    memset(packet, 0, DEFAULT_PACKET_SIZE);
-    packet_pos = 0;
+    // Acknowledged values may be longer than requested ones, tsize 0 becomes file size, empty multicast becomes
+    // addr,port,master and resumed offset gets its CRC, so OACK may not fit even though request did.
+    int size = options_set(session, packet, sizeof(packet), packet_put_u16(packet, sizeof(packet), 0, OACK));
+    if (size < 0) {
+        send_error_packet(session, socket, dest_addr, ERR_OPTION_NEGOTIATION, "Acknowledged options do not fit into OACK.");
+        return false;
+    }
+    metrics_add(METRIC_OACKS, 1);
 
-    opcode_set(OACK, packet);
-    options_set(packet);
+    packet_send(session, socket, packet, size, dest_addr);
+    return true;
+}
 
-    if (sendto(socket, packet, packet_pos, MSG_CONFIRM, (const struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-        error_exit("Sendto failed.");
+bool gap_ack_needed(Session_t *session) {
+    long now = time_now();
+    // Lock-step receiver acknowledges every duplicate.
+    if (session->options[WINDOWSIZE].value > 1 && session->gap_acked_at != 0 && session->gap_block == session->block_number &&
+        now - session->gap_acked_at < session->timer.srtt / 2) {
+        return false;
     }
-    packet_pos = 0;
+    session->gap_acked_at = now;
+    session->gap_block = session->block_number;
+    return true;
 }
 
-void handle_data_packet(char *packet, int expected_block_number, FILE *file, int recvfrom_size) {
-    int opcode, block_number;
-    char data[options[BLKSIZE].value];
+bool handle_data_packet(Session_t *session, char *packet, int recvfrom_size) {
+    Packet_t data;
+    long block_number;
+    int blksize = session->options[BLKSIZE].value;
 
-    opcode = opcode_get(packet);
-    if (opcode != DATA) {
-        error_exit("Invalid opcode, server expected DATA.");
+    if (packet_parse(packet, recvfrom_size, &data) != CODEC_OK || data.opcode != DATA || data.data_size > blksize) {
+        return false;
     }
-    block_number = block_number_get(packet);
-    if (block_number != expected_block_number) {
-        error_exit("Invalid data block number.");
+    // Only the next block is accepted, anything else is a duplicate or out of order.
+    block_number = block_number_unwrap(session->block_number + 1, data.block_number);
+    if (block_number != session->block_number + 1) {
+        // Duplicate or out of order block, last in-order block is acknowledged once per gap.
+        if (!gap_ack_needed(session)) {
+            return false;
+        }
+        session->window_count = 0;
+        timer_arm(session);
+        return true;
     }
-    memcpy(data, data_get(packet, recvfrom_size), recvfrom_size - 4);
-    for (int i = 0; i < recvfrom_size - 4; i++) {
-        fputc(data[i], file);
+    // Payload is written straight from packet buffer.
+    if (!block_write(session, block_number, data.data, data.data_size)) {
+        // Corrupted compressed stream keeps its own error.
+        if (session->options[COMPRESS].flag && session->error_msg != NULL) {
+            return false;
+        }
+        return session_error_set(session, ERR_DISK_FULL, "Failed to write file.");
     }
-    packet_pos = 0;
-}
-
-bool send_data_packet(int socket, struct sockaddr_in dest_addr, int block_number, FILE *file) {
-    char packet[options[BLKSIZE].value + 4];
-    memset(packet, 0, options[BLKSIZE].value + 4);
-    opcode_set(DATA, packet);
-    block_number_set(block_number, packet);
-    data_set(packet, file);
-    if (sendto(socket, packet, packet_pos, MSG_CONFIRM, (const struct sockaddr *)&dest_addr, (socklen_t)sizeof(dest_addr)) < 0) {
-        error_exit("Sendto failed.");
+    session->block_number++;
+    session->window_count++;
+    metrics_add(METRIC_BYTES_RECEIVED, data.data_size);
+    // First block after our ACK measures round trip time, any in-order block shows sender is making progress.
+    if (session->timer.sent_at != 0) {
+        timer_ack(session);
+    }
+    else {
+        session->timer.retries = 0;
+    }
+    if (data.data_size < blksize) {
+        session->last = true;
     }
-    if (packet_pos < options[BLKSIZE].value + 4) {
-        packet_pos = 0;
+    // Receiver acknowledges once per window and always the last block.
+    if (session->last || session->window_count >= session->options[WINDOWSIZE].value) {
+        session->window_count = 0;
+        timer_start(session);
         return true;
     }
-    packet_pos = 0;
+    timer_arm(session);
     return false;
 }
 
-void send_error_packet(int socket, struct sockaddr_in dest_addr, int error_code, char *error_message) {
-    char packet[DEFAULT_PACKET_SIZE];
-    memset(packet, 0, DEFAULT_PACKET_SIZE);
-    packet_pos = 0;
+long data_packet_build(Session_t *session, long block_number, char *buffer, struct iovec *iov) {
+    long size;
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = packet_build_data(buffer, OPCODE_SIZE + BLOCK_NUMBER_SIZE, block_number);
+    if (session->map != NULL) {
+        // Zero-copy, payload is sent straight from the mapping.
+        long offset = block_offset(session, block_number);
+        long length = block_length(session, block_number);
+        size = offset >= session->map_size ? 0 : session->map_size - offset;
+        size = size < length ? size : length;
+        iov[1].iov_base = session->map + offset;
+    }
+    else {
+        if ((size = block_read(session, block_number, buffer + iov[0].iov_len)) < 0) {
+            return -1;
+        }
+        iov[1].iov_base = buffer + iov[0].iov_len;
+    }
+    iov[1].iov_len = size;
+    return size;
+}
 
-    opcode_set(ERROR, packet);
-    error_code_set(error_code, packet);
-    error_msg_set(error_message, packet);
-    empty_byte_insert(packet);
+bool send_data_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, long block_number) {
+    char buffer[session->options[BLKSIZE].value + 4];
+    struct iovec iov[2];
+    long size = data_packet_build(session, block_number, buffer, iov);
+    if (size < 0) {
+        return false;
+    }
+    packet_send_iov(session, socket, iov, dest_addr);
+    metrics_add(METRIC_PACKETS_SENT, 1);
+    metrics_add(METRIC_BYTES_SENT, size);
+    session->last = size < session->options[BLKSIZE].value;
+    return true;
+}
 
-    if (sendto(socket, packet, packet_pos, MSG_CONFIRM, (const struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-        error_exit("Sendto failed.");
+bool send_window(Session_t *session, int socket, struct sockaddr_in dest_addr) {
+    Batch_t *batch = session->batch;
+    int count = 0;
+    long size;
+    // Blocks after last acknowledged one were lost, they are simply read again from their offsets.
+    if (session->block_sent != session->block_number) {
+        session->block_sent = session->block_number;
+        session->last = false;
+        session->timer.retransmitted = true;
+        metrics_add(METRIC_RETRANSMITS, 1);
+        timer_arm(session);
+    }
+    else {
+        timer_start(session);
+    }
+    for (long i = 0; i < session->options[WINDOWSIZE].value && !session->last; i++) {
+        // Whole window is one link chain on the ring, so packets leave in order.
+        if (session->uring != NULL) {
+            if ((size = uring_data_queue(session->uring, &dest_addr, ++session->block_sent)) < 0) {
+                uring_link_end(session->uring->ring);
+                return false;
+            }
+            metrics_add(METRIC_PACKETS_SENT, 1);
+            metrics_add(METRIC_BYTES_SENT, size);
+            session->last = size < session->options[BLKSIZE].value;
+            continue;
+        }
+        if (batch == NULL) {
+            if (!send_data_packet(session, socket, dest_addr, ++session->block_sent)) {
+                return false;
+            }
+            continue;
+        }
+        // Whole window goes out with sendmmsg, batch capacity packets per call.
+        size = data_packet_build(session, ++session->block_sent, batch->send_buffer + (size_t)count * BATCH_SLOT_SIZE,
+                                 &batch->send_iovs[2 * count]);
+        if (size < 0) {
+            return false;
+        }
+        metrics_add(METRIC_PACKETS_SENT, 1);
+        metrics_add(METRIC_BYTES_SENT, size);
+        session->last = size < session->options[BLKSIZE].value;
+        if (++count == batch->capacity) {
+            batch_send(session, socket, &dest_addr, count);
+            count = 0;
+        }
     }
-    error_exit(error_message);
+    if (count > 0) {
+        batch_send(session, socket, &dest_addr, count);
+    }
+    if (session->uring != NULL) {
+        uring_link_end(session->uring->ring);
+    }
+    return true;
 }
 
-void display_message(int socket, struct sockaddr_in source_addr, char *packet) {
+void send_error_packet(Session_t *session, int socket, struct sockaddr_in dest_addr, int error_code, char *error_message) {
+    char packet[DEFAULT_PACKET_SIZE];
+    int size = packet_build_error(packet, sizeof(packet), error_code, error_message);
+    metrics_add(METRIC_ERRORS + (error_code >= 0 && error_code < METRIC_ERROR_CODES ? error_code : ERR_NOT_DEFINED), 1);
+
+    packet_send(session, socket, packet, size, dest_addr);
+}
+
+void display_message(Session_t *session, int socket, struct sockaddr_in source_addr, char *packet, int size) {
     struct sockaddr_in dest_addr;
     socklen_t dest_addr_size = sizeof(dest_addr);
-    memset(&dest_addr, 0, dest_addr_size);
-
-    // Get required information for printing message.
-    if (getsockname(socket, (struct sockaddr *)&dest_addr, (socklen_t *)&dest_addr_size) < 0) {
-        send_error_packet(socket, source_addr, ERR_NOT_DEFINED, "Failed to get socket name.");
-    }
-    int dest_port = ntohs(dest_addr.sin_port);
-    int src_port = ntohs(source_addr.sin_port);
-    char *src_ip = inet_ntoa(source_addr.sin_addr);
-    int opcode = opcode_get(packet);
-    int block_number;
-    char *mode = NULL;
-    char *file_name = NULL;
-    int error_code;
-    char *error_msg = NULL;
-    
-    switch (opcode) {
-        case RRQ:
-        case WRQ:
-            file_name = file_name_get(packet);
-            mode = mode_get(packet);
-            fprintf(stderr, "%s: %s:%d \"%s\" %s",opcode == RRQ ? "RRQ" : "WRQ", src_ip, src_port, file_name, mode);
-            display_options(packet);
-            break;
-        case DATA:
-            block_number = block_number_get(packet);
-            fprintf(stderr, "DATA: %s:%d:%d %d\n", src_ip, src_port, dest_port, block_number);
-            break;
-        case ACK:
-            block_number = block_number_get(packet);
-            fprintf(stderr, "ACK: %s:%d %d\n", src_ip, src_port, block_number);
-            break;
-        case ERROR:
-            error_code = error_code_get(packet);
-            error_msg = error_msg_get(packet);
-            fprintf(stderr, "ERROR: %s:%d:%d %d \"%s\"\n", src_ip, src_port, dest_port, error_code, error_msg);
-            break;
-        case OACK:
-            fprintf(stderr, "OACK: %s:%d", src_ip, src_port);
-            display_options(packet);
-            break;
-        default:
-            send_error_packet(socket, source_addr, ERR_ILLEGAL_OPERATION, "Illegal TFTP operation.");
-    }
-    packet_pos = 0;
-}
+    int opcode;
 
-void display_options(char *packet) {
-    while (packet[packet_pos] != '\0') {
-        fprintf(stderr, " %s=%s", packet + packet_pos, packet + packet_pos + strlen(packet + packet_pos) + 1);
-        packet_pos += strlen(packet + packet_pos) + 1 + strlen(packet + packet_pos + strlen(packet + packet_pos) + 1) + 1;
+    if (size < OPCODE_SIZE) {
+        return;
+    }
+    opcode = codec_get_u16(packet);
+    // Disabled levels cost only this check, enabled ones only a copy into ring of this thread.
+    if (!log_enabled(opcode == DATA || opcode == ACK ? LOG_PACKET : LOG_REQUEST)) {
+        return;
     }
-    printf("\n");
+    // Local port is looked up once per socket, not for every packet, socket without port yet is looked up again.
+    if (session->log_socket != socket || session->log_port == 0) {
+        memset(&dest_addr, 0, dest_addr_size);
+        // Port is only logged, socket whose name cannot be read is logged with port 0.
+        getsockname(socket, (struct sockaddr *)&dest_addr, &dest_addr_size);
+        session->log_socket = socket;
+        session->log_port = ntohs(dest_addr.sin_port);
+    }
+    log_packet(opcode, packet, size, &source_addr, session->log_port);
 }
 
-FILE *open_file(int socket, char *packet, char *dir_path, struct sockaddr_in addr) {
-    int opcode;
+FILE *open_file(Session_t *session, int socket, Packet_t *request, char *dir_path, struct sockaddr_in addr) {
     long size;
-    int available_memory;
-    char file_name[MAX_FILE_NAME_LEN + 1];
-    char mode[MAX_MODE_LEN + 1];
+    long available_memory;
     char full_path[MAX_FILE_NAME_LEN + MAX_DIR_PATH_LEN + 2];
     FILE *file = NULL;
-    opcode = opcode_get(packet);
-    strncpy(file_name, file_name_get(packet), MAX_FILE_NAME_LEN);
-    strncpy(mode, mode_get(packet), MAX_MODE_LEN);
-    strncpy(full_path, dir_path, MAX_DIR_PATH_LEN);
-    strcat(full_path, "/");
-    strcat(full_path, file_name);
-
-    if (opcode == WRQ) {
-        if (access(full_path, F_OK) != -1) {
-            send_error_packet(socket, addr, ERR_FILE_ALREADY_EXISTS, "File already exists.");
-            exit(EXIT_FAILURE);
-        }
-        file = fopen(full_path, "w");
-        if (file == NULL) {
-            send_error_packet(socket, addr, ERR_FILE_NOT_FOUND, "File not found.");
-            exit(EXIT_FAILURE);
+    struct stat status;
+    uint32_t crc;
+    bool exists;
+    snprintf(full_path, sizeof(full_path), "%.*s/%.*s", MAX_DIR_PATH_LEN, dir_path, MAX_FILE_NAME_LEN, request->file_name);
+
+    if (request->opcode == WRQ) {
+        exists = access(full_path, F_OK) != -1;
+        if (exists && !session->options[OFFSET].flag) {
+            send_error_packet(session, socket, addr, ERR_FILE_ALREADY_EXISTS, "File already exists.");
+            return NULL;
         }
-        if (options[TSIZE].flag) {
-            size = option_get_value(TSIZE);
+        if (session->options[TSIZE].flag) {
+            size = option_get_value(session, TSIZE);
+            // Resumed upload only adds bytes past those already in file.
+            if (exists && stat(full_path, &status) == 0) {
+                size -= status.st_size;
+            }
             if ((available_memory = check_memory(dir_path)) == -1) {
-                send_error_packet(socket, addr, ERR_NOT_DEFINED, "Failed to get file size.");
+                send_error_packet(session, socket, addr, ERR_NOT_DEFINED, "Failed to get file size.");
+                return NULL;
             }
             if (size >= available_memory) {
-                send_error_packet(socket, addr, ERR_DISK_FULL, "Not enough space.");
+                send_error_packet(session, socket, addr, ERR_DISK_FULL, "Not enough space.");
+                return NULL;
+            }
+        }
+        file = fopen(full_path, exists ? "r+" : "w");
+        if (file == NULL) {
+            send_error_packet(session, socket, addr, ERR_ACCESS_VIOLATION, "Failed to create file.");
+            return NULL;
+        }
+        // Resumed upload continues existing file, client checks its size and CRC against own data before sending.
+        if (session->options[OFFSET].flag) {
+            session->options[OFFSET].value = 0;
+            if (exists) {
+                if ((size = file_size_get(file)) == -1 || !file_tail_crc(fileno(file), size, &session->offset_crc)) {
+                    send_error_packet(session, socket, addr, ERR_NOT_DEFINED, "Failed to read file.");
+                    fclose(file);
+                    return NULL;
+                }
+                session->options[OFFSET].value = size;
             }
-            option_set(TSIZE, size, option_get_order(TSIZE), 0);
         }
     }
-    else if (opcode == RRQ) {
-        if (strcmp(mode, "netascii") == 0) {
-            file = fopen(full_path, "r");
+    else if (request->opcode == RRQ) {
+        if ((file = fopen(full_path, "rb")) == NULL) {
+            send_error_packet(session, socket, addr, ERR_FILE_NOT_FOUND, "File not found.");
+            return NULL;
         }
-        else if (strcmp(mode, "octet") == 0) {
-            file = fopen(full_path, "rb");
+        // Resumed read skips bytes client holds only if they match the file, otherwise it starts over at 0.
+        if (session->options[OFFSET].flag && session->options[OFFSET].value > 0 &&
+            (!file_tail_crc(fileno(file), session->options[OFFSET].value, &crc) || crc != session->offset_crc)) {
+            session->options[OFFSET].value = 0;
         }
-        else {
-            send_error_packet(socket, addr, ERR_ILLEGAL_OPERATION, "Illegal TFTP operation.");
+        // Netascii is sent from encoding of file made as blocks are read, blocks and tsize are counted in encoded bytes.
+        if (session->mode == NETASCII && (session->encoded = netascii_open(fileno(file))) == NULL) {
+            send_error_packet(session, socket, addr, ERR_NOT_DEFINED, "Failed to encode file.");
+            fclose(file);
+            return NULL;
         }
-        if (file == NULL) {
-            send_error_packet(socket, addr, ERR_FILE_NOT_FOUND, "File not found.");
+        // Compressed transfer is sent from frames compressed as blocks are read, tsize is size of compressed stream.
+        if (session->options[COMPRESS].flag && (session->encoded = compress_open(fileno(file))) == NULL) {
+            send_error_packet(session, socket, addr, ERR_NOT_DEFINED, "Failed to compress file.");
+            fclose(file);
+            return NULL;
+        }
+        // Encoded size is known once encoding reached end of file, tsize of file that is neither cached nor small is declined.
+        if (session->options[TSIZE].flag && session->encoded != NULL) {
+            if ((size = encodestream_size(session->encoded)) == -1) {
+                option_clear(session, TSIZE);
+            }
+            else {
+                session->options[TSIZE].value = size;
+            }
         }
-        if (options[TSIZE].flag) {
-            if ((size = check_file_size(full_path)) == -1) {
-                send_error_packet(socket, addr, ERR_NOT_DEFINED, "Failed to get file size.");
+        else if (session->options[TSIZE].flag) {
+            if ((size = file_size_get(file)) == -1) {
+                send_error_packet(session, socket, addr, ERR_NOT_DEFINED, "Failed to get file size.");
+                fclose(file);
+                return NULL;
             }
-            option_set(TSIZE, size, option_get_order(TSIZE), 0);
+            // Reply with the real file size, RRQ tsize validation does not apply here.
+            session->options[TSIZE].value = size;
         }
     }
     else {
-        send_error_packet(socket, addr, ERR_ILLEGAL_OPERATION, "Illegal TFTP operation.");
-        exit(EXIT_FAILURE);
+        send_error_packet(session, socket, addr, ERR_ILLEGAL_OPERATION, "Illegal TFTP operation.");
     }
-    packet_pos = 0;
     return file;
 }
 
-// Mention in docs: https://stackoverflow.com/questions/59658328/implicit-declaration-of-strnlen-in-freertos
-size_t strnlen(const char *s, size_t maxlen) {
-    size_t len = 0;
-    if(s)
-        for(char c = *s; (len < maxlen && c != '\0'); c = *++s) len++;
-    return len;
-}
-
 long check_memory(char *dir_path) {
     struct statfs mem;
     if (statfs(dir_path, &mem) == -1) {
@@ -623,6 +1495,14 @@ long check_memory(char *dir_path) {
     return (long) mem.f_bavail * mem.f_bsize;
 }
 
+long file_size_get(FILE *file) {
+    struct stat status;
+    if (fstat(fileno(file), &status) < 0) {
+        return -1;
+    }
+    return status.st_size;
+}
+
 long check_file_size(char *file_name) {
     struct stat status;
     if (stat(file_name, &status) < 0) {
@@ -631,8 +1511,81 @@ long check_file_size(char *file_name) {
     return status.st_size;
 }
 
-void string_to_lower(char *str) {
-    for(int i = 0; str[i]; i++){
-        str[i] = tolower(str[i]);
+#if defined(__x86_64__)
+/**
+* @brief Update CRC32C with crc32 instruction of SSE4.2, 8 bytes at a time.
+*
+* @param crc Inverted CRC of preceding data.
+* @param buffer Data.
+* @param size Size of data.
+*
+* @return Updated inverted CRC.
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *buffer, long size) {
+    uint64_t word;
+    uint64_t value = crc;
+    for (; size >= 8; size -= 8, buffer += 8) {
+        memcpy(&word, buffer, sizeof(word));
+        value = __builtin_ia32_crc32di(value, word);
+    }
+    crc = value;
+    for (; size > 0; size--) {
+        crc = __builtin_ia32_crc32qi(crc, *buffer++);
+    }
+    return crc;
+}
+#endif
+
+// Lookup table of bytewise CRC32C, reflected polynomial 0x82F63B78.
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+* @brief Fill lookup table of bytewise CRC32C.
+*
+* @return void
+*/
+static void crc32c_table_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        crc32c_table[i] = crc;
     }
-}
\ No newline at end of file
+}
+
+uint32_t crc32c_update(uint32_t crc, const char *buffer, long size) {
+    const unsigned char *data = (const unsigned char *)buffer;
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c_hardware(crc, data, size);
+    }
+#endif
+    pthread_once(&crc32c_once, crc32c_table_init);
+    for (; size > 0; size--) {
+        crc = crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool file_tail_crc(int fd, long end, uint32_t *crc) {
+    char buffer[CACHE_CHUNK_SIZE];
+    off_t offset = end > OFFSET_CRC_WINDOW ? end - OFFSET_CRC_WINDOW : 0;
+    ssize_t result;
+    *crc = 0;
+    while (offset < end) {
+        long length = end - offset < (long)sizeof(buffer) ? end - offset : (long)sizeof(buffer);
+        if ((result = pread(fd, buffer, length, offset)) < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        *crc = crc32c_update(*crc, buffer, result);
+        offset += result;
+    }
+    return true;
+}
@@ -0,0 +1,228 @@
+//
+// File: codec-test.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Tests of bounds checks of packet codec, truncated and malformed packets are rejected and builders
+//              report fields that do not fit instead of writing past buffer.
+//
+
+#include "../include/utils.h"
+
+// Built packets are followed by guard bytes that must stay untouched.
+#define GUARD 16
+#define GUARD_BYTE 0x5A
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+* @brief Check that guard bytes after used part of buffer are untouched.
+*
+* @param buffer Buffer.
+* @param size Size of buffer without guard.
+*
+* @return True if guard is intact.
+*/
+static bool guard_intact(const char *buffer, int size) {
+    for (int i = 0; i < GUARD; i++) {
+        if ((unsigned char)buffer[size + i] != GUARD_BYTE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* @brief Check that string view lies inside packet and ends with NUL inside it.
+*
+* @param buffer Packet.
+* @param size Size of packet.
+* @param string View returned by parser.
+*
+* @return True if view is inside packet.
+*/
+static bool view_inside(const char *buffer, int size, const char *string) {
+    return string >= buffer && string < buffer + size && memchr(string, '\0', buffer + size - string) != NULL;
+}
+
+/**
+* @brief Parse copy of packet in buffer of exactly its size, so reading past its end is caught by sanitizers.
+*
+* @param packet Packet.
+* @param size Size of packet.
+* @param parsed Pointer to store parsed packet, its views stay valid until the next call.
+*
+* @return Parse result.
+*/
+static int parse_exact(const char *packet, int size, Packet_t *parsed) {
+    static char *copy = NULL;
+    int result;
+    free(copy);
+    copy = malloc(size > 0 ? size : 1);
+    memcpy(copy, packet, size);
+    if ((result = packet_parse(copy, size, parsed)) == CODEC_OK) {
+        if (parsed->opcode == RRQ || parsed->opcode == WRQ) {
+            CHECK(view_inside(copy, size, parsed->file_name) && view_inside(copy, size, parsed->mode));
+        }
+        for (int i = 0; i < parsed->num_options; i++) {
+            CHECK(view_inside(copy, size, parsed->options[i].name) && view_inside(copy, size, parsed->options[i].value));
+        }
+        if (parsed->opcode == ERROR) {
+            CHECK(view_inside(copy, size, parsed->error_msg));
+        }
+        if (parsed->opcode == DATA) {
+            CHECK(parsed->data == copy + OPCODE_SIZE + BLOCK_NUMBER_SIZE && parsed->data + parsed->data_size == copy + size);
+        }
+    }
+    return result;
+}
+
+/**
+* @brief Every truncation of request is rejected unless it ends right after mode or after whole option.
+*
+* @return void
+*/
+static void test_request_truncated(void) {
+    char packet[REQUEST_PACKET_SIZE];
+    Packet_t parsed;
+    int size = packet_build_request(packet, sizeof(packet), RRQ, "file.txt", "octet");
+    int valid[3], options = 0, result;
+
+    valid[0] = size;
+    size = packet_put_option(packet, sizeof(packet), size, "blksize", "1468");
+    valid[1] = size;
+    size = packet_put_option(packet, sizeof(packet), size, "tsize", "0");
+    valid[2] = size;
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_OK && parsed.num_options == 2);
+    CHECK(strcmp(parsed.options[1].name, "tsize") == 0 && strcmp(parsed.options[1].value, "0") == 0);
+    for (int cut = 0; cut < size; cut++) {
+        result = parse_exact(packet, cut, &parsed);
+        if (options < 3 && cut == valid[options]) {
+            CHECK(result == CODEC_OK && parsed.num_options == options);
+            options++;
+        }
+        else {
+            CHECK(result == CODEC_TRUNCATED || result == CODEC_UNTERMINATED);
+        }
+    }
+    // Name without value.
+    CHECK(parse_exact(packet, valid[1] + 6, &parsed) == CODEC_TRUNCATED);
+    // Zero padding after last option ends the list.
+    size = packet_put_u16(packet, sizeof(packet), size, 0);
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_OK && parsed.num_options == 2);
+}
+
+/**
+* @brief Fixed size packets shorter than their header are rejected, ERROR needs terminated message.
+*
+* @return void
+*/
+static void test_fixed_truncated(void) {
+    char packet[DEFAULT_PACKET_SIZE] = { 0 };
+    Packet_t parsed;
+    int size;
+
+    CHECK(parse_exact(packet, 0, &parsed) == CODEC_TRUNCATED);
+    CHECK(parse_exact(packet, 1, &parsed) == CODEC_TRUNCATED);
+    size = packet_build_ack(packet, sizeof(packet), 70000);
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_OK && parsed.block_number == 70000 - 65536);
+    CHECK(parse_exact(packet, size - 1, &parsed) == CODEC_TRUNCATED);
+    size = packet_build_data(packet, sizeof(packet), 1);
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_OK && parsed.data_size == 0);
+    CHECK(parse_exact(packet, size - 1, &parsed) == CODEC_TRUNCATED);
+    memset(packet + size, 'x', 512);
+    CHECK(parse_exact(packet, size + 512, &parsed) == CODEC_OK && parsed.data_size == 512);
+    size = packet_build_error(packet, sizeof(packet), ERR_FILE_NOT_FOUND, "File not found.");
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_OK && parsed.error_code == ERR_FILE_NOT_FOUND);
+    CHECK(parse_exact(packet, size - 1, &parsed) == CODEC_UNTERMINATED);
+    CHECK(parse_exact(packet, OPCODE_SIZE + ERROR_CODE_SIZE, &parsed) == CODEC_TRUNCATED);
+    CHECK(parse_exact(packet, OPCODE_SIZE + 1, &parsed) == CODEC_TRUNCATED);
+    codec_put_u16(packet, 0);
+    CHECK(parse_exact(packet, 4, &parsed) == CODEC_BAD_OPCODE);
+    codec_put_u16(packet, OACK + 1);
+    CHECK(parse_exact(packet, 4, &parsed) == CODEC_BAD_OPCODE);
+}
+
+/**
+* @brief At most CODEC_OPTIONS_MAX options are accepted.
+*
+* @return void
+*/
+static void test_too_many_options(void) {
+    char packet[REQUEST_PACKET_SIZE];
+    char name[8];
+    Packet_t parsed;
+    int size = packet_put_u16(packet, sizeof(packet), 0, OACK);
+
+    for (int i = 0; i < CODEC_OPTIONS_MAX; i++) {
+        snprintf(name, sizeof(name), "o%d", i);
+        size = packet_put_option(packet, sizeof(packet), size, name, "1");
+    }
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_OK && parsed.num_options == CODEC_OPTIONS_MAX);
+    size = packet_put_option(packet, sizeof(packet), size, "extra", "1");
+    CHECK(parse_exact(packet, size, &parsed) == CODEC_TOO_MANY_OPTIONS);
+}
+
+/**
+* @brief Builders report field that does not fit, -1 is passed through and nothing is written past capacity.
+*
+* @return void
+*/
+static void test_builders_bounds(void) {
+    char buffer[64 + GUARD];
+    int size;
+
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_put_u16(buffer, 1, 0, ACK) == -1);
+    CHECK(packet_put_u16(buffer, 2, 0, ACK) == 2);
+    CHECK(packet_put_u16(buffer, 2, -1, ACK) == -1);
+    CHECK(guard_intact(buffer, 2));
+
+    // String with its NUL exactly fills buffer, one byte less does not fit.
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_put_string(buffer, 6, 0, "hello") == 6 && guard_intact(buffer, 6));
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_put_string(buffer, 5, 0, "hello") == -1 && guard_intact(buffer, 5));
+    CHECK(packet_put_string(buffer, 5, 5, "") == -1);
+    CHECK(packet_put_string(buffer, 5, -1, "") == -1);
+
+    // Name fits, value does not.
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_put_option(buffer, 13, 2, "tsize", "1234") == 13);
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_put_option(buffer, 12, 2, "tsize", "1234") == -1 && guard_intact(buffer, 12));
+
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_build_request(buffer, 15, RRQ, "file", "netascii") == -1 && guard_intact(buffer, 15));
+    CHECK(packet_build_request(buffer, 16, RRQ, "file", "netascii") == 16);
+    CHECK(packet_build_ack(buffer, 3, 1) == -1 && packet_build_ack(buffer, 4, 1) == 4);
+    CHECK(packet_build_data(buffer, 3, 1) == -1 && packet_build_data(buffer, 4, 1) == 4);
+
+    // Error message is cut off to fit, empty message needs room for NUL.
+    memset(buffer, GUARD_BYTE, sizeof(buffer));
+    CHECK(packet_build_error(buffer, 4, ERR_NOT_DEFINED, "x") == -1);
+    size = packet_build_error(buffer, 10, ERR_NOT_DEFINED, "Transfer timed out.");
+    CHECK(size == 10 && buffer[9] == '\0' && memcmp(buffer + 4, "Trans", 5) == 0 && guard_intact(buffer, 10));
+    CHECK(packet_build_error(buffer, 5, ERR_NOT_DEFINED, "x") == 5 && buffer[4] == '\0');
+}
+
+int main() {
+    test_request_truncated();
+    test_fixed_truncated();
+    test_too_many_options();
+    test_builders_bounds();
+    if (failures > 0) {
+        printf("codec-test: %d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("codec-test: all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,390 @@
+//
+// File: compress-test.c
+//
+// Author: Lukáš Zavadil (xzavad20)
+//
+// Description: Tests of LZ codec, frame decoder and stream of compressed frames, round trips of typical data and
+//              rejection of malformed input.
+//
+
+#include "../include/compress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Output buffers are followed by guard bytes that must stay untouched.
+#define GUARD 64
+#define GUARD_BYTE 0x5A
+// Worst case of lz_compress for one chunk.
+#define LZ_BOUND (COMPRESS_CHUNK + COMPRESS_CHUNK / 255 + 16)
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+* @brief Fill buffer with pseudo-random bytes from small alphabet, alphabet of 256 gives incompressible data.
+*
+* @param buffer Buffer.
+* @param size Size of buffer.
+* @param alphabet Number of distinct bytes.
+* @param seed Pointer to generator state.
+*
+* @return void
+*/
+static void fill_random(char *buffer, size_t size, int alphabet, unsigned *seed) {
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = 'a' + rand_r(seed) % alphabet;
+    }
+}
+
+/**
+* @brief Check that guard bytes after end of buffer are untouched.
+*
+* @param buffer Buffer.
+* @param size Size of buffer without guard.
+*
+* @return True if guard is intact.
+*/
+static bool guard_intact(const char *buffer, size_t size) {
+    for (size_t i = 0; i < GUARD; i++) {
+        if ((unsigned char)buffer[size + i] != GUARD_BYTE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* @brief Compress and decompress data, check that it comes back unchanged and within bound.
+*
+* @param input Data, at most COMPRESS_CHUNK bytes.
+* @param size Size of data.
+*
+* @return void
+*/
+static void lz_round_trip(const char *input, size_t size) {
+    static char compressed[LZ_BOUND + GUARD];
+    static char output[COMPRESS_CHUNK + GUARD];
+    size_t compressed_size;
+    long output_size;
+
+    memset(compressed, GUARD_BYTE, sizeof(compressed));
+    compressed_size = lz_compress(input, size, compressed);
+    CHECK(compressed_size <= size + size / 255 + 16);
+    CHECK(guard_intact(compressed, size + size / 255 + 16));
+    memset(output, GUARD_BYTE, sizeof(output));
+    output_size = lz_decompress(compressed, compressed_size, output, size);
+    CHECK(output_size == (long)size);
+    CHECK(output_size < 0 || memcmp(input, output, size) == 0);
+    CHECK(guard_intact(output, size));
+    // Output buffer one byte short must be refused, not overrun.
+    if (size > 0) {
+        memset(output, GUARD_BYTE, sizeof(output));
+        CHECK(lz_decompress(compressed, compressed_size, output, size - 1) == -1);
+        CHECK(guard_intact(output, size - 1));
+    }
+}
+
+/**
+* @brief Round trips of empty, tiny, repetitive, overlapping, text-like and incompressible data.
+*
+* @return void
+*/
+static void test_lz_round_trip(void) {
+    char *input = malloc(COMPRESS_CHUNK);
+    unsigned seed = 1;
+
+    lz_round_trip("", 0);
+    lz_round_trip("a", 1);
+    lz_round_trip("abc", 3);
+    lz_round_trip("abcd", 4);
+    lz_round_trip("abcdabcd", 8);
+    // Match overlapping its own output, offset 1 and 3.
+    memset(input, 'x', COMPRESS_CHUNK);
+    lz_round_trip(input, COMPRESS_CHUNK);
+    for (size_t i = 0; i < COMPRESS_CHUNK; i++) {
+        input[i] = "abc"[i % 3];
+    }
+    lz_round_trip(input, COMPRESS_CHUNK);
+    // Literal runs of 15 and 15 + 255 bytes need length continuation bytes.
+    fill_random(input, COMPRESS_CHUNK, 256, &seed);
+    lz_round_trip(input, 15);
+    lz_round_trip(input, 15 + 255);
+    lz_round_trip(input, 15 + 255 + 1);
+    lz_round_trip(input, COMPRESS_CHUNK);
+    // Matches of every length around token and continuation boundaries.
+    for (size_t length = 4; length < 300; length += 7) {
+        fill_random(input, 64, 256, &seed);
+        for (size_t i = 0; i < length; i++) {
+            input[64 + i] = input[i];
+        }
+        fill_random(input + 64 + length, 32, 256, &seed);
+        lz_round_trip(input, 64 + length + 32);
+    }
+    for (int alphabet = 2; alphabet <= 26; alphabet += 8) {
+        fill_random(input, COMPRESS_CHUNK, alphabet, &seed);
+        lz_round_trip(input, COMPRESS_CHUNK);
+    }
+    // Every size of short repetitive data.
+    for (size_t size = 0; size < 200; size++) {
+        for (size_t i = 0; i < size; i++) {
+            input[i] = "hello world "[i % 12];
+        }
+        lz_round_trip(input, size);
+    }
+    free(input);
+}
+
+/**
+* @brief Malformed LZ data is refused without writing past output.
+*
+* @return void
+*/
+static void test_lz_malformed(void) {
+    char output[64 + GUARD];
+    char *input = malloc(COMPRESS_CHUNK);
+    char *compressed = malloc(LZ_BOUND);
+    unsigned seed = 2;
+    long result;
+
+    // Token promising literals that are not there.
+    CHECK(lz_decompress("\x30" "ab", 3, output, 64) == -1);
+    // Literal length continuation cut off.
+    CHECK(lz_decompress("\xF0", 1, output, 64) == -1);
+    CHECK(lz_decompress("\xF0\xFF", 2, output, 64) == -1);
+    // Match offset cut off, zero, and reaching before start of output.
+    CHECK(lz_decompress("\x10" "a" "\x01", 3, output, 64) == -1);
+    CHECK(lz_decompress("\x10" "a" "\x00\x00", 4, output, 64) == -1);
+    CHECK(lz_decompress("\x10" "a" "\x02\x00", 4, output, 64) == -1);
+    // Match length continuation cut off.
+    CHECK(lz_decompress("\x1F" "a" "\x01\x00", 4, output, 64) == -1);
+    CHECK(lz_decompress("\x1F" "a" "\x01\x00\xFF", 5, output, 64) == -1);
+    // Valid match longer than output.
+    memset(output, GUARD_BYTE, sizeof(output));
+    CHECK(lz_decompress("\x1F" "a" "\x01\x00\x80", 5, output, 64) == -1);
+    CHECK(guard_intact(output, 64));
+    CHECK(lz_decompress("\x1F" "a" "\x01\x00\x2C", 5, output, 64) == 64);
+
+    // Every truncation of valid data is refused or decodes to a prefix, never past capacity.
+    fill_random(input, 4096, 4, &seed);
+    size_t size = lz_compress(input, 4096, compressed);
+    char *decoded = malloc(4096 + GUARD);
+    for (size_t cut = 0; cut < size; cut++) {
+        memset(decoded, GUARD_BYTE, 4096 + GUARD);
+        result = lz_decompress(compressed, cut, decoded, 4096);
+        CHECK(result < 0 || (result <= 4096 && memcmp(decoded, input, result) == 0));
+        CHECK(guard_intact(decoded, 4096));
+    }
+    // Random corruption never writes past capacity.
+    for (int round = 0; round < 20000; round++) {
+        size_t length = rand_r(&seed) % 128;
+        for (size_t i = 0; i < length; i++) {
+            compressed[i] = rand_r(&seed);
+        }
+        memset(output, GUARD_BYTE, sizeof(output));
+        result = lz_decompress(compressed, length, output, 64);
+        CHECK(result <= 64);
+        CHECK(guard_intact(output, 64));
+    }
+    free(decoded);
+    free(compressed);
+    free(input);
+}
+
+/**
+* @brief Feed stream to decoder in pieces of given size and collect decompressed data.
+*
+* @param stream Compressed stream.
+* @param size Size of stream.
+* @param piece Size of every piece, the last one may be shorter.
+* @param output Buffer for decompressed data.
+* @param capacity Size of output buffer.
+*
+* @return Number of decompressed bytes, -1 if decoder refused stream or stream ended inside frame.
+*/
+static long decode_pieces(const char *stream, size_t size, size_t piece, char *output, size_t capacity) {
+    CompressDecoder_t decoder;
+    size_t total = 0, left, chunk_size;
+    const char *chunk;
+    int result = 0;
+
+    memset(&decoder, 0, sizeof(decoder));
+    for (size_t pos = 0; pos < size && result >= 0; pos += piece) {
+        const char *input = stream + pos;
+        left = size - pos < piece ? size - pos : piece;
+        while ((result = compress_decode(&decoder, &input, &left, &chunk, &chunk_size)) == 1) {
+            if (chunk_size > capacity - total) {
+                result = -1;
+                break;
+            }
+            memcpy(output + total, chunk, chunk_size);
+            total += chunk_size;
+        }
+    }
+    if (decoder.frame_size != 0) {
+        result = -1;
+    }
+    compress_decoder_free(&decoder);
+    return result < 0 ? -1 : (long)total;
+}
+
+/**
+* @brief Frames of several chunks decode the same when split at any block size.
+*
+* @return void
+*/
+static void test_frames_split(void) {
+    size_t size = 3 * COMPRESS_CHUNK + 1000, stream_size = 0;
+    char *input = malloc(size);
+    char *stream = malloc(4 * (COMPRESS_HEADER + LZ_BOUND));
+    char *output = malloc(size);
+    size_t pieces[] = { 1, 3, 4, 5, 512, 1400, 65464, 1 << 20 };
+    unsigned seed = 3;
+
+    // Compressible, incompressible (stored) and short last chunk.
+    fill_random(input, COMPRESS_CHUNK, 4, &seed);
+    fill_random(input + COMPRESS_CHUNK, COMPRESS_CHUNK, 256, &seed);
+    memset(input + 2 * COMPRESS_CHUNK, 0, COMPRESS_CHUNK);
+    fill_random(input + 3 * COMPRESS_CHUNK, 1000, 8, &seed);
+    for (size_t pos = 0; pos < size; pos += COMPRESS_CHUNK) {
+        size_t chunk = size - pos < COMPRESS_CHUNK ? size - pos : COMPRESS_CHUNK;
+        stream_size += compress_frame(input + pos, chunk, stream + stream_size);
+    }
+    // Incompressible chunk is stored with its high header bit.
+    size_t first = COMPRESS_HEADER + ((unsigned char)stream[0] | (unsigned char)stream[1] << 8 | (unsigned char)stream[2] << 16);
+    CHECK(((unsigned char)stream[first + 3] & 0x80) != 0);
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        memset(output, 0, size);
+        CHECK(decode_pieces(stream, stream_size, pieces[i], output, size) == (long)size);
+        CHECK(memcmp(input, output, size) == 0);
+    }
+    // Stream ending inside frame, at every header byte and inside payload.
+    for (size_t cut = 1; cut < 8; cut++) {
+        CHECK(decode_pieces(stream, cut, 1, output, size) == -1);
+    }
+    CHECK(decode_pieces(stream, first - 1, 512, output, size) == -1);
+    free(output);
+    free(stream);
+    free(input);
+}
+
+/**
+* @brief Corrupted frame headers and payloads are refused by decoder.
+*
+* @return void
+*/
+static void test_frames_malformed(void) {
+    char stream[COMPRESS_HEADER + 64];
+    char output[COMPRESS_CHUNK];
+    unsigned seed = 4;
+
+    // Payload size larger than any frame, compressed and stored, whole header and header split by blocks.
+    memcpy(stream, "\x01\x00\x01\x00", 4);
+    CHECK(decode_pieces(stream, sizeof(stream), sizeof(stream), output, sizeof(output)) == -1);
+    CHECK(decode_pieces(stream, sizeof(stream), 1, output, sizeof(output)) == -1);
+    memcpy(stream, "\x01\x00\x01\x80", 4);
+    CHECK(decode_pieces(stream, sizeof(stream), sizeof(stream), output, sizeof(output)) == -1);
+    CHECK(decode_pieces(stream, sizeof(stream), 3, output, sizeof(output)) == -1);
+    // Compressed payload that is not valid LZ data, in place and collected from pieces.
+    memcpy(stream, "\x04\x00\x00\x00" "\x10" "a" "\x05\x00", 8);
+    CHECK(decode_pieces(stream, 8, 8, output, sizeof(output)) == -1);
+    CHECK(decode_pieces(stream, 8, 1, output, sizeof(output)) == -1);
+    // Random frames are refused or decode within one chunk each.
+    for (int round = 0; round < 20000; round++) {
+        uint32_t payload = rand_r(&seed) % 64;
+        if (rand_r(&seed) % 2) {
+            payload |= COMPRESS_STORED;
+        }
+        stream[0] = payload & 0xFF;
+        stream[1] = (payload >> 8) & 0xFF;
+        stream[2] = (payload >> 16) & 0xFF;
+        stream[3] = payload >> 24;
+        for (size_t i = COMPRESS_HEADER; i < sizeof(stream); i++) {
+            stream[i] = rand_r(&seed);
+        }
+        size_t length = COMPRESS_HEADER + (payload & ~COMPRESS_STORED);
+        long result = decode_pieces(stream, length, 1 + rand_r(&seed) % 16, output, sizeof(output));
+        CHECK(result <= COMPRESS_CHUNK);
+    }
+}
+
+/**
+* @brief Stream of compressed frames read at any offset matches frames compressed in one go.
+*
+* @return void
+*/
+static void test_stream_read(void) {
+    size_t size = 5 * COMPRESS_CHUNK + 123, stream_size = 0;
+    char *input = malloc(size);
+    char *expected = malloc(6 * (COMPRESS_HEADER + LZ_BOUND));
+    char *buffer = malloc(70000);
+    char path[] = "/tmp/compress-test-XXXXXX";
+    unsigned seed = 5;
+    EncodeStream_t *stream;
+    int fd;
+
+    for (size_t pos = 0; pos < size; pos += 4096) {
+        fill_random(input + pos, size - pos < 4096 ? size - pos : 4096, pos / 4096 % 3 == 0 ? 256 : 3, &seed);
+    }
+    for (size_t pos = 0; pos < size; pos += COMPRESS_CHUNK) {
+        size_t chunk = size - pos < COMPRESS_CHUNK ? size - pos : COMPRESS_CHUNK;
+        stream_size += compress_frame(input + pos, chunk, expected + stream_size);
+    }
+    if ((fd = mkstemp(path)) < 0 || write(fd, input, size) != (ssize_t)size) {
+        CHECK(!"temporary file");
+        return;
+    }
+    unlink(path);
+    // Size is unknown until encoding reaches end of file.
+    CHECK((stream = compress_open(fd)) != NULL);
+    CHECK(encodestream_size(stream) == -1);
+    // Blocks in order, the last one short.
+    size_t pos = 0;
+    long result;
+    while ((result = encodestream_read(stream, buffer, 1400, pos)) == 1400) {
+        CHECK(memcmp(buffer, expected + pos, 1400) == 0);
+        pos += 1400;
+    }
+    CHECK(result >= 0 && pos + result == stream_size && memcmp(buffer, expected + pos, result) == 0);
+    CHECK(encodestream_size(stream) == (off_t)stream_size);
+    // Retransmissions reaching back into earlier chunks and reads spanning several chunks.
+    for (int round = 0; round < 2000; round++) {
+        size_t offset = rand_r(&seed) % (stream_size + 10);
+        size_t length = 1 + rand_r(&seed) % 70000;
+        size_t available = offset >= stream_size ? 0 : stream_size - offset;
+        result = encodestream_read(stream, buffer, length, offset);
+        CHECK(result == (long)(length < available ? length : available));
+        CHECK(result <= 0 || memcmp(buffer, expected + offset, result) == 0);
+    }
+    encodestream_close(stream);
+    // File read to its end was cached, second stream knows its size right away and reads the same frames.
+    CHECK((stream = compress_open(fd)) != NULL);
+    CHECK(encodestream_size(stream) == (off_t)stream_size);
+    CHECK(encodestream_read(stream, buffer, 70000, 100) == 70000 && memcmp(buffer, expected + 100, 70000) == 0);
+    encodestream_close(stream);
+    close(fd);
+    free(buffer);
+    free(expected);
+    free(input);
+}
+
+int main() {
+    test_lz_round_trip();
+    test_lz_malformed();
+    test_frames_split();
+    test_frames_malformed();
+    test_stream_read();
+    if (failures > 0) {
+        printf("compress-test: %d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("compress-test: all checks passed\n");
+    return EXIT_SUCCESS;
+}